@@ -0,0 +1,85 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/combat.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "harness.h"
+
+using namespace std;
+using namespace nplanetary::map;
+using namespace nplanetary::rules;
+
+namespace nplanetary::bench {
+namespace {
+/** numbers of ships and bases fighting in one phase */
+constexpr size_t COMBATANT_COUNTS[] = {100, 1000, 10000};
+/** targets each attacker splits its strength between */
+constexpr size_t TARGETS = 3;
+constexpr size_t TURNS = 100;
+}  // namespace
+
+void benchCombat(Suite &suite) {
+  mt19937_64 rng = mt19937_64(0);
+  uniform_int_distribution<int32_t> position =
+      uniform_int_distribution<int32_t>(-20, 20);
+  uniform_int_distribution<int32_t> speed =
+      uniform_int_distribution<int32_t>(-3, 3);
+  uniform_int_distribution<uint32_t> strength =
+      uniform_int_distribution<uint32_t>(1, 16);
+
+  for (size_t count : COMBATANT_COUNTS) {
+    string name = "combat/" + to_string(count);
+    if (!suite.enabled(name)) {
+      continue;
+    }
+
+    Combatants combatants;
+    while (combatants.size() < count) {
+      Role role = combatants.size() % 10 == 0 ? Role::BASE
+                  : combatants.size() % 3 == 0 ? Role::CIVILIAN
+                                               : Role::MILITARY;
+      combatants.add(Hex{position(rng), position(rng)},
+                     Hex{speed(rng), speed(rng)},
+                     static_cast<uint8_t>(strength(rng)), role);
+    }
+    uniform_int_distribution<uint32_t> target =
+        uniform_int_distribution<uint32_t>(0,
+                                           static_cast<uint32_t>(count - 1));
+    Attacks attacks;
+    vector<uint32_t> targets = vector<uint32_t>(TARGETS);
+    for (uint32_t attacker = 0; attacker < count; ++attacker) {
+      for (uint32_t &chosen : targets) {
+        chosen = target(rng);
+      }
+      attacks.add(attacker, targets, combatants.strengths[attacker]);
+    }
+
+    Combat combat;
+    Dice dice = Dice(0);
+    uint32_t turn = 0;
+    suite.latency(name, TURNS, 0,
+                  [&]() { combat.resolve(combatants, attacks, dice, turn++); });
+  }
+}
+}  // namespace nplanetary::bench
@@ -0,0 +1,176 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "networking/cryptoSocket.h"
+
+#include <cstdint>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "harness.h"
+#include "transfer.h"
+
+using namespace std;
+using namespace nplanetary::networking;
+
+namespace nplanetary::bench {
+namespace {
+constexpr char const *PASSWORD = "password";
+constexpr size_t HANDSHAKES = 32;
+/** a game's players, and the snapshot each is sent at the end of a round */
+constexpr size_t PLAYERS = 6;
+constexpr size_t SNAPSHOT_SIZE = 1 << 20;
+constexpr size_t SNAPSHOTS = 32;
+
+struct CryptoLayer {
+  using Server = CryptoServer;
+  using Connection = CryptoSocket;
+
+  static Server listen(stop_token const &stopFlag) {
+    return CryptoServer(PASSWORD, stopFlag);
+  }
+  static Connection connect(stop_token const &stopFlag) {
+    return CryptoSocket("127.0.0.1", PASSWORD, stopFlag);
+  }
+  static Connection accept(Server &server) { return server.accept(); }
+  static void send(Connection &connection, vector<uint8_t> const &payload) {
+    connection.write(payload.data(), payload.size());
+    connection.flush();
+  }
+  static void receive(Connection &connection, vector<uint8_t> &buffer) {
+    connection.read(buffer.data(), buffer.size());
+  }
+};
+
+/**
+ * Measures how long the server takes to accept a client, with and without a
+ * session ticket
+ */
+void benchHandshakes(Suite &suite) {
+  stop_source source;
+  CryptoServer server = CryptoServer(PASSWORD, source.get_token());
+
+  // clients only run scrypt once per server, like a reconnecting player
+  CryptoSocket::Ticket ticket;
+  thread first = thread(
+      [&ticket](stop_token stopFlag) {
+        ticket = CryptoSocket("127.0.0.1", PASSWORD, stopFlag).getTicket();
+      },
+      source.get_token());
+  server.accept();
+  first.join();
+
+  suite.latency("crypto/handshake/full", HANDSHAKES, 0, [&]() {
+    thread client = thread(
+        [](stop_token stopFlag) {
+          CryptoSocket("127.0.0.1", PASSWORD, stopFlag);
+        },
+        source.get_token());
+    CryptoSocket connection = server.accept();
+    client.join();
+  });
+  suite.latency("crypto/handshake/resumed", HANDSHAKES, 0, [&]() {
+    thread client = thread(
+        [&ticket](stop_token stopFlag) {
+          CryptoSocket("127.0.0.1", ticket, PASSWORD, stopFlag);
+        },
+        source.get_token());
+    CryptoSocket connection = server.accept();
+    client.join();
+  });
+}
+
+/**
+ * Measures sending a snapshot to every player, with send
+ */
+template <typename F>
+void benchBroadcast(Suite &suite, CryptoServer &server,
+                    stop_token const &stopFlag, string const &name, F send) {
+  if (!suite.enabled(name)) {
+    return;
+  }
+
+  vector<thread> clients;
+  for (size_t idx = 0; idx < PLAYERS; ++idx) {
+    clients.emplace_back(
+        [](stop_token stopFlag) {
+          CryptoSocket socket = CryptoSocket("127.0.0.1", PASSWORD, stopFlag);
+          vector<uint8_t> buffer = vector<uint8_t>(SNAPSHOT_SIZE);
+          for (size_t snapshot = 0; snapshot < SNAPSHOTS; ++snapshot) {
+            socket.read(buffer.data(), buffer.size());
+          }
+        },
+        stopFlag);
+  }
+  vector<CryptoSocket> connections;
+  vector<CryptoSocket *> recipients;
+  for (size_t idx = 0; idx < PLAYERS; ++idx) {
+    connections.push_back(server.accept());
+  }
+  for (CryptoSocket &connection : connections) {
+    recipients.push_back(&connection);
+  }
+
+  vector<uint8_t> snapshot = vector<uint8_t>(SNAPSHOT_SIZE, 0xa5);
+  suite.throughput(name, SNAPSHOTS, PLAYERS * SNAPSHOT_SIZE, [&]() {
+    for (size_t idx = 0; idx < SNAPSHOTS; ++idx) {
+      send(recipients, snapshot);
+    }
+  });
+  for (thread &client : clients) {
+    client.join();
+  }
+}
+
+/**
+ * Compares encrypting a snapshot for each player in turn against encrypting
+ * it on a broadcaster's pool
+ */
+void benchBroadcasts(Suite &suite) {
+  stop_source source;
+  CryptoServer server = CryptoServer(PASSWORD, source.get_token());
+  Broadcaster broadcaster;
+
+  string suffix = "/" + to_string(PLAYERS) + "x" + sizeName(SNAPSHOT_SIZE);
+  benchBroadcast(suite, server, source.get_token(),
+                 "crypto/broadcast/serial" + suffix,
+                 [](vector<CryptoSocket *> const &recipients,
+                    vector<uint8_t> const &snapshot) {
+                   for (CryptoSocket *recipient : recipients) {
+                     recipient->write(snapshot.data(), snapshot.size());
+                     recipient->flush();
+                   }
+                 });
+  benchBroadcast(suite, server, source.get_token(),
+                 "crypto/broadcast/pooled" + suffix,
+                 [&broadcaster](vector<CryptoSocket *> const &recipients,
+                                vector<uint8_t> const &snapshot) {
+                   broadcaster.send(recipients, snapshot);
+                 });
+}
+}  // namespace
+
+void benchCryptoSocket(Suite &suite) {
+  benchTransfers<CryptoLayer>(suite, "crypto");
+  benchHandshakes(suite);
+  benchBroadcasts(suite);
+}
+}  // namespace nplanetary::bench
@@ -0,0 +1,53 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/dice.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "harness.h"
+
+using namespace std;
+using namespace nplanetary::rules;
+
+namespace nplanetary::bench {
+namespace {
+constexpr size_t ROLL_COUNT = 1 << 20;
+constexpr size_t BATCHES = 20;
+}  // namespace
+
+void benchDice(Suite &suite) {
+  if (!suite.enabled("dice/batch")) {
+    return;
+  }
+
+  vector<uint32_t> entities = vector<uint32_t>(ROLL_COUNT);
+  for (size_t idx = 0; idx < entities.size(); ++idx) {
+    entities[idx] = static_cast<uint32_t>(idx);
+  }
+  vector<uint8_t> faces = vector<uint8_t>(entities.size());
+
+  Dice dice = Dice(0);
+  uint32_t turn = 0;
+  suite.latency("dice/batch", BATCHES, 0, [&]() {
+    dice.roll(turn++, Phase::COMBAT, entities, 0, faces);
+  });
+}
+}  // namespace nplanetary::bench
@@ -0,0 +1,84 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "harness.h"
+
+#include <iomanip>
+#include <iostream>
+#include <utility>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace nplanetary::bench {
+Suite::Suite(string filter) : filter(move(filter)), results() {}
+
+bool Suite::enabled(string_view name) const noexcept {
+  return name.find(filter) != string_view::npos;
+}
+
+void Suite::add(Result result) {
+  cerr << left << setw(40) << result.name << right << setw(8)
+       << result.iterations << " x " << setw(12)
+       << (result.total / result.iterations).count() << " ns";
+  if (result.p50.has_value()) {
+    cerr << "  p50 " << setw(12) << result.p50->count() << " ns  p99 "
+         << setw(12) << result.p99->count() << " ns";
+  }
+  if (result.throughput.has_value()) {
+    cerr << "  " << fixed << setprecision(1) << *result.throughput / 1e6
+         << " MB/s" << defaultfloat;
+  }
+  cerr << '\n';
+
+  results.push_back(move(result));
+}
+
+void Suite::writeJson(ostream &out) const {
+  // names are plain ASCII, so nothing needs escaping
+  out << "{\n  \"benchmarks\": [";
+  for (size_t idx = 0; idx < results.size(); ++idx) {
+    Result const &result = results[idx];
+    out << (idx == 0 ? "\n" : ",\n") << "    {\"name\": \"" << result.name
+        << "\", \"iterations\": " << result.iterations
+        << ", \"total_ns\": " << result.total.count()
+        << ", \"mean_ns\": " << (result.total / result.iterations).count();
+    if (result.p50.has_value()) {
+      out << ", \"p50_ns\": " << result.p50->count()
+          << ", \"p99_ns\": " << result.p99->count();
+    }
+    if (result.throughput.has_value()) {
+      out << ", \"bytes_per_second\": " << fixed << setprecision(0)
+          << *result.throughput << defaultfloat;
+    }
+    out << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+string sizeName(size_t bytes) {
+  if (bytes >= 1024 * 1024 && bytes % (1024 * 1024) == 0) {
+    return to_string(bytes / (1024 * 1024)) + "MiB";
+  } else if (bytes >= 1024 && bytes % 1024 == 0) {
+    return to_string(bytes / 1024) + "KiB";
+  } else {
+    return to_string(bytes) + "B";
+  }
+}
+}  // namespace nplanetary::bench
@@ -0,0 +1,192 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_BENCH_HARNESS_H_
+#define NPLANETARY_BENCH_HARNESS_H_
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nplanetary::bench {
+/** payload sizes every transfer benchmark is run with */
+constexpr std::array<size_t, 6> PAYLOAD_SIZES = {
+    1, 64, 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024,
+};
+
+/**
+ * Summary of one benchmark
+ */
+struct Result {
+  std::string name;
+  size_t iterations;
+  /** wall time of every iteration together */
+  std::chrono::nanoseconds total;
+  /** latency percentiles, if each iteration was timed on its own */
+  std::optional<std::chrono::nanoseconds> p50;
+  std::optional<std::chrono::nanoseconds> p99;
+  /** payload bytes moved per second, if the benchmark moves data */
+  std::optional<double> throughput;
+};
+
+/**
+ * Runs benchmarks and collects their results
+ */
+class Suite {
+ public:
+  /**
+   * Creates a suite that only runs benchmarks whose names contain filter
+   */
+  explicit Suite(std::string filter);
+  Suite(Suite const &) noexcept = delete;
+  Suite(Suite &&) noexcept = default;
+
+  ~Suite() noexcept = default;
+
+  Suite &operator=(Suite const &) noexcept = delete;
+  Suite &operator=(Suite &&) noexcept = default;
+
+  /**
+   * Whether a benchmark with this name should run
+   */
+  bool enabled(std::string_view name) const noexcept;
+
+  /**
+   * Times one call to f, which runs the benchmark's iterations back to back
+   *
+   * @param bytes payload moved per iteration, if any
+   */
+  template <typename F>
+  void throughput(std::string const &name, size_t iterations, size_t bytes,
+                  F f);
+  /**
+   * Times each of iterations calls to f on its own
+   *
+   * @param bytes payload moved per iteration, if any
+   */
+  template <typename F>
+  void latency(std::string const &name, size_t iterations, size_t bytes, F f);
+
+  /**
+   * Records a result, printing it for whoever is watching
+   */
+  void add(Result result);
+
+  /**
+   * Writes every result as a JSON document
+   */
+  void writeJson(std::ostream &out) const;
+
+ private:
+  std::string filter;
+  std::vector<Result> results;
+};
+
+/**
+ * Number of iterations to move roughly totalBytes in messages of size bytes
+ */
+constexpr size_t iterationsFor(size_t bytes, size_t totalBytes,
+                               size_t minimum, size_t maximum) noexcept {
+  return std::clamp(totalBytes / bytes, minimum, maximum);
+}
+
+/**
+ * Human-readable name for a payload size, like 64KiB
+ */
+std::string sizeName(size_t bytes);
+
+template <typename F>
+void Suite::throughput(std::string const &name, size_t iterations,
+                       size_t bytes, F f) {
+  if (!enabled(name)) {
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::nanoseconds total = std::chrono::steady_clock::now() - start;
+
+  std::optional<double> rate;
+  if (bytes != 0) {
+    rate = static_cast<double>(bytes * iterations) /
+           std::chrono::duration<double>(total).count();
+  }
+  add(Result{.name = name,
+             .iterations = iterations,
+             .total = total,
+             .p50 = std::nullopt,
+             .p99 = std::nullopt,
+             .throughput = rate});
+}
+
+template <typename F>
+void Suite::latency(std::string const &name, size_t iterations, size_t bytes,
+                    F f) {
+  if (!enabled(name)) {
+    return;
+  }
+
+  std::vector<std::chrono::nanoseconds> samples;
+  samples.reserve(iterations);
+  for (size_t idx = 0; idx < iterations; ++idx) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    samples.push_back(std::chrono::steady_clock::now() - start);
+  }
+
+  std::chrono::nanoseconds total = std::chrono::nanoseconds::zero();
+  for (std::chrono::nanoseconds sample : samples) {
+    total += sample;
+  }
+  std::sort(samples.begin(), samples.end());
+
+  std::optional<double> rate;
+  if (bytes != 0) {
+    rate = static_cast<double>(bytes * iterations) /
+           std::chrono::duration<double>(total).count();
+  }
+  add(Result{.name = name,
+             .iterations = iterations,
+             .total = total,
+             .p50 = samples[(samples.size() - 1) * 50 / 100],
+             .p99 = samples[(samples.size() - 1) * 99 / 100],
+             .throughput = rate});
+}
+
+/**
+ * Each layer's benchmarks; defined alongside the layer's scenarios
+ */
+void benchRawSocket(Suite &suite);
+void benchCryptoSocket(Suite &suite);
+void benchSocket(Suite &suite);
+void benchMovement(Suite &suite);
+void benchOrdnance(Suite &suite);
+void benchLineOfSight(Suite &suite);
+void benchCombat(Suite &suite);
+void benchDice(Suite &suite);
+void benchLogistics(Suite &suite);
+}  // namespace nplanetary::bench
+
+#endif  // NPLANETARY_BENCH_HARNESS_H_
@@ -0,0 +1,90 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "map/lineOfSight.h"
+
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "harness.h"
+#include "map/map.h"
+
+using namespace std;
+using namespace nplanetary::map;
+
+namespace nplanetary::bench {
+namespace {
+/** numbers of ships on the board, each of which may attack any other */
+constexpr size_t SHIP_COUNTS[] = {100, 300};
+constexpr size_t TURNS = 20;
+}  // namespace
+
+void benchLineOfSight(Suite &suite) {
+  mt19937 rng = mt19937(0);
+  uniform_int_distribution<int32_t> position =
+      uniform_int_distribution<int32_t>(-60, 60);
+
+  Map map = Map(80);
+  while (map.getBodies().size() < 8) {
+    try {
+      map.addBody(Body{.name = "Planet " + to_string(map.getBodies().size()),
+                       .centre = Hex{position(rng), position(rng)},
+                       .radius = 2,
+                       .major = true});
+    } catch (runtime_error const &) {
+      // off the map or overlapping another; pick somewhere else
+    }
+  }
+
+  for (size_t count : SHIP_COUNTS) {
+    string name = "lineOfSight/" + to_string(count);
+    if (!suite.enabled(name)) {
+      continue;
+    }
+
+    vector<Hex> ships;
+    while (ships.size() < count) {
+      Hex ship = Hex{position(rng), position(rng)};
+      if (map.contains(ship)) {
+        ships.push_back(ship);
+      }
+    }
+    // every ship considers attacking every other, so each pair is asked
+    // about both ways round
+    vector<Hex> from;
+    vector<Hex> to;
+    for (Hex attacker : ships) {
+      for (Hex target : ships) {
+        from.push_back(attacker);
+        to.push_back(target);
+      }
+    }
+    vector<uint8_t> results = vector<uint8_t>(from.size());
+
+    LineOfSight sight = LineOfSight(map);
+    suite.latency(name, TURNS, 0, [&]() {
+      sight.newTurn();
+      sight.visible(from, to, results);
+    });
+  }
+}
+}  // namespace nplanetary::bench
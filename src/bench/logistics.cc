@@ -0,0 +1,84 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/logistics.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+
+#include "harness.h"
+
+using namespace std;
+using namespace nplanetary::rules;
+
+namespace nplanetary::bench {
+namespace {
+/** numbers of transfer orders given in one phase */
+constexpr size_t ORDER_COUNTS[] = {1000, 10000, 100000};
+constexpr uint32_t HOLDER_COUNT = 5000;
+constexpr uint32_t PLAYERS = 4;
+constexpr size_t PHASES = 100;
+}  // namespace
+
+void benchLogistics(Suite &suite) {
+  mt19937 rng = mt19937(0);
+  uniform_int_distribution<uint32_t> holder =
+      uniform_int_distribution<uint32_t>(0, HOLDER_COUNT - 1);
+  uniform_int_distribution<uint32_t> resource =
+      uniform_int_distribution<uint32_t>(0, RESOURCE_COUNT - 1);
+  uniform_int_distribution<int32_t> amount =
+      uniform_int_distribution<int32_t>(1, 10);
+
+  for (size_t count : ORDER_COUNTS) {
+    string name = "logistics/" + to_string(count);
+    if (!suite.enabled(name)) {
+      continue;
+    }
+
+    Holders holders;
+    for (uint32_t idx = 0; idx < HOLDER_COUNT; ++idx) {
+      holders.add(idx % PLAYERS, idx % 10 == 0);
+    }
+
+    // most transfers are between other players, and ordered by both sides
+    Orders orders;
+    while (orders.size() < count) {
+      uint32_t issuer = holder(rng);
+      uint32_t partner = holder(rng);
+      if (issuer == partner) {
+        continue;
+      }
+      Resource given = static_cast<Resource>(resource(rng));
+      int32_t quantity = amount(rng);
+      orders.add(issuer, partner, given, quantity);
+      if (orders.size() % 4 != 0) {
+        orders.add(partner, issuer, given, -quantity);
+      }
+    }
+
+    Logistics logistics;
+    suite.latency(name, PHASES, 0, [&]() {
+      // refill every stock so each phase does the same work
+      holders.stocks.assign(holders.stocks.size(), 1000);
+      logistics.resolve(holders, orders);
+    });
+  }
+}
+}  // namespace nplanetary::bench
@@ -0,0 +1,55 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "harness.h"
+
+using namespace std;
+using namespace nplanetary::bench;
+
+/**
+ * Runs the benchmarks, writing results as JSON
+ *
+ * Usage: nplanetary-bench [output file] [name filter]
+ */
+int main(int argc, char **argv) {
+  string output = argc > 1 ? argv[1] : "bench.json";
+  Suite suite = Suite(argc > 2 ? argv[2] : "");
+
+  benchRawSocket(suite);
+  benchCryptoSocket(suite);
+  benchSocket(suite);
+  benchMovement(suite);
+  benchOrdnance(suite);
+  benchLineOfSight(suite);
+  benchCombat(suite);
+  benchDice(suite);
+  benchLogistics(suite);
+
+  ofstream out = ofstream(output);
+  suite.writeJson(out);
+  if (!out) {
+    cerr << "could not write results to " << output << '\n';
+    return 1;
+  }
+  return 0;
+}
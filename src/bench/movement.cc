@@ -0,0 +1,85 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/movement.h"
+
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "harness.h"
+#include "map/map.h"
+
+using namespace std;
+using namespace nplanetary::map;
+using namespace nplanetary::rules;
+
+namespace nplanetary::bench {
+namespace {
+/** numbers of ships and ordnance moved per turn */
+constexpr size_t MOVER_COUNTS[] = {1000, 10000, 50000};
+constexpr size_t TURNS = 100;
+
+/**
+ * A large map with planets scattered across it
+ */
+Map crowdedSystem(mt19937 &rng) {
+  Map map = Map(200);
+  uniform_int_distribution<int32_t> position =
+      uniform_int_distribution<int32_t>(-150, 150);
+  while (map.getBodies().size() < 20) {
+    Hex centre = Hex{position(rng), position(rng)};
+    try {
+      map.addBody(Body{.name = "Planet " + to_string(map.getBodies().size()),
+                       .centre = centre,
+                       .radius = 2,
+                       .major = true});
+    } catch (runtime_error const &) {
+      // off the map or overlapping another; pick somewhere else
+    }
+  }
+  return map;
+}
+}  // namespace
+
+void benchMovement(Suite &suite) {
+  mt19937 rng = mt19937(0);
+  Map map = crowdedSystem(rng);
+  uniform_int_distribution<int32_t> position =
+      uniform_int_distribution<int32_t>(-100, 100);
+  uniform_int_distribution<int32_t> speed =
+      uniform_int_distribution<int32_t>(-1, 1);
+
+  for (size_t count : MOVER_COUNTS) {
+    string name = "movement/" + to_string(count);
+    if (!suite.enabled(name)) {
+      continue;
+    }
+
+    Movement movement = Movement(map);
+    Movers movers;
+    while (movers.size() < count) {
+      movers.add(Hex{position(rng), position(rng)},
+                 Hex{speed(rng), speed(rng)});
+    }
+    suite.latency(name, TURNS, 0, [&]() { movement.advance(movers); });
+  }
+}
+}  // namespace nplanetary::bench
@@ -0,0 +1,192 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "networking/networking.h"
+
+#include <chrono>
+#include <cstdint>
+#include <semaphore>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "harness.h"
+#include "transfer.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace nplanetary::networking;
+
+namespace nplanetary::bench {
+namespace {
+constexpr char const *PASSWORD = "password";
+/** values sent between waiting for the other side; fits in socket buffers */
+constexpr size_t ROUND_SIZE = 4096;
+constexpr size_t ROUNDS = 32;
+
+struct SocketLayer {
+  using Server = networking::Server;
+  using Connection = Socket;
+
+  static Server listen(stop_token const &stopFlag) {
+    return Server(PASSWORD, stopFlag);
+  }
+  static Connection connect(stop_token const &stopFlag) {
+    return Socket("127.0.0.1", PASSWORD, stopFlag);
+  }
+  static Connection accept(Server &server) { return server.accept(); }
+  static void send(Connection &connection, vector<uint8_t> const &payload) {
+    connection << span<uint8_t const>(payload);
+    connection.flush();
+  }
+  static void receive(Connection &connection, vector<uint8_t> &buffer) {
+    connection >> buffer;
+  }
+};
+
+/**
+ * Measures the cost of sending and receiving one value of type T at a time
+ *
+ * @param value makes the idx-th value to send
+ */
+template <typename T, typename F>
+void benchScalar(Suite &suite, networking::Server &server,
+                 stop_source &source, uint8_t features,
+                 string const &prefix, F value) {
+  vector<T> values;
+  values.reserve(ROUND_SIZE);
+  for (size_t idx = 0; idx < ROUND_SIZE; ++idx) {
+    values.push_back(value(idx));
+  }
+
+  if (string name = prefix + " <<"; suite.enabled(name)) {
+    thread receiver = thread(
+        [features](stop_token stopFlag) {
+          Socket socket = Socket("127.0.0.1", PASSWORD, stopFlag, features);
+          T x;
+          for (size_t idx = 0; idx < ROUNDS * ROUND_SIZE; ++idx) {
+            socket >> x;
+          }
+        },
+        source.get_token());
+    Socket connection = server.accept();
+
+    suite.throughput(name, ROUNDS * ROUND_SIZE, 0, [&]() {
+      for (size_t round = 0; round < ROUNDS; ++round) {
+        for (T const &x : values) {
+          connection << x;
+        }
+      }
+      connection.flush();
+    });
+    receiver.join();
+  }
+
+  if (string name = prefix + " >>"; suite.enabled(name)) {
+    // only time decoding rounds that have already arrived
+    binary_semaphore sent = binary_semaphore(0);
+    binary_semaphore received = binary_semaphore(0);
+    thread sender = thread(
+        [features, &values, &sent, &received](stop_token stopFlag) {
+          Socket socket = Socket("127.0.0.1", PASSWORD, stopFlag, features);
+          for (size_t round = 0; round < ROUNDS; ++round) {
+            for (T const &x : values) {
+              socket << x;
+            }
+            socket.flush();
+            sent.release();
+            received.acquire();
+          }
+        },
+        source.get_token());
+    Socket connection = server.accept();
+
+    nanoseconds total = nanoseconds::zero();
+    T x;
+    for (size_t round = 0; round < ROUNDS; ++round) {
+      sent.acquire();
+      auto start = steady_clock::now();
+      for (size_t idx = 0; idx < ROUND_SIZE; ++idx) {
+        connection >> x;
+      }
+      total += steady_clock::now() - start;
+      received.release();
+    }
+    sender.join();
+
+    suite.add(Result{.name = name,
+                     .iterations = ROUNDS * ROUND_SIZE,
+                     .total = total,
+                     .p50 = nullopt,
+                     .p99 = nullopt,
+                     .throughput = nullopt});
+  }
+}
+
+/**
+ * Measures every scalar type with the given features
+ */
+void benchScalars(Suite &suite, uint8_t features, string const &mode) {
+  stop_source source;
+  networking::Server server =
+      networking::Server(PASSWORD, source.get_token(), features);
+
+  // small values, like most of what a game sends
+  string prefix = "socket/scalar/" + mode + "/";
+  benchScalar<uint8_t>(suite, server, source, features, prefix + "u8",
+                       [](size_t idx) { return static_cast<uint8_t>(idx); });
+  benchScalar<uint16_t>(suite, server, source, features, prefix + "u16",
+                        [](size_t idx) { return static_cast<uint16_t>(idx); });
+  benchScalar<uint32_t>(suite, server, source, features, prefix + "u32",
+                        [](size_t idx) { return static_cast<uint32_t>(idx); });
+  benchScalar<uint64_t>(suite, server, source, features, prefix + "u64",
+                        [](size_t idx) -> uint64_t { return idx; });
+  benchScalar<int8_t>(suite, server, source, features, prefix + "s8",
+                      [](size_t idx) { return static_cast<int8_t>(idx); });
+  benchScalar<int16_t>(suite, server, source, features, prefix + "s16",
+                       [](size_t idx) {
+                         return static_cast<int16_t>(idx % 2 == 0 ? idx : -idx);
+                       });
+  benchScalar<int32_t>(suite, server, source, features, prefix + "s32",
+                       [](size_t idx) {
+                         return static_cast<int32_t>(idx % 2 == 0 ? idx : -idx);
+                       });
+  benchScalar<int64_t>(suite, server, source, features, prefix + "s64",
+                       [](size_t idx) {
+                         return static_cast<int64_t>(idx % 2 == 0 ? idx : -idx);
+                       });
+  benchScalar<char>(suite, server, source, features, prefix + "char",
+                    [](size_t idx) {
+                      return static_cast<char>('a' + idx % 26);
+                    });
+  benchScalar<bool>(suite, server, source, features, prefix + "bool",
+                    [](size_t idx) { return idx % 2 == 0; });
+  benchScalar<string>(suite, server, source, features, prefix + "string",
+                      [](size_t idx) { return "ship " + to_string(idx); });
+}
+}  // namespace
+
+void benchSocket(Suite &suite) {
+  benchTransfers<SocketLayer>(suite, "socket");
+  benchScalars(suite, CryptoSocket::ALL_FEATURES, "compact");
+  benchScalars(suite, 0, "fixed");
+}
+}  // namespace nplanetary::bench
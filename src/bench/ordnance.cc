@@ -0,0 +1,80 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/ordnance.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "harness.h"
+
+using namespace std;
+using namespace nplanetary::map;
+using namespace nplanetary::rules;
+
+namespace nplanetary::bench {
+namespace {
+/** numbers of pieces of ordnance, mostly mines, live per turn */
+constexpr size_t PIECE_COUNTS[] = {1000, 10000, 50000};
+constexpr size_t SHIP_COUNT = 500;
+constexpr size_t TURNS = 100;
+}  // namespace
+
+void benchOrdnance(Suite &suite) {
+  mt19937_64 rng = mt19937_64(0);
+  uniform_int_distribution<int32_t> position =
+      uniform_int_distribution<int32_t>(-150, 150);
+  uniform_int_distribution<int32_t> speed =
+      uniform_int_distribution<int32_t>(-3, 3);
+
+  Tracks ships;
+  while (ships.size() < SHIP_COUNT) {
+    Hex from = Hex{position(rng), position(rng)};
+    ships.add(from, from + Hex{speed(rng), speed(rng)});
+  }
+  vector<uint8_t> sizes = vector<uint8_t>(ships.size(), 1);
+
+  for (size_t count : PIECE_COUNTS) {
+    string name = "ordnance/" + to_string(count);
+    if (!suite.enabled(name)) {
+      continue;
+    }
+
+    // one in ten is a torpedo on its way somewhere; the rest are mines
+    Tracks ordnance;
+    while (ordnance.size() < count) {
+      Hex from = Hex{position(rng), position(rng)};
+      Hex velocity = ordnance.size() % 10 == 0 ? Hex{speed(rng), speed(rng)}
+                                               : Hex{0, 0};
+      ordnance.add(from, from + velocity);
+    }
+    vector<uint32_t> exempt =
+        vector<uint32_t>(ordnance.size(), Detonations::NO_TARGET);
+
+    Detonations detonations;
+    Dice dice = Dice(0);
+    uint32_t turn = 0;
+    suite.latency(name, TURNS, 0, [&]() {
+      detonations.resolve(ships, sizes, ordnance, exempt, dice, turn++);
+    });
+  }
+}
+}  // namespace nplanetary::bench
@@ -0,0 +1,55 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "networking/rawSocket.h"
+
+#include <cstdint>
+#include <stop_token>
+#include <vector>
+
+#include "harness.h"
+#include "transfer.h"
+
+using namespace std;
+using namespace nplanetary::networking;
+
+namespace nplanetary::bench {
+namespace {
+struct RawLayer {
+  using Server = RawServer;
+  using Connection = RawSocket;
+
+  static Server listen(stop_token const &stopFlag) {
+    return RawServer(stopFlag);
+  }
+  static Connection connect(stop_token const &stopFlag) {
+    return RawSocket("127.0.0.1", stopFlag);
+  }
+  static Connection accept(Server &server) { return server.accept(); }
+  static void send(Connection &connection, vector<uint8_t> const &payload) {
+    connection.write(payload.data(), payload.size());
+  }
+  static void receive(Connection &connection, vector<uint8_t> &buffer) {
+    connection.read(buffer.data(), buffer.size());
+  }
+};
+}  // namespace
+
+void benchRawSocket(Suite &suite) { benchTransfers<RawLayer>(suite, "raw"); }
+}  // namespace nplanetary::bench
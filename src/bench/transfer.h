@@ -0,0 +1,103 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_BENCH_TRANSFER_H_
+#define NPLANETARY_BENCH_TRANSFER_H_
+
+#include <cstdint>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "harness.h"
+
+namespace nplanetary::bench {
+/** bytes each throughput benchmark tries to move */
+constexpr size_t THROUGHPUT_BYTES = 64 * 1024 * 1024;
+/** bytes each latency benchmark tries to move each way */
+constexpr size_t LATENCY_BYTES = 16 * 1024 * 1024;
+
+/**
+ * Measures one-way throughput and round trip latency over loopback for every
+ * payload size
+ *
+ * Layer describes a networking layer, with Server and Connection types and
+ * static functions listen(stopFlag), connect(stopFlag), accept(server),
+ * send(connection, payload), and receive(connection, buffer), where payload
+ * and buffer are byte vectors and receive fills the whole buffer
+ */
+template <typename Layer>
+void benchTransfers(Suite &suite, std::string const &prefix) {
+  std::stop_source source;
+  typename Layer::Server server = Layer::listen(source.get_token());
+
+  for (size_t bytes : PAYLOAD_SIZES) {
+    std::vector<uint8_t> payload = std::vector<uint8_t>(bytes, 0x5a);
+
+    if (std::string name = prefix + "/throughput/" + sizeName(bytes);
+        suite.enabled(name)) {
+      size_t count = iterationsFor(bytes, THROUGHPUT_BYTES, 8, 20000);
+      std::thread receiver = std::thread(
+          [bytes, count](std::stop_token stopFlag) {
+            typename Layer::Connection connection = Layer::connect(stopFlag);
+            std::vector<uint8_t> buffer = std::vector<uint8_t>(bytes);
+            for (size_t idx = 0; idx < count; ++idx) {
+              Layer::receive(connection, buffer);
+            }
+          },
+          source.get_token());
+      typename Layer::Connection connection = Layer::accept(server);
+
+      // done once the receiver has everything, not once it's all queued
+      suite.throughput(name, count, bytes, [&]() {
+        for (size_t idx = 0; idx < count; ++idx) {
+          Layer::send(connection, payload);
+        }
+        receiver.join();
+      });
+    }
+
+    if (std::string name = prefix + "/latency/" + sizeName(bytes);
+        suite.enabled(name)) {
+      size_t count = iterationsFor(bytes, LATENCY_BYTES, 8, 2000);
+      std::thread echoer = std::thread(
+          [bytes, count](std::stop_token stopFlag) {
+            typename Layer::Connection connection = Layer::connect(stopFlag);
+            std::vector<uint8_t> buffer = std::vector<uint8_t>(bytes);
+            for (size_t idx = 0; idx < count; ++idx) {
+              Layer::receive(connection, buffer);
+              Layer::send(connection, buffer);
+            }
+          },
+          source.get_token());
+      typename Layer::Connection connection = Layer::accept(server);
+
+      std::vector<uint8_t> buffer = std::vector<uint8_t>(bytes);
+      suite.latency(name, count, 0, [&]() {
+        Layer::send(connection, payload);
+        Layer::receive(connection, buffer);
+      });
+      echoer.join();
+    }
+  }
+}
+}  // namespace nplanetary::bench
+
+#endif  // NPLANETARY_BENCH_TRANSFER_H_
@@ -0,0 +1,112 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_MAP_HEX_H_
+#define NPLANETARY_MAP_HEX_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace nplanetary::map {
+/**
+ * One of the six directions from a hex to its neighbours, counterclockwise
+ * from east
+ */
+enum class Direction : uint8_t {
+  EAST,
+  NORTHEAST,
+  NORTHWEST,
+  WEST,
+  SOUTHWEST,
+  SOUTHEAST,
+};
+
+constexpr size_t DIRECTION_COUNT = 6;
+
+/**
+ * A hex, or a vector between hexes, in axial coordinates
+ *
+ * The third cube coordinate, s, is implied by q + r + s = 0. Also used for
+ * velocities, in hexes per turn
+ */
+struct Hex {
+  int32_t q;
+  int32_t r;
+
+  constexpr int32_t s() const noexcept { return -q - r; }
+
+  constexpr Hex operator+(Hex other) const noexcept {
+    return Hex{q + other.q, r + other.r};
+  }
+  constexpr Hex operator-(Hex other) const noexcept {
+    return Hex{q - other.q, r - other.r};
+  }
+  constexpr Hex operator-() const noexcept { return Hex{-q, -r}; }
+  constexpr Hex operator*(int32_t scale) const noexcept {
+    return Hex{q * scale, r * scale};
+  }
+  constexpr Hex &operator+=(Hex other) noexcept {
+    q += other.q;
+    r += other.r;
+    return *this;
+  }
+
+  constexpr bool operator==(Hex const &) const noexcept = default;
+};
+
+/** the step to the neighbour in each direction */
+constexpr std::array<Hex, DIRECTION_COUNT> DIRECTIONS = {{
+    {1, 0},
+    {1, -1},
+    {0, -1},
+    {-1, 0},
+    {-1, 1},
+    {0, 1},
+}};
+
+constexpr Hex step(Direction direction) noexcept {
+  return DIRECTIONS[static_cast<size_t>(direction)];
+}
+
+constexpr Direction opposite(Direction direction) noexcept {
+  return static_cast<Direction>((static_cast<size_t>(direction) + 3) %
+                                DIRECTION_COUNT);
+}
+
+constexpr Hex neighbour(Hex hex, Direction direction) noexcept {
+  return hex + step(direction);
+}
+
+/**
+ * Number of hexes from the origin, or the number of hexes per turn of a
+ * velocity
+ */
+constexpr int32_t length(Hex hex) noexcept {
+  auto magnitude = [](int32_t x) { return x < 0 ? -x : x; };
+  return (magnitude(hex.q) + magnitude(hex.r) + magnitude(hex.s())) / 2;
+}
+
+/**
+ * Number of steps between two hexes
+ */
+constexpr int32_t distance(Hex a, Hex b) noexcept { return length(a - b); }
+}  // namespace nplanetary::map
+
+#endif  // NPLANETARY_MAP_HEX_H_
@@ -0,0 +1,278 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "map/lineOfSight.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace nplanetary::map {
+namespace {
+constexpr size_t INITIAL_SLOTS = 1024;
+constexpr size_t WORD_BITS = 64;
+/** bits per coordinate of a hex in a key */
+constexpr int KEY_BITS = 12;
+/** makes every coordinate on a map positive */
+constexpr int32_t KEY_OFFSET = Map::MAX_RADIUS + 1;
+static_assert(2 * KEY_OFFSET < 1 << KEY_BITS);
+
+uint64_t pack(Hex hex) noexcept {
+  return static_cast<uint64_t>(hex.q + KEY_OFFSET) << KEY_BITS |
+         static_cast<uint64_t>(hex.r + KEY_OFFSET);
+}
+
+/**
+ * A fraction with a positive denominator
+ */
+struct Fraction {
+  int64_t numerator;
+  int64_t denominator;
+
+  bool operator<(Fraction const &other) const noexcept {
+    return numerator * other.denominator < other.numerator * denominator;
+  }
+};
+
+/**
+ * Neighbour on the far side of where each difference between cube
+ * coordinates reaches -1 and 1
+ */
+constexpr array<array<Direction, 2>, 3> ACROSS = {{
+    {Direction::SOUTHWEST, Direction::NORTHEAST},
+    {Direction::NORTHWEST, Direction::SOUTHEAST},
+    {Direction::EAST, Direction::WEST},
+}};
+
+/**
+ * Whether a line passes through the inside of a surface hex, or along the
+ * edge between it and another surface
+ *
+ * The inside of a hex is where rounding to the nearest hex is unambiguous,
+ * so where the differences between each pair of cube coordinates relative to
+ * its centre are all strictly between -1 and 1. Each difference changes
+ * linearly along the line, so each gives an open interval of the line, and
+ * the line passes through the hex if those overlap somewhere between its
+ * ends. Every coordinate is a whole number, so this is exact.
+ *
+ * @param solid whether the neighbour of the hex in some direction is a
+ * surface too, so a line along the edge between them goes through the body
+ */
+template <typename F>
+bool crosses(Hex from, Hex to, Hex hex, F solid) {
+  Hex start = from - hex;
+  Hex step = to - from;
+  array<int64_t, 3> starts = {start.q - start.r, start.r - start.s(),
+                              start.s() - start.q};
+  array<int64_t, 3> steps = {step.q - step.r, step.r - step.s(),
+                             step.s() - step.q};
+
+  Fraction low = Fraction{0, 1};
+  Fraction high = Fraction{1, 1};
+  bool lowOpen = false;
+  bool highOpen = false;
+  for (size_t axis = 0; axis < starts.size(); ++axis) {
+    int64_t x = starts[axis];
+    int64_t dx = steps[axis];
+    if (dx == 0) {
+      if (x == -1 || x == 1) {
+        // along an edge, which only matters if both sides are surface
+        if (!solid(ACROSS[axis][x > 0])) {
+          return false;
+        }
+      } else if (x != 0) {
+        return false;
+      }
+      continue;
+    }
+
+    // where x + dx t is -1 and 1, in order along the line
+    Fraction enter = dx > 0 ? Fraction{-1 - x, dx} : Fraction{x - 1, -dx};
+    Fraction exit = dx > 0 ? Fraction{1 - x, dx} : Fraction{x + 1, -dx};
+    if (!(enter < low)) {
+      low = enter;
+      lowOpen = true;
+    }
+    if (!(high < exit)) {
+      high = exit;
+      highOpen = true;
+    }
+  }
+  // a closed end of the line lets the interval be a single point
+  return lowOpen || highOpen ? low < high : !(high < low);
+}
+}  // namespace
+
+LineOfSight::LineOfSight(Map const &map)
+    : radius(map.getRadius()),
+      stride(2 * map.getRadius() + 3),
+      words((static_cast<size_t>(stride) + WORD_BITS - 1) / WORD_BITS),
+      surfaces(static_cast<size_t>(stride) * words, 0),
+      entries(INITIAL_SLOTS, Entry{0, 0, false}),
+      turn(1),
+      cached(0) {
+  for (size_t idx = 0; idx < map.size(); ++idx) {
+    if (map.getTerrain(idx) == Terrain::BODY) {
+      size_t row = idx / static_cast<size_t>(stride);
+      size_t column = idx % static_cast<size_t>(stride);
+      surfaces[row * words + column / WORD_BITS] |= uint64_t{1}
+                                                    << (column % WORD_BITS);
+    }
+  }
+}
+
+bool LineOfSight::visible(Hex from, Hex to) {
+  for (Hex hex : {from, to}) {
+    if (length(hex) > radius) {
+      throw runtime_error("hex off the map: "s + to_string(hex.q) + ", " +
+                          to_string(hex.r));
+    }
+  }
+
+  uint64_t key = min(pack(from), pack(to)) << 2 * KEY_BITS |
+                 max(pack(from), pack(to));
+  Entry *entry = &slot(key);
+  if (entry->turn == turn) {
+    return entry->visible;
+  }
+
+  bool clear = trace(from, to);
+  if (2 * (cached + 1) > entries.size()) {
+    grow();
+    entry = &slot(key);
+  }
+  *entry = Entry{key, turn, clear};
+  ++cached;
+  return clear;
+}
+
+void LineOfSight::visible(span<Hex const> from, span<Hex const> to,
+                          span<uint8_t> results) {
+  if (from.size() != to.size() || from.size() != results.size()) {
+    throw runtime_error("every query needs two hexes and a result");
+  }
+  for (size_t idx = 0; idx < from.size(); ++idx) {
+    results[idx] = visible(from[idx], to[idx]);
+  }
+}
+
+void LineOfSight::newTurn() noexcept {
+  ++turn;
+  cached = 0;
+  if (turn == 0) {
+    // every answer ever given could now look current
+    fill(entries.begin(), entries.end(), Entry{0, 0, false});
+    turn = 1;
+  }
+}
+
+size_t LineOfSight::getCached() const noexcept { return cached; }
+
+bool LineOfSight::trace(Hex from, Hex to) const noexcept {
+  // a point in some hex is less than a hex away from its centre along each
+  // axis, so checking the rows near the line and the columns near where it
+  // crosses each row finds every surface it could pass through
+  //
+  // rows and columns are counted as stored, from one before the edge of the
+  // map, so they never go negative
+  int32_t offset = radius + 1;
+  size_t lowRow =
+      static_cast<size_t>(max(min(from.r, to.r) - 1, -radius) + offset);
+  size_t highRow =
+      static_cast<size_t>(min(max(from.r, to.r) + 1, radius) + offset);
+  Hex step = to - from;
+  for (size_t row = lowRow; row <= highRow; ++row) {
+    double lowColumn = min(from.q, to.q);
+    double highColumn = max(from.q, to.q);
+    if (step.r != 0) {
+      double r = static_cast<double>(row) - offset - from.r;
+      double enter = clamp((r - 1) / step.r, 0.0, 1.0);
+      double exit = clamp((r + 1) / step.r, 0.0, 1.0);
+      lowColumn = from.q + step.q * min(enter, exit);
+      highColumn = from.q + step.q * max(enter, exit);
+      if (lowColumn > highColumn) {
+        swap(lowColumn, highColumn);
+      }
+    }
+
+    size_t rowStart = row * words;
+    size_t first =
+        static_cast<size_t>(max(floor(lowColumn) - 1 + offset, 0.0));
+    size_t last = static_cast<size_t>(
+        min(ceil(highColumn) + 1 + offset, static_cast<double>(stride - 1)));
+    for (size_t column = first; column <= last;) {
+      size_t word = column / WORD_BITS;
+      uint64_t bits = surfaces[rowStart + word] >> (column % WORD_BITS);
+      if (bits == 0) {
+        column = (word + 1) * WORD_BITS;
+        continue;
+      }
+
+      column += static_cast<size_t>(countr_zero(bits));
+      if (column > last) {
+        break;
+      }
+      Hex hex = Hex{static_cast<int32_t>(column) - offset,
+                    static_cast<int32_t>(row) - offset};
+      auto solid = [this, hex](Direction direction) {
+        return surface(neighbour(hex, direction));
+      };
+      if (hex != from && hex != to && crosses(from, to, hex, solid)) {
+        return false;
+      }
+      ++column;
+    }
+  }
+  return true;
+}
+
+bool LineOfSight::surface(Hex hex) const noexcept {
+  if (length(hex) > radius) {
+    return false;
+  }
+  size_t row = static_cast<size_t>(hex.r + radius + 1);
+  size_t column = static_cast<size_t>(hex.q + radius + 1);
+  return (surfaces[row * words + column / WORD_BITS] >>
+          (column % WORD_BITS) & 1) != 0;
+}
+
+LineOfSight::Entry &LineOfSight::slot(uint64_t key) noexcept {
+  size_t mask = entries.size() - 1;
+  size_t idx = (key * 0x9e3779b97f4a7c15) >> 32 & mask;
+  while (entries[idx].turn == turn && entries[idx].key != key) {
+    idx = (idx + 1) & mask;
+  }
+  return entries[idx];
+}
+
+void LineOfSight::grow() {
+  vector<Entry> old = vector<Entry>(2 * entries.size(), Entry{0, 0, false});
+  swap(old, entries);
+  for (Entry const &entry : old) {
+    if (entry.turn == turn) {
+      slot(entry.key) = entry;
+    }
+  }
+}
+}  // namespace nplanetary::map
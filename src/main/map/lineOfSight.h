@@ -0,0 +1,121 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_MAP_LINEOFSIGHT_H_
+#define NPLANETARY_MAP_LINEOFSIGHT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "map/hex.h"
+#include "map/map.h"
+
+namespace nplanetary::map {
+/**
+ * Answers whether a line between two hexes on a map is clear of every body,
+ * for deciding who may attack whom
+ *
+ * A line is blocked if it passes through the inside of a body's surface,
+ * other than a surface it starts or ends on, or along the edge between two
+ * surfaces; grazing the edge or corner of a body doesn't block it, and
+ * neither do asteroids. Which hexes are surfaces is
+ * stored as one bitmask per row, so only surfaces near the line are ever
+ * looked at, and answers are remembered until the next turn.
+ *
+ * Built from the map as it is; a map that changes needs a new one
+ */
+class LineOfSight {
+ public:
+  explicit LineOfSight(Map const &map);
+  LineOfSight(LineOfSight const &) = default;
+  LineOfSight(LineOfSight &&) noexcept = default;
+
+  ~LineOfSight() noexcept = default;
+
+  LineOfSight &operator=(LineOfSight const &) = default;
+  LineOfSight &operator=(LineOfSight &&) noexcept = default;
+
+  /**
+   * Whether the line between two hexes on the map is clear
+   */
+  bool visible(Hex from, Hex to);
+  /**
+   * Answers many queries, one after another, as if each were asked alone
+   *
+   * @param results set to one if the line between each pair of hexes is
+   * clear, or zero if it isn't
+   */
+  void visible(std::span<Hex const> from, std::span<Hex const> to,
+               std::span<uint8_t> results);
+
+  /**
+   * Forgets every answer, since things will have moved
+   */
+  void newTurn() noexcept;
+  /**
+   * Number of answers remembered this turn
+   */
+  size_t getCached() const noexcept;
+
+ private:
+  /**
+   * A remembered answer
+   */
+  struct Entry {
+    /** both hexes, in a fixed order */
+    uint64_t key;
+    /** turn the answer was found in; older answers are empty slots */
+    uint32_t turn;
+    bool visible;
+  };
+
+  /**
+   * Whether the line is clear, without remembering the answer
+   */
+  bool trace(Hex from, Hex to) const noexcept;
+  /**
+   * Whether a hex is part of a body's surface; false off the map
+   */
+  bool surface(Hex hex) const noexcept;
+
+  /**
+   * Finds the slot a key is remembered in, or the empty slot it would go in
+   */
+  Entry &slot(uint64_t key) noexcept;
+  /**
+   * Doubles the number of slots, keeping this turn's answers
+   */
+  void grow();
+
+  int32_t radius;
+  int32_t stride;
+  /** 64 bit words per row of surfaces */
+  size_t words;
+  /** one bit per stored hex, set if it's part of a body's surface */
+  std::vector<uint64_t> surfaces;
+
+  std::vector<Entry> entries;
+  uint32_t turn;
+  size_t cached;
+};
+}  // namespace nplanetary::map
+
+#endif  // NPLANETARY_MAP_LINEOFSIGHT_H_
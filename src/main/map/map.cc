@@ -0,0 +1,271 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "map/map.h"
+
+#include <array>
+#include <stdexcept>
+#include <utility>
+
+#include "networking/networking.h"
+
+using namespace std;
+using namespace nplanetary::networking;
+
+namespace nplanetary::map {
+namespace {
+/**
+ * Squared distance between hex centres, scaled to stay an integer
+ */
+int32_t euclideanLength(Hex hex) noexcept {
+  int32_t x = 2 * hex.q + hex.r;
+  return x * x + 3 * hex.r * hex.r;
+}
+
+/**
+ * Direction of the neighbour of a hex closest to a point
+ *
+ * Two neighbours next to each other may be equally close; the clockwise one
+ * of the two is taken, so the pull around a body looks the same from every
+ * side
+ */
+Direction towards(Hex hex, Hex target) noexcept {
+  array<int32_t, DIRECTION_COUNT> lengths;
+  size_t best = 0;
+  for (size_t idx = 0; idx < DIRECTION_COUNT; ++idx) {
+    lengths[idx] = euclideanLength(hex + DIRECTIONS[idx] - target);
+    if (lengths[idx] < lengths[best]) {
+      best = idx;
+    }
+  }
+
+  // directions go anticlockwise, so only a tie with the one before needs
+  // moving to - including from EAST round to SOUTHEAST
+  size_t before = (best + DIRECTION_COUNT - 1) % DIRECTION_COUNT;
+  return static_cast<Direction>(lengths[before] == lengths[best] ? before
+                                                                  : best);
+}
+
+/**
+ * Number of hexes on a map with some radius
+ */
+size_t hexCount(int32_t radius) noexcept {
+  return static_cast<size_t>(3 * radius * (radius + 1) + 1);
+}
+}  // namespace
+
+Map::Map(int32_t radius)
+    : radius(radius),
+      stride(2 * radius + 3),
+      offsets(),
+      terrain(),
+      gravity(),
+      bodyIds(),
+      bases(),
+      bodies() {
+  if (radius < 0 || radius > MAX_RADIUS) {
+    throw runtime_error("invalid map radius: "s + to_string(radius));
+  }
+
+  for (size_t idx = 0; idx < DIRECTION_COUNT; ++idx) {
+    offsets[idx] = DIRECTIONS[idx].q + DIRECTIONS[idx].r * stride;
+  }
+
+  size_t stored = static_cast<size_t>(stride) * static_cast<size_t>(stride);
+  terrain.resize(stored, Terrain::OFF_MAP);
+  gravity.resize(stored, 0);
+  bodyIds.resize(stored, NO_BODY);
+  bases.resize(stored, 0);
+  for (size_t idx = 0; idx < stored; ++idx) {
+    if (contains(hexAt(idx))) {
+      terrain[idx] = Terrain::SPACE;
+    }
+  }
+}
+
+int32_t Map::getRadius() const noexcept { return radius; }
+
+bool Map::contains(Hex hex) const noexcept { return length(hex) <= radius; }
+
+size_t Map::size() const noexcept { return terrain.size(); }
+
+size_t Map::index(Hex hex) const noexcept {
+  return static_cast<size_t>((hex.r + radius + 1) * stride +
+                             (hex.q + radius + 1));
+}
+
+Hex Map::hexAt(size_t index) const noexcept {
+  int32_t row = static_cast<int32_t>(index / static_cast<size_t>(stride));
+  int32_t column = static_cast<int32_t>(index % static_cast<size_t>(stride));
+  return Hex{column - radius - 1, row - radius - 1};
+}
+
+size_t Map::neighbour(size_t index, Direction direction) const noexcept {
+  return static_cast<size_t>(static_cast<ptrdiff_t>(index) +
+                             offsets[static_cast<size_t>(direction)]);
+}
+
+Terrain Map::getTerrain(size_t index) const noexcept { return terrain[index]; }
+
+uint8_t Map::getGravity(size_t index) const noexcept { return gravity[index]; }
+
+uint8_t Map::getBody(size_t index) const noexcept { return bodyIds[index]; }
+
+uint8_t Map::getBases(size_t index) const noexcept { return bases[index]; }
+
+span<Body const> Map::getBodies() const noexcept { return bodies; }
+
+uint8_t Map::addBody(Body const &body) {
+  if (bodies.size() == MAX_BODIES) {
+    throw runtime_error("too many bodies");
+  } else if (body.radius < 0 || length(body.centre) + body.radius > radius) {
+    throw runtime_error("body doesn't fit on the map: "s + body.name);
+  }
+
+  // check before changing anything
+  for (int32_t dr = -body.radius; dr <= body.radius; ++dr) {
+    for (int32_t dq = -body.radius; dq <= body.radius; ++dq) {
+      if (length(Hex{dq, dr}) <= body.radius &&
+          terrain[index(body.centre + Hex{dq, dr})] == Terrain::BODY) {
+        throw runtime_error("body overlaps another: "s + body.name);
+      }
+    }
+  }
+
+  uint8_t id = static_cast<uint8_t>(bodies.size());
+  int32_t reach = body.radius + 1;
+  for (int32_t dr = -reach; dr <= reach; ++dr) {
+    for (int32_t dq = -reach; dq <= reach; ++dq) {
+      Hex hex = body.centre + Hex{dq, dr};
+      int32_t away = length(Hex{dq, dr});
+      if (away > reach || !contains(hex)) {
+        continue;
+      }
+
+      size_t idx = index(hex);
+      if (away <= body.radius) {
+        terrain[idx] = Terrain::BODY;
+        gravity[idx] = 0;
+        bodyIds[idx] = id;
+      } else if (terrain[idx] != Terrain::BODY) {
+        // pulls towards the surface; a hex near several bodies feels each
+        gravity[idx] |= static_cast<uint8_t>(
+            1 << static_cast<size_t>(towards(hex, body.centre)));
+        if (bodyIds[idx] == NO_BODY) {
+          bodyIds[idx] = id;
+        }
+      }
+    }
+  }
+
+  bodies.push_back(body);
+  return id;
+}
+
+void Map::setTerrain(Hex hex, Terrain terrain) {
+  size_t idx = checkedIndex(hex);
+  if (this->terrain[idx] == Terrain::BODY || terrain == Terrain::BODY ||
+      terrain == Terrain::OFF_MAP) {
+    throw runtime_error("only bodies may change their surface");
+  }
+  this->terrain[idx] = terrain;
+}
+
+void Map::setBase(Hex hex, uint8_t player, bool present) {
+  size_t idx = checkedIndex(hex);
+  if (player >= 8) {
+    throw runtime_error("invalid player: "s + to_string(player));
+  }
+  uint8_t mask = static_cast<uint8_t>(1 << player);
+  bases[idx] =
+      static_cast<uint8_t>(present ? bases[idx] | mask : bases[idx] & ~mask);
+}
+
+size_t Map::checkedIndex(Hex hex) const {
+  if (!contains(hex)) {
+    throw runtime_error("hex off the map: "s + to_string(hex.q) + ", " +
+                        to_string(hex.r));
+  }
+  return index(hex);
+}
+
+Socket &operator<<(Socket &socket, Map const &map) {
+  socket << map.radius << static_cast<uint8_t>(map.bodies.size());
+  for (Body const &body : map.bodies) {
+    socket << body.name << body.centre.q << body.centre.r << body.radius
+           << body.major;
+  }
+
+  // gravity and body ids follow from the bodies, so only send what doesn't,
+  // and only for hexes on the map
+  vector<uint8_t> terrain;
+  vector<uint8_t> bases;
+  terrain.reserve(hexCount(map.radius));
+  bases.reserve(hexCount(map.radius));
+  for (size_t idx = 0; idx < map.size(); ++idx) {
+    if (map.terrain[idx] != Terrain::OFF_MAP) {
+      terrain.push_back(static_cast<uint8_t>(map.terrain[idx]));
+      bases.push_back(map.bases[idx]);
+    }
+  }
+  socket << span<uint8_t const>(terrain) << span<uint8_t const>(bases);
+  return socket;
+}
+
+Socket &operator>>(Socket &socket, Map &map) {
+  int32_t radius;
+  uint8_t bodyCount;
+  socket >> radius >> bodyCount;
+  Map received = Map(radius);
+  for (size_t idx = 0; idx < bodyCount; ++idx) {
+    Body body;
+    socket >> body.name >> body.centre.q >> body.centre.r >> body.radius >>
+        body.major;
+    received.addBody(body);
+  }
+
+  vector<uint8_t> terrain;
+  vector<uint8_t> bases;
+  socket >> terrain >> bases;
+  if (terrain.size() != hexCount(radius) || bases.size() != hexCount(radius)) {
+    throw runtime_error("invalid map");
+  }
+  size_t next = 0;
+  for (size_t idx = 0; idx < received.size(); ++idx) {
+    if (received.terrain[idx] == Terrain::OFF_MAP) {
+      continue;
+    }
+
+    // bodies must be where they said they were
+    uint8_t recvd = terrain[next];
+    if (recvd == static_cast<uint8_t>(Terrain::OFF_MAP) ||
+        recvd > static_cast<uint8_t>(Terrain::ICE_ASTEROID) ||
+        (recvd == static_cast<uint8_t>(Terrain::BODY)) !=
+            (received.terrain[idx] == Terrain::BODY)) {
+      throw runtime_error("invalid map");
+    }
+    received.terrain[idx] = static_cast<Terrain>(recvd);
+    received.bases[idx] = bases[next];
+    ++next;
+  }
+
+  map = move(received);
+  return socket;
+}
+}  // namespace nplanetary::map
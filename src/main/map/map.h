@@ -0,0 +1,168 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_MAP_MAP_H_
+#define NPLANETARY_MAP_MAP_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "map/hex.h"
+
+namespace nplanetary::networking {
+class Socket;
+}
+
+namespace nplanetary::map {
+enum class Terrain : uint8_t {
+  /** outside the map, including the border around it */
+  OFF_MAP,
+  SPACE,
+  /** the surface of a planet or moon */
+  BODY,
+  /** an asteroid an outpost would mine ore from */
+  ORE_ASTEROID,
+  /** an asteroid an outpost would mine water from */
+  ICE_ASTEROID,
+};
+
+/**
+ * A planet or moon
+ */
+struct Body {
+  std::string name = "";
+  Hex centre = {};
+  /** hexes from the centre to the edge of the surface; zero for one hex */
+  int32_t radius = 0;
+  /** a major planet, as opposed to a minor one like a moon */
+  bool major = false;
+};
+
+/**
+ * A hexagonal map, stored as one dense array per property of a hex
+ *
+ * Hexes are stored by row in axial coordinates, within a one hex border that
+ * is always OFF_MAP, so every hex on the map has the same index offset to its
+ * neighbour in each direction and looking one up needs no bounds check
+ */
+class Map {
+ public:
+  /** largest radius a map may have */
+  static constexpr int32_t MAX_RADIUS = 1024;
+  /** body id of hexes that aren't on or near a body */
+  static constexpr uint8_t NO_BODY = 0xff;
+  static constexpr size_t MAX_BODIES = NO_BODY;
+
+  /**
+   * An empty map, with radius hexes from the centre to each edge
+   */
+  explicit Map(int32_t radius = 0);
+  Map(Map const &) = default;
+  Map(Map &&) noexcept = default;
+
+  ~Map() noexcept = default;
+
+  Map &operator=(Map const &) = default;
+  Map &operator=(Map &&) noexcept = default;
+
+  int32_t getRadius() const noexcept;
+  /**
+   * Whether a hex is on the map
+   */
+  bool contains(Hex hex) const noexcept;
+
+  /**
+   * Number of stored hexes, including those off the map
+   */
+  size_t size() const noexcept;
+  /**
+   * Where a hex is stored; it must be on the map or next to it
+   */
+  size_t index(Hex hex) const noexcept;
+  Hex hexAt(size_t index) const noexcept;
+  /**
+   * Where the neighbour of a hex on the map is stored
+   */
+  size_t neighbour(size_t index, Direction direction) const noexcept;
+
+  Terrain getTerrain(size_t index) const noexcept;
+  /**
+   * Directions a ship in this hex is pulled in, as a bitmask indexed by
+   * Direction
+   */
+  uint8_t getGravity(size_t index) const noexcept;
+  /**
+   * Body whose surface this is, or whose gravity this hex is in; NO_BODY if
+   * neither
+   */
+  uint8_t getBody(size_t index) const noexcept;
+  /**
+   * Players with a base in this hex, as a bitmask indexed by player
+   */
+  uint8_t getBases(size_t index) const noexcept;
+
+  std::span<Body const> getBodies() const noexcept;
+
+  /**
+   * Adds a body, making the ring of hexes around its surface pull towards it
+   *
+   * @returns the body's id
+   */
+  uint8_t addBody(Body const &body);
+  /**
+   * Changes the terrain of a hex on the map that isn't part of a body
+   */
+  void setTerrain(Hex hex, Terrain terrain);
+  void setBase(Hex hex, uint8_t player, bool present);
+
+  /**
+   * Sends the map, leaving out what receiving it recomputes
+   */
+  friend networking::Socket &operator<<(networking::Socket &socket,
+                                        Map const &map);
+  friend networking::Socket &operator>>(networking::Socket &socket, Map &map);
+
+ private:
+  /**
+   * Checks that a hex is on the map
+   *
+   * @returns where it's stored
+   */
+  size_t checkedIndex(Hex hex) const;
+
+  int32_t radius;
+  /** stored hexes per row, including the border */
+  int32_t stride;
+  /** index offset to the neighbour in each direction */
+  std::array<ptrdiff_t, DIRECTION_COUNT> offsets;
+
+  std::vector<Terrain> terrain;
+  std::vector<uint8_t> gravity;
+  std::vector<uint8_t> bodyIds;
+  std::vector<uint8_t> bases;
+
+  std::vector<Body> bodies;
+};
+}  // namespace nplanetary::map
+
+#endif  // NPLANETARY_MAP_MAP_H_
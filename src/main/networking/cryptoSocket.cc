@@ -20,11 +20,24 @@
 #include "networking/cryptoSocket.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <iostream>  // TODO: debug only
 #include <limits>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <utility>
+#include <variant>
+
+#include "networking/executor.h"
 
 using namespace std;
+using namespace std::chrono;
 
 namespace nplanetary::networking {
 struct SodiumInit {
@@ -34,10 +47,20 @@ struct SodiumInit {
 } sodiumInit;
 
 CryptoSocket::CryptoSocket(string const &hostname, string const &password,
-                           stop_token const &stopFlag)
-    : CryptoSocket(RawSocket(hostname, stopFlag), password) {}
+                           stop_token const &stopFlag, uint8_t features)
+    : CryptoSocket(RawSocket(hostname, stopFlag), nullptr, password, features) {
+}
+CryptoSocket::CryptoSocket(string const &hostname, Ticket const &ticket,
+                           string const &password, stop_token const &stopFlag,
+                           uint8_t features)
+    : CryptoSocket(RawSocket(hostname, stopFlag), &ticket, password, features) {
+}
 
 CryptoSocket::~CryptoSocket() {
+  if (!rawSocket) {
+    // moved from
+    return;
+  }
   try {
     flush();
   } catch (...) {
@@ -46,205 +69,1072 @@ CryptoSocket::~CryptoSocket() {
 }
 
 void CryptoSocket::read(uint8_t *buf, size_t n) {
-  // do we require more chunks?
-  if (recvBuffer.empty()) {
-    pull();
+  if (speculating) {
+    span<uint8_t const> available = peek(n);
+    copy(available.begin(), available.begin() + n, buf);
+    speculated += n;
+    return;
   }
 
-  // how large is the first chunk?
-  if (recvBuffer.front().size() >= n) {
-    // take as much as needed
-    copy(recvBuffer.front().begin(), recvBuffer.front().begin() + n, buf);
-    if (recvBuffer.front().size() == n) {
-      recvBuffer.pop_front();
-    } else {
-      recvBuffer.front().erase(recvBuffer.front().begin(),
-                               recvBuffer.front().begin() + n);
+  while (n != 0) {
+    // do we require more data?
+    if (recvBuffer.empty()) {
+      pull();
     }
-  } else {
-    // take all, recurse
-    copy(recvBuffer.front().begin(), recvBuffer.front().end(), buf);
-    size_t copied = recvBuffer.front().size();
-    recvBuffer.pop_front();
-    read(buf + copied, n - copied);
+
+    // take as much as needed or available
+    span<uint8_t const> available = recvBuffer.peek();
+    size_t taken = min(available.size(), n);
+    copy(available.begin(), available.begin() + taken, buf);
+    recvBuffer.consume(taken);
+    buf += taken;
+    n -= taken;
+  }
+}
+span<uint8_t const> CryptoSocket::peek(size_t n) {
+  while (recvBuffer.size() - speculated < n) {
+    if (speculating) {
+      needed = max(needed, speculated + n);
+      throw IncompleteFlag();
+    }
+    pull();
+  }
+  return recvBuffer.peek().subspan(speculated);
+}
+void CryptoSocket::consume(size_t n) {
+  if (speculating) {
+    peek(n);
+    speculated += n;
+    return;
+  }
+
+  while (recvBuffer.size() < n) {
+    n -= recvBuffer.size();
+    recvBuffer.consume(recvBuffer.size());
+    pull();
+  }
+  recvBuffer.consume(n);
+}
+void CryptoSocket::expect(size_t n) noexcept {
+  if (speculating) {
+    needed = max(needed, speculated + n);
   }
 }
 void CryptoSocket::write(uint8_t const *buf, size_t n) {
-  copy(buf, buf + n, back_inserter(sendBuffer));
-  if (sendBuffer.size() >= 4096) {
-    flush();
+  sendBuffer.insert(sendBuffer.end(), buf, buf + n);
+  if (sendBuffer.size() >= sendThreshold() && !deferringFlush) {
+    send();
   }
 }
 void CryptoSocket::flush() {
-  if (sendBuffer.empty()) {
-    return;
+  send();
+  if (holding) {
+    uncork();
   }
+}
 
-  // calculate size of chunk to send
-  uint16_t sendSize;
-  if (sendBuffer.size() > numeric_limits<uint16_t>::max()) {
-    sendSize = numeric_limits<uint16_t>::max();
-  } else {
-    sendSize = sendBuffer.size();
+void CryptoSocket::setFraming(Framing framing) {
+  if ((framing == Framing::IMMEDIATE) !=
+      (this->framing == Framing::IMMEDIATE)) {
+    rawSocket.setNoDelay(framing == Framing::IMMEDIATE);
   }
+  if ((framing == Framing::BULK) != (this->framing == Framing::BULK)) {
+    // uncorking pushes out anything held back
+    rawSocket.setCork(framing == Framing::BULK);
+    holding = false;
+  }
+  this->framing = framing;
+}
+Framing CryptoSocket::getFraming() const noexcept { return framing; }
 
-  // send header
-  array<uint8_t, sizeof(uint16_t)> plaintextHeader;
-  plaintextHeader[0] = (sendSize >> 0) & 0xff;
-  plaintextHeader[1] = (sendSize >> 8) & 0xff;
+Task<void> CryptoSocket::asyncRead(uint8_t *buf, size_t n) {
+  while (n != 0) {
+    // do we require more data?
+    if (recvBuffer.empty()) {
+      co_await asyncPull();
+    }
 
-  array<uint8_t,
-        sizeof(uint16_t) + crypto_secretstream_xchacha20poly1305_ABYTES>
-      ciphertextHeader;
-  crypto_secretstream_xchacha20poly1305_push(
-      &sendState, ciphertextHeader.data(), nullptr, plaintextHeader.data(),
-      plaintextHeader.size(), nullptr, 0, 0);
-  rawSocket.write(ciphertextHeader.data(), ciphertextHeader.size());
-
-  // send message
-  unique_ptr<uint8_t[]> ciphertext = make_unique<uint8_t[]>(
-      sendSize + crypto_secretstream_xchacha20poly1305_ABYTES);
-  crypto_secretstream_xchacha20poly1305_push(&sendState, ciphertext.get(),
-                                             nullptr, sendBuffer.data(),
-                                             sendSize, nullptr, 0, 0);
-  rawSocket.write(ciphertext.get(),
-                  sendSize + crypto_secretstream_xchacha20poly1305_ABYTES);
-  sendBuffer.erase(sendBuffer.begin(), sendBuffer.begin() + sendSize);
-
-  // recurse until send buffer is empty
-  return flush();
-}
-
-CryptoSocket::CryptoSocket(RawSocket rawSocket, std::string const &password)
-    : rawSocket(move(rawSocket)) {
-  // setup sending
-
-  // run keygen
-  array<uint8_t, crypto_secretstream_xchacha20poly1305_KEYBYTES> key;
-  array<uint8_t, crypto_pwhash_scryptsalsa208sha256_SALTBYTES> salt;
-  randombytes_buf(salt.data(), salt.size());
-  this->rawSocket.write(salt.data(), salt.size());
-  if (crypto_pwhash_scryptsalsa208sha256(
-          key.data(), key.size(), password.c_str(), password.size(),
-          salt.data(), crypto_pwhash_scryptsalsa208sha256_MEMLIMIT_INTERACTIVE,
-          crypto_pwhash_scryptsalsa208sha256_OPSLIMIT_INTERACTIVE) != 0) {
-    throw runtime_error("ran out of memory while hashing password for send");
+    // take as much as needed or available
+    span<uint8_t const> available = recvBuffer.peek();
+    size_t taken = min(available.size(), n);
+    copy(available.begin(), available.begin() + taken, buf);
+    recvBuffer.consume(taken);
+    buf += taken;
+    n -= taken;
+  }
+}
+Task<void> CryptoSocket::asyncWrite(uint8_t const *buf, size_t n) {
+  sendBuffer.insert(sendBuffer.end(), buf, buf + n);
+  if (sendBuffer.size() >= sendThreshold()) {
+    co_await asyncSend();
   }
+}
+Task<void> CryptoSocket::asyncFlush() {
+  co_await asyncSend();
+  if (holding) {
+    uncork();
+  }
+}
 
-  // make header
-  array<uint8_t, crypto_secretstream_xchacha20poly1305_HEADERBYTES> header;
-  crypto_secretstream_xchacha20poly1305_init_push(&sendState, header.data(),
-                                                  key.data());
-  this->rawSocket.write(header.data(), header.size());
+uint8_t CryptoSocket::getFeatures() const noexcept { return features; }
+CryptoSocket::Ticket const &CryptoSocket::getTicket() const noexcept {
+  return ticket;
+}
+Stats CryptoSocket::getStats() const noexcept { return rawSocket.getStats(); }
+
+CryptoSocket::CryptoSocket(RawSocket rawSocket, Ticket const *ticket,
+                           string const &password, uint8_t features)
+    : rawSocket(move(rawSocket)),
+      features(features),
+      ticket(),
+      cleartext(false),
+      recvArena(),
+      sendArena(),
+      speculating(false),
+      speculated(0),
+      needed(0),
+      deferringFlush(false),
+      framing(Framing::BATCHED),
+      holding(false) {
+  steady_clock::time_point start = steady_clock::now();
 
-  // setup receiving
+  if (this->rawSocket.isTrusted()) {
+    trust();
+    this->rawSocket.getCounters().addHandshake(start);
+    return;
+  }
 
-  // run keygen
+  // get the server's salt and nonce
+  Salt salt;
+  Nonce serverNonce;
   this->rawSocket.read(salt.data(), salt.size());
+  this->rawSocket.read(serverNonce.data(), serverNonce.size());
+
+  if (ticket == nullptr) {
+    fullClient(password, salt, serverNonce, true);
+  } else if (!resumeClient(*ticket, serverNonce)) {
+    // rejected - the server now expects a full handshake
+    fullClient(password, salt, serverNonce, false);
+  }
+
+  this->rawSocket.getCounters().addHandshake(start);
+}
+
+CryptoSocket::CryptoSocket(RawSocket rawSocket, MasterKey const &masterKey,
+                           TicketKey const &ticketKey, uint8_t features)
+    : rawSocket(move(rawSocket)),
+      features(features),
+      ticket(),
+      cleartext(false),
+      recvArena(),
+      sendArena(),
+      speculating(false),
+      speculated(0),
+      needed(0),
+      deferringFlush(false),
+      framing(Framing::BATCHED),
+      holding(false) {
+  steady_clock::time_point start = steady_clock::now();
+
+  if (this->rawSocket.isTrusted()) {
+    trust();
+    this->rawSocket.getCounters().addHandshake(start);
+    return;
+  }
+
+  // send our salt and a fresh nonce
+  Nonce serverNonce;
+  randombytes_buf(serverNonce.data(), serverNonce.size());
+  stage(masterKey.salt);
+  stage(serverNonce);
+  sendStaged();
+
+  // how does the client want to connect?
+  uint8_t mode;
+  this->rawSocket.read(&mode, sizeof(mode));
+  switch (mode) {
+    case RESUME_MODE: {
+      if (!resumeServer(ticketKey, serverNonce)) {
+        // rejected - fall back to a full handshake
+        fullServer(masterKey, ticketKey, serverNonce);
+      }
+      break;
+    }
+    case FULL_MODE: {
+      fullServer(masterKey, ticketKey, serverNonce);
+      break;
+    }
+    default: {
+      throw runtime_error("invalid handshake mode");
+    }
+  }
+
+  this->rawSocket.getCounters().addHandshake(start);
+}
+
+CryptoSocket::MasterKey CryptoSocket::deriveMasterKey(string const &password,
+                                                      Salt const &salt) {
+  MasterKey masterKey;
+  masterKey.salt = salt;
   if (crypto_pwhash_scryptsalsa208sha256(
-          key.data(), key.size(), password.c_str(), password.size(),
-          salt.data(), crypto_pwhash_scryptsalsa208sha256_MEMLIMIT_INTERACTIVE,
+          masterKey.key.data(), masterKey.key.size(), password.c_str(),
+          password.size(), salt.data(),
+          crypto_pwhash_scryptsalsa208sha256_MEMLIMIT_INTERACTIVE,
           crypto_pwhash_scryptsalsa208sha256_OPSLIMIT_INTERACTIVE) != 0) {
-    throw runtime_error("ran out of memory while hashing password for recv");
+    throw runtime_error("ran out of memory while hashing password");
   }
+  return masterKey;
+}
 
-  // read header
-  this->rawSocket.read(header.data(), header.size());
-  if (crypto_secretstream_xchacha20poly1305_init_pull(&recvState, header.data(),
-                                                      key.data()) != 0) {
-    throw runtime_error("invalid header");
+CryptoSocket::MasterKey CryptoSocket::clientMasterKey(string const &password,
+                                                      Salt const &salt) {
+  static mutex lock;
+  static string lastPassword;
+  static optional<MasterKey> last;
+
+  {
+    lock_guard<mutex> guard(lock);
+    if (last.has_value() && last->salt == salt && lastPassword == password) {
+      return *last;
+    }
   }
 
-  // final handshake
+  MasterKey masterKey = deriveMasterKey(password, salt);
 
-  // generate test packet
-  array<uint8_t, VERIFICATION_PACKET_SIZE> sendVerify;
-  randombytes_buf(sendVerify.data(), sendVerify.size());
+  lock_guard<mutex> guard(lock);
+  lastPassword = password;
+  last = masterKey;
+  return masterKey;
+}
 
-  // send packet
-  array<uint8_t,
-        VERIFICATION_PACKET_SIZE + crypto_secretstream_xchacha20poly1305_ABYTES>
-      sendVerifyCiphered;
-  crypto_secretstream_xchacha20poly1305_push(
-      &sendState, sendVerifyCiphered.data(), nullptr, sendVerify.data(),
-      sendVerify.size(), nullptr, 0, 0);
-  this->rawSocket.write(sendVerifyCiphered.data(), sendVerifyCiphered.size());
-
-  // get other side's test packet
-  array<uint8_t,
-        VERIFICATION_PACKET_SIZE + crypto_secretstream_xchacha20poly1305_ABYTES>
-      recvVerifyCiphered;
-  this->rawSocket.read(recvVerifyCiphered.data(), recvVerifyCiphered.size());
-
-  // decrypt
-  array<uint8_t, VERIFICATION_PACKET_SIZE> recvVerify;
-  if (crypto_secretstream_xchacha20poly1305_pull(
-          &recvState, recvVerify.data(), nullptr, nullptr,
-          recvVerifyCiphered.data(), recvVerifyCiphered.size(), nullptr,
-          0) != 0) {
-    throw PasswordMismatchFlag();
+CryptoSocket::Key CryptoSocket::deriveSessionKey(Key const &secret,
+                                                 uint8_t direction,
+                                                 Nonce const &clientNonce,
+                                                 Nonce const &serverNonce) {
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, secret.data(), secret.size(),
+                          crypto_secretstream_xchacha20poly1305_KEYBYTES);
+  crypto_generichash_update(&state, &direction, sizeof(direction));
+  crypto_generichash_update(&state, clientNonce.data(), clientNonce.size());
+  crypto_generichash_update(&state, serverNonce.data(), serverNonce.size());
+
+  Key key;
+  crypto_generichash_final(&state, key.data(), key.size());
+  return key;
+}
+
+bool CryptoSocket::resumeClient(Ticket const &ticket,
+                                Nonce const &serverNonce) {
+  Nonce clientNonce;
+  randombytes_buf(clientNonce.data(), clientNonce.size());
+
+  // send everything the server needs in one go
+  uint8_t mode = RESUME_MODE;
+  stage(span<uint8_t const>(&mode, sizeof(mode)));
+  stage(ticket.sealed);
+  stage(clientNonce);
+  Verify sendVerify = startSending(deriveSessionKey(
+      ticket.secret, CLIENT_TO_SERVER, clientNonce, serverNonce));
+  stageEncrypted(sendVerify);
+  stageEncrypted(span<uint8_t const>(&features, sizeof(features)));
+  sendStaged();
+
+  uint8_t status;
+  rawSocket.read(&status, sizeof(status));
+  if (status != TICKET_ACCEPTED) {
+    return false;
   }
 
-  // reply
-  crypto_secretstream_xchacha20poly1305_push(
-      &sendState, recvVerifyCiphered.data(), nullptr, recvVerify.data(),
-      recvVerify.size(), nullptr, 0, 0);
-  this->rawSocket.write(recvVerifyCiphered.data(), recvVerifyCiphered.size());
+  // decrypting the server's test packet proves it opened the ticket
+  startReceiving(deriveSessionKey(ticket.secret, SERVER_TO_CLIENT,
+                                  clientNonce, serverNonce));
+  receiveFeatures();
+  receiveTicket();
+  return true;
+}
+
+void CryptoSocket::fullClient(string const &password, Salt const &salt,
+                              Nonce const &serverNonce, bool sendMode) {
+  // only the client runs scrypt per connection
+  MasterKey masterKey = clientMasterKey(password, salt);
+  Nonce clientNonce;
+  randombytes_buf(clientNonce.data(), clientNonce.size());
+
+  // send header and test packet
+  if (sendMode) {
+    uint8_t mode = FULL_MODE;
+    stage(span<uint8_t const>(&mode, sizeof(mode)));
+  }
+  stage(clientNonce);
+  Verify sendVerify = startSending(deriveSessionKey(
+      masterKey.key, CLIENT_TO_SERVER, clientNonce, serverNonce));
+  stageEncrypted(sendVerify);
+  sendStaged();
+
+  // reply to the server's test packet, along with the features we offer
+  Verify recvVerify = startReceiving(deriveSessionKey(
+      masterKey.key, SERVER_TO_CLIENT, clientNonce, serverNonce));
+  stageEncrypted(recvVerify);
+  stageEncrypted(span<uint8_t const>(&features, sizeof(features)));
+  sendStaged();
 
   // get reply packet
-  this->rawSocket.read(recvVerifyCiphered.data(), recvVerifyCiphered.size());
+  if (!receiveEncrypted(recvVerify) || sendVerify != recvVerify) {
+    throw PasswordMismatchFlag();
+  }
+  receiveFeatures();
+  receiveTicket();
+}
+
+bool CryptoSocket::resumeServer(TicketKey const &ticketKey,
+                                Nonce const &serverNonce) {
+  array<uint8_t, SEALED_TICKET_SIZE> sealed;
+  Nonce clientNonce;
+  rawSocket.read(sealed.data(), sealed.size());
+  rawSocket.read(clientNonce.data(), clientNonce.size());
+
+  optional<Key> secret = openTicket(ticketKey, sealed);
+  if (!secret.has_value()) {
+    // skip the rest of the client's attempt
+    size_t attemptSize =
+        crypto_secretstream_xchacha20poly1305_HEADERBYTES +
+        VERIFICATION_PACKET_SIZE + sizeof(features) +
+        2 * crypto_secretstream_xchacha20poly1305_ABYTES;
+    if (recvArena.size() < attemptSize) {
+      recvArena.resize(attemptSize);
+    }
+    rawSocket.read(recvArena.data(), attemptSize);
+
+    uint8_t status = TICKET_REJECTED;
+    stage(span<uint8_t const>(&status, sizeof(status)));
+    sendStaged();
+    return false;
+  }
+
+  // reply with everything the client needs in one go
+  uint8_t status = TICKET_ACCEPTED;
+  stage(span<uint8_t const>(&status, sizeof(status)));
+  Verify sendVerify = startSending(
+      deriveSessionKey(*secret, SERVER_TO_CLIENT, clientNonce, serverNonce));
+  stageEncrypted(sendVerify);
+  stageEncrypted(span<uint8_t const>(&features, sizeof(features)));
+  stageTicket(ticketKey);
+  sendStaged();
+
+  startReceiving(
+      deriveSessionKey(*secret, CLIENT_TO_SERVER, clientNonce, serverNonce));
+  receiveFeatures();
+  return true;
+}
+
+void CryptoSocket::fullServer(MasterKey const &masterKey,
+                              TicketKey const &ticketKey,
+                              Nonce const &serverNonce) {
+  Nonce clientNonce;
+  rawSocket.read(clientNonce.data(), clientNonce.size());
+
+  // send header and test packet
+  Verify sendVerify = startSending(deriveSessionKey(
+      masterKey.key, SERVER_TO_CLIENT, clientNonce, serverNonce));
+  stageEncrypted(sendVerify);
+  sendStaged();
+
+  // reply to the client's test packet, along with the features we offer and
+  // a ticket to resume with
+  Verify recvVerify = startReceiving(deriveSessionKey(
+      masterKey.key, CLIENT_TO_SERVER, clientNonce, serverNonce));
+  stageEncrypted(recvVerify);
+  stageEncrypted(span<uint8_t const>(&features, sizeof(features)));
+  stageTicket(ticketKey);
+  sendStaged();
 
-  // decrypt
-  if (crypto_secretstream_xchacha20poly1305_pull(
-          &recvState, recvVerify.data(), nullptr, nullptr,
-          recvVerifyCiphered.data(), recvVerifyCiphered.size(), nullptr,
-          0) != 0) {
+  // get reply packet
+  if (!receiveEncrypted(recvVerify) || sendVerify != recvVerify) {
     throw PasswordMismatchFlag();
   }
+  receiveFeatures();
+}
+
+CryptoSocket::Verify CryptoSocket::startSending(Key const &sendKey) {
+  array<uint8_t, crypto_secretstream_xchacha20poly1305_HEADERBYTES> header;
+  crypto_secretstream_xchacha20poly1305_init_push(&sendState, header.data(),
+                                                  sendKey.data());
+  stage(header);
+
+  Verify sendVerify;
+  randombytes_buf(sendVerify.data(), sendVerify.size());
+  return sendVerify;
+}
+
+CryptoSocket::Verify CryptoSocket::startReceiving(Key const &recvKey) {
+  array<uint8_t, crypto_secretstream_xchacha20poly1305_HEADERBYTES> header;
+  rawSocket.read(header.data(), header.size());
+  if (crypto_secretstream_xchacha20poly1305_init_pull(&recvState, header.data(),
+                                                      recvKey.data()) != 0) {
+    throw runtime_error("invalid header");
+  }
 
-  if (sendVerify != recvVerify) {
+  // can only be decrypted with the same key
+  Verify recvVerify;
+  if (!receiveEncrypted(recvVerify)) {
     throw PasswordMismatchFlag();
   }
+  return recvVerify;
 }
 
-void CryptoSocket::pull() {
-  // read header
-  array<uint8_t,
-        sizeof(uint16_t) + crypto_secretstream_xchacha20poly1305_ABYTES>
-      ciphertextHeader;
-  array<uint8_t, sizeof(uint16_t)> plaintextHeader;
-
-  rawSocket.read(ciphertextHeader.data(), ciphertextHeader.size());
-  if (crypto_secretstream_xchacha20poly1305_pull(
-          &recvState, plaintextHeader.data(), nullptr, nullptr,
-          ciphertextHeader.data(), ciphertextHeader.size(), nullptr, 0) != 0) {
+void CryptoSocket::receiveFeatures() {
+  uint8_t offered;
+  if (!receiveEncrypted(span<uint8_t>(&offered, sizeof(offered)))) {
     throw runtime_error("invalid message detected");
   }
+  features &= offered;
+}
 
-  uint16_t dataLength = (static_cast<uint16_t>(plaintextHeader[0]) << 0) |
-                        (static_cast<uint16_t>(plaintextHeader[1]) << 8);
+void CryptoSocket::trust() {
+  // both sides send first; the pipe has room for both
+  rawSocket.write(&features, sizeof(features));
+  uint8_t offered;
+  rawSocket.read(&offered, sizeof(offered));
+  features &= offered;
+  cleartext = true;
+}
 
-  // read message
-  unique_ptr<uint8_t[]> ciphertext = make_unique<uint8_t[]>(
-      dataLength + crypto_secretstream_xchacha20poly1305_ABYTES);
-  vector<uint8_t> plaintext = vector<uint8_t>(dataLength);
+void CryptoSocket::stageTicket(TicketKey const &ticketKey) {
+  // secret, then when it was issued
+  array<uint8_t, sizeof(Key) + sizeof(uint64_t)> plaintext;
+  randombytes_buf(plaintext.data(), sizeof(Key));
+  uint64_t issued = static_cast<uint64_t>(
+      chrono::duration_cast<chrono::seconds>(
+          chrono::system_clock::now().time_since_epoch())
+          .count());
+  for (size_t idx = 0; idx < sizeof(uint64_t); ++idx) {
+    plaintext[sizeof(Key) + idx] = (issued >> (idx * 8)) & 0xff;
+  }
 
-  rawSocket.read(ciphertext.get(),
-                 dataLength + crypto_secretstream_xchacha20poly1305_ABYTES);
-  if (crypto_secretstream_xchacha20poly1305_pull(
-          &recvState, plaintext.data(), nullptr, nullptr, ciphertext.get(),
-          dataLength + crypto_secretstream_xchacha20poly1305_ABYTES, nullptr,
-          0)) {
+  // the client gets the secret and the sealed ticket
+  array<uint8_t, sizeof(Key) + SEALED_TICKET_SIZE> message;
+  copy(plaintext.begin(), plaintext.begin() + sizeof(Key), message.begin());
+  uint8_t *sealed = message.data() + sizeof(Key);
+  randombytes_buf(sealed, crypto_secretbox_NONCEBYTES);
+  crypto_secretbox_easy(sealed + crypto_secretbox_NONCEBYTES, plaintext.data(),
+                        plaintext.size(), sealed, ticketKey.data());
+  stageEncrypted(message);
+}
+
+void CryptoSocket::receiveTicket() {
+  array<uint8_t, sizeof(Key) + SEALED_TICKET_SIZE> message;
+  if (!receiveEncrypted(message)) {
     throw runtime_error("invalid message detected");
   }
+  copy(message.begin(), message.begin() + sizeof(Key), ticket.secret.begin());
+  copy(message.begin() + sizeof(Key), message.end(), ticket.sealed.begin());
+}
+
+optional<CryptoSocket::Key> CryptoSocket::openTicket(
+    TicketKey const &ticketKey,
+    array<uint8_t, SEALED_TICKET_SIZE> const &sealed) {
+  array<uint8_t, sizeof(Key) + sizeof(uint64_t)> plaintext;
+  if (crypto_secretbox_open_easy(
+          plaintext.data(), sealed.data() + crypto_secretbox_NONCEBYTES,
+          sealed.size() - crypto_secretbox_NONCEBYTES, sealed.data(),
+          ticketKey.data()) != 0) {
+    return nullopt;
+  }
+
+  uint64_t issued = 0;
+  for (size_t idx = 0; idx < sizeof(uint64_t); ++idx) {
+    issued |= static_cast<uint64_t>(plaintext[sizeof(Key) + idx]) << (idx * 8);
+  }
+  uint64_t now = static_cast<uint64_t>(
+      chrono::duration_cast<chrono::seconds>(
+          chrono::system_clock::now().time_since_epoch())
+          .count());
+  if (issued > now ||
+      now - issued >
+          static_cast<uint64_t>(
+              chrono::duration_cast<chrono::seconds>(TICKET_LIFETIME)
+                  .count())) {
+    return nullopt;
+  }
 
-  recvBuffer.emplace_back(move(plaintext));
+  Key secret;
+  copy(plaintext.begin(), plaintext.begin() + sizeof(Key), secret.begin());
+  return secret;
 }
 
-CryptoServer::CryptoServer(string const &password, stop_token const &stopFlag)
-    : rawServer(stopFlag), password(password) {}
+void CryptoSocket::stage(span<uint8_t const> bytes) {
+  sendBuffer.insert(sendBuffer.end(), bytes.begin(), bytes.end());
+}
+
+void CryptoSocket::stageEncrypted(span<uint8_t const> message) {
+  size_t offset = sendBuffer.size();
+  sendBuffer.resize(offset + message.size() +
+                    crypto_secretstream_xchacha20poly1305_ABYTES);
+  crypto_secretstream_xchacha20poly1305_push(
+      &sendState, sendBuffer.data() + offset, nullptr, message.data(),
+      message.size(), nullptr, 0, 0);
+}
+
+void CryptoSocket::sendStaged() {
+  rawSocket.write(sendBuffer.data(), sendBuffer.size());
+  sendBuffer.clear();
+}
+
+bool CryptoSocket::receiveEncrypted(span<uint8_t> message) {
+  size_t ciphertextSize =
+      message.size() + crypto_secretstream_xchacha20poly1305_ABYTES;
+  if (recvArena.size() < ciphertextSize) {
+    recvArena.resize(ciphertextSize);
+  }
+  rawSocket.read(recvArena.data(), ciphertextSize);
+  return crypto_secretstream_xchacha20poly1305_pull(
+             &recvState, message.data(), nullptr, nullptr, recvArena.data(),
+             ciphertextSize, nullptr, 0) == 0;
+}
+
+size_t CryptoSocket::frameHeaderSize() const noexcept {
+  return ((features & WIDE_FRAMES) != 0 ? sizeof(uint32_t)
+                                         : sizeof(uint16_t)) +
+         tagSize();
+}
+
+size_t CryptoSocket::tagSize() const noexcept {
+  return cleartext ? 0 : crypto_secretstream_xchacha20poly1305_ABYTES;
+}
+
+size_t CryptoSocket::frameLimit() const noexcept {
+  return (features & WIDE_FRAMES) != 0 ? WIDE_FRAME_LIMIT
+                                       : numeric_limits<uint16_t>::max();
+}
+
+size_t CryptoSocket::sendThreshold() const noexcept {
+  return framing == Framing::BULK ? frameLimit() : BUFFER_LIMIT;
+}
+
+void CryptoSocket::send() {
+  if (sendBuffer.empty()) {
+    return;
+  }
+
+  rawSocket.write(sendArena.data(), seal());
+  holding = framing == Framing::BULK;
+}
+
+Task<void> CryptoSocket::asyncSend() {
+  if (sendBuffer.empty()) {
+    co_return;
+  }
+
+  co_await rawSocket.asyncWrite(sendArena.data(), seal());
+  holding = framing == Framing::BULK;
+}
+
+void CryptoSocket::uncork() {
+  rawSocket.setCork(false);
+  rawSocket.setCork(true);
+  holding = false;
+}
+
+void CryptoSocket::pull() {
+  FrameHeader header;
+  rawSocket.read(header.data(), frameHeaderSize());
+  size_t ciphertextSize = openHeader(header);
+  rawSocket.read(frameBuffer(ciphertextSize), ciphertextSize);
+  openFrame(ciphertextSize);
+}
+
+Task<void> CryptoSocket::asyncPull() {
+  FrameHeader header;
+  co_await rawSocket.asyncRead(header.data(), frameHeaderSize());
+  size_t ciphertextSize = openHeader(header);
+  co_await rawSocket.asyncRead(frameBuffer(ciphertextSize), ciphertextSize);
+  openFrame(ciphertextSize);
+}
+
+size_t CryptoSocket::openHeader(FrameHeader const &header) {
+  array<uint8_t, sizeof(uint32_t)> plaintextHeader = {};
+  size_t headerSize = frameHeaderSize();
+  if (cleartext) {
+    copy(header.begin(), header.begin() + headerSize, plaintextHeader.begin());
+  } else {
+    Counters::Timer timer = rawSocket.getCounters().timeDecrypt();
+    if (crypto_secretstream_xchacha20poly1305_pull(
+            &recvState, plaintextHeader.data(), nullptr, nullptr,
+            header.data(), headerSize, nullptr, 0) != 0) {
+      throw runtime_error("invalid message detected");
+    }
+  }
+
+  // little endian, two or four bytes long
+  size_t dataLength = 0;
+  for (size_t idx = 0; idx != headerSize - tagSize(); ++idx) {
+    dataLength |= static_cast<size_t>(plaintextHeader[idx]) << (8 * idx);
+  }
+  if (dataLength > frameLimit()) {
+    throw runtime_error("frame too large");
+  }
+
+  size_t ciphertextSize = dataLength + tagSize();
+  if (!cleartext && recvArena.size() < ciphertextSize) {
+    recvArena.resize(ciphertextSize);
+  }
+  return ciphertextSize;
+}
+
+uint8_t *CryptoSocket::frameBuffer(size_t ciphertextSize) {
+  // cleartext frames are received straight onto the end of the received data
+  return cleartext ? recvBuffer.prepare(ciphertextSize).data()
+                   : recvArena.data();
+}
+
+void CryptoSocket::openFrame(size_t ciphertextSize) {
+  // decrypt straight onto the end of the received data
+  size_t dataLength = ciphertextSize - tagSize();
+  if (!cleartext) {
+    span<uint8_t> decrypted = recvBuffer.prepare(dataLength);
+    Counters::Timer timer = rawSocket.getCounters().timeDecrypt();
+    if (crypto_secretstream_xchacha20poly1305_pull(
+            &recvState, decrypted.data(), nullptr, nullptr, recvArena.data(),
+            ciphertextSize, nullptr, 0)) {
+      throw runtime_error("invalid message detected");
+    }
+  }
+  recvBuffer.commit(dataLength);
+
+  Counters &counters = rawSocket.getCounters();
+  counters.addFrameIn();
+  counters.noteBuffered(recvBuffer.size());
+}
+
+size_t CryptoSocket::seal(span<uint8_t const> extra) {
+  // encrypt every chunk into the arena so they all go out in one write
+  size_t limit = frameLimit();
+  size_t chunkCount = (sendBuffer.size() + limit - 1) / limit +
+                      (extra.size() + limit - 1) / limit;
+  size_t ciphertextSize = sendBuffer.size() + extra.size() +
+                          chunkCount * (frameHeaderSize() + tagSize());
+  if (sendArena.size() < ciphertextSize) {
+    sendArena.resize(ciphertextSize);
+  }
+
+  Counters::Timer timer = rawSocket.getCounters().timeEncrypt();
+  uint8_t *ciphertext = sealFrames(sendArena.data(), sendBuffer);
+  ciphertext = sealFrames(ciphertext, extra);
+
+  sendBuffer.clear();
+  return ciphertext - sendArena.data();
+}
+
+uint8_t *CryptoSocket::sealFrames(uint8_t *ciphertext,
+                                  span<uint8_t const> plaintext) {
+  size_t limit = frameLimit();
+  size_t headerSize = frameHeaderSize();
+  size_t lengthSize = headerSize - tagSize();
+  for (size_t sent = 0; sent != plaintext.size();) {
+    // calculate size of chunk to send
+    size_t sendSize = min(plaintext.size() - sent, limit);
+
+    // header - little endian, two or four bytes long
+    array<uint8_t, sizeof(uint32_t)> plaintextHeader;
+    for (size_t idx = 0; idx != lengthSize; ++idx) {
+      plaintextHeader[idx] = static_cast<uint8_t>(sendSize >> (8 * idx));
+    }
+    if (cleartext) {
+      // trusted - sent as is
+      copy(plaintextHeader.begin(), plaintextHeader.begin() + lengthSize,
+           ciphertext);
+      copy(plaintext.begin() + sent, plaintext.begin() + sent + sendSize,
+           ciphertext + headerSize);
+    } else {
+      crypto_secretstream_xchacha20poly1305_push(
+          &sendState, ciphertext, nullptr, plaintextHeader.data(), lengthSize,
+          nullptr, 0, 0);
+      crypto_secretstream_xchacha20poly1305_push(
+          &sendState, ciphertext + headerSize, nullptr,
+          plaintext.data() + sent, sendSize, nullptr, 0, 0);
+    }
+    ciphertext += headerSize + sendSize + tagSize();
+    sent += sendSize;
+    rawSocket.getCounters().addFrameOut();
+  }
+  return ciphertext;
+}
+
+struct CryptoServer::Pipeline {
+  /** stops the pipeline when the caller's stop token does */
+  struct Forward {
+    stop_source *stop;
+    void operator()() const noexcept { stop->request_stop(); }
+  };
+
+  Pipeline(string const &password, stop_token const &stopFlag,
+           uint8_t features, ServerOptions const &options)
+      : stopFlag(stopFlag),
+        stop(),
+        forward(stopFlag, Forward{&stop}),
+        stopEvent(stop.get_token()),
+        rawServer(stop.get_token(), options.listen),
+        masterKey(),
+        ticketKey(),
+        features(features),
+        options(options),
+        lock(),
+        changed(),
+        pending(),
+        results(),
+        finished(),
+        acceptor(),
+        workers() {
+    // derive the long-term key once; connections only need a fast hash
+    CryptoSocket::Salt salt;
+    randombytes_buf(salt.data(), salt.size());
+    masterKey = CryptoSocket::deriveMasterKey(password, salt);
+
+    crypto_secretbox_keygen(ticketKey.data());
+
+    acceptor = thread(acceptLoop, ref(*this));
+    for (size_t idx = 0; idx < options.handshakeWorkers; ++idx) {
+      workers.emplace_back(handshakeLoop, ref(*this));
+    }
+  }
+  Pipeline(Pipeline const &) noexcept = delete;
+  Pipeline(Pipeline &&) noexcept = delete;
+
+  ~Pipeline() noexcept {
+    stop.request_stop();
+    changed.notify_all();
+    acceptor.join();
+    for (thread &worker : workers) {
+      worker.join();
+    }
+  }
+
+  Pipeline &operator=(Pipeline const &) noexcept = delete;
+  Pipeline &operator=(Pipeline &&) noexcept = delete;
+
+  /** the caller's stop token, which finished connections use */
+  stop_token stopFlag;
+  /** stops the pipeline's threads and unfinished handshakes */
+  stop_source stop;
+  stop_callback<Forward> forward;
+  StopEvent stopEvent;
+
+  RawServer rawServer;
+  CryptoSocket::MasterKey masterKey;
+  /** seals tickets; new tickets are needed whenever the server restarts */
+  CryptoSocket::TicketKey ticketKey;
+  uint8_t features;
+  ServerOptions options;
+
+  mutex lock;
+  condition_variable_any changed;
+  /** connections waiting for a handshake */
+  deque<RawSocket> pending;
+  /** finished handshakes, or what they threw */
+  deque<variant<exception_ptr, CryptoSocket>> results;
+  /** notified whenever a result is added */
+  WakeEvent finished;
+
+  thread acceptor;
+  vector<thread> workers;
+};
+
+CryptoServer::CryptoServer(string const &password, stop_token const &stopFlag,
+                           uint8_t features, ServerOptions const &options)
+    : pipeline(make_unique<Pipeline>(password, stopFlag, features, options)) {}
+
+CryptoServer::CryptoServer(CryptoServer &&) noexcept = default;
+
+CryptoServer::~CryptoServer() noexcept = default;
+
+CryptoServer &CryptoServer::operator=(CryptoServer &&) noexcept = default;
 
 CryptoSocket CryptoServer::accept() {
-  return CryptoSocket(rawServer.accept(), password);
+  unique_lock<mutex> guard(pipeline->lock);
+  if (!pipeline->changed.wait(guard, pipeline->stop.get_token(), [this]() {
+        return !pipeline->results.empty();
+      })) {
+    throw pipeline->stopFlag;
+  }
+  return takeResult(guard);
+}
+
+Task<CryptoSocket> CryptoServer::asyncAccept() {
+  while (true) {
+    {
+      unique_lock<mutex> guard(pipeline->lock);
+      if (!pipeline->results.empty()) {
+        co_return takeResult(guard);
+      }
+    }
+
+    // cancel on this if need be
+    if (pipeline->stop.stop_requested()) {
+      throw pipeline->stopFlag;
+    }
+
+    // results added from now on will wake us
+    co_await pipeline->finished.wait(pipeline->stopEvent);
+    pipeline->finished.clear();
+  }
+}
+
+CryptoSocket CryptoServer::takeResult(unique_lock<mutex> &guard) {
+  variant<exception_ptr, CryptoSocket> result =
+      move(pipeline->results.front());
+  pipeline->results.pop_front();
+  guard.unlock();
+  pipeline->changed.notify_all();
+
+  if (holds_alternative<exception_ptr>(result)) {
+    rethrow_exception(get<exception_ptr>(result));
+  }
+  return move(get<CryptoSocket>(result));
+}
+
+void CryptoServer::acceptLoop(Pipeline &pipeline) {
+  stop_token stopFlag = pipeline.stop.get_token();
+  while (true) {
+    // leave connections in the OS's queue if ours is full
+    {
+      unique_lock<mutex> guard(pipeline.lock);
+      if (!pipeline.changed.wait(guard, stopFlag, [&pipeline]() {
+            return pipeline.pending.size() + pipeline.results.size() <
+                   pipeline.options.queueLength;
+          })) {
+        return;
+      }
+    }
+
+    try {
+      RawSocket rawSocket = pipeline.rawServer.accept();
+
+      lock_guard<mutex> guard(pipeline.lock);
+      pipeline.pending.push_back(move(rawSocket));
+    } catch (stop_token const &) {
+      return;
+    } catch (...) {
+      // let whoever is accepting see the error
+      lock_guard<mutex> guard(pipeline.lock);
+      pipeline.results.emplace_back(current_exception());
+      pipeline.finished.notify();
+    }
+    pipeline.changed.notify_all();
+  }
+}
+
+void CryptoServer::handshakeLoop(Pipeline &pipeline) {
+  stop_token stopFlag = pipeline.stop.get_token();
+  while (true) {
+    optional<RawSocket> rawSocket;
+    {
+      unique_lock<mutex> guard(pipeline.lock);
+      if (!pipeline.changed.wait(guard, stopFlag, [&pipeline]() {
+            return !pipeline.pending.empty();
+          })) {
+        return;
+      }
+      rawSocket.emplace(move(pipeline.pending.front()));
+      pipeline.pending.pop_front();
+    }
+
+    variant<exception_ptr, CryptoSocket> result;
+    try {
+      rawSocket->setDeadline(steady_clock::now() +
+                             pipeline.options.handshakeTimeout);
+      CryptoSocket socket =
+          CryptoSocket(move(*rawSocket), pipeline.masterKey,
+                       pipeline.ticketKey, pipeline.features);
+
+      // hand over to the caller
+      socket.rawSocket.clearDeadline();
+      socket.rawSocket.setStopFlag(pipeline.stopFlag);
+      result = move(socket);
+    } catch (stop_token const &) {
+      return;
+    } catch (...) {
+      result = current_exception();
+    }
+
+    {
+      lock_guard<mutex> guard(pipeline.lock);
+      pipeline.results.push_back(move(result));
+      pipeline.finished.notify();
+    }
+    pipeline.changed.notify_all();
+  }
+}
+
+struct Broadcaster::Pool {
+  /**
+   * Sending one message to some recipients
+   */
+  struct Job {
+    span<CryptoSocket *const> recipients;
+    span<uint8_t const> message;
+    /** ciphertext size for each recipient, or what sealing threw */
+    vector<size_t> sizes;
+    vector<exception_ptr> errors;
+  };
+
+  explicit Pool(size_t workers)
+      : lock(),
+        changed(),
+        stopping(false),
+        generation(0),
+        job(nullptr),
+        next(0),
+        busy(0),
+        threads() {
+    for (size_t idx = 0; idx < workers; ++idx) {
+      threads.emplace_back(workLoop, ref(*this));
+    }
+  }
+  Pool(Pool const &) noexcept = delete;
+  Pool(Pool &&) noexcept = delete;
+
+  ~Pool() noexcept {
+    {
+      scoped_lock guard(lock);
+      stopping = true;
+    }
+    changed.notify_all();
+    for (thread &worker : threads) {
+      worker.join();
+    }
+  }
+
+  Pool &operator=(Pool const &) noexcept = delete;
+  Pool &operator=(Pool &&) noexcept = delete;
+
+  mutex lock;
+  condition_variable changed;
+  bool stopping;
+  /** incremented for each job, so workers can tell a new one has started */
+  uint64_t generation;
+  Job *job;
+  /** index of the next recipient to encrypt for */
+  atomic<size_t> next;
+  /** workers still helping with the current job */
+  size_t busy;
+
+  vector<thread> threads;
+};
+
+Broadcaster::Broadcaster(size_t workers)
+    : pool(make_unique<Pool>(workers)) {}
+
+Broadcaster::Broadcaster(Broadcaster &&) noexcept = default;
+
+Broadcaster::~Broadcaster() noexcept = default;
+
+Broadcaster &Broadcaster::operator=(Broadcaster &&) noexcept = default;
+
+void Broadcaster::send(span<CryptoSocket *const> recipients,
+                       span<uint8_t const> message) {
+  Pool::Job job = {
+      .recipients = recipients,
+      .message = message,
+      .sizes = vector<size_t>(recipients.size()),
+      .errors = vector<exception_ptr>(recipients.size()),
+  };
+
+  // encrypt for every recipient, with the workers' help if there's enough
+  if (recipients.size() > 1 && !pool->threads.empty()) {
+    {
+      scoped_lock guard(pool->lock);
+      pool->job = &job;
+      pool->next = 0;
+      pool->busy = pool->threads.size();
+      ++pool->generation;
+    }
+    pool->changed.notify_all();
+    work(*pool);
+
+    unique_lock<mutex> guard(pool->lock);
+    pool->changed.wait(guard, [this]() { return pool->busy == 0; });
+    pool->job = nullptr;
+  } else {
+    pool->job = &job;
+    pool->next = 0;
+    work(*pool);
+    pool->job = nullptr;
+  }
+
+  // send to every recipient that was encrypted for at once
+  vector<RawSocket::Write> writes;
+  writes.reserve(recipients.size());
+  for (size_t idx = 0; idx < recipients.size(); ++idx) {
+    if (job.errors[idx] == nullptr) {
+      writes.push_back(RawSocket::Write{
+          .socket = &recipients[idx]->rawSocket,
+          .buf = recipients[idx]->sendArena.data(),
+          .count = job.sizes[idx],
+      });
+    }
+  }
+  exception_ptr error = nullptr;
+  try {
+    RawSocket::writeAll(writes);
+  } catch (...) {
+    error = current_exception();
+  }
+
+  // this is a flush, so nothing may be held back
+  for (size_t idx = 0; idx < recipients.size(); ++idx) {
+    if (job.errors[idx] != nullptr) {
+      if (error == nullptr) {
+        error = job.errors[idx];
+      }
+    } else if (recipients[idx]->framing == Framing::BULK) {
+      try {
+        recipients[idx]->uncork();
+      } catch (...) {
+        if (error == nullptr) {
+          error = current_exception();
+        }
+      }
+    }
+  }
+  if (error != nullptr) {
+    rethrow_exception(error);
+  }
+}
+
+void Broadcaster::work(Pool &pool) {
+  Pool::Job &job = *pool.job;
+  for (size_t idx = pool.next.fetch_add(1, memory_order_relaxed);
+       idx < job.recipients.size();
+       idx = pool.next.fetch_add(1, memory_order_relaxed)) {
+    try {
+      job.sizes[idx] = job.recipients[idx]->seal(job.message);
+    } catch (...) {
+      job.errors[idx] = current_exception();
+    }
+  }
+}
+
+void Broadcaster::workLoop(Pool &pool) {
+  uint64_t seen = 0;
+  while (true) {
+    {
+      unique_lock<mutex> guard(pool.lock);
+      pool.changed.wait(guard, [&pool, seen]() {
+        return pool.stopping || pool.generation != seen;
+      });
+      if (pool.stopping) {
+        return;
+      }
+      seen = pool.generation;
+    }
+
+    work(pool);
+
+    {
+      scoped_lock guard(pool.lock);
+      --pool.busy;
+    }
+    pool.changed.notify_all();
+  }
 }
 }  // namespace nplanetary::networking
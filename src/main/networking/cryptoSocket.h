@@ -23,26 +23,91 @@
 #include <sodium.h>
 
 #include <array>
+#include <chrono>
 #include <cstdint>
 #include <iterator>
-#include <list>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <stop_token>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "networking/rawSocket.h"
+#include "networking/recvBuffer.h"
 
 namespace nplanetary::networking {
 class PasswordMismatchFlag {};
 
+/**
+ * How a CryptoSocket groups what it sends into frames and TCP segments
+ */
+enum class Framing : uint8_t {
+  /** small frames, sent whenever a few KiB are queued */
+  BATCHED,
+  /**
+   * the largest frames negotiated, held back with TCP_CORK until flushed;
+   * for bulk state
+   */
+  BULK,
+  /**
+   * Nagle's algorithm is off, so a flush goes out at once; for small,
+   * latency-sensitive messages
+   */
+  IMMEDIATE,
+};
+
 class CryptoServer;
+class Broadcaster;
 class CryptoSocket {
   friend class CryptoServer;
+  friend class Broadcaster;
 
  public:
+  /** integers may be sent as variable length and delta encoded values */
+  static constexpr uint8_t COMPACT_INTEGERS = 0x01;
+  /** frames have a 32 bit length, so may be larger than 64 KiB */
+  static constexpr uint8_t WIDE_FRAMES = 0x02;
+  static constexpr uint8_t ALL_FEATURES = COMPACT_INTEGERS | WIDE_FRAMES;
+
+  using Key =
+      std::array<uint8_t, crypto_secretstream_xchacha20poly1305_KEYBYTES>;
+
+  static constexpr size_t SEALED_TICKET_SIZE =
+      crypto_secretbox_NONCEBYTES + crypto_secretbox_MACBYTES +
+      crypto_secretstream_xchacha20poly1305_KEYBYTES + sizeof(uint64_t);
+
+  /**
+   * Lets a client resume a session without the password's key derivation or
+   * the full handshake
+   */
+  struct Ticket {
+    /** secret both sides derive the resumed session's keys from */
+    Key secret;
+    /** the secret and when it was issued, readable only by the server */
+    std::array<uint8_t, SEALED_TICKET_SIZE> sealed;
+  };
+
+  /**
+   * Connects to a server, offering the given optional features
+   *
+   * In-process connections to a server that trusts them skip the handshake
+   * and encryption, and ignore the password
+   */
   CryptoSocket(std::string const &hostname, std::string const &password,
-               std::stop_token const &stopFlag);
+               std::stop_token const &stopFlag,
+               uint8_t features = ALL_FEATURES);
+  /**
+   * Reconnects to a server using a ticket from an earlier connection to it
+   *
+   * Falls back to a full handshake with the password if the server rejects
+   * the ticket
+   */
+  CryptoSocket(std::string const &hostname, Ticket const &ticket,
+               std::string const &password, std::stop_token const &stopFlag,
+               uint8_t features = ALL_FEATURES);
   CryptoSocket(CryptoSocket const &) noexcept = delete;
   CryptoSocket(CryptoSocket &&) noexcept = default;
 
@@ -52,45 +117,512 @@ class CryptoSocket {
   CryptoSocket &operator=(CryptoSocket &&) noexcept = default;
 
   void read(uint8_t *, size_t n);
+  /**
+   * Get at least n contiguous received bytes without consuming them
+   *
+   * The span is valid until the next read, peek, or consume
+   */
+  std::span<uint8_t const> peek(size_t n);
+  /**
+   * Discards n received bytes
+   */
+  void consume(size_t n);
+  /**
+   * Promises that at least n more bytes are about to be read, so asyncDecode
+   * can wait for all of them before running decode again
+   */
+  void expect(size_t n) noexcept;
   void write(uint8_t const *, size_t n);
   void flush();
 
- private:
-  CryptoSocket(RawSocket rawSocket, std::string const &password);
+  /**
+   * Sets how everything sent from now on is framed
+   */
+  void setFraming(Framing framing);
+  Framing getFraming() const noexcept;
+  /**
+   * Runs build, which queues one message with write, under some framing, then
+   * flushes it and goes back to the previous framing
+   */
+  template <typename F>
+  void message(Framing framing, F build);
+  /**
+   * Runs encode, which queues bytes with write, then takes back and returns
+   * what it queued instead of sending it
+   */
+  template <typename F>
+  std::vector<uint8_t> capture(F encode);
 
-  void pull();
+  /**
+   * Reads n bytes, letting other tasks run while waiting
+   *
+   * Must be awaited by a task running on an Executor, as must every other
+   * async function
+   */
+  Task<void> asyncRead(uint8_t *buf, size_t n);
+  /**
+   * Queues n bytes to send, flushing if enough are queued
+   */
+  Task<void> asyncWrite(uint8_t const *buf, size_t n);
+  Task<void> asyncFlush();
+  /**
+   * Runs decode against the bytes received so far
+   *
+   * decode reads with read, peek, and consume. If it needs bytes that haven't
+   * arrived, everything it consumed is put back and it runs again once the
+   * read that stopped it (or everything promised with expect) can complete,
+   * so it must not change anything until it has read all it needs
+   */
+  template <typename F>
+  Task<void> asyncDecode(F decode);
+  /**
+   * Runs encode, which queues bytes with write, then flushes if enough are
+   * queued
+   */
+  template <typename F>
+  Task<void> asyncEncode(F encode);
+
+  /**
+   * Optional features that both sides offered during the handshake
+   */
+  uint8_t getFeatures() const noexcept;
+  /**
+   * Ticket the server issued for resuming this session; clients only
+   */
+  Ticket const &getTicket() const noexcept;
+  /**
+   * What this connection has done so far; zero unless NPLANETARY_STATS is
+   * defined
+   */
+  Stats getStats() const noexcept;
 
+ private:
   static constexpr uint16_t BUFFER_LIMIT = 4096;
+  /** largest frame sent or accepted if frames are wide */
+  static constexpr size_t WIDE_FRAME_LIMIT = 1 << 20;
   static constexpr size_t VERIFICATION_PACKET_SIZE = 32;
+  static constexpr size_t NONCE_SIZE = 32;
+  static constexpr uint8_t CLIENT_TO_SERVER = 0;
+  static constexpr uint8_t SERVER_TO_CLIENT = 1;
+  static constexpr uint8_t FULL_MODE = 0;
+  static constexpr uint8_t RESUME_MODE = 1;
+  static constexpr uint8_t TICKET_REJECTED = 0;
+  static constexpr uint8_t TICKET_ACCEPTED = 1;
+  static constexpr std::chrono::hours TICKET_LIFETIME = std::chrono::hours(24);
+
+  using Salt =
+      std::array<uint8_t, crypto_pwhash_scryptsalsa208sha256_SALTBYTES>;
+  using Nonce = std::array<uint8_t, NONCE_SIZE>;
+  using Verify = std::array<uint8_t, VERIFICATION_PACKET_SIZE>;
+  using TicketKey = std::array<uint8_t, crypto_secretbox_KEYBYTES>;
+  /** a frame's encrypted length, in its first frameHeaderSize() bytes */
+  using FrameHeader =
+      std::array<uint8_t, sizeof(uint32_t) +
+                              crypto_secretstream_xchacha20poly1305_ABYTES>;
+
+  /**
+   * Thrown by reads during asyncDecode when not enough bytes have arrived
+   */
+  class IncompleteFlag {};
+
+  /**
+   * A key derived from the password with scrypt, and the salt used
+   *
+   * The server derives one when created; clients derive it from the salt the
+   * server sends
+   */
+  struct MasterKey {
+    Salt salt;
+    Key key;
+  };
+
+  /**
+   * Client side of the handshake, resuming with the ticket if given
+   */
+  CryptoSocket(RawSocket rawSocket, Ticket const *ticket,
+               std::string const &password, uint8_t features);
+  /**
+   * Server side of the handshake
+   */
+  CryptoSocket(RawSocket rawSocket, MasterKey const &masterKey,
+               TicketKey const &ticketKey, uint8_t features);
+
+  /**
+   * Runs scrypt over the password
+   */
+  static MasterKey deriveMasterKey(std::string const &password,
+                                   Salt const &salt);
+  /**
+   * Gets the master key for a server's salt, reusing the last one derived if
+   * the server and password are the same
+   */
+  static MasterKey clientMasterKey(std::string const &password,
+                                   Salt const &salt);
+  /**
+   * Derives the key for one direction of a connection from a shared secret
+   * and both sides' nonces
+   */
+  static Key deriveSessionKey(Key const &secret, uint8_t direction,
+                              Nonce const &clientNonce,
+                              Nonce const &serverNonce);
+
+  /**
+   * Tries to resume a session with a ticket
+   *
+   * @returns false if the server rejected the ticket
+   */
+  bool resumeClient(Ticket const &ticket, Nonce const &serverNonce);
+  /**
+   * Runs a full handshake with keys derived from the password
+   */
+  void fullClient(std::string const &password, Salt const &salt,
+                  Nonce const &serverNonce, bool sendMode);
+  /**
+   * Resumes a session if the client's ticket is valid
+   *
+   * @returns false if the ticket was rejected
+   */
+  bool resumeServer(TicketKey const &ticketKey, Nonce const &serverNonce);
+  void fullServer(MasterKey const &masterKey, TicketKey const &ticketKey,
+                  Nonce const &serverNonce);
+
+  /**
+   * Starts the send stream, staging its header and a random test packet
+   *
+   * @returns the test packet
+   */
+  Verify startSending(Key const &sendKey);
+  /**
+   * Reads the other side's header and test packet, starting the receive stream
+   *
+   * @returns the other side's test packet
+   */
+  Verify startReceiving(Key const &recvKey);
+  /**
+   * Reads the features the other side offered, keeping only shared ones
+   */
+  void receiveFeatures();
+  /**
+   * Swaps features in the clear instead of a handshake, for trusted
+   * connections
+   */
+  void trust();
+  /**
+   * Stages a fresh ticket for the client
+   */
+  void stageTicket(TicketKey const &ticketKey);
+  void receiveTicket();
+  /**
+   * Gets the secret from a sealed ticket, unless it's forged or expired
+   */
+  static std::optional<Key> openTicket(
+      TicketKey const &ticketKey,
+      std::array<uint8_t, SEALED_TICKET_SIZE> const &sealed);
+
+  /**
+   * Queues bytes to send in the clear during the handshake
+   */
+  void stage(std::span<uint8_t const> bytes);
+  /**
+   * Queues an encrypted message to send during the handshake
+   */
+  void stageEncrypted(std::span<uint8_t const> message);
+  /**
+   * Sends everything staged in one write
+   */
+  void sendStaged();
+  /**
+   * Reads a message sent with stageEncrypted
+   *
+   * @returns false if the message could not be decrypted
+   */
+  bool receiveEncrypted(std::span<uint8_t> message);
+
+  /**
+   * Size of the encrypted header of every frame
+   */
+  size_t frameHeaderSize() const noexcept;
+  /**
+   * Size of the authentication tag after each part of a frame
+   */
+  size_t tagSize() const noexcept;
+  /**
+   * Largest frame that may be sent or received
+   */
+  size_t frameLimit() const noexcept;
+  /**
+   * How many queued bytes are sent without waiting for a flush
+   */
+  size_t sendThreshold() const noexcept;
+
+  /**
+   * Encrypts and writes everything queued, without pushing out anything held
+   * back by TCP_CORK
+   */
+  void send();
+  Task<void> asyncSend();
+  /**
+   * Pushes out anything held back by TCP_CORK
+   */
+  void uncork();
+
+  /**
+   * Receives and decrypts a frame
+   */
+  void pull();
+  Task<void> asyncPull();
+  /**
+   * Decrypts a frame's header, making room to receive the rest of the frame
+   *
+   * @returns size of the rest of the frame
+   */
+  size_t openHeader(FrameHeader const &header);
+  /**
+   * Where to receive the rest of a frame into
+   */
+  uint8_t *frameBuffer(size_t ciphertextSize);
+  /**
+   * Decrypts the rest of a frame onto the end of the received data
+   */
+  void openFrame(size_t ciphertextSize);
+  /**
+   * Encrypts everything queued, then extra, into the send arena
+   *
+   * @returns size of the ciphertext
+   */
+  size_t seal(std::span<uint8_t const> extra = std::span<uint8_t const>());
+  /**
+   * Encrypts plaintext as frames starting at ciphertext
+   *
+   * @returns the end of the frames
+   */
+  uint8_t *sealFrames(uint8_t *ciphertext, std::span<uint8_t const> plaintext);
 
   RawSocket rawSocket;
 
+  uint8_t features;
+  Ticket ticket;
+  /** frames are sent in the clear, for trusted connections */
+  bool cleartext;
+
   crypto_secretstream_xchacha20poly1305_state sendState;
   crypto_secretstream_xchacha20poly1305_state recvState;
 
-  /** list of chunks of decrypted data received */
-  std::list<std::vector<uint8_t>> recvBuffer;
+  /** decrypted data received */
+  RecvBuffer recvBuffer;
+  /** reused space for the ciphertext of a frame; only ever grows */
+  std::vector<uint8_t> recvArena;
   /** vector of data to be encrypted and sent */
   std::vector<uint8_t> sendBuffer;
+  /** reused space for the ciphertext of a flush; only ever grows */
+  std::vector<uint8_t> sendArena;
+
+  /** reads are only tentative, during asyncDecode */
+  bool speculating;
+  /** bytes tentatively consumed */
+  size_t speculated;
+  /** bytes an interrupted decode needs buffered before it can get further */
+  size_t needed;
+  /** writes never flush, during asyncEncode */
+  bool deferringFlush;
+  Framing framing;
+  /** bytes were sent since the last uncork, and TCP_CORK may hold them back */
+  bool holding;
+};
+
+template <typename F>
+Task<void> CryptoSocket::asyncDecode(F decode) {
+  while (true) {
+    speculating = true;
+    speculated = 0;
+    needed = 0;
+    bool complete = true;
+    try {
+      decode();
+    } catch (IncompleteFlag const &) {
+      complete = false;
+    } catch (...) {
+      speculating = false;
+      throw;
+    }
+    speculating = false;
+
+    if (complete) {
+      recvBuffer.consume(speculated);
+      co_return;
+    }
+    // put everything back and try again once it can get further, instead of
+    // decoding everything again every frame
+    do {
+      co_await asyncPull();
+    } while (recvBuffer.size() < needed);
+  }
+}
+
+template <typename F>
+Task<void> CryptoSocket::asyncEncode(F encode) {
+  deferringFlush = true;
+  try {
+    encode();
+  } catch (...) {
+    deferringFlush = false;
+    throw;
+  }
+  deferringFlush = false;
+
+  if (sendBuffer.size() >= sendThreshold()) {
+    co_await asyncSend();
+  }
+}
+
+template <typename F>
+void CryptoSocket::message(Framing framing, F build) {
+  Framing previous = this->framing;
+  setFraming(framing);
+  try {
+    build();
+    flush();
+  } catch (...) {
+    setFraming(previous);
+    throw;
+  }
+  setFraming(previous);
+}
+
+template <typename F>
+std::vector<uint8_t> CryptoSocket::capture(F encode) {
+  size_t start = sendBuffer.size();
+  deferringFlush = true;
+  try {
+    encode();
+  } catch (...) {
+    deferringFlush = false;
+    sendBuffer.resize(start);
+    throw;
+  }
+  deferringFlush = false;
+
+  std::vector<uint8_t> captured =
+      std::vector<uint8_t>(sendBuffer.begin() + start, sendBuffer.end());
+  sendBuffer.resize(start);
+  return captured;
+}
+
+/**
+ * How a server accepts connections
+ */
+struct ServerOptions {
+  /**
+   * where to listen; in-process clients of a server that trusts them skip
+   * the handshake and encryption
+   */
+  ListenOptions listen = ListenOptions();
+  /** handshakes run at once */
+  size_t handshakeWorkers = 4;
+  /** handshakes that take longer than this are abandoned */
+  std::chrono::milliseconds handshakeTimeout = std::chrono::seconds(10);
+  /** connections waiting for a handshake, or waiting to be accepted */
+  size_t queueLength = 64;
 };
 
 class CryptoServer {
  public:
-  CryptoServer(std::string const &password, std::stop_token const &stopFlag);
+  /**
+   * Creates a server, offering the given optional features to clients
+   *
+   * Connections are accepted and their handshakes run in the background as
+   * soon as the server is created
+   */
+  CryptoServer(std::string const &password, std::stop_token const &stopFlag,
+               uint8_t features = CryptoSocket::ALL_FEATURES,
+               ServerOptions const &options = ServerOptions());
   CryptoServer(CryptoServer const &) noexcept = delete;
-  CryptoServer(CryptoServer &&) noexcept = default;
+  CryptoServer(CryptoServer &&) noexcept;
 
-  ~CryptoServer() noexcept = default;
+  ~CryptoServer() noexcept;
 
   CryptoServer &operator=(CryptoServer const &) noexcept = delete;
-  CryptoServer &operator=(CryptoServer &&) noexcept = default;
+  CryptoServer &operator=(CryptoServer &&) noexcept;
 
+  /**
+   * Gets the next connection to finish its handshake
+   *
+   * Rethrows whatever a failed handshake threw, such as PasswordMismatchFlag
+   * or TimeoutFlag
+   */
   CryptoSocket accept();
+  /**
+   * Gets the next connection to finish its handshake, letting other tasks run
+   * while waiting
+   *
+   * Must be awaited by a task running on an Executor
+   */
+  Task<CryptoSocket> asyncAccept();
 
  private:
-  RawServer rawServer;
+  struct Pipeline;
+
+  /**
+   * Accepts connections until stopped, queueing them for handshakes
+   */
+  static void acceptLoop(Pipeline &pipeline);
+  /**
+   * Runs queued handshakes until stopped
+   */
+  static void handshakeLoop(Pipeline &pipeline);
+  /**
+   * Takes the oldest result, rethrowing it if the handshake failed
+   */
+  CryptoSocket takeResult(std::unique_lock<std::mutex> &guard);
+
+  std::unique_ptr<Pipeline> pipeline;
+};
+
+/**
+ * Sends one message to many sockets, encrypting it for each of them on a
+ * pool of threads
+ *
+ * Every socket has its own stream state, so a message sent to n sockets must
+ * be encrypted n times; this spreads that work over the pool instead of doing
+ * it all on the sending thread
+ */
+class Broadcaster {
+ public:
+  /**
+   * Creates a pool of worker threads, which help the sending thread encrypt
+   */
+  explicit Broadcaster(size_t workers = std::thread::hardware_concurrency());
+  Broadcaster(Broadcaster const &) noexcept = delete;
+  Broadcaster(Broadcaster &&) noexcept;
+
+  ~Broadcaster() noexcept;
+
+  Broadcaster &operator=(Broadcaster const &) noexcept = delete;
+  Broadcaster &operator=(Broadcaster &&) noexcept;
+
+  /**
+   * Sends message to every recipient, after anything already queued for it,
+   * and flushes them
+   *
+   * No other thread may use the recipients until this returns. Rethrows the
+   * first error once every recipient has been sent to or has failed
+   */
+  void send(std::span<CryptoSocket *const> recipients,
+            std::span<uint8_t const> message);
+
+ private:
+  struct Pool;
+
+  /**
+   * Encrypts for the current job's recipients until there are none left
+   */
+  static void work(Pool &pool);
+  /**
+   * Waits for jobs until stopped, helping with each
+   */
+  static void workLoop(Pool &pool);
 
-  std::string password;
+  std::unique_ptr<Pool> pool;
 };
 }  // namespace nplanetary::networking
 
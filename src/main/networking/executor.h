@@ -0,0 +1,211 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_NETWORKING_EXECUTOR_H_
+#define NPLANETARY_NETWORKING_EXECUTOR_H_
+
+#if defined(__linux__)
+#else
+#error "OS not recognized/supported"
+#endif
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <stop_token>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "networking/rawSocket.h"
+#include "networking/task.h"
+
+namespace nplanetary::networking {
+/**
+ * A single threaded event loop that runs tasks, resuming them whenever the
+ * socket they are waiting on is ready
+ *
+ * Lets one thread serve any number of connections, each with its own task
+ * written as if it were blocking; run one executor per thread for a small
+ * pool. Tasks must only be resumed by the executor they started on
+ */
+class Executor {
+ public:
+  /**
+   * Suspends a task until an fd has some events, or a stop event fires
+   */
+  class Wait {
+    friend class Executor;
+
+   public:
+    Wait(int fd, uint32_t events, StopEvent const &stopEvent) noexcept;
+    Wait(Wait const &) noexcept = delete;
+    Wait(Wait &&) noexcept = delete;
+
+    ~Wait() noexcept;
+
+    Wait &operator=(Wait const &) noexcept = delete;
+    Wait &operator=(Wait &&) noexcept = delete;
+
+    bool await_ready() const noexcept;
+    /**
+     * Registers with the executor running this thread's tasks
+     */
+    void await_suspend(std::coroutine_handle<> handle);
+    /**
+     * @returns the epoll events that happened to the fd, or zero if only the
+     * stop event fired
+     */
+    uint32_t await_resume() const noexcept;
+
+   private:
+    int fd;
+    uint32_t events;
+    int stopFD;
+
+    /** executor this is registered with, if any */
+    Executor *executor;
+    std::coroutine_handle<> handle;
+    uint32_t revents;
+  };
+
+  explicit Executor(std::stop_token const &stopFlag);
+  Executor(Executor const &) noexcept = delete;
+  Executor(Executor &&) noexcept = delete;
+
+  /**
+   * Destroys any tasks still running
+   */
+  ~Executor() noexcept;
+
+  Executor &operator=(Executor const &) noexcept = delete;
+  Executor &operator=(Executor &&) noexcept = delete;
+
+  /**
+   * Starts running a task on this executor during the next poll
+   *
+   * The task is destroyed once it finishes. A task ending with a HangupFlag or
+   * a stop token is assumed to have finished normally; anything else it
+   * throws is rethrown from poll
+   */
+  void spawn(Task<void> task);
+
+  /**
+   * Runs this executor until the task finishes
+   *
+   * @returns the task's result
+   */
+  template <typename T>
+  T run(Task<T> task);
+  /**
+   * Waits for events and resumes tasks until stopped
+   */
+  [[noreturn]] void run();
+  /**
+   * Resumes every task that is ready, waiting for one batch of events first
+   * if none are
+   */
+  void poll();
+
+ private:
+  struct Detached;
+
+  static constexpr int MAX_EVENTS = 64;
+
+  /**
+   * Owns a spawned task until it finishes
+   */
+  static Detached detach(Executor &executor, Task<void> task);
+
+  void add(Wait &wait);
+  void remove(Wait &wait);
+  /**
+   * Updates which events epoll reports for fd, after a wait is added to or
+   * removed from it
+   */
+  void watch(int fd, bool added);
+  void resumeReady();
+
+  int fd;
+  std::stop_token stopFlag;
+  StopEvent stopEvent;
+
+  /** tasks waiting on each fd */
+  std::unordered_map<int, std::vector<Wait *>> waits;
+  /** tasks to resume during the next poll */
+  std::vector<std::coroutine_handle<>> ready;
+  /** frames of spawned tasks that haven't finished yet */
+  std::unordered_set<void *> spawned;
+  /** first unexpected exception thrown by a spawned task */
+  std::exception_ptr error;
+};
+
+/**
+ * An eventfd other threads can use to wake up a task
+ */
+class WakeEvent {
+ public:
+  WakeEvent();
+  WakeEvent(WakeEvent const &) noexcept = delete;
+  WakeEvent(WakeEvent &&) noexcept = delete;
+
+  ~WakeEvent() noexcept;
+
+  WakeEvent &operator=(WakeEvent const &) noexcept = delete;
+  WakeEvent &operator=(WakeEvent &&) noexcept = delete;
+
+  /**
+   * Wakes up the waiting task, or the next one to wait if none is
+   */
+  void notify() noexcept;
+  /**
+   * Suspends the calling task until notified or stopEvent fires
+   */
+  Executor::Wait wait(StopEvent const &stopEvent) const noexcept;
+  /**
+   * Blocks the calling thread until notified or stopEvent fires
+   *
+   * @throws TimeoutFlag if the deadline passes first
+   */
+  void sleep(
+      StopEvent const &stopEvent,
+      std::optional<std::chrono::steady_clock::time_point> const &deadline =
+          std::nullopt) const;
+  /**
+   * Forgets any notifications since the last clear
+   */
+  void clear() noexcept;
+
+ private:
+  int fd;
+};
+
+template <typename T>
+T Executor::run(Task<T> task) {
+  ready.push_back(task.handle);
+  while (!task.handle.done()) {
+    poll();
+  }
+  return task.handle.promise().result();
+}
+}  // namespace nplanetary::networking
+
+#endif  // NPLANETARY_NETWORKING_EXECUTOR_H_
@@ -0,0 +1,319 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#if defined(__linux__)
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "networking/executor.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace nplanetary::networking {
+namespace {
+/** executor resuming tasks on this thread, if any */
+thread_local Executor *current = nullptr;
+}  // namespace
+
+struct Executor::Detached {
+  struct promise_type {
+    promise_type(Executor &executor, Task<void> const &) : executor(executor) {
+      executor.spawned.insert(
+          coroutine_handle<promise_type>::from_promise(*this).address());
+    }
+    promise_type(promise_type const &) noexcept = delete;
+    promise_type(promise_type &&) noexcept = delete;
+
+    ~promise_type() noexcept {
+      executor.spawned.erase(
+          coroutine_handle<promise_type>::from_promise(*this).address());
+    }
+
+    promise_type &operator=(promise_type const &) noexcept = delete;
+    promise_type &operator=(promise_type &&) noexcept = delete;
+
+    Detached get_return_object() noexcept {
+      return Detached{coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    suspend_always initial_suspend() const noexcept { return {}; }
+    suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() noexcept {
+      if (executor.error == nullptr) {
+        executor.error = current_exception();
+      }
+    }
+
+    Executor &executor;
+  };
+
+  coroutine_handle<promise_type> handle;
+};
+
+Executor::Wait::Wait(int fd, uint32_t events,
+                     StopEvent const &stopEvent) noexcept
+    : fd(fd),
+      events(events),
+      stopFD(stopEvent.getFD()),
+      executor(nullptr),
+      handle(),
+      revents(0) {}
+
+Executor::Wait::~Wait() noexcept {
+  if (executor != nullptr) {
+    // task destroyed while suspended
+    executor->remove(*this);
+  }
+}
+
+bool Executor::Wait::await_ready() const noexcept { return false; }
+
+void Executor::Wait::await_suspend(coroutine_handle<> handle) {
+  if (current == nullptr) {
+    throw logic_error("task awaited a socket outside of an executor");
+  }
+  this->handle = handle;
+  current->add(*this);
+}
+
+uint32_t Executor::Wait::await_resume() const noexcept { return revents; }
+
+Executor::Executor(stop_token const &stopFlag)
+    : fd(epoll_create1(EPOLL_CLOEXEC)),
+      stopFlag(stopFlag),
+      stopEvent(stopFlag),
+      waits(),
+      ready(),
+      spawned(),
+      error() {
+  if (fd == -1) {
+    fd = 0;
+    throw runtime_error("could not create epoll instance: "s +
+                        strerror(errno));
+  }
+
+  // wake up when stopped
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = stopEvent.getFD();
+  if (epoll_ctl(fd, EPOLL_CTL_ADD, stopEvent.getFD(), &event) != 0) {
+    close(fd);
+    throw runtime_error("could not watch stop event: "s + strerror(errno));
+  }
+}
+
+Executor::~Executor() noexcept {
+  // destroying a task removes it from spawned
+  vector<void *> unfinished = vector<void *>(spawned.begin(), spawned.end());
+  for (void *frame : unfinished) {
+    coroutine_handle<>::from_address(frame).destroy();
+  }
+
+  if (fd != 0) {
+    close(fd);
+  }
+}
+
+void Executor::spawn(Task<void> task) {
+  ready.push_back(detach(*this, move(task)).handle);
+}
+
+void Executor::run() {
+  while (true) {
+    poll();
+  }
+}
+
+void Executor::poll() {
+  // cancel on this if need be
+  if (stopFlag.stop_requested()) {
+    throw stopFlag;
+  }
+
+  // don't sleep if there's already something to do
+  array<struct epoll_event, MAX_EVENTS> events;
+  int count = epoll_wait(fd, events.data(), events.size(),
+                         ready.empty() ? -1 : 0);
+  if (count == -1) {
+    if (errno != EINTR) {
+      throw runtime_error("could not wait for events: "s + strerror(errno));
+    }
+    // interrupted by signal; still resume anything ready
+    count = 0;
+  }
+
+  for (int idx = 0; idx < count; ++idx) {
+    auto found = waits.find(events[idx].data.fd);
+    if (found == waits.end()) {
+      // the executor's own stop event
+      continue;
+    }
+
+    // waking a task removes it from the list
+    vector<Wait *> waiting = found->second;
+    for (Wait *wait : waiting) {
+      uint32_t wanted = events[idx].data.fd == wait->fd
+                            ? wait->events | EPOLLERR | EPOLLHUP
+                            : EPOLLIN;
+      if ((events[idx].events & wanted) != 0) {
+        wait->revents =
+            events[idx].data.fd == wait->fd ? events[idx].events : 0;
+        ready.push_back(wait->handle);
+        remove(*wait);
+      }
+    }
+  }
+
+  resumeReady();
+
+  if (stopFlag.stop_requested()) {
+    throw stopFlag;
+  }
+}
+
+Executor::Detached Executor::detach(Executor &, Task<void> task) {
+  try {
+    co_await task;
+  } catch (HangupFlag const &) {
+    // peer left
+  } catch (stop_token const &) {
+    // cancelled
+  }
+}
+
+void Executor::add(Wait &wait) {
+  waits[wait.fd].push_back(&wait);
+  try {
+    watch(wait.fd, true);
+  } catch (...) {
+    waits[wait.fd].pop_back();
+    watch(wait.fd, false);
+    throw;
+  }
+  waits[wait.stopFD].push_back(&wait);
+  watch(wait.stopFD, true);
+  wait.executor = this;
+}
+
+void Executor::remove(Wait &wait) {
+  for (int waitFD : {wait.fd, wait.stopFD}) {
+    vector<Wait *> &waiting = waits[waitFD];
+    waiting.erase(find(waiting.begin(), waiting.end(), &wait));
+    watch(waitFD, false);
+  }
+  wait.executor = nullptr;
+}
+
+void Executor::watch(int watchFD, bool added) {
+  auto found = waits.find(watchFD);
+  if (found->second.empty()) {
+    epoll_ctl(fd, EPOLL_CTL_DEL, watchFD, nullptr);
+    waits.erase(found);
+    return;
+  }
+
+  struct epoll_event event = {};
+  event.data.fd = watchFD;
+  for (Wait const *wait : found->second) {
+    event.events |= wait->fd == watchFD ? wait->events : EPOLLIN;
+  }
+  int op =
+      added && found->second.size() == 1 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+  if (epoll_ctl(fd, op, watchFD, &event) != 0) {
+    throw runtime_error("could not watch fd: "s + strerror(errno));
+  }
+}
+
+void Executor::resumeReady() {
+  Executor *previous = exchange(current, this);
+  while (!ready.empty()) {
+    // tasks resumed now might make others ready
+    vector<coroutine_handle<>> resuming = move(ready);
+    ready.clear();
+    for (coroutine_handle<> handle : resuming) {
+      handle.resume();
+    }
+  }
+  current = previous;
+
+  if (error != nullptr) {
+    rethrow_exception(exchange(error, nullptr));
+  }
+}
+
+WakeEvent::WakeEvent() : fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+  if (fd == -1) {
+    throw runtime_error("could not create eventfd: "s + strerror(errno));
+  }
+}
+
+WakeEvent::~WakeEvent() noexcept { close(fd); }
+
+void WakeEvent::notify() noexcept { eventfd_write(fd, 1); }
+
+Executor::Wait WakeEvent::wait(StopEvent const &stopEvent) const noexcept {
+  return Executor::Wait(fd, EPOLLIN, stopEvent);
+}
+
+void WakeEvent::sleep(
+    StopEvent const &stopEvent,
+    optional<steady_clock::time_point> const &deadline) const {
+  array<struct pollfd, 2> polled = {{
+      {.fd = fd, .events = POLLIN, .revents = 0},
+      {.fd = stopEvent.getFD(), .events = POLLIN, .revents = 0},
+  }};
+  while (true) {
+    int timeout = -1;
+    if (deadline.has_value()) {
+      auto remaining = ceil<milliseconds>(*deadline - steady_clock::now());
+      if (remaining.count() <= 0) {
+        throw TimeoutFlag();
+      }
+      timeout = static_cast<int>(min<milliseconds::rep>(
+          remaining.count(), numeric_limits<int>::max()));
+    }
+
+    int retval = ::poll(polled.data(), polled.size(), timeout);
+    if (retval > 0) {
+      return;
+    } else if (retval == -1 && errno != EINTR) {
+      throw runtime_error("could not wait for event: "s + strerror(errno));
+    }
+    // timed out or interrupted - check the deadline again
+  }
+}
+
+void WakeEvent::clear() noexcept {
+  eventfd_t count;
+  eventfd_read(fd, &count);
+}
+}  // namespace nplanetary::networking
+
+#endif
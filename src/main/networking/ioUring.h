@@ -0,0 +1,212 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_NETWORKING_IOURING_H_
+#define NPLANETARY_NETWORKING_IOURING_H_
+
+#if defined(__linux__)
+#else
+#error "OS not recognized/supported"
+#endif
+
+#if defined(NPLANETARY_IO_URING)
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <unordered_map>
+
+#include "networking/rawSocket.h"
+
+namespace nplanetary::networking {
+/**
+ * A minimal io_uring instance used as the RawSocket/RawServer backend
+ *
+ * Each operation is one io_uring_enter that both submits the request and
+ * waits for it, paired with a poll on the caller's stop event so blocked
+ * operations can be cancelled. Small reads go through a registered buffer
+ */
+class IoUring {
+ public:
+  /**
+   * A write to one of many sockets, submitted together
+   */
+  struct Write {
+    int fd;
+    uint8_t const *buf;
+    size_t count;
+    StopEvent const *stopEvent;
+    std::stop_token const *stopFlag;
+  };
+
+  /**
+   * Create a ring; throws if io_uring is not available
+   */
+  explicit IoUring(unsigned entries = DEFAULT_ENTRIES);
+  IoUring(IoUring const &) noexcept = delete;
+  IoUring(IoUring &&) noexcept = delete;
+
+  ~IoUring() noexcept;
+
+  IoUring &operator=(IoUring const &) noexcept = delete;
+  IoUring &operator=(IoUring &&) noexcept = delete;
+
+  /**
+   * Is the io_uring backend usable in this process?
+   *
+   * False if the kernel refuses to create rings, or if the environment
+   * variable NPLANETARY_IO_URING is set to 0
+   */
+  static bool available() noexcept;
+  /**
+   * The calling thread's ring, or nullptr if the backend is not available
+   */
+  static IoUring *forThread() noexcept;
+
+  /**
+   * Reads count bytes from fd into buf
+   */
+  void read(int fd, uint8_t *buf, size_t count, StopEvent const &stopEvent,
+            std::stop_token const &stopFlag);
+  /**
+   * Writes count bytes from buf to fd
+   */
+  void write(int fd, uint8_t const *buf, size_t count,
+             StopEvent const &stopEvent, std::stop_token const &stopFlag);
+  /**
+   * Sends a message once, possibly partially
+   *
+   * @returns bytes sent, or a negated errno
+   */
+  int32_t sendMessage(int fd, struct msghdr const *message,
+                      StopEvent const &stopEvent,
+                      std::stop_token const &stopFlag);
+  /**
+   * Performs all writes, submitting them together
+   *
+   * Rethrows the first error encountered once every write has finished or
+   * failed
+   */
+  void writeAll(std::span<Write const> writes);
+  /**
+   * Accepts a connection on a listening fd, using a multishot accept if the
+   * kernel supports it
+   *
+   * A ring should only ever accept on one fd
+   */
+  int accept(int fd, StopEvent const &stopEvent,
+             std::stop_token const &stopFlag);
+  /**
+   * Cancels any outstanding accept and closes connections accepted but not
+   * yet returned, so the listening fd can be closed
+   */
+  void stopAccepting() noexcept;
+
+ private:
+  static constexpr unsigned DEFAULT_ENTRIES = 64;
+  static constexpr size_t READ_BUFFER_SIZE = 65536;
+  /** user data for completions that should be dropped */
+  static constexpr uint64_t IGNORED = 0;
+
+  void release() noexcept;
+
+  /**
+   * Get a zeroed sqe to fill in, submitting queued sqes if the ring is full
+   */
+  struct io_uring_sqe *nextSQE();
+  /**
+   * Submits queued sqes, waiting for at least minComplete completions
+   */
+  void enter(unsigned minComplete);
+  /**
+   * Moves completions out of the ring
+   */
+  void reap() noexcept;
+
+  /**
+   * Allocates user data for a request whose result is wanted
+   */
+  uint64_t track();
+  /**
+   * Takes the result of a tracked request, if it has completed
+   */
+  std::optional<int32_t> take(uint64_t id);
+  /**
+   * Queues a cancellation of a request; it still completes, probably with
+   * -ECANCELED
+   */
+  void cancel(uint64_t id);
+  /**
+   * Queues a cancellation of a request and drops its result
+   */
+  void abandon(uint64_t id);
+  /**
+   * Queues a poll that completes once stopFD is readable
+   */
+  uint64_t watchStop(int stopFD);
+  /**
+   * Submits and waits for a tracked request, cancelling it on stop
+   */
+  int32_t submitAndAwait(uint64_t id, int stopFD,
+                         std::stop_token const &stopFlag);
+
+  int fd;
+
+  void *sqRing;
+  size_t sqRingSize;
+  void *cqRing;
+  size_t cqRingSize;
+  struct io_uring_sqe *sqes;
+  size_t sqesSize;
+
+  unsigned *sqHead;
+  unsigned *sqTail;
+  unsigned sqMask;
+  unsigned *sqArray;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned cqMask;
+  struct io_uring_cqe *cqes;
+
+  /** tail including sqes filled in but not yet submitted */
+  unsigned localTail;
+  uint64_t nextID;
+  /** results of tracked requests; empty if not yet completed */
+  std::unordered_map<uint64_t, std::optional<int32_t>> results;
+
+  std::unique_ptr<uint8_t[]> readBuffer;
+  bool fixedBuffer;
+
+  uint64_t acceptID;
+  bool acceptArmed;
+  bool multishotAccept;
+  /** accepted fds, or negated errnos */
+  std::deque<int32_t> accepted;
+};
+}  // namespace nplanetary::networking
+
+#endif
+
+#endif  // NPLANETARY_NETWORKING_IOURING_H_
@@ -0,0 +1,636 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#if defined(__linux__) && defined(NPLANETARY_IO_URING)
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "networking/ioUring.h"
+
+using namespace std;
+
+namespace nplanetary::networking {
+namespace {
+template <typename T>
+T *at(void *base, uint32_t offset) noexcept {
+  return static_cast<T *>(static_cast<void *>(static_cast<uint8_t *>(base) +
+                                              offset));
+}
+
+uint64_t toUserData(void const *ptr) noexcept {
+  return reinterpret_cast<uintptr_t>(ptr);
+}
+}  // namespace
+
+IoUring::IoUring(unsigned entries)
+    : fd(0),
+      sqRing(MAP_FAILED),
+      sqRingSize(0),
+      cqRing(MAP_FAILED),
+      cqRingSize(0),
+      sqes(nullptr),
+      sqesSize(0),
+      sqHead(nullptr),
+      sqTail(nullptr),
+      sqMask(0),
+      sqArray(nullptr),
+      cqHead(nullptr),
+      cqTail(nullptr),
+      cqMask(0),
+      cqes(nullptr),
+      localTail(0),
+      nextID(IGNORED + 1),
+      results(),
+      readBuffer(make_unique<uint8_t[]>(READ_BUFFER_SIZE)),
+      fixedBuffer(false),
+      acceptID(IGNORED),
+      acceptArmed(false),
+      multishotAccept(true),
+      accepted() {
+  struct io_uring_params params = {};
+  if (int retval = static_cast<int>(
+          syscall(__NR_io_uring_setup, entries, &params));
+      retval != -1) {
+    fd = retval;
+  } else {
+    throw runtime_error("could not create io_uring: "s + strerror(errno));
+  }
+
+  // map rings
+  sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMap) {
+    sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+  }
+
+  sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sqRing == MAP_FAILED) {
+    int error = errno;
+    release();
+    throw runtime_error("could not map io_uring: "s + strerror(error));
+  }
+  if (singleMap) {
+    cqRing = sqRing;
+  } else {
+    cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED) {
+      int error = errno;
+      release();
+      throw runtime_error("could not map io_uring: "s + strerror(error));
+    }
+  }
+  sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *mappedSQEs = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (mappedSQEs == MAP_FAILED) {
+    int error = errno;
+    release();
+    throw runtime_error("could not map io_uring: "s + strerror(error));
+  }
+  sqes = static_cast<struct io_uring_sqe *>(mappedSQEs);
+
+  sqHead = at<unsigned>(sqRing, params.sq_off.head);
+  sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+  sqMask = *at<unsigned>(sqRing, params.sq_off.ring_mask);
+  sqArray = at<unsigned>(sqRing, params.sq_off.array);
+  cqHead = at<unsigned>(cqRing, params.cq_off.head);
+  cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+  cqMask = *at<unsigned>(cqRing, params.cq_off.ring_mask);
+  cqes = at<struct io_uring_cqe>(cqRing, params.cq_off.cqes);
+  localTail = *sqTail;
+
+  // register read buffer - not fatal if we can't (e.g. memlock limits)
+  struct iovec registered = {
+      .iov_base = readBuffer.get(),
+      .iov_len = READ_BUFFER_SIZE,
+  };
+  fixedBuffer =
+      syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+              &registered, 1) == 0;
+}
+
+IoUring::~IoUring() noexcept { release(); }
+
+bool IoUring::available() noexcept {
+  static bool const usable = []() {
+    if (char const *setting = getenv("NPLANETARY_IO_URING");
+        setting != nullptr && string(setting) == "0") {
+      return false;
+    }
+    try {
+      IoUring probe = IoUring(1);
+      return true;
+    } catch (...) {
+      return false;
+    }
+  }();
+  return usable;
+}
+
+IoUring *IoUring::forThread() noexcept {
+  thread_local unique_ptr<IoUring> ring = []() -> unique_ptr<IoUring> {
+    if (!available()) {
+      return nullptr;
+    }
+    try {
+      return make_unique<IoUring>();
+    } catch (...) {
+      return nullptr;
+    }
+  }();
+  return ring.get();
+}
+
+void IoUring::read(int sockFD, uint8_t *buf, size_t count,
+                   StopEvent const &stopEvent, stop_token const &stopFlag) {
+  while (count != 0) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
+
+    uint64_t id = track();
+    struct io_uring_sqe *sqe = nextSQE();
+    bool viaFixed = fixedBuffer && count <= READ_BUFFER_SIZE;
+    sqe->fd = sockFD;
+    if (viaFixed) {
+      sqe->opcode = IORING_OP_READ_FIXED;
+      sqe->addr = toUserData(readBuffer.get());
+      sqe->len = static_cast<uint32_t>(count);
+      sqe->buf_index = 0;
+    } else {
+      sqe->opcode = IORING_OP_RECV;
+      sqe->addr = toUserData(buf);
+      sqe->len = static_cast<uint32_t>(
+          min<size_t>(count, numeric_limits<uint32_t>::max()));
+      sqe->msg_flags = MSG_WAITALL;
+    }
+    sqe->user_data = id;
+
+    int32_t result = submitAndAwait(id, stopEvent.getFD(), stopFlag);
+    if (result == 0) {
+      // end of data
+      throw HangupFlag();
+    } else if (result > 0) {
+      if (viaFixed) {
+        copy(readBuffer.get(), readBuffer.get() + result, buf);
+      }
+      buf += result;
+      count -= static_cast<size_t>(result);
+    } else {
+      switch (-result) {
+        case EAGAIN:
+        case EINTR: {
+          // retry
+          break;
+        }
+        case EPIPE: {
+          // hangup
+          throw HangupFlag();
+        }
+        default: {
+          throw runtime_error("could not read from socket: "s +
+                              strerror(-result));
+        }
+      }
+    }
+  }
+}
+
+void IoUring::write(int sockFD, uint8_t const *buf, size_t count,
+                    StopEvent const &stopEvent, stop_token const &stopFlag) {
+  Write single = {
+      .fd = sockFD,
+      .buf = buf,
+      .count = count,
+      .stopEvent = &stopEvent,
+      .stopFlag = &stopFlag,
+  };
+  writeAll(span<Write const>(&single, 1));
+}
+
+int32_t IoUring::sendMessage(int sockFD, struct msghdr const *message,
+                             StopEvent const &stopEvent,
+                             stop_token const &stopFlag) {
+  // cancel on this if need be
+  if (stopFlag.stop_requested()) {
+    throw stopFlag;
+  }
+
+  uint64_t id = track();
+  struct io_uring_sqe *sqe = nextSQE();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = sockFD;
+  sqe->addr = toUserData(message);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  sqe->user_data = id;
+  return submitAndAwait(id, stopEvent.getFD(), stopFlag);
+}
+
+void IoUring::writeAll(span<Write const> writes) {
+  struct State {
+    uint8_t const *buf;
+    size_t count;
+    uint64_t id;
+    bool cancelled;
+  };
+  vector<State> states;
+  states.reserve(writes.size());
+  for (Write const &write : writes) {
+    states.push_back(State{
+        .buf = write.buf, .count = write.count, .id = IGNORED,
+        .cancelled = false});
+  }
+
+  // one stop poll per distinct stop event
+  vector<pair<int, uint64_t>> stops;
+  for (Write const &write : writes) {
+    int stopFD = write.stopEvent->getFD();
+    if (none_of(stops.begin(), stops.end(),
+                [stopFD](pair<int, uint64_t> const &stop) {
+                  return stop.first == stopFD;
+                })) {
+      stops.emplace_back(stopFD, watchStop(stopFD));
+    }
+  }
+
+  exception_ptr error = nullptr;
+  auto fail = [&error, &states](size_t idx, exception_ptr thrown) {
+    if (error == nullptr) {
+      error = thrown;
+    }
+    states[idx].count = 0;
+  };
+
+  while (true) {
+    // queue a send for everything with data left and nothing in flight
+    bool busy = false;
+    for (size_t idx = 0; idx < writes.size(); ++idx) {
+      State &state = states[idx];
+      if (state.id == IGNORED && state.count != 0) {
+        if (writes[idx].stopFlag->stop_requested()) {
+          fail(idx, make_exception_ptr(*writes[idx].stopFlag));
+          continue;
+        }
+        state.id = track();
+        struct io_uring_sqe *sqe = nextSQE();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = writes[idx].fd;
+        sqe->addr = toUserData(state.buf);
+        sqe->len = static_cast<uint32_t>(
+            min<size_t>(state.count, numeric_limits<uint32_t>::max()));
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->user_data = state.id;
+      }
+      busy = busy || state.id != IGNORED;
+    }
+    if (!busy) {
+      break;
+    }
+
+    enter(1);
+    reap();
+
+    // handle finished sends
+    for (size_t idx = 0; idx < writes.size(); ++idx) {
+      State &state = states[idx];
+      if (state.id == IGNORED) {
+        continue;
+      }
+      optional<int32_t> result = take(state.id);
+      if (!result.has_value()) {
+        continue;
+      }
+      state.id = IGNORED;
+      bool cancelled = state.cancelled;
+      state.cancelled = false;
+
+      if (*result == -ECANCELED && cancelled) {
+        fail(idx, make_exception_ptr(*writes[idx].stopFlag));
+      } else if (*result >= 0) {
+        state.buf += *result;
+        state.count -= static_cast<size_t>(*result);
+      } else {
+        switch (-*result) {
+          case EAGAIN:
+          case EINTR: {
+            // retry
+            break;
+          }
+          case EPIPE: {
+            // hangup
+            fail(idx, make_exception_ptr(HangupFlag()));
+            break;
+          }
+          default: {
+            fail(idx,
+                 make_exception_ptr(runtime_error(
+                     "could not write to socket: "s + strerror(-*result))));
+            break;
+          }
+        }
+      }
+    }
+
+    // a stop fired - cancel the affected sends
+    for (pair<int, uint64_t> &stop : stops) {
+      if (stop.second != IGNORED && take(stop.second).has_value()) {
+        stop.second = IGNORED;
+        for (size_t idx = 0; idx < writes.size(); ++idx) {
+          if (writes[idx].stopEvent->getFD() == stop.first &&
+              states[idx].id != IGNORED && !states[idx].cancelled) {
+            cancel(states[idx].id);
+            states[idx].cancelled = true;
+          }
+        }
+      }
+    }
+  }
+
+  for (pair<int, uint64_t> const &stop : stops) {
+    if (stop.second != IGNORED) {
+      abandon(stop.second);
+    }
+  }
+
+  if (error != nullptr) {
+    rethrow_exception(error);
+  }
+}
+
+int IoUring::accept(int listenFD, StopEvent const &stopEvent,
+                    stop_token const &stopFlag) {
+  // cancel on this if need be
+  if (stopFlag.stop_requested()) {
+    throw stopFlag;
+  }
+
+  uint64_t stop = IGNORED;
+  while (true) {
+    // take anything already accepted
+    while (!accepted.empty()) {
+      int32_t result = accepted.front();
+      accepted.pop_front();
+      if (result >= 0) {
+        if (stop != IGNORED) {
+          abandon(stop);
+        }
+        return result;
+      }
+
+      if (-result == EINVAL && multishotAccept) {
+        // kernel doesn't support multishot accept
+        multishotAccept = false;
+        continue;
+      }
+      switch (-result) {
+        case EAGAIN:
+        case EINTR:
+        case ECONNABORTED:
+        case ENETDOWN:
+        case EPROTO:
+        case ENOPROTOOPT:
+        case EHOSTDOWN:
+        case ENONET:
+        case EHOSTUNREACH:
+        case EOPNOTSUPP:
+        case ENETUNREACH: {
+          // retry
+          break;
+        }
+        default: {
+          if (stop != IGNORED) {
+            abandon(stop);
+          }
+          throw runtime_error("could not accept on socket: "s +
+                              strerror(-result));
+        }
+      }
+    }
+
+    if (!acceptArmed) {
+      acceptID = nextID++;
+      struct io_uring_sqe *sqe = nextSQE();
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = listenFD;
+      sqe->accept_flags = SOCK_CLOEXEC;
+      if (multishotAccept) {
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+      }
+      sqe->user_data = acceptID;
+      acceptArmed = true;
+    }
+    if (stop == IGNORED) {
+      stop = watchStop(stopEvent.getFD());
+    }
+
+    enter(1);
+    reap();
+
+    if (take(stop).has_value()) {
+      throw stopFlag;
+    }
+  }
+}
+
+void IoUring::stopAccepting() noexcept {
+  try {
+    if (acceptArmed) {
+      cancel(acceptID);
+      while (acceptArmed) {
+        enter(1);
+        reap();
+      }
+    }
+  } catch (...) {
+    // swallow exceptions - called while closing
+  }
+
+  for (int32_t result : accepted) {
+    if (result >= 0) {
+      close(result);
+    }
+  }
+  accepted.clear();
+}
+
+void IoUring::release() noexcept {
+  if (sqes != nullptr) {
+    munmap(sqes, sqesSize);
+  }
+  if (cqRing != MAP_FAILED && cqRing != sqRing) {
+    munmap(cqRing, cqRingSize);
+  }
+  if (sqRing != MAP_FAILED) {
+    munmap(sqRing, sqRingSize);
+  }
+  if (fd != 0) {
+    close(fd);
+  }
+}
+
+struct io_uring_sqe *IoUring::nextSQE() {
+  unsigned head = atomic_ref<unsigned>(*sqHead).load(memory_order_acquire);
+  if (localTail - head > sqMask) {
+    // full - make room
+    enter(0);
+  }
+
+  unsigned idx = localTail & sqMask;
+  sqes[idx] = {};
+  sqArray[idx] = idx;
+  ++localTail;
+  return &sqes[idx];
+}
+
+void IoUring::enter(unsigned minComplete) {
+  atomic_ref<unsigned>(*sqTail).store(localTail, memory_order_release);
+  while (true) {
+    unsigned head = atomic_ref<unsigned>(*sqHead).load(memory_order_acquire);
+    if (syscall(__NR_io_uring_enter, fd, localTail - head, minComplete,
+                minComplete != 0 ? IORING_ENTER_GETEVENTS : 0, nullptr,
+                0) != -1) {
+      return;
+    }
+
+    int error = errno;
+    switch (error) {
+      case EINTR: {
+        // interrupted by signal; retry
+        continue;
+      }
+      case EAGAIN:
+      case EBUSY: {
+        // completion queue is backed up; caller reaps and tries again
+        return;
+      }
+      default: {
+        throw runtime_error("could not submit to io_uring: "s +
+                            strerror(error));
+      }
+    }
+  }
+}
+
+void IoUring::reap() noexcept {
+  unsigned head = *cqHead;
+  unsigned tail = atomic_ref<unsigned>(*cqTail).load(memory_order_acquire);
+  for (; head != tail; ++head) {
+    struct io_uring_cqe const &cqe = cqes[head & cqMask];
+    if (acceptArmed && cqe.user_data == acceptID) {
+      if (cqe.res != -ECANCELED) {
+        accepted.push_back(cqe.res);
+      }
+      if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+        acceptArmed = false;
+      }
+    } else if (auto found = results.find(cqe.user_data);
+               found != results.end()) {
+      found->second = cqe.res;
+    }
+  }
+  atomic_ref<unsigned>(*cqHead).store(head, memory_order_release);
+}
+
+uint64_t IoUring::track() {
+  uint64_t id = nextID++;
+  results.emplace(id, nullopt);
+  return id;
+}
+
+optional<int32_t> IoUring::take(uint64_t id) {
+  auto found = results.find(id);
+  if (found == results.end() || !found->second.has_value()) {
+    return nullopt;
+  }
+  optional<int32_t> result = found->second;
+  results.erase(found);
+  return result;
+}
+
+void IoUring::cancel(uint64_t id) {
+  struct io_uring_sqe *sqe = nextSQE();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = id;
+  sqe->user_data = IGNORED;
+}
+
+void IoUring::abandon(uint64_t id) {
+  results.erase(id);
+  cancel(id);
+}
+
+uint64_t IoUring::watchStop(int stopFD) {
+  uint64_t id = track();
+  struct io_uring_sqe *sqe = nextSQE();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = stopFD;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = id;
+  return id;
+}
+
+int32_t IoUring::submitAndAwait(uint64_t id, int stopFD,
+                                stop_token const &stopFlag) {
+  uint64_t stop = watchStop(stopFD);
+  while (true) {
+    enter(1);
+    reap();
+
+    if (optional<int32_t> result = take(id); result.has_value()) {
+      abandon(stop);
+      return *result;
+    }
+
+    if (take(stop).has_value()) {
+      // stopped - request can't outlive its buffer, so wait for it to end
+      cancel(id);
+      while (!take(id).has_value()) {
+        enter(1);
+        reap();
+      }
+      throw stopFlag;
+    }
+  }
+}
+}  // namespace nplanetary::networking
+
+#endif
@@ -0,0 +1,187 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_NETWORKING_LOCALPIPE_H_
+#define NPLANETARY_NETWORKING_LOCALPIPE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+
+#include "networking/executor.h"
+#include "networking/rawSocket.h"
+#include "networking/stats.h"
+#include "networking/task.h"
+
+namespace nplanetary::networking {
+/**
+ * One direction of an in-process connection: a lock-free ring of bytes with
+ * a single reader and a single writer
+ *
+ * Neither side makes a syscall unless it has to sleep until the other makes
+ * progress, or has to wake the other up
+ */
+class LocalRing {
+ public:
+  static constexpr size_t CAPACITY = 1 << 18;
+
+  LocalRing();
+  LocalRing(LocalRing const &) noexcept = delete;
+  LocalRing(LocalRing &&) noexcept = delete;
+
+  ~LocalRing() noexcept = default;
+
+  LocalRing &operator=(LocalRing const &) noexcept = delete;
+  LocalRing &operator=(LocalRing &&) noexcept = delete;
+
+  /**
+   * Reads count bytes into buf, like RawSocket::read
+   */
+  void read(uint8_t *buf, size_t count, std::stop_token const &stopFlag,
+            StopEvent const &stopEvent,
+            std::optional<std::chrono::steady_clock::time_point> const
+                &deadline,
+            Counters &counters);
+  /**
+   * Writes count bytes from buf, like RawSocket::write
+   */
+  void write(uint8_t const *buf, size_t count, std::stop_token const &stopFlag,
+             StopEvent const &stopEvent,
+             std::optional<std::chrono::steady_clock::time_point> const
+                 &deadline,
+             Counters &counters);
+  Task<void> asyncRead(uint8_t *buf, size_t count,
+                       std::stop_token const &stopFlag,
+                       StopEvent const &stopEvent, Counters &counters);
+  Task<void> asyncWrite(uint8_t const *buf, size_t count,
+                        std::stop_token const &stopFlag,
+                        StopEvent const &stopEvent, Counters &counters);
+
+  /**
+   * Hangs up, waking up both sides; the reader may still read what was
+   * written before
+   */
+  void close() noexcept;
+
+ private:
+  /**
+   * Copies as many bytes as are available, up to count
+   *
+   * @returns bytes copied
+   */
+  size_t tryRead(uint8_t *buf, size_t count) noexcept;
+  /**
+   * Copies as many bytes as there is room for, up to count
+   *
+   * @returns bytes copied
+   */
+  size_t tryWrite(uint8_t const *buf, size_t count) noexcept;
+  /**
+   * Whether the reader can make progress, or the writer if !reading
+   *
+   * Call after announcing that side is waiting, so the other side either sees
+   * the announcement or this sees its progress
+   */
+  bool ready(bool reading) const noexcept;
+
+  std::unique_ptr<uint8_t[]> buffer;
+  /** bytes ever read; only the reader changes it */
+  alignas(64) std::atomic<size_t> head;
+  /** bytes ever written; only the writer changes it */
+  alignas(64) std::atomic<size_t> tail;
+  std::atomic<bool> closed;
+  /** whether a side is asleep, or about to be, and needs waking */
+  std::atomic<bool> readerWaiting;
+  std::atomic<bool> writerWaiting;
+  /** notified when bytes are written, or on hangup */
+  WakeEvent readable;
+  /** notified when bytes are read, or on hangup */
+  WakeEvent writable;
+};
+
+/**
+ * Both directions of an in-process connection, shared by its two ends
+ */
+struct LocalPipe {
+  explicit LocalPipe(bool trusted);
+
+  /** hangs up both directions */
+  void close() noexcept;
+
+  LocalRing toServer;
+  LocalRing toClient;
+  /** the server lets in-process clients skip encryption */
+  bool trusted;
+};
+
+/**
+ * Where in-process clients connect to a server, by name
+ */
+class LocalListener {
+ public:
+  /**
+   * Starts listening under name
+   *
+   * @param trusted whether connections may skip encryption
+   */
+  LocalListener(std::string const &name, bool trusted);
+  LocalListener(LocalListener const &) noexcept = delete;
+  LocalListener(LocalListener &&) noexcept = delete;
+
+  /**
+   * Stops listening, hanging up on connections that were never accepted
+   */
+  ~LocalListener() noexcept;
+
+  LocalListener &operator=(LocalListener const &) noexcept = delete;
+  LocalListener &operator=(LocalListener &&) noexcept = delete;
+
+  /**
+   * Connects to the listener with this name
+   */
+  static std::shared_ptr<LocalPipe> connect(std::string const &name);
+
+  std::shared_ptr<LocalPipe> accept(std::stop_token const &stopFlag,
+                                    StopEvent const &stopEvent);
+  Task<std::shared_ptr<LocalPipe>> asyncAccept(std::stop_token const &stopFlag,
+                                               StopEvent const &stopEvent);
+
+ private:
+  /**
+   * Takes the oldest connection, if there is one
+   */
+  std::shared_ptr<LocalPipe> take();
+
+  std::string name;
+  bool trusted;
+  std::mutex lock;
+  /** connections waiting to be accepted */
+  std::deque<std::shared_ptr<LocalPipe>> pending;
+  /** notified when a connection is added */
+  WakeEvent connected;
+};
+}  // namespace nplanetary::networking
+
+#endif  // NPLANETARY_NETWORKING_LOCALPIPE_H_
@@ -0,0 +1,355 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#if defined(__linux__)
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "networking/localPipe.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace nplanetary::networking {
+namespace {
+/**
+ * Listeners by name, so clients can find them
+ */
+struct Registry {
+  mutex lock = {};
+  unordered_map<string, LocalListener *> listeners = {};
+};
+
+Registry &registry() {
+  static Registry registry;
+  return registry;
+}
+}  // namespace
+
+LocalRing::LocalRing()
+    : buffer(make_unique<uint8_t[]>(CAPACITY)),
+      head(0),
+      tail(0),
+      closed(false),
+      readerWaiting(false),
+      writerWaiting(false),
+      readable(),
+      writable() {}
+
+void LocalRing::read(uint8_t *buf, size_t count, stop_token const &stopFlag,
+                     StopEvent const &stopEvent,
+                     optional<steady_clock::time_point> const &deadline,
+                     Counters &counters) {
+  bool woken = false;
+  while (count != 0) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
+
+    // anything written before the hangup is still read
+    bool hungUp = closed.load();
+    if (size_t taken = tryRead(buf, count); taken != 0) {
+      counters.addBytesIn(taken);
+      buf += taken;
+      count -= taken;
+      woken = false;
+      continue;
+    } else if (hungUp) {
+      throw HangupFlag();
+    }
+
+    if (woken) {
+      counters.addEmptyWakeup();
+    }
+    // nothing yet - sleep until the writer says there is
+    readerWaiting.store(true);
+    if (!ready(true)) {
+      readable.sleep(stopEvent, deadline);
+      counters.addSyscall();
+      woken = true;
+    }
+    readerWaiting.store(false);
+    readable.clear();
+  }
+}
+
+void LocalRing::write(uint8_t const *buf, size_t count,
+                      stop_token const &stopFlag, StopEvent const &stopEvent,
+                      optional<steady_clock::time_point> const &deadline,
+                      Counters &counters) {
+  bool woken = false;
+  while (count != 0) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
+
+    if (closed.load()) {
+      throw HangupFlag();
+    } else if (size_t written = tryWrite(buf, count); written != 0) {
+      counters.addBytesOut(written);
+      buf += written;
+      count -= written;
+      woken = false;
+      continue;
+    }
+
+    if (woken) {
+      counters.addEmptyWakeup();
+    }
+    // full - sleep until the reader makes room
+    writerWaiting.store(true);
+    if (!ready(false)) {
+      writable.sleep(stopEvent, deadline);
+      counters.addSyscall();
+      woken = true;
+    }
+    writerWaiting.store(false);
+    writable.clear();
+  }
+}
+
+Task<void> LocalRing::asyncRead(uint8_t *buf, size_t count,
+                                stop_token const &stopFlag,
+                                StopEvent const &stopEvent,
+                                Counters &counters) {
+  bool woken = false;
+  while (count != 0) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
+
+    bool hungUp = closed.load();
+    if (size_t taken = tryRead(buf, count); taken != 0) {
+      counters.addBytesIn(taken);
+      buf += taken;
+      count -= taken;
+      woken = false;
+      continue;
+    } else if (hungUp) {
+      throw HangupFlag();
+    }
+
+    if (woken) {
+      counters.addEmptyWakeup();
+    }
+    // nothing yet - let other tasks run until there is
+    readerWaiting.store(true);
+    if (!ready(true)) {
+      co_await readable.wait(stopEvent);
+      woken = true;
+    }
+    readerWaiting.store(false);
+    readable.clear();
+  }
+}
+
+Task<void> LocalRing::asyncWrite(uint8_t const *buf, size_t count,
+                                 stop_token const &stopFlag,
+                                 StopEvent const &stopEvent,
+                                 Counters &counters) {
+  bool woken = false;
+  while (count != 0) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
+
+    if (closed.load()) {
+      throw HangupFlag();
+    } else if (size_t written = tryWrite(buf, count); written != 0) {
+      counters.addBytesOut(written);
+      buf += written;
+      count -= written;
+      woken = false;
+      continue;
+    }
+
+    if (woken) {
+      counters.addEmptyWakeup();
+    }
+    // full - let other tasks run until there's room
+    writerWaiting.store(true);
+    if (!ready(false)) {
+      co_await writable.wait(stopEvent);
+      woken = true;
+    }
+    writerWaiting.store(false);
+    writable.clear();
+  }
+}
+
+void LocalRing::close() noexcept {
+  closed.store(true);
+  readable.notify();
+  writable.notify();
+}
+
+size_t LocalRing::tryRead(uint8_t *buf, size_t count) noexcept {
+  size_t start = head.load(memory_order_relaxed);
+  size_t taken = min(count, tail.load(memory_order_acquire) - start);
+  if (taken == 0) {
+    return 0;
+  }
+
+  // may wrap around the end of the buffer
+  size_t offset = start & (CAPACITY - 1);
+  size_t first = min(taken, CAPACITY - offset);
+  memcpy(buf, buffer.get() + offset, first);
+  memcpy(buf + first, buffer.get(), taken - first);
+
+  // seq_cst so the writer either sees the room or sees that we aren't waiting
+  head.store(start + taken);
+  if (writerWaiting.exchange(false)) {
+    writable.notify();
+  }
+  return taken;
+}
+
+size_t LocalRing::tryWrite(uint8_t const *buf, size_t count) noexcept {
+  size_t start = tail.load(memory_order_relaxed);
+  size_t written =
+      min(count, CAPACITY - (start - head.load(memory_order_acquire)));
+  if (written == 0) {
+    return 0;
+  }
+
+  // may wrap around the end of the buffer
+  size_t offset = start & (CAPACITY - 1);
+  size_t first = min(written, CAPACITY - offset);
+  memcpy(buffer.get() + offset, buf, first);
+  memcpy(buffer.get(), buf + first, written - first);
+
+  // seq_cst so the reader either sees the bytes or sees that we aren't waiting
+  tail.store(start + written);
+  if (readerWaiting.exchange(false)) {
+    readable.notify();
+  }
+  return written;
+}
+
+bool LocalRing::ready(bool reading) const noexcept {
+  if (closed.load()) {
+    return true;
+  }
+  size_t used = tail.load() - head.load();
+  return reading ? used != 0 : used != CAPACITY;
+}
+
+LocalPipe::LocalPipe(bool trusted)
+    : toServer(), toClient(), trusted(trusted) {}
+
+void LocalPipe::close() noexcept {
+  toServer.close();
+  toClient.close();
+}
+
+LocalListener::LocalListener(string const &name, bool trusted)
+    : name(name), trusted(trusted), lock(), pending(), connected() {
+  Registry &listeners = registry();
+  scoped_lock guard(listeners.lock);
+  if (!listeners.listeners.emplace(name, this).second) {
+    throw runtime_error("could not listen on local:"s + name +
+                        ": name in use");
+  }
+}
+
+LocalListener::~LocalListener() noexcept {
+  {
+    Registry &listeners = registry();
+    scoped_lock guard(listeners.lock);
+    listeners.listeners.erase(name);
+  }
+
+  scoped_lock guard(lock);
+  for (shared_ptr<LocalPipe> const &pipe : pending) {
+    pipe->close();
+  }
+}
+
+shared_ptr<LocalPipe> LocalListener::connect(string const &name) {
+  Registry &listeners = registry();
+  // held throughout so the listener can't be destroyed under us
+  scoped_lock guard(listeners.lock);
+  auto found = listeners.listeners.find(name);
+  if (found == listeners.listeners.end()) {
+    throw runtime_error("could not connect to local:"s + name);
+  }
+
+  LocalListener &listener = *found->second;
+  shared_ptr<LocalPipe> pipe = make_shared<LocalPipe>(listener.trusted);
+  {
+    scoped_lock listenerGuard(listener.lock);
+    listener.pending.push_back(pipe);
+  }
+  listener.connected.notify();
+  return pipe;
+}
+
+shared_ptr<LocalPipe> LocalListener::accept(stop_token const &stopFlag,
+                                            StopEvent const &stopEvent) {
+  while (true) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
+
+    if (shared_ptr<LocalPipe> pipe = take(); pipe != nullptr) {
+      return pipe;
+    }
+    // connections added from now on will wake us
+    connected.sleep(stopEvent);
+    connected.clear();
+  }
+}
+
+Task<shared_ptr<LocalPipe>> LocalListener::asyncAccept(
+    stop_token const &stopFlag, StopEvent const &stopEvent) {
+  while (true) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
+
+    if (shared_ptr<LocalPipe> pipe = take(); pipe != nullptr) {
+      co_return pipe;
+    }
+    // connections added from now on will wake us
+    co_await connected.wait(stopEvent);
+    connected.clear();
+  }
+}
+
+shared_ptr<LocalPipe> LocalListener::take() {
+  scoped_lock guard(lock);
+  if (pending.empty()) {
+    return nullptr;
+  }
+  shared_ptr<LocalPipe> pipe = move(pending.front());
+  pending.pop_front();
+  return pipe;
+}
+}  // namespace nplanetary::networking
+
+#endif
@@ -19,8 +19,13 @@
 
 #include "networking/networking.h"
 
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <limits>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
 #include <utility>
 
 using namespace std;
@@ -37,11 +42,70 @@ To pun(From from) {
   } cvt = {.from = from};
   return cvt.to;
 }
+
+template <typename T>
+T byteswap(T x) {
+  using U = make_unsigned_t<T>;
+  U u = pun<T, U>(x);
+  if constexpr (sizeof(T) == sizeof(uint16_t)) {
+    u = __builtin_bswap16(u);
+  } else if constexpr (sizeof(T) == sizeof(uint32_t)) {
+    u = __builtin_bswap32(u);
+  } else if constexpr (sizeof(T) == sizeof(uint64_t)) {
+    u = __builtin_bswap64(u);
+  }
+  return pun<U, T>(u);
+}
+
+/** elements to byte swap at once on big-endian hosts */
+constexpr size_t SWAP_BLOCK_SIZE = 1024;
+
+/**
+ * Most bytes of an array allocated ahead of its elements arriving, so a peer
+ * can't make us allocate a huge array by sending just its header
+ */
+constexpr size_t RECEIVE_CHUNK_SIZE = 64 * 1024;
+
+/** longest possible LEB128 encoding of a 64 bit value */
+constexpr size_t MAX_VARINT_SIZE = 10;
+
+/**
+ * Maps signed values to unsigned ones so small magnitudes stay small
+ */
+template <typename T>
+make_unsigned_t<T> zigzag(T x) {
+  using U = make_unsigned_t<T>;
+  return (pun<T, U>(x) << 1) ^ pun<T, U>(x >> (sizeof(T) * 8 - 1));
+}
+template <typename T>
+T unzigzag(make_unsigned_t<T> u) {
+  using U = make_unsigned_t<T>;
+  return pun<U, T>(static_cast<U>((u >> 1) ^ (~(u & 1) + 1)));
+}
+
+/**
+ * Writes x as a LEB128 varint
+ *
+ * @returns number of bytes written
+ */
+size_t encodeVarint(uint64_t x, uint8_t *out) {
+  size_t size = 0;
+  while (x >= 0x80) {
+    out[size++] = static_cast<uint8_t>(x | 0x80);
+    x >>= 7;
+  }
+  out[size++] = static_cast<uint8_t>(x);
+  return size;
+}
 }  // namespace
 
 Socket::Socket(string const &hostname, string const &password,
-               stop_token const &stopFlag)
-    : Socket(CryptoSocket(hostname, password, stopFlag)) {}
+               stop_token const &stopFlag, uint8_t features)
+    : Socket(CryptoSocket(hostname, password, stopFlag, features)) {}
+Socket::Socket(string const &hostname, CryptoSocket::Ticket const &ticket,
+               string const &password, stop_token const &stopFlag,
+               uint8_t features)
+    : Socket(CryptoSocket(hostname, ticket, password, stopFlag, features)) {}
 
 Socket &Socket::operator<<(uint8_t x) {
   array<uint8_t, sizeof(uint8_t) + sizeof(uint8_t)> formatted;
@@ -52,6 +116,11 @@ Socket &Socket::operator<<(uint8_t x) {
   return *this;
 }
 Socket &Socket::operator<<(uint16_t x) {
+  if (compact) {
+    sendVarint(U16_TAG, x);
+    return *this;
+  }
+
   array<uint8_t, sizeof(uint16_t) + sizeof(uint8_t)> formatted;
   formatted[0] = U16_TAG;
   formatted[1] = (x >> 0) & 0xff;
@@ -61,6 +130,11 @@ Socket &Socket::operator<<(uint16_t x) {
   return *this;
 }
 Socket &Socket::operator<<(uint32_t x) {
+  if (compact) {
+    sendVarint(U32_TAG, x);
+    return *this;
+  }
+
   array<uint8_t, sizeof(uint32_t) + sizeof(uint8_t)> formatted;
   formatted[0] = U32_TAG;
   formatted[1] = (x >> 0) & 0xff;
@@ -72,7 +146,12 @@ Socket &Socket::operator<<(uint32_t x) {
   return *this;
 }
 Socket &Socket::operator<<(uint64_t x) {
-  array<uint8_t, sizeof(uint32_t) + sizeof(uint8_t)> formatted;
+  if (compact) {
+    sendVarint(U64_TAG, x);
+    return *this;
+  }
+
+  array<uint8_t, sizeof(uint64_t) + sizeof(uint8_t)> formatted;
   formatted[0] = U64_TAG;
   formatted[1] = (x >> 0) & 0xff;
   formatted[2] = (x >> 8) & 0xff;
@@ -96,6 +175,11 @@ Socket &Socket::operator<<(int8_t x) {
   return *this;
 }
 Socket &Socket::operator<<(int16_t x) {
+  if (compact) {
+    sendVarint(S16_TAG, zigzag(x));
+    return *this;
+  }
+
   uint16_t u = pun<int16_t, uint16_t>(x);
   array<uint8_t, sizeof(uint16_t) + sizeof(uint8_t)> formatted;
   formatted[0] = S16_TAG;
@@ -106,6 +190,11 @@ Socket &Socket::operator<<(int16_t x) {
   return *this;
 }
 Socket &Socket::operator<<(int32_t x) {
+  if (compact) {
+    sendVarint(S32_TAG, zigzag(x));
+    return *this;
+  }
+
   uint32_t u = pun<int32_t, uint32_t>(x);
   array<uint8_t, sizeof(uint32_t) + sizeof(uint8_t)> formatted;
   formatted[0] = S32_TAG;
@@ -118,8 +207,13 @@ Socket &Socket::operator<<(int32_t x) {
   return *this;
 }
 Socket &Socket::operator<<(int64_t x) {
+  if (compact) {
+    sendVarint(S64_TAG, zigzag(x));
+    return *this;
+  }
+
   uint64_t u = pun<int64_t, uint64_t>(x);
-  array<uint8_t, sizeof(uint32_t) + sizeof(uint8_t)> formatted;
+  array<uint8_t, sizeof(uint64_t) + sizeof(uint8_t)> formatted;
   formatted[0] = S64_TAG;
   formatted[1] = (u >> 0) & 0xff;
   formatted[2] = (u >> 8) & 0xff;
@@ -164,33 +258,79 @@ Socket &Socket::operator<<(bool b) {
   return *this;
 }
 
-void Socket::flush() { return cryptoSocket.flush(); }
+Socket &Socket::operator<<(span<uint8_t const> x) {
+  sendArray(U8_TAG, x);
+  return *this;
+}
+Socket &Socket::operator<<(span<uint16_t const> x) {
+  sendArray(U16_TAG, x);
+  return *this;
+}
+Socket &Socket::operator<<(span<uint32_t const> x) {
+  sendArray(U32_TAG, x);
+  return *this;
+}
+Socket &Socket::operator<<(span<uint64_t const> x) {
+  sendArray(U64_TAG, x);
+  return *this;
+}
+Socket &Socket::operator<<(span<int8_t const> x) {
+  sendArray(S8_TAG, x);
+  return *this;
+}
+Socket &Socket::operator<<(span<int16_t const> x) {
+  sendArray(S16_TAG, x);
+  return *this;
+}
+Socket &Socket::operator<<(span<int32_t const> x) {
+  sendArray(S32_TAG, x);
+  return *this;
+}
+Socket &Socket::operator<<(span<int64_t const> x) {
+  sendArray(S64_TAG, x);
+  return *this;
+}
+Socket &Socket::operator<<(span<string const> x) {
+  for (string const &element : x) {
+    if (element.size() > numeric_limits<uint16_t>::max()) {
+      throw runtime_error("string too long to send");
+    }
+  }
 
-Socket &Socket::operator>>(uint8_t &x) {
-  uint8_t tag;
-  cryptoSocket.read(&tag, 1);
+  sendArrayHeader(STRING_TAG, x.size());
+  for (string const &element : x) {
+    array<uint8_t, sizeof(uint16_t)> formatted;
+    formatted[0] = (element.size() >> 0) & 0xff;
+    formatted[1] = (element.size() >> 8) & 0xff;
 
-  if (tag != U8_TAG) {
-    throw runtime_error("type tag mismatch");
+    cryptoSocket.write(formatted.data(), formatted.size());
+    cryptoSocket.write(reinterpret_cast<uint8_t const *>(element.data()),
+                       element.size());
   }
+  return *this;
+}
+
+void Socket::flush() { return cryptoSocket.flush(); }
+
+void Socket::setFraming(Framing framing) { cryptoSocket.setFraming(framing); }
 
-  array<uint8_t, sizeof(uint8_t)> bytes;
-  cryptoSocket.read(bytes.data(), bytes.size());
+Task<void> Socket::asyncFlush() { return cryptoSocket.asyncFlush(); }
+
+Socket &Socket::operator>>(uint8_t &x) {
+  span<uint8_t const> bytes = receive(U8_TAG, sizeof(uint8_t));
 
   x = (static_cast<uint8_t>(bytes[0]) << 0);
 
   return *this;
 }
 Socket &Socket::operator>>(uint16_t &x) {
-  uint8_t tag;
-  cryptoSocket.read(&tag, 1);
-
-  if (tag != U16_TAG) {
-    throw runtime_error("type tag mismatch");
+  if (compact) {
+    x = static_cast<uint16_t>(
+        receiveVarint(U16_TAG, numeric_limits<uint16_t>::max()));
+    return *this;
   }
 
-  array<uint8_t, sizeof(uint16_t)> bytes;
-  cryptoSocket.read(bytes.data(), bytes.size());
+  span<uint8_t const> bytes = receive(U16_TAG, sizeof(uint16_t));
 
   x = (static_cast<uint16_t>(bytes[0]) << 0) |
       (static_cast<uint16_t>(bytes[1]) << 8);
@@ -198,15 +338,13 @@ Socket &Socket::operator>>(uint16_t &x) {
   return *this;
 }
 Socket &Socket::operator>>(uint32_t &x) {
-  uint8_t tag;
-  cryptoSocket.read(&tag, 1);
-
-  if (tag != U32_TAG) {
-    throw runtime_error("type tag mismatch");
+  if (compact) {
+    x = static_cast<uint32_t>(
+        receiveVarint(U32_TAG, numeric_limits<uint32_t>::max()));
+    return *this;
   }
 
-  array<uint8_t, sizeof(uint32_t)> bytes;
-  cryptoSocket.read(bytes.data(), bytes.size());
+  span<uint8_t const> bytes = receive(U32_TAG, sizeof(uint32_t));
 
   x = (static_cast<uint32_t>(bytes[0]) << 0) |
       (static_cast<uint32_t>(bytes[1]) << 8) |
@@ -216,15 +354,12 @@ Socket &Socket::operator>>(uint32_t &x) {
   return *this;
 }
 Socket &Socket::operator>>(uint64_t &x) {
-  uint8_t tag;
-  cryptoSocket.read(&tag, 1);
-
-  if (tag != U64_TAG) {
-    throw runtime_error("type tag mismatch");
+  if (compact) {
+    x = receiveVarint(U64_TAG, numeric_limits<uint64_t>::max());
+    return *this;
   }
 
-  array<uint8_t, sizeof(uint64_t)> bytes;
-  cryptoSocket.read(bytes.data(), bytes.size());
+  span<uint8_t const> bytes = receive(U64_TAG, sizeof(uint64_t));
 
   x = (static_cast<uint64_t>(bytes[0]) << 0) |
       (static_cast<uint64_t>(bytes[1]) << 8) |
@@ -238,15 +373,7 @@ Socket &Socket::operator>>(uint64_t &x) {
   return *this;
 }
 Socket &Socket::operator>>(int8_t &x) {
-  uint8_t tag;
-  cryptoSocket.read(&tag, 1);
-
-  if (tag != S8_TAG) {
-    throw runtime_error("type tag mismatch");
-  }
-
-  array<uint8_t, sizeof(uint8_t)> bytes;
-  cryptoSocket.read(bytes.data(), bytes.size());
+  span<uint8_t const> bytes = receive(S8_TAG, sizeof(uint8_t));
 
   uint8_t u = (static_cast<uint8_t>(bytes[0]) << 0);
   x = pun<uint8_t, int8_t>(u);
@@ -254,15 +381,13 @@ Socket &Socket::operator>>(int8_t &x) {
   return *this;
 }
 Socket &Socket::operator>>(int16_t &x) {
-  uint8_t tag;
-  cryptoSocket.read(&tag, 1);
-
-  if (tag != S16_TAG) {
-    throw runtime_error("type tag mismatch");
+  if (compact) {
+    x = unzigzag<int16_t>(static_cast<uint16_t>(
+        receiveVarint(S16_TAG, numeric_limits<uint16_t>::max())));
+    return *this;
   }
 
-  array<uint8_t, sizeof(uint16_t)> bytes;
-  cryptoSocket.read(bytes.data(), bytes.size());
+  span<uint8_t const> bytes = receive(S16_TAG, sizeof(uint16_t));
 
   uint16_t u = (static_cast<uint16_t>(bytes[0]) << 0) |
                (static_cast<uint16_t>(bytes[1]) << 8);
@@ -271,15 +396,13 @@ Socket &Socket::operator>>(int16_t &x) {
   return *this;
 }
 Socket &Socket::operator>>(int32_t &x) {
-  uint8_t tag;
-  cryptoSocket.read(&tag, 1);
-
-  if (tag != S32_TAG) {
-    throw runtime_error("type tag mismatch");
+  if (compact) {
+    x = unzigzag<int32_t>(static_cast<uint32_t>(
+        receiveVarint(S32_TAG, numeric_limits<uint32_t>::max())));
+    return *this;
   }
 
-  array<uint8_t, sizeof(uint32_t)> bytes;
-  cryptoSocket.read(bytes.data(), bytes.size());
+  span<uint8_t const> bytes = receive(S32_TAG, sizeof(uint32_t));
 
   uint32_t u = (static_cast<uint32_t>(bytes[0]) << 0) |
                (static_cast<uint32_t>(bytes[1]) << 8) |
@@ -290,15 +413,13 @@ Socket &Socket::operator>>(int32_t &x) {
   return *this;
 }
 Socket &Socket::operator>>(int64_t &x) {
-  uint8_t tag;
-  cryptoSocket.read(&tag, 1);
-
-  if (tag != U64_TAG) {
-    throw runtime_error("type tag mismatch");
+  if (compact) {
+    x = unzigzag<int64_t>(
+        receiveVarint(S64_TAG, numeric_limits<uint64_t>::max()));
+    return *this;
   }
 
-  array<uint8_t, sizeof(uint64_t)> bytes;
-  cryptoSocket.read(bytes.data(), bytes.size());
+  span<uint8_t const> bytes = receive(S64_TAG, sizeof(uint64_t));
 
   uint64_t u = (static_cast<uint64_t>(bytes[0]) << 0) |
                (static_cast<uint64_t>(bytes[1]) << 8) |
@@ -308,35 +429,19 @@ Socket &Socket::operator>>(int64_t &x) {
                (static_cast<uint64_t>(bytes[5]) << 40) |
                (static_cast<uint64_t>(bytes[6]) << 48) |
                (static_cast<uint64_t>(bytes[7]) << 56);
-  x = pun<uint32_t, int32_t>(u);
+  x = pun<uint64_t, int64_t>(u);
 
   return *this;
 }
 Socket &Socket::operator>>(char &x) {
-  uint8_t tag;
-  cryptoSocket.read(&tag, 1);
-
-  if (tag != CHAR_TAG) {
-    throw runtime_error("type tag mismatch");
-  }
-
-  array<uint8_t, sizeof(char)> bytes;
-  cryptoSocket.read(bytes.data(), bytes.size());
+  span<uint8_t const> bytes = receive(CHAR_TAG, sizeof(char));
 
   x = pun<uint8_t, char>(bytes[0]);
 
   return *this;
 }
 Socket &Socket::operator>>(string &x) {
-  uint8_t tag;
-  cryptoSocket.read(&tag, 1);
-
-  if (tag != STRING_TAG) {
-    throw runtime_error("type tag mismatch");
-  }
-
-  array<uint8_t, sizeof(uint16_t)> bytes;
-  cryptoSocket.read(bytes.data(), bytes.size());
+  span<uint8_t const> bytes = receive(STRING_TAG, sizeof(uint16_t));
 
   uint16_t size = (static_cast<uint16_t>(bytes[0]) << 0) |
                   (static_cast<uint16_t>(bytes[1]) << 8);
@@ -346,26 +451,260 @@ Socket &Socket::operator>>(string &x) {
   return *this;
 }
 Socket &Socket::operator>>(bool &x) {
-  uint8_t tag;
-  cryptoSocket.read(&tag, 1);
+  span<uint8_t const> bytes = receive(BOOL_TAG, sizeof(uint8_t));
+
+  x = bytes[0] != 0;
+
+  return *this;
+}
+
+Socket &Socket::operator>>(vector<uint8_t> &x) {
+  receiveArray(U8_TAG, x);
+  return *this;
+}
+Socket &Socket::operator>>(vector<uint16_t> &x) {
+  receiveArray(U16_TAG, x);
+  return *this;
+}
+Socket &Socket::operator>>(vector<uint32_t> &x) {
+  receiveArray(U32_TAG, x);
+  return *this;
+}
+Socket &Socket::operator>>(vector<uint64_t> &x) {
+  receiveArray(U64_TAG, x);
+  return *this;
+}
+Socket &Socket::operator>>(vector<int8_t> &x) {
+  receiveArray(S8_TAG, x);
+  return *this;
+}
+Socket &Socket::operator>>(vector<int16_t> &x) {
+  receiveArray(S16_TAG, x);
+  return *this;
+}
+Socket &Socket::operator>>(vector<int32_t> &x) {
+  receiveArray(S32_TAG, x);
+  return *this;
+}
+Socket &Socket::operator>>(vector<int64_t> &x) {
+  receiveArray(S64_TAG, x);
+  return *this;
+}
+Socket &Socket::operator>>(vector<string> &x) {
+  uint32_t count = receiveArrayHeader(STRING_TAG);
+
+  // each element has at least its length
+  cryptoSocket.expect(count * sizeof(uint16_t));
+  x.clear();
+  x.reserve(min<size_t>(count, RECEIVE_CHUNK_SIZE / sizeof(string)));
+  for (uint32_t idx = 0; idx < count; ++idx) {
+    array<uint8_t, sizeof(uint16_t)> bytes;
+    cryptoSocket.read(bytes.data(), bytes.size());
+    uint16_t size = (static_cast<uint16_t>(bytes[0]) << 0) |
+                    (static_cast<uint16_t>(bytes[1]) << 8);
+
+    string element = string(size, '\0');
+    cryptoSocket.read(reinterpret_cast<uint8_t *>(element.data()), size);
+    x.push_back(move(element));
+  }
+  return *this;
+}
+
+void Socket::sendField(uint16_t field, int64_t x) {
+  if (compact) {
+    int64_t &last = sentFields[field];
+    int64_t delta =
+        pun<uint64_t, int64_t>(pun<int64_t, uint64_t>(x) -
+                               pun<int64_t, uint64_t>(last));
+    last = x;
+
+    array<uint8_t, sizeof(uint8_t) + 2 * MAX_VARINT_SIZE> formatted;
+    formatted[0] = FIELD_TAG;
+    size_t size = 1;
+    size += encodeVarint(field, formatted.data() + size);
+    size += encodeVarint(zigzag(delta), formatted.data() + size);
+
+    cryptoSocket.write(formatted.data(), size);
+    return;
+  }
+
+  uint64_t u = pun<int64_t, uint64_t>(x);
+  array<uint8_t, sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint64_t)>
+      formatted;
+  formatted[0] = FIELD_TAG;
+  formatted[1] = (field >> 0) & 0xff;
+  formatted[2] = (field >> 8) & 0xff;
+  formatted[3] = (u >> 0) & 0xff;
+  formatted[4] = (u >> 8) & 0xff;
+  formatted[5] = (u >> 16) & 0xff;
+  formatted[6] = (u >> 24) & 0xff;
+  formatted[7] = (u >> 32) & 0xff;
+  formatted[8] = (u >> 40) & 0xff;
+  formatted[9] = (u >> 48) & 0xff;
+  formatted[10] = (u >> 56) & 0xff;
 
-  if (tag != BOOL_TAG) {
+  cryptoSocket.write(formatted.data(), formatted.size());
+}
+int64_t Socket::receiveField(uint16_t field) {
+  if (compact) {
+    if (receiveVarint(FIELD_TAG, numeric_limits<uint16_t>::max()) != field) {
+      throw runtime_error("field mismatch");
+    }
+    int64_t delta = unzigzag<int64_t>(receiveVarint());
+
+    int64_t &last = receivedFields[field];
+    last = pun<uint64_t, int64_t>(pun<int64_t, uint64_t>(last) +
+                                  pun<int64_t, uint64_t>(delta));
+    return last;
+  }
+
+  span<uint8_t const> bytes =
+      receive(FIELD_TAG, sizeof(uint16_t) + sizeof(uint64_t));
+  if (((static_cast<uint16_t>(bytes[0]) << 0) |
+       (static_cast<uint16_t>(bytes[1]) << 8)) != field) {
+    throw runtime_error("field mismatch");
+  }
+  uint64_t u = (static_cast<uint64_t>(bytes[2]) << 0) |
+               (static_cast<uint64_t>(bytes[3]) << 8) |
+               (static_cast<uint64_t>(bytes[4]) << 16) |
+               (static_cast<uint64_t>(bytes[5]) << 24) |
+               (static_cast<uint64_t>(bytes[6]) << 32) |
+               (static_cast<uint64_t>(bytes[7]) << 40) |
+               (static_cast<uint64_t>(bytes[8]) << 48) |
+               (static_cast<uint64_t>(bytes[9]) << 56);
+  return pun<uint64_t, int64_t>(u);
+}
+
+CryptoSocket::Ticket const &Socket::getTicket() const noexcept {
+  return cryptoSocket.getTicket();
+}
+
+Stats Socket::getStats() const noexcept { return cryptoSocket.getStats(); }
+
+span<uint8_t const> Socket::receive(uint8_t tag, size_t size) {
+  span<uint8_t const> bytes = cryptoSocket.peek(sizeof(uint8_t) + size);
+  if (bytes[0] != tag) {
     throw runtime_error("type tag mismatch");
   }
+  cryptoSocket.consume(sizeof(uint8_t) + size);
+  return bytes.subspan(sizeof(uint8_t), size);
+}
 
-  array<uint8_t, sizeof(uint8_t)> bytes;
-  cryptoSocket.read(bytes.data(), bytes.size());
+void Socket::sendVarint(uint8_t tag, uint64_t x) {
+  array<uint8_t, sizeof(uint8_t) + MAX_VARINT_SIZE> formatted;
+  formatted[0] = tag;
+  size_t size = 1 + encodeVarint(x, formatted.data() + 1);
 
-  x = bytes[0] != 0;
+  cryptoSocket.write(formatted.data(), size);
+}
+uint64_t Socket::receiveVarint(uint8_t tag, uint64_t max) {
+  receive(tag, 0);
 
-  return *this;
+  uint64_t x = receiveVarint();
+  if (x > max) {
+    throw runtime_error("value out of range");
+  }
+  return x;
+}
+uint64_t Socket::receiveVarint() {
+  uint64_t x = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    uint8_t byte = cryptoSocket.peek(sizeof(uint8_t))[0];
+    cryptoSocket.consume(sizeof(uint8_t));
+
+    x |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return x;
+    }
+  }
+  throw runtime_error("varint too long");
+}
+
+template <typename T>
+void Socket::sendArray(uint8_t elementTag, span<T const> xs) {
+  sendArrayHeader(elementTag, xs.size());
+  if constexpr (sizeof(T) == 1 || endian::native == endian::little) {
+    // already in wire order
+    cryptoSocket.write(reinterpret_cast<uint8_t const *>(xs.data()),
+                       xs.size_bytes());
+  } else {
+    // swap a block at a time - simple enough for the compiler to vectorize
+    array<T, SWAP_BLOCK_SIZE> block;
+    for (size_t start = 0; start < xs.size(); start += block.size()) {
+      size_t count = min(block.size(), xs.size() - start);
+      for (size_t idx = 0; idx < count; ++idx) {
+        block[idx] = byteswap(xs[start + idx]);
+      }
+      cryptoSocket.write(reinterpret_cast<uint8_t const *>(block.data()),
+                         count * sizeof(T));
+    }
+  }
+}
+void Socket::sendArrayHeader(uint8_t elementTag, size_t count) {
+  if (count > numeric_limits<uint32_t>::max()) {
+    throw runtime_error("array too long to send");
+  }
+
+  array<uint8_t, sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint32_t)>
+      formatted;
+  formatted[0] = ARRAY_TAG;
+  formatted[1] = elementTag;
+  formatted[2] = (count >> 0) & 0xff;
+  formatted[3] = (count >> 8) & 0xff;
+  formatted[4] = (count >> 16) & 0xff;
+  formatted[5] = (count >> 24) & 0xff;
+
+  cryptoSocket.write(formatted.data(), formatted.size());
+}
+template <typename T>
+void Socket::receiveArray(uint8_t elementTag, vector<T> &xs) {
+  uint32_t count = receiveArrayHeader(elementTag);
+
+  // grow the array as its elements arrive
+  cryptoSocket.expect(count * sizeof(T));
+  xs.clear();
+  size_t chunk = RECEIVE_CHUNK_SIZE / sizeof(T);
+  for (size_t start = 0; start < count; start += chunk) {
+    size_t size = min<size_t>(chunk, count - start);
+    xs.resize(start + size);
+    cryptoSocket.read(reinterpret_cast<uint8_t *>(xs.data() + start),
+                      size * sizeof(T));
+  }
+  if constexpr (sizeof(T) != 1 && endian::native != endian::little) {
+    for (T &x : xs) {
+      x = byteswap(x);
+    }
+  }
+}
+uint32_t Socket::receiveArrayHeader(uint8_t elementTag) {
+  span<uint8_t const> bytes =
+      cryptoSocket.peek(sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint32_t));
+  if (bytes[0] != ARRAY_TAG || bytes[1] != elementTag) {
+    throw runtime_error("type tag mismatch");
+  }
+
+  uint32_t count = (static_cast<uint32_t>(bytes[2]) << 0) |
+                   (static_cast<uint32_t>(bytes[3]) << 8) |
+                   (static_cast<uint32_t>(bytes[4]) << 16) |
+                   (static_cast<uint32_t>(bytes[5]) << 24);
+  cryptoSocket.consume(sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint32_t));
+  return count;
 }
 
 Socket::Socket(CryptoSocket cryptoSocket) noexcept
-    : cryptoSocket(move(cryptoSocket)) {}
+    : cryptoSocket(move(cryptoSocket)),
+      compact((this->cryptoSocket.getFeatures() &
+               CryptoSocket::COMPACT_INTEGERS) != 0),
+      sentFields(),
+      receivedFields() {}
 
-Server::Server(string const &password, stop_token const &stopFlag)
-    : cryptoServer(password, stopFlag) {}
+Server::Server(string const &password, stop_token const &stopFlag,
+               uint8_t features, ServerOptions const &options)
+    : cryptoServer(password, stopFlag, features, options) {}
 
 Socket Server::accept() { return Socket(cryptoServer.accept()); }
+
+Task<Socket> Server::asyncAccept() {
+  co_return Socket(co_await cryptoServer.asyncAccept());
+}
 }  // namespace nplanetary::networking
@@ -20,11 +20,17 @@
 #ifndef NPLANETARY_NETWORKING_NETWORKING_H_
 #define NPLANETARY_NETWORKING_NETWORKING_H_
 
+#include <array>
 #include <cstdint>
+#include <span>
+#include <stdexcept>
 #include <stop_token>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "networking/cryptoSocket.h"
+#include "networking/serializable.h"
 
 namespace nplanetary::networking {
 class Server;
@@ -43,9 +49,29 @@ class Socket {
   static constexpr uint8_t CHAR_TAG = 'c';
   static constexpr uint8_t STRING_TAG = 'C';
   static constexpr uint8_t BOOL_TAG = 'o';
+  static constexpr uint8_t ARRAY_TAG = 'a';
+  static constexpr uint8_t FIELD_TAG = 'f';
+  static constexpr uint8_t STRUCT_TAG = 'm';
 
+  /**
+   * Connects to a server
+   *
+   * If both sides offer CryptoSocket::COMPACT_INTEGERS, multi-byte integers
+   * are sent as LEB128 varints (zigzag encoded if signed) and fields are delta
+   * encoded
+   */
   Socket(std::string const &hostname, std::string const &password,
-         std::stop_token const &stopFlag);
+         std::stop_token const &stopFlag,
+         uint8_t features = CryptoSocket::ALL_FEATURES);
+  /**
+   * Reconnects to a server using a ticket from an earlier connection
+   *
+   * Falls back to a full handshake with the password if the server rejects
+   * the ticket
+   */
+  Socket(std::string const &hostname, CryptoSocket::Ticket const &ticket,
+         std::string const &password, std::stop_token const &stopFlag,
+         uint8_t features = CryptoSocket::ALL_FEATURES);
   Socket(Socket const &) noexcept = delete;
   Socket(Socket &&) noexcept = default;
 
@@ -66,8 +92,60 @@ class Socket {
   Socket &operator<<(std::string const &);
   Socket &operator<<(bool);
 
+  /**
+   * Sends a whole array at once
+   *
+   * The array is tagged once, followed by the element type's tag, a 32 bit
+   * count, and the packed little-endian elements
+   */
+  Socket &operator<<(std::span<uint8_t const>);
+  Socket &operator<<(std::span<uint16_t const>);
+  Socket &operator<<(std::span<uint32_t const>);
+  Socket &operator<<(std::span<uint64_t const>);
+  Socket &operator<<(std::span<int8_t const>);
+  Socket &operator<<(std::span<int16_t const>);
+  Socket &operator<<(std::span<int32_t const>);
+  Socket &operator<<(std::span<int64_t const>);
+  /**
+   * Sends many strings at once, each one as a 16 bit length and its characters
+   */
+  Socket &operator<<(std::span<std::string const>);
+  /**
+   * Sends a whole struct in one write
+   *
+   * The struct is tagged once, followed by a hash of its schema and then its
+   * packed fields, instead of tagging each field
+   */
+  template <Serializable T>
+  Socket &operator<<(T const &);
+
   void flush();
 
+  /**
+   * Sets how everything sent from now on is framed
+   */
+  void setFraming(Framing framing);
+  /**
+   * Runs build, which sends one message, under some framing, then flushes it
+   * and goes back to the previous framing
+   *
+   * Usage is `socket.message(Framing::IMMEDIATE, [&]() { socket << ack; });`
+   */
+  template <typename F>
+  void message(Framing framing, F build);
+  /**
+   * Sends one message to every recipient, serializing it once and encrypting
+   * it on the broadcaster's threads
+   *
+   * build is given a recipient to send the message to, and is run once for
+   * recipients with compact integers and once for those without. It must not
+   * send fields, since each recipient has its own last values. Usage is
+   * `Socket::broadcast(broadcaster, players, [&](Socket &s) { s << state; });`
+   */
+  template <typename F>
+  static void broadcast(Broadcaster &broadcaster,
+                        std::span<Socket *const> recipients, F build);
+
   Socket &operator>>(uint8_t &);
   Socket &operator>>(uint16_t &);
   Socket &operator>>(uint32_t &);
@@ -80,15 +158,109 @@ class Socket {
   Socket &operator>>(std::string &);
   Socket &operator>>(bool &);
 
+  Socket &operator>>(std::vector<uint8_t> &);
+  Socket &operator>>(std::vector<uint16_t> &);
+  Socket &operator>>(std::vector<uint32_t> &);
+  Socket &operator>>(std::vector<uint64_t> &);
+  Socket &operator>>(std::vector<int8_t> &);
+  Socket &operator>>(std::vector<int16_t> &);
+  Socket &operator>>(std::vector<int32_t> &);
+  Socket &operator>>(std::vector<int64_t> &);
+  Socket &operator>>(std::vector<std::string> &);
+  template <Serializable T>
+  Socket &operator>>(T &);
+
+  /**
+   * Sends the current value of some field identified by a caller-chosen id
+   *
+   * With compact integers, only the difference from the last value sent for
+   * the same field is sent; every field starts at zero
+   */
+  void sendField(uint16_t field, int64_t x);
+  /**
+   * Receives a value sent with sendField for the same field
+   */
+  int64_t receiveField(uint16_t field);
+
+  /**
+   * Receives a value, letting other tasks run while waiting for it
+   *
+   * Must be awaited by a task running on an Executor, as must every other
+   * async function; usage is `T x = co_await socket.read<T>();`
+   */
+  template <typename T>
+  Task<T> read();
+  /**
+   * Sends a value, letting other tasks run if it fills the send buffer
+   *
+   * x must outlive the task
+   */
+  template <typename T>
+  Task<void> write(T const &x);
+  Task<void> asyncFlush();
+
+  /**
+   * Ticket to reconnect to the server with; clients only
+   */
+  CryptoSocket::Ticket const &getTicket() const noexcept;
+  /**
+   * What this connection has done so far; zero unless NPLANETARY_STATS is
+   * defined
+   */
+  Stats getStats() const noexcept;
+
  private:
   explicit Socket(CryptoSocket cryptoSocket) noexcept;
 
+  /**
+   * Reads a value's tag and size bytes, checking the tag
+   *
+   * @returns the value's bytes, valid until the next read
+   */
+  std::span<uint8_t const> receive(uint8_t tag, size_t size);
+
+  /**
+   * Sends a tag followed by x as a varint
+   */
+  void sendVarint(uint8_t tag, uint64_t x);
+  /**
+   * Reads a tag followed by a varint, checking the tag and that the value is
+   * at most max
+   */
+  uint64_t receiveVarint(uint8_t tag, uint64_t max);
+  /**
+   * Reads an untagged varint
+   */
+  uint64_t receiveVarint();
+
+  template <typename T>
+  void sendArray(uint8_t elementTag, std::span<T const> xs);
+  /**
+   * Sends the array tag, element tag, and count
+   */
+  void sendArrayHeader(uint8_t elementTag, size_t count);
+  template <typename T>
+  void receiveArray(uint8_t elementTag, std::vector<T> &xs);
+  /**
+   * Reads an array header, checking both tags
+   *
+   * @returns number of elements in the array
+   */
+  uint32_t receiveArrayHeader(uint8_t elementTag);
+
   CryptoSocket cryptoSocket;
+
+  bool compact;
+  /** last value of each field sent and received */
+  std::unordered_map<uint16_t, int64_t> sentFields;
+  std::unordered_map<uint16_t, int64_t> receivedFields;
 };
 
 class Server {
  public:
-  explicit Server(std::string const &password, std::stop_token const &stopFlag);
+  explicit Server(std::string const &password, std::stop_token const &stopFlag,
+                  uint8_t features = CryptoSocket::ALL_FEATURES,
+                  ServerOptions const &options = ServerOptions());
   Server(Server const &) noexcept = delete;
   Server(Server &&) noexcept = default;
 
@@ -98,10 +270,85 @@ class Server {
   Server &operator=(Server &&) noexcept = default;
 
   Socket accept();
+  /**
+   * Accepts a connection, letting other tasks run while waiting
+   */
+  Task<Socket> asyncAccept();
 
  private:
   CryptoServer cryptoServer;
 };
+
+template <Serializable T>
+Socket &Socket::operator<<(T const &x) {
+  constexpr uint64_t hash = schema::hash<T>();
+
+  std::array<uint8_t,
+             sizeof(uint8_t) + sizeof(uint64_t) + schema::wireSize<T>()>
+      formatted;
+  formatted[0] = STRUCT_TAG;
+  uint8_t *out = schema::encode(hash, formatted.data() + 1);
+  schema::encode(x, out);
+
+  cryptoSocket.write(formatted.data(), formatted.size());
+  return *this;
+}
+template <Serializable T>
+Socket &Socket::operator>>(T &x) {
+  constexpr uint64_t hash = schema::hash<T>();
+
+  std::span<uint8_t const> bytes =
+      receive(STRUCT_TAG, sizeof(uint64_t) + schema::wireSize<T>());
+  uint64_t recvdHash;
+  uint8_t const *in = schema::decode(recvdHash, bytes.data());
+  if (recvdHash != hash) {
+    throw std::runtime_error("schema mismatch");
+  }
+  schema::decode(x, in);
+
+  return *this;
+}
+
+template <typename F>
+void Socket::message(Framing framing, F build) {
+  cryptoSocket.message(framing, build);
+}
+
+template <typename F>
+void Socket::broadcast(Broadcaster &broadcaster,
+                       std::span<Socket *const> recipients, F build) {
+  // recipients with and without compact integers need different encodings
+  for (bool compact : {true, false}) {
+    Socket *encoder = nullptr;
+    std::vector<CryptoSocket *> group;
+    for (Socket *recipient : recipients) {
+      if (recipient->compact == compact) {
+        if (encoder == nullptr) {
+          encoder = recipient;
+        }
+        group.push_back(&recipient->cryptoSocket);
+      }
+    }
+    if (encoder == nullptr) {
+      continue;
+    }
+
+    std::vector<uint8_t> message =
+        encoder->cryptoSocket.capture([&]() { build(*encoder); });
+    broadcaster.send(group, message);
+  }
+}
+
+template <typename T>
+Task<T> Socket::read() {
+  T x;
+  co_await cryptoSocket.asyncDecode([this, &x]() { *this >> x; });
+  co_return x;
+}
+template <typename T>
+Task<void> Socket::write(T const &x) {
+  co_await cryptoSocket.asyncEncode([this, &x]() { *this << x; });
+}
 }  // namespace nplanetary::networking
 
 #endif  // NPLANETARY_NETWORKING_NETWORKING_H_
@@ -25,21 +25,86 @@
 #error "OS not recognized/supported"
 #endif
 
+#include <sys/types.h>
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <span>
 #include <stop_token>
 #include <string>
 
+#include "networking/stats.h"
+#include "networking/task.h"
+
 namespace nplanetary::networking {
 constexpr uint16_t PORT = 0x4e50;
 
 class HangupFlag {};
+class TimeoutFlag {};
+
+#if defined(__linux__)
+/**
+ * An eventfd that becomes readable once a stop is requested
+ *
+ * Lets blocking waits sleep until either their fd is ready or they are
+ * cancelled, instead of waking up periodically to check the stop token
+ */
+class StopEvent {
+ public:
+  explicit StopEvent(std::stop_token const &stopFlag);
+  StopEvent(StopEvent const &) noexcept = delete;
+  StopEvent(StopEvent &&) noexcept;
+
+  ~StopEvent() noexcept;
+
+  StopEvent &operator=(StopEvent const &) noexcept = delete;
+  StopEvent &operator=(StopEvent &&) noexcept;
+
+  int getFD() const noexcept;
+
+ private:
+  struct Notify {
+    int fd;
+    void operator()() const noexcept;
+  };
+
+  int fd;
+  std::unique_ptr<std::stop_callback<Notify>> callback;
+};
+#endif
+
+class Reactor;
+class LocalRing;
+struct LocalPipe;
+class LocalListener;
+#if defined(NPLANETARY_IO_URING)
+class IoUring;
+#endif
 
 class RawServer;
 class RawSocket {
   friend class RawServer;
+  friend class Reactor;
 
  public:
+  /**
+   * A write to one of many sockets, see writeAll
+   */
+  struct Write {
+    RawSocket *socket;
+    uint8_t const *buf;
+    size_t count;
+  };
+
   /**
    * Create a socket connecting to some host
+   *
+   * The host may be followed by `:<port>` to connect to a port other than
+   * PORT, with IPv6 addresses in brackets, like `[::1]:1234`. A hostname of
+   * the form `unix:<path>` connects to a Unix domain socket,
+   * and one of the form `local:<name>` connects to a server in this process
+   * listening under that name, through memory instead of the kernel
    */
   explicit RawSocket(std::string const &hostname,
                      std::stop_token const &stopFlag);
@@ -52,6 +117,35 @@ class RawSocket {
   RawSocket &operator=(RawSocket &&) noexcept;
 
   operator bool() const noexcept;
+  /**
+   * Whether this is an in-process connection to a server that trusts them, so
+   * encryption may be skipped
+   */
+  bool isTrusted() const noexcept;
+
+  /**
+   * Makes reads and writes throw TimeoutFlag once the deadline passes
+   *
+   * Only applies to this socket's own reads and writes, not to writeAll
+   */
+  void setDeadline(std::chrono::steady_clock::time_point deadline) noexcept;
+  void clearDeadline() noexcept;
+  /**
+   * Cancels reads and writes on stopFlag instead of the current stop token
+   */
+  void setStopFlag(std::stop_token const &stopFlag);
+  /**
+   * Turns Nagle's algorithm off, so small writes are sent without waiting for
+   * earlier ones to be acknowledged
+   *
+   * Does nothing if the connection isn't over TCP, as does setCork
+   */
+  void setNoDelay(bool noDelay);
+  /**
+   * Holds back partial segments until uncorked, so many writes go out as few
+   * full segments
+   */
+  void setCork(bool cork);
 
   /**
    * Reads count bytes into buf
@@ -61,22 +155,95 @@ class RawSocket {
    * Writes count bytes from buf
    */
   void write(uint8_t const *buf, size_t count);
+  /**
+   * Writes each buffer in order, gathered into as few syscalls as possible
+   */
+  void write(std::span<std::span<uint8_t const> const> buffers);
+
+  /**
+   * Reads count bytes into buf, letting other tasks run while waiting
+   *
+   * Must be awaited by a task running on an Executor; ignores the deadline
+   */
+  Task<void> asyncRead(uint8_t *buf, size_t count);
+  /**
+   * Writes count bytes from buf, letting other tasks run while waiting
+   *
+   * Must be awaited by a task running on an Executor; ignores the deadline
+   */
+  Task<void> asyncWrite(uint8_t const *buf, size_t count);
+
+  /**
+   * Performs all writes, batching them into as few syscalls as possible
+   *
+   * Rethrows the first error encountered once every write has finished or
+   * failed
+   */
+  static void writeAll(std::span<Write const> writes);
+
+  /**
+   * What this connection has done so far; zero unless NPLANETARY_STATS is
+   * defined
+   */
+  Stats getStats() const noexcept;
+  /**
+   * Counters for the layers above to add what they do to
+   */
+  Counters &getCounters() noexcept;
 
  private:
 #if defined(__linux__)
-  explicit RawSocket(int fd, std::stop_token const &stopFlag) noexcept;
+  explicit RawSocket(int fd, std::stop_token const &stopFlag);
+  /**
+   * The server's end of an in-process connection
+   */
+  RawSocket(std::shared_ptr<LocalPipe> pipe, std::stop_token const &stopFlag);
 
   int fd;
   std::stop_token stopFlag;
+  StopEvent stopEvent;
+  std::optional<std::chrono::steady_clock::time_point> deadline;
 #endif
+  /** the connection, if in-process instead of over an fd */
+  std::shared_ptr<LocalPipe> pipe;
+  /** this end's directions of the pipe */
+  LocalRing *in;
+  LocalRing *out;
+  Counters counters;
+};
+
+/**
+ * Where and how a server listens
+ */
+struct ListenOptions {
+  /** connections the OS queues before they are accepted */
+  int backlog = 64;
+  /**
+   * host or address to listen on, or every interface if empty; or a Unix
+   * domain socket as `unix:<path>`, or in-process clients as `local:<name>`,
+   * see RawSocket
+   */
+  std::string address = "";
+  /** TCP port to listen on; zero picks a free one */
+  uint16_t port = PORT;
+  /**
+   * lets several servers, in any process, listen on the same port, with the
+   * kernel spreading connections between them; every one of them must set it
+   */
+  bool reusePort = false;
+  /** in-process clients may skip encryption */
+  bool trustLocal = false;
 };
 
 class RawServer {
+  friend class Reactor;
+
  public:
   /**
    * Create a server socket
    */
-  explicit RawServer(std::stop_token const &stopFlag);
+  explicit RawServer(std::stop_token const &stopFlag,
+                     ListenOptions const &options = ListenOptions());
   RawServer(RawServer const &) noexcept = delete;
   RawServer(RawServer &&) noexcept;
 
@@ -89,14 +256,35 @@ class RawServer {
    * Accepts a connection
    */
   RawSocket accept();
+  /**
+   * Accepts a connection, letting other tasks run while waiting
+   *
+   * Must be awaited by a task running on an Executor
+   */
+  Task<RawSocket> asyncAccept();
+
+  /**
+   * TCP port this is listening on, or zero if not listening over TCP
+   */
+  uint16_t getPort() const;
 
  private:
 #if defined(__linux__)
-  static constexpr int QUEUE_LENGTH = 4;
-
   int fd;
   std::stop_token stopFlag;
+  StopEvent stopEvent;
+  /** socket file to remove once closed, if on a Unix domain socket */
+  std::string unixPath;
+  /** identifies the socket file this server created */
+  dev_t unixDevice;
+  ino_t unixInode;
+#if defined(NPLANETARY_IO_URING)
+  /** accepts through io_uring if available */
+  std::unique_ptr<IoUring> ring;
+#endif
 #endif
+  /** accepts in-process connections instead, if listening for them */
+  std::unique_ptr<LocalListener> listener;
 };
 }  // namespace nplanetary::networking
 
@@ -20,34 +20,350 @@
 #if defined(__linux__)
 
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <cstring>
+#include <exception>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <thread>
 #include <utility>
+#include <vector>
 
+#include "networking/executor.h"
+#include "networking/ioUring.h"
+#include "networking/localPipe.h"
 #include "networking/rawSocket.h"
 
 using namespace std;
 using namespace std::chrono;
 
 namespace nplanetary::networking {
+namespace {
+constexpr char UNIX_PREFIX[] = "unix:";
+constexpr char LOCAL_PREFIX[] = "local:";
+
+/**
+ * If address starts with prefix, gets the rest of it
+ */
+optional<string> stripPrefix(string const &address, string const &prefix) {
+  if (address.compare(0, prefix.size(), prefix) != 0) {
+    return nullopt;
+  }
+  return address.substr(prefix.size());
+}
+
+/**
+ * Splits a hostname into its host and port, which defaults to PORT
+ */
+pair<string, string> splitPort(string const &hostname) {
+  if (hostname.starts_with('[')) {
+    // IPv6 address, maybe with a port
+    if (size_t end = hostname.find("]:"); end != string::npos) {
+      return {hostname.substr(1, end - 1), hostname.substr(end + 2)};
+    } else if (hostname.ends_with(']')) {
+      return {hostname.substr(1, hostname.size() - 2), to_string(PORT)};
+    }
+  } else if (size_t colon = hostname.find(':');
+             colon != string::npos && colon == hostname.rfind(':')) {
+    return {hostname.substr(0, colon), hostname.substr(colon + 1)};
+  }
+  // no port, or a bare IPv6 address
+  return {hostname, to_string(PORT)};
+}
+
+/**
+ * Builds the address of a Unix domain socket
+ */
+struct sockaddr_un unixAddress(string const &path) {
+  struct sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw runtime_error("socket path too long: "s + path);
+  }
+  copy(path.begin(), path.end(), address.sun_path);
+  return address;
+}
+
+/**
+ * Blocks until fd has one of the requested events or stopEvent fires
+ *
+ * Counts each poll against counters, if given
+ *
+ * @returns the events that happened to fd, or zero if only stopEvent fired
+ */
+short awaitEvents(int fd, short events, StopEvent const &stopEvent,
+                  optional<steady_clock::time_point> const &deadline,
+                  Counters *counters, string const &errorPrefix) {
+  array<struct pollfd, 2> polled = {{
+      {.fd = fd, .events = events, .revents = 0},
+      {.fd = stopEvent.getFD(), .events = POLLIN, .revents = 0},
+  }};
+  while (true) {
+    int timeout = -1;
+    if (deadline.has_value()) {
+      auto remaining = ceil<milliseconds>(*deadline - steady_clock::now());
+      if (remaining.count() <= 0) {
+        throw TimeoutFlag();
+      }
+      timeout = static_cast<int>(min<milliseconds::rep>(
+          remaining.count(), numeric_limits<int>::max()));
+    }
+
+    int retval = poll(polled.data(), polled.size(), timeout);
+    if (counters != nullptr) {
+      counters->addSyscall();
+    }
+    if (retval > 0) {
+      return polled[0].revents;
+    } else if (retval == -1 && errno != EINTR) {
+      throw runtime_error(errorPrefix + strerror(errno));
+    }
+    // timed out or interrupted - check the deadline again
+  }
+}
+
+/**
+ * Sends a message once the socket is writable, possibly partially
+ *
+ * Never blocks past the deadline or a stop request: the send itself doesn't
+ * wait, so callers go back to polling when it would have
+ *
+ * @returns bytes sent, or a negated errno; -EAGAIN if woken up to be cancelled
+ * or if there was no room after all
+ */
+ssize_t sendWhenWritable(int fd, struct msghdr const &message,
+                         StopEvent const &stopEvent,
+                         optional<steady_clock::time_point> const &deadline,
+                         Counters &counters) {
+  // wait for output
+  short revents = awaitEvents(fd, POLLOUT, stopEvent, deadline, &counters,
+                              "could not write to socket: ");
+  if (revents == 0) {
+    // woken up to be cancelled
+    return -EAGAIN;
+  } else if ((revents & POLLERR) != 0) {
+    // socket error
+    int error;
+    socklen_t optlen = sizeof(int);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &optlen);
+    throw runtime_error("could not write to socket: socket error: "s +
+                        strerror(error));
+  } else if ((revents & POLLNVAL) != 0) {
+    // polling error
+    throw runtime_error("invalid fd: "s + to_string(fd));
+  } else if ((revents & POLLHUP) != 0) {
+    // disconnected
+    throw HangupFlag();
+  }
+
+  // connected sockets block, so don't wait for all of it to be queued
+  ssize_t retval = sendmsg(fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+  counters.addSyscall();
+  return retval != -1 ? retval : -errno;
+}
+
+/**
+ * Whether accept failed because of the connection rather than the server
+ */
+bool acceptRetryable(int error) noexcept {
+  switch (error) {
+    case EAGAIN:
+    case EINTR:
+    case ECONNABORTED:
+    case ENETDOWN:
+    case EPROTO:
+    case ENOPROTOOPT:
+    case EHOSTDOWN:
+    case ENONET:
+    case EHOSTUNREACH:
+    case EOPNOTSUPP:
+    case ENETUNREACH: {
+      return true;
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+/**
+ * Binds a TCP socket on some host, or every interface if it's empty
+ *
+ * @returns the socket, which is nonblocking so accept never waits
+ */
+int bindTCP(string const &host, uint16_t port, bool reusePort) {
+  int fd = 0;
+
+  // setup for bind lookup
+  struct addrinfo hints = {};
+  hints.ai_flags = AI_PASSIVE | AI_V4MAPPED | AI_ADDRCONFIG | AI_NUMERICSERV;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  string portString = to_string(port);
+  struct addrinfo *rawResult;
+  if (int retval = getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                               portString.c_str(), &hints, &rawResult);
+      retval != 0) {
+    throw runtime_error("could not search for bindable socket: "s +
+                        gai_strerror(retval));
+  }
+  unique_ptr<struct addrinfo, decltype(&freeaddrinfo)> result =
+      unique_ptr<struct addrinfo, decltype(&freeaddrinfo)>(rawResult,
+                                                           freeaddrinfo);
+
+  // try each result in sequence
+  for (struct addrinfo const *candidate = result.get(); candidate != nullptr;
+       candidate = candidate->ai_next) {
+    if (fd = socket(candidate->ai_family,
+                    candidate->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                    candidate->ai_protocol);
+        fd == -1) {
+      continue;
+    }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(int));
+    if (reusePort &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(int)) == -1) {
+      int error = errno;
+      close(fd);
+      throw runtime_error("could not set SO_REUSEPORT: "s + strerror(error));
+    }
+
+    if (bind(fd, candidate->ai_addr, candidate->ai_addrlen) != -1) {
+      break;
+    }
+
+    close(fd);
+    fd = 0;
+  }
+
+  if (fd == 0) {
+    // failed to bind
+    throw runtime_error("could not bind to socket");
+  }
+  return fd;
+}
+
+/**
+ * Binds a Unix domain socket, replacing any socket file left at path
+ *
+ * @param bound set to the status of the socket file bound
+ * @returns the socket, which is nonblocking so accept never waits
+ */
+int bindUnix(string const &path, struct stat &bound) {
+  struct sockaddr_un address = unixAddress(path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd == -1) {
+    throw runtime_error("could not create socket: "s + strerror(errno));
+  }
+
+  // a server that didn't shut down cleanly leaves its socket file behind -
+  // but anything else at path isn't ours to remove
+  if (lstat(path.c_str(), &bound) == 0 && S_ISSOCK(bound.st_mode)) {
+    unlink(path.c_str());
+  }
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&address),
+           sizeof(address)) == -1 ||
+      lstat(path.c_str(), &bound) == -1) {
+    int error = errno;
+    close(fd);
+    throw runtime_error("could not bind to unix:"s + path + ": " +
+                        strerror(error));
+  }
+  return fd;
+}
+}  // namespace
+
+StopEvent::StopEvent(stop_token const &stopFlag)
+    : fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)), callback() {
+  if (fd == -1) {
+    fd = 0;
+    throw runtime_error("could not create eventfd: "s + strerror(errno));
+  }
+  callback = make_unique<stop_callback<Notify>>(stopFlag, Notify{fd});
+}
+
+StopEvent::StopEvent(StopEvent &&other) noexcept
+    : fd(other.fd), callback(move(other.callback)) {
+  other.fd = 0;
+}
+
+StopEvent::~StopEvent() noexcept {
+  // deregister before closing so a racing stop can't write to a closed fd
+  callback.reset();
+  if (fd != 0) {
+    close(fd);
+  }
+}
+
+StopEvent &StopEvent::operator=(StopEvent &&other) noexcept {
+  swap(fd, other.fd);
+  swap(callback, other.callback);
+  return *this;
+}
+
+int StopEvent::getFD() const noexcept { return fd; }
+
+void StopEvent::Notify::operator()() const noexcept { eventfd_write(fd, 1); }
+
 RawSocket::RawSocket(string const &hostname, stop_token const &stopFlag)
-    : fd(0), stopFlag(stopFlag) {
+    : fd(0),
+      stopFlag(stopFlag),
+      stopEvent(stopFlag),
+      deadline(),
+      pipe(),
+      in(nullptr),
+      out(nullptr),
+      counters() {
+  if (optional<string> name = stripPrefix(hostname, LOCAL_PREFIX);
+      name.has_value()) {
+    pipe = LocalListener::connect(*name);
+    in = &pipe->toClient;
+    out = &pipe->toServer;
+    return;
+  } else if (optional<string> path = stripPrefix(hostname, UNIX_PREFIX);
+             path.has_value()) {
+    struct sockaddr_un address = unixAddress(*path);
+    if (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0); fd == -1) {
+      fd = 0;
+      throw runtime_error("could not create socket: "s + strerror(errno));
+    }
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&address),
+                sizeof(address)) == -1) {
+      int error = errno;
+      close(fd);
+      fd = 0;
+      throw runtime_error("could not connect to "s + hostname + ": " +
+                          strerror(error));
+    }
+    return;
+  }
+
   // do DNS lookup
   struct addrinfo hints = {};
   hints.ai_flags = AI_V4MAPPED | AI_ADDRCONFIG | AI_IDN | AI_NUMERICSERV;
   hints.ai_family = AF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
-  string portString = to_string(PORT);
+  auto [host, portString] = splitPort(hostname);
   struct addrinfo *rawResult;
   if (int retval =
-          getaddrinfo(hostname.c_str(), portString.c_str(), &hints, &rawResult);
+          getaddrinfo(host.c_str(), portString.c_str(), &hints, &rawResult);
       retval != 0) {
     throw runtime_error("could not lookup host: "s + gai_strerror(retval));
   }
@@ -78,10 +394,15 @@ RawSocket::RawSocket(string const &hostname, stop_token const &stopFlag)
   }
 }
 
-RawSocket::RawSocket(RawSocket &&other) noexcept {
-  fd = other.fd;
-  stopFlag = other.stopFlag;
-
+RawSocket::RawSocket(RawSocket &&other) noexcept
+    : fd(other.fd),
+      stopFlag(other.stopFlag),
+      stopEvent(move(other.stopEvent)),
+      deadline(other.deadline),
+      pipe(move(other.pipe)),
+      in(other.in),
+      out(other.out),
+      counters(move(other.counters)) {
   other.fd = 0;
 }
 
@@ -89,90 +410,145 @@ RawSocket::~RawSocket() noexcept {
   if (fd != 0) {
     close(fd);
   }
+  if (pipe != nullptr) {
+    pipe->close();
+  }
 }
 
 RawSocket &RawSocket::operator=(RawSocket &&other) noexcept {
   swap(fd, other.fd);
   stopFlag = other.stopFlag;
+  swap(stopEvent, other.stopEvent);
+  deadline = other.deadline;
+  swap(pipe, other.pipe);
+  swap(in, other.in);
+  swap(out, other.out);
+  swap(counters, other.counters);
   return *this;
 }
 
-RawSocket::operator bool() const noexcept { return fd != 0; }
+RawSocket::operator bool() const noexcept { return fd != 0 || pipe != nullptr; }
+
+bool RawSocket::isTrusted() const noexcept {
+  return pipe != nullptr && pipe->trusted;
+}
+
+void RawSocket::setDeadline(steady_clock::time_point deadline) noexcept {
+  this->deadline = deadline;
+}
+
+void RawSocket::clearDeadline() noexcept { deadline = nullopt; }
+
+void RawSocket::setStopFlag(stop_token const &stopFlag) {
+  stopEvent = StopEvent(stopFlag);
+  this->stopFlag = stopFlag;
+}
+
+void RawSocket::setNoDelay(bool noDelay) {
+  if (pipe != nullptr) {
+    return;
+  }
+
+  int value = noDelay;
+  counters.addSyscall();
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) == -1 &&
+      errno != EOPNOTSUPP) {
+    throw runtime_error("could not set TCP_NODELAY: "s + strerror(errno));
+  }
+}
+
+void RawSocket::setCork(bool cork) {
+  if (pipe != nullptr) {
+    return;
+  }
+
+  int value = cork;
+  counters.addSyscall();
+  if (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == -1 &&
+      errno != EOPNOTSUPP) {
+    throw runtime_error("could not set TCP_CORK: "s + strerror(errno));
+  }
+}
 
 void RawSocket::read(uint8_t *buf, size_t count) {
-  // cancel on this if need be
-  if (stopFlag.stop_requested()) {
-    throw stopFlag;
+  if (pipe != nullptr) {
+    in->read(buf, count, stopFlag, stopEvent, deadline, counters);
+    return;
   }
 
-  // poll fd for input
-  struct pollfd polled {
-    .fd = fd, .events = POLLIN, .revents = 0,
-  };
-  switch (poll(&polled, 1, 10)) {
-    case 1: {
-      // something happened to fd
-      if ((polled.revents & POLLERR) != 0) {
-        // socket error
-        int error;
-        socklen_t optlen = sizeof(int);
-        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &optlen);
-        throw runtime_error("could not read from socket: socket error: "s +
-                            strerror(error));
-      } else if ((polled.revents & POLLNVAL) != 0) {
-        // polling error
-        throw runtime_error("invalid fd: "s + to_string(fd));
-      } else if ((polled.revents & POLLIN) != 0) {
-        // can read
-        ssize_t retval = ::read(fd, buf, count);
-        if (retval == 0) {
-          // end of data
-          throw HangupFlag();
-        } else if (retval != -1) {
-          if (retval == count) {
-            // read all data
-            return;
-          } else {
-            // more data left
-            buf += retval;
-            count -= retval;
-            return read(buf, count);
-          }
-        } else {
-          // error
-          int error = errno;
-          switch (error) {
-            case EAGAIN:
-            case EINTR: {
-              // retry
-              return read(buf, count);
-            }
-            case EPIPE: {
-              // hangup
-              throw HangupFlag();
-            }
-            default: {
-              throw runtime_error("could not read from socket: "s +
-                                  strerror(error));
-            }
-          }
-        }
-      } else {
-        // hangup, no data left
-        throw HangupFlag();
-      }
+#if defined(NPLANETARY_IO_URING)
+  if (IoUring *ring = IoUring::forThread();
+      ring != nullptr && !deadline.has_value()) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
     }
-    case 0: {
-      // nothing happened; retry
-      return read(buf, count);
+    ring->read(fd, buf, count, stopEvent, stopFlag);
+    counters.addSyscall();
+    counters.addBytesIn(count);
+    return;
+  }
+#endif
+
+  while (true) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
     }
-    case -1: {
+
+    // wait for input
+    short revents = awaitEvents(fd, POLLIN, stopEvent, deadline, &counters,
+                                "could not read from socket: ");
+    if (revents == 0) {
+      // woken up to be cancelled
+      counters.addEmptyWakeup();
+      continue;
+    } else if ((revents & POLLERR) != 0) {
+      // socket error
+      int error;
+      socklen_t optlen = sizeof(int);
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &optlen);
+      throw runtime_error("could not read from socket: socket error: "s +
+                          strerror(error));
+    } else if ((revents & POLLNVAL) != 0) {
+      // polling error
+      throw runtime_error("invalid fd: "s + to_string(fd));
+    } else if ((revents & POLLIN) == 0) {
+      // hangup, no data left
+      throw HangupFlag();
+    }
+
+    // can read, but don't block if the data went away in the meantime
+    ssize_t retval = recv(fd, buf, count, MSG_DONTWAIT);
+    counters.addSyscall();
+    if (retval == 0) {
+      // end of data
+      throw HangupFlag();
+    } else if (retval != -1) {
+      counters.addBytesIn(static_cast<uint64_t>(retval));
+      if (static_cast<size_t>(retval) == count) {
+        // read all data
+        return;
+      }
+      // more data left
+      buf += retval;
+      count -= static_cast<size_t>(retval);
+    } else {
       // error
       int error = errno;
       switch (error) {
+        case EAGAIN: {
+          // woken up with nothing to read
+          counters.addEmptyWakeup();
+          break;
+        }
         case EINTR: {
-          // interrupted by signal; retry
-          return read(buf, count);
+          // retry
+          break;
+        }
+        case EPIPE: {
+          // hangup
+          throw HangupFlag();
         }
         default: {
           throw runtime_error("could not read from socket: "s +
@@ -180,242 +556,511 @@ void RawSocket::read(uint8_t *buf, size_t count) {
         }
       }
     }
-    default: {
-      abort();
-    }
   }
 }
 
 void RawSocket::write(uint8_t const *buf, size_t count) {
-  // cancel on this if need be
-  if (stopFlag.stop_requested()) {
-    throw stopFlag;
+  if (pipe != nullptr) {
+    out->write(buf, count, stopFlag, stopEvent, deadline, counters);
+    return;
   }
 
-  // poll fd for output
-  struct pollfd polled {
-    .fd = fd, .events = POLLOUT, .revents = 0,
+#if defined(NPLANETARY_IO_URING)
+  if (IoUring *ring = IoUring::forThread();
+      ring != nullptr && !deadline.has_value()) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
+    ring->write(fd, buf, count, stopEvent, stopFlag);
+    counters.addSyscall();
+    counters.addBytesOut(count);
+    return;
+  }
+#endif
+
+  struct iovec iov = {
+      .iov_base = const_cast<uint8_t *>(buf),
+      .iov_len = count,
   };
-  switch (poll(&polled, 1, 10)) {
-    case 1: {
-      // something happened to fd
-      if ((polled.revents & POLLERR) != 0) {
-        // socket error
-        int error;
-        socklen_t optlen = sizeof(int);
-        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &optlen);
-        throw runtime_error("could not write to socket: socket error: "s +
-                            strerror(error));
-      } else if ((polled.revents & POLLNVAL) != 0) {
-        // polling error
-        throw runtime_error("invalid fd: "s + to_string(fd));
-      } else if ((polled.revents & POLLHUP) != 0) {
-        // disconnected
-        throw HangupFlag();
-      } else {
-        // can write
-        ssize_t retval = ::write(fd, buf, count);
-        if (retval != -1) {
-          if (retval == count) {
-            // wrote all data
-            return;
-          } else {
-            // more data left
-            buf += retval;
-            count -= retval;
-            return write(buf, count);
-          }
-        } else {
-          // error
-          int error = errno;
-          switch (error) {
-            case EAGAIN:
-            case EINTR: {
-              // retry
-              return write(buf, count);
-            }
-            case EPIPE: {
-              // hangup
-              throw HangupFlag();
-            }
-            default: {
-              throw runtime_error("could not write to socket: "s +
-                                  strerror(error));
-            }
-          }
+  struct msghdr message = {};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  while (true) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
+
+    ssize_t retval =
+        sendWhenWritable(fd, message, stopEvent, deadline, counters);
+    if (retval >= 0) {
+      counters.addBytesOut(static_cast<uint64_t>(retval));
+      if (static_cast<size_t>(retval) == iov.iov_len) {
+        // wrote all data
+        return;
+      }
+      // more data left
+      iov.iov_base = static_cast<uint8_t *>(iov.iov_base) + retval;
+      iov.iov_len -= static_cast<size_t>(retval);
+    } else {
+      switch (-retval) {
+        case EAGAIN: {
+          // woken up without room to write
+          counters.addEmptyWakeup();
+          break;
+        }
+        case EINTR: {
+          // retry
+          break;
+        }
+        case EPIPE: {
+          // hangup
+          throw HangupFlag();
+        }
+        default: {
+          throw runtime_error("could not write to socket: "s +
+                              strerror(static_cast<int>(-retval)));
         }
       }
     }
-    case 0: {
-      // nothing happened; retry
-      return write(buf, count);
+  }
+}
+
+void RawSocket::write(span<span<uint8_t const> const> buffers) {
+  if (pipe != nullptr) {
+    // no syscalls to save
+    for (span<uint8_t const> buffer : buffers) {
+      out->write(buffer.data(), buffer.size(), stopFlag, stopEvent, deadline,
+                 counters);
     }
-    case -1: {
-      // error
-      int error = errno;
-      switch (error) {
+    return;
+  }
+
+  vector<struct iovec> iovecs;
+  iovecs.reserve(buffers.size());
+  for (span<uint8_t const> buffer : buffers) {
+    if (!buffer.empty()) {
+      iovecs.push_back(iovec{
+          .iov_base = const_cast<uint8_t *>(buffer.data()),
+          .iov_len = buffer.size(),
+      });
+    }
+  }
+
+  size_t first = 0;
+  while (first != iovecs.size()) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
+
+    struct msghdr message = {};
+    message.msg_iov = iovecs.data() + first;
+    message.msg_iovlen = iovecs.size() - first;
+
+    ssize_t retval;
+#if defined(NPLANETARY_IO_URING)
+    if (IoUring *ring = IoUring::forThread();
+        ring != nullptr && !deadline.has_value()) {
+      retval = ring->sendMessage(fd, &message, stopEvent, stopFlag);
+      counters.addSyscall();
+    } else {
+      retval = sendWhenWritable(fd, message, stopEvent, deadline, counters);
+    }
+#else
+    retval = sendWhenWritable(fd, message, stopEvent, deadline, counters);
+#endif
+
+    if (retval >= 0) {
+      counters.addBytesOut(static_cast<uint64_t>(retval));
+      // skip past what was written
+      size_t written = static_cast<size_t>(retval);
+      while (first != iovecs.size() && written >= iovecs[first].iov_len) {
+        written -= iovecs[first].iov_len;
+        ++first;
+      }
+      if (first != iovecs.size()) {
+        iovecs[first].iov_base =
+            static_cast<uint8_t *>(iovecs[first].iov_base) + written;
+        iovecs[first].iov_len -= written;
+      }
+    } else {
+      switch (-retval) {
+        case EAGAIN: {
+          // woken up without room to write
+          counters.addEmptyWakeup();
+          break;
+        }
         case EINTR: {
-          // interrupted by signal; retry
-          return write(buf, count);
+          // retry
+          break;
+        }
+        case EPIPE: {
+          // hangup
+          throw HangupFlag();
         }
         default: {
-          throw runtime_error("could not write to socket: "s + strerror(error));
+          throw runtime_error("could not write to socket: "s +
+                              strerror(static_cast<int>(-retval)));
         }
       }
     }
-    default: {
-      abort();
-    }
   }
 }
 
-RawSocket::RawSocket(int fd, stop_token const &stopFlag) noexcept
-    : fd(fd), stopFlag(stopFlag) {}
+Task<void> RawSocket::asyncRead(uint8_t *buf, size_t count) {
+  if (pipe != nullptr) {
+    co_await in->asyncRead(buf, count, stopFlag, stopEvent, counters);
+    co_return;
+  }
+
+  bool woken = false;
+  while (count != 0) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
 
-RawServer::RawServer(stop_token const &stopFlag) : fd(0), stopFlag(stopFlag) {
-  // setup for bind lookup
-  struct addrinfo hints = {};
-  hints.ai_flags = AI_PASSIVE | AI_V4MAPPED | AI_ADDRCONFIG | AI_NUMERICSERV;
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-  string portString = to_string(PORT);
-  struct addrinfo *rawResult;
-  if (int retval = getaddrinfo(nullptr, portString.c_str(), &hints, &rawResult);
-      retval != 0) {
-    throw runtime_error("could not search for bindable socket: "s +
-                        gai_strerror(retval));
+    ssize_t retval = recv(fd, buf, count, MSG_DONTWAIT);
+    counters.addSyscall();
+    if (retval == 0) {
+      // end of data
+      throw HangupFlag();
+    } else if (retval != -1) {
+      // more data left
+      counters.addBytesIn(static_cast<uint64_t>(retval));
+      buf += retval;
+      count -= static_cast<size_t>(retval);
+    } else if (int error = errno; error == EAGAIN) {
+      if (woken) {
+        counters.addEmptyWakeup();
+      }
+      // nothing yet - let other tasks run until there is
+      co_await Executor::Wait(fd, EPOLLIN, stopEvent);
+      woken = true;
+    } else if (error == EPIPE) {
+      // hangup
+      throw HangupFlag();
+    } else if (error != EINTR) {
+      throw runtime_error("could not read from socket: "s + strerror(error));
+    }
   }
-  unique_ptr<struct addrinfo, decltype(&freeaddrinfo)> result =
-      unique_ptr<struct addrinfo, decltype(&freeaddrinfo)>(rawResult,
-                                                           freeaddrinfo);
+}
 
-  // try each result in sequence
-  for (struct addrinfo const *candidate = result.get(); candidate != nullptr;
-       candidate = candidate->ai_next) {
-    if (fd = socket(candidate->ai_family, candidate->ai_socktype | SOCK_CLOEXEC,
-                    candidate->ai_protocol);
-        fd == -1) {
-      continue;
+Task<void> RawSocket::asyncWrite(uint8_t const *buf, size_t count) {
+  if (pipe != nullptr) {
+    co_await out->asyncWrite(buf, count, stopFlag, stopEvent, counters);
+    co_return;
+  }
+
+  bool woken = false;
+  while (count != 0) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
     }
 
-    int one = 1;
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(int));
+    ssize_t retval = send(fd, buf, count, MSG_DONTWAIT | MSG_NOSIGNAL);
+    counters.addSyscall();
+    if (retval != -1) {
+      // more data left
+      counters.addBytesOut(static_cast<uint64_t>(retval));
+      buf += retval;
+      count -= static_cast<size_t>(retval);
+    } else if (int error = errno; error == EAGAIN) {
+      if (woken) {
+        counters.addEmptyWakeup();
+      }
+      // buffer full - let other tasks run until there's space
+      co_await Executor::Wait(fd, EPOLLOUT, stopEvent);
+      woken = true;
+    } else if (error == EPIPE) {
+      // hangup
+      throw HangupFlag();
+    } else if (error != EINTR) {
+      throw runtime_error("could not write to socket: "s + strerror(error));
+    }
+  }
+}
 
-    if (bind(fd, candidate->ai_addr, candidate->ai_addrlen) != -1) {
-      break;
+void RawSocket::writeAll(span<Write const> writes) {
+#if defined(NPLANETARY_IO_URING)
+  if (IoUring *ring = IoUring::forThread(); ring != nullptr) {
+    // in-process sockets have no syscalls to batch
+    exception_ptr error = nullptr;
+    vector<IoUring::Write> batch;
+    batch.reserve(writes.size());
+    for (Write const &write : writes) {
+      if (write.socket->pipe != nullptr) {
+        try {
+          write.socket->write(write.buf, write.count);
+        } catch (...) {
+          if (error == nullptr) {
+            error = current_exception();
+          }
+        }
+        continue;
+      }
+      batch.push_back(IoUring::Write{
+          .fd = write.socket->fd,
+          .buf = write.buf,
+          .count = write.count,
+          .stopEvent = &write.socket->stopEvent,
+          .stopFlag = &write.socket->stopFlag,
+      });
+    }
+    try {
+      ring->writeAll(batch);
+      for (Write const &write : writes) {
+        if (write.socket->pipe == nullptr) {
+          write.socket->counters.addSyscall();
+          write.socket->counters.addBytesOut(write.count);
+        }
+      }
+    } catch (...) {
+      if (error == nullptr) {
+        error = current_exception();
+      }
     }
+    if (error != nullptr) {
+      rethrow_exception(error);
+    }
+    return;
+  }
+#endif
 
-    close(fd);
-    fd = 0;
+  // no batching available - write one by one
+  exception_ptr error = nullptr;
+  for (Write const &write : writes) {
+    try {
+      write.socket->write(write.buf, write.count);
+    } catch (...) {
+      if (error == nullptr) {
+        error = current_exception();
+      }
+    }
   }
+  if (error != nullptr) {
+    rethrow_exception(error);
+  }
+}
 
-  if (fd == 0) {
-    // failed to bind
-    throw runtime_error("could not bind to socket");
+Stats RawSocket::getStats() const noexcept { return counters.snapshot(); }
+
+Counters &RawSocket::getCounters() noexcept { return counters; }
+
+RawSocket::RawSocket(int fd, stop_token const &stopFlag)
+    : fd(fd),
+      stopFlag(stopFlag),
+      stopEvent(stopFlag),
+      deadline(),
+      pipe(),
+      in(nullptr),
+      out(nullptr),
+      counters() {}
+
+RawSocket::RawSocket(shared_ptr<LocalPipe> pipe, stop_token const &stopFlag)
+    : fd(0),
+      stopFlag(stopFlag),
+      stopEvent(stopFlag),
+      deadline(),
+      pipe(move(pipe)),
+      in(&this->pipe->toServer),
+      out(&this->pipe->toClient),
+      counters() {}
+
+RawServer::RawServer(stop_token const &stopFlag,
+                     ListenOptions const &options)
+    : fd(0),
+      stopFlag(stopFlag),
+      stopEvent(stopFlag),
+      unixPath(),
+      unixDevice(0),
+      unixInode(0),
+#if defined(NPLANETARY_IO_URING)
+      ring(),
+#endif
+      listener() {
+  if (optional<string> name = stripPrefix(options.address, LOCAL_PREFIX);
+      name.has_value()) {
+    listener = make_unique<LocalListener>(*name, options.trustLocal);
+    return;
+  } else if (optional<string> path = stripPrefix(options.address, UNIX_PREFIX);
+             path.has_value()) {
+    struct stat bound;
+    fd = bindUnix(*path, bound);
+    unixPath = *path;
+    unixDevice = bound.st_dev;
+    unixInode = bound.st_ino;
+  } else {
+    fd = bindTCP(options.address, options.port, options.reusePort);
   }
 
   // listen on socket
-  if (int retval = listen(fd, QUEUE_LENGTH); retval != 0) {
+  if (int retval = listen(fd, options.backlog); retval != 0) {
     close(fd);
     throw runtime_error("could not listen on socket: "s + strerror(errno));
   }
-}
 
-RawServer::RawServer(RawServer &&other) noexcept {
-  fd = other.fd;
-  stopFlag = other.stopFlag;
+#if defined(NPLANETARY_IO_URING)
+  if (IoUring::available()) {
+    ring = make_unique<IoUring>();
+  }
+#endif
+}
 
+RawServer::RawServer(RawServer &&other) noexcept
+    : fd(other.fd),
+      stopFlag(other.stopFlag),
+      stopEvent(move(other.stopEvent)),
+      unixPath(move(other.unixPath)),
+      unixDevice(other.unixDevice),
+      unixInode(other.unixInode),
+#if defined(NPLANETARY_IO_URING)
+      ring(move(other.ring)),
+#endif
+      listener(move(other.listener)) {
   other.fd = 0;
+  other.unixPath.clear();
 }
 
 RawServer::~RawServer() noexcept {
+#if defined(NPLANETARY_IO_URING)
+  if (ring != nullptr) {
+    // outstanding accepts keep the socket listening, even once closed
+    ring->stopAccepting();
+  }
+#endif
   if (fd != 0) close(fd);
+  // another server may have replaced our socket file since
+  struct stat status;
+  if (!unixPath.empty() && lstat(unixPath.c_str(), &status) == 0 &&
+      S_ISSOCK(status.st_mode) && status.st_dev == unixDevice &&
+      status.st_ino == unixInode) {
+    unlink(unixPath.c_str());
+  }
 }
 
 RawServer &RawServer::operator=(RawServer &&other) noexcept {
   swap(fd, other.fd);
   stopFlag = other.stopFlag;
+  swap(stopEvent, other.stopEvent);
+  swap(unixPath, other.unixPath);
+  swap(unixDevice, other.unixDevice);
+  swap(unixInode, other.unixInode);
+#if defined(NPLANETARY_IO_URING)
+  swap(ring, other.ring);
+#endif
+  swap(listener, other.listener);
   return *this;
 }
 
 RawSocket RawServer::accept() {
-  // cancel on this if need be
-  if (stopFlag.stop_requested()) {
-    throw stopFlag;
+  if (listener != nullptr) {
+    return RawSocket(listener->accept(stopFlag, stopEvent), stopFlag);
   }
 
-  // poll fd for input
-  struct pollfd polled {
-    .fd = fd, .events = POLLIN, .revents = 0,
-  };
-  switch (poll(&polled, 1, 10)) {
-    case 1: {
-      // something happened to fd
-      if ((polled.revents & POLLERR) != 0) {
-        // socket error
-        int error;
-        socklen_t optlen = sizeof(int);
-        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &optlen);
-        throw runtime_error("could not accept on socket: socket error: "s +
-                            strerror(error));
-      } else if ((polled.revents & POLLNVAL) != 0) {
-        // polling error
-        throw runtime_error("invalid fd: "s + to_string(fd));
-      } else if ((polled.revents & POLLIN) != 0) {
-        // can accept
-        int connFD = ::accept(fd, nullptr, nullptr);
-        if (connFD != -1) {
-          // got a socket
-          return RawSocket(connFD, stopFlag);
-        } else {
-          // error
-          int error = errno;
-          switch (error) {
-            case EAGAIN:
-            case EINTR:
-            case ECONNABORTED:
-            case ENETDOWN:
-            case EPROTO:
-            case ENOPROTOOPT:
-            case EHOSTDOWN:
-            case ENONET:
-            case EHOSTUNREACH:
-            case EOPNOTSUPP:
-            case ENETUNREACH: {
-              // retry
-              return accept();
-            }
-            default: {
-              throw runtime_error("could not read from socket: "s +
-                                  strerror(error));
-            }
-          }
-        }
-      } else {
-        // hangup - this shouldn't happen
-        throw runtime_error("hangup on passive socket");
-      }
+#if defined(NPLANETARY_IO_URING)
+  if (ring != nullptr) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
     }
-    case 0: {
-      // nothing happened; retry
-      return accept();
+    return RawSocket(ring->accept(fd, stopEvent, stopFlag), stopFlag);
+  }
+#endif
+
+  while (true) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
     }
-    case -1: {
-      // error
-      int error = errno;
-      switch (error) {
-        case EINTR: {
-          // interrupted by signal; retry
-          return accept();
-        }
-        default: {
-          throw runtime_error("could not accept on socket: "s +
-                              strerror(error));
-        }
-      }
+
+    // wait for input
+    short revents = awaitEvents(fd, POLLIN, stopEvent, nullopt, nullptr,
+                                "could not accept on socket: ");
+    if (revents == 0) {
+      // woken up to be cancelled
+      continue;
+    } else if ((revents & POLLERR) != 0) {
+      // socket error
+      int error;
+      socklen_t optlen = sizeof(int);
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &optlen);
+      throw runtime_error("could not accept on socket: socket error: "s +
+                          strerror(error));
+    } else if ((revents & POLLNVAL) != 0) {
+      // polling error
+      throw runtime_error("invalid fd: "s + to_string(fd));
+    } else if ((revents & POLLIN) == 0) {
+      // hangup - this shouldn't happen
+      throw runtime_error("hangup on passive socket");
+    }
+
+    // can accept
+    int connFD = ::accept(fd, nullptr, nullptr);
+    if (connFD != -1) {
+      // got a socket
+      return RawSocket(connFD, stopFlag);
+    }
+
+    // error
+    if (int error = errno; !acceptRetryable(error)) {
+      throw runtime_error("could not read from socket: "s + strerror(error));
+    }
+  }
+}
+
+Task<RawSocket> RawServer::asyncAccept() {
+  if (listener != nullptr) {
+    co_return RawSocket(co_await listener->asyncAccept(stopFlag, stopEvent),
+                        stopFlag);
+  }
+
+  while (true) {
+    // cancel on this if need be
+    if (stopFlag.stop_requested()) {
+      throw stopFlag;
+    }
+
+    int connFD = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (connFD != -1) {
+      // got a socket
+      co_return RawSocket(connFD, stopFlag);
+    }
+
+    if (int error = errno; error == EAGAIN) {
+      // nothing to accept yet, or another task took the connection that woke
+      // us - wait again
+      co_await Executor::Wait(fd, EPOLLIN, stopEvent);
+    } else if (!acceptRetryable(error)) {
+      throw runtime_error("could not read from socket: "s + strerror(error));
+    }
+  }
+}
+
+uint16_t RawServer::getPort() const {
+  if (fd == 0 || !unixPath.empty()) {
+    return 0;
+  }
+
+  struct sockaddr_storage address = {};
+  socklen_t length = sizeof(address);
+  if (getsockname(fd, reinterpret_cast<struct sockaddr *>(&address),
+                  &length) == -1) {
+    throw runtime_error("could not get socket address: "s + strerror(errno));
+  }
+  switch (address.ss_family) {
+    case AF_INET: {
+      return ntohs(reinterpret_cast<struct sockaddr_in *>(&address)->sin_port);
+    }
+    case AF_INET6: {
+      return ntohs(
+          reinterpret_cast<struct sockaddr_in6 *>(&address)->sin6_port);
     }
     default: {
-      abort();
+      return 0;
     }
   }
 }
@@ -0,0 +1,122 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_NETWORKING_REACTOR_H_
+#define NPLANETARY_NETWORKING_REACTOR_H_
+
+#if defined(__linux__)
+#else
+#error "OS not recognized/supported"
+#endif
+
+#include <functional>
+#include <memory>
+#include <stop_token>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "networking/rawSocket.h"
+
+namespace nplanetary::networking {
+/**
+ * An event loop that owns many sockets and dispatches readiness callbacks
+ *
+ * Lets one thread serve any number of idle connections; the loop sleeps until
+ * a socket is ready or a stop is requested. Only sockets and servers with an
+ * fd may be added, not in-process ones; use an Executor for those
+ */
+class Reactor {
+ public:
+  using ServerCallback = std::function<void(RawServer &)>;
+  using SocketCallback = std::function<void(RawSocket &)>;
+
+  explicit Reactor(std::stop_token const &stopFlag);
+  Reactor(Reactor const &) noexcept = delete;
+  Reactor(Reactor &&) noexcept;
+
+  ~Reactor() noexcept;
+
+  Reactor &operator=(Reactor const &) noexcept = delete;
+  Reactor &operator=(Reactor &&) noexcept;
+
+  /**
+   * Takes ownership of a server; onAcceptable is called whenever a
+   * connection is pending
+   */
+  void add(RawServer server, ServerCallback onAcceptable);
+  /**
+   * Takes ownership of a socket; onReadable is called whenever data or a
+   * hangup is pending
+   *
+   * If onReadable throws a HangupFlag, the socket is removed
+   */
+  void add(RawSocket socket, SocketCallback onReadable);
+
+  /**
+   * Closes a server owned by this reactor
+   *
+   * May be called from within a callback, including the server's own
+   */
+  void remove(RawServer const &server);
+  /**
+   * Closes a socket owned by this reactor
+   *
+   * May be called from within a callback, including the socket's own
+   */
+  void remove(RawSocket const &socket);
+
+  /**
+   * Number of servers and sockets owned
+   */
+  size_t size() const noexcept;
+
+  /**
+   * Waits for events and dispatches their callbacks until stopped
+   */
+  [[noreturn]] void run();
+  /**
+   * Waits for one batch of events and dispatches their callbacks
+   */
+  void poll();
+
+ private:
+  struct Entry {
+    std::variant<RawServer, RawSocket> owned;
+    /** given the reactor that owns the entry now, which may have moved */
+    std::function<void(Reactor &)> dispatch;
+  };
+
+  static constexpr int MAX_EVENTS = 64;
+
+  void add(int fd, std::unique_ptr<Entry> entry);
+  void remove(int fd);
+
+  int fd;
+  std::stop_token stopFlag;
+  StopEvent stopEvent;
+
+  std::unordered_map<int, std::unique_ptr<Entry>> entries;
+  /** entries removed during dispatch, closed once the batch is done */
+  std::vector<std::unique_ptr<Entry>> removed;
+  bool dispatching;
+};
+}  // namespace nplanetary::networking
+
+#endif  // NPLANETARY_NETWORKING_REACTOR_H_
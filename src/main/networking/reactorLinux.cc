@@ -0,0 +1,198 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#if defined(__linux__)
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "networking/reactor.h"
+
+using namespace std;
+
+namespace nplanetary::networking {
+Reactor::Reactor(stop_token const &stopFlag)
+    : fd(epoll_create1(EPOLL_CLOEXEC)),
+      stopFlag(stopFlag),
+      stopEvent(stopFlag),
+      entries(),
+      removed(),
+      dispatching(false) {
+  if (fd == -1) {
+    fd = 0;
+    throw runtime_error("could not create epoll instance: "s +
+                        strerror(errno));
+  }
+
+  // wake up when stopped
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = stopEvent.getFD();
+  if (epoll_ctl(fd, EPOLL_CTL_ADD, stopEvent.getFD(), &event) != 0) {
+    close(fd);
+    throw runtime_error("could not watch stop event: "s + strerror(errno));
+  }
+}
+
+Reactor::Reactor(Reactor &&other) noexcept
+    : fd(other.fd),
+      stopFlag(other.stopFlag),
+      stopEvent(move(other.stopEvent)),
+      entries(move(other.entries)),
+      removed(move(other.removed)),
+      dispatching(false) {
+  other.fd = 0;
+}
+
+Reactor::~Reactor() noexcept {
+  if (fd != 0) {
+    close(fd);
+  }
+}
+
+Reactor &Reactor::operator=(Reactor &&other) noexcept {
+  swap(fd, other.fd);
+  stopFlag = other.stopFlag;
+  swap(stopEvent, other.stopEvent);
+  swap(entries, other.entries);
+  swap(removed, other.removed);
+  return *this;
+}
+
+void Reactor::add(RawServer server, ServerCallback onAcceptable) {
+  if (server.listener != nullptr) {
+    throw runtime_error("in-process servers can't be added to a reactor");
+  }
+  int serverFD = server.fd;
+  unique_ptr<Entry> entry =
+      make_unique<Entry>(Entry{.owned = move(server), .dispatch = {}});
+  entry->dispatch = [owned = &get<RawServer>(entry->owned),
+                     onAcceptable = move(onAcceptable)](Reactor &) {
+    onAcceptable(*owned);
+  };
+  add(serverFD, move(entry));
+}
+
+void Reactor::add(RawSocket socket, SocketCallback onReadable) {
+  if (socket.pipe != nullptr) {
+    throw runtime_error("in-process sockets can't be added to a reactor");
+  }
+  int socketFD = socket.fd;
+  unique_ptr<Entry> entry =
+      make_unique<Entry>(Entry{.owned = move(socket), .dispatch = {}});
+  entry->dispatch = [owned = &get<RawSocket>(entry->owned),
+                     onReadable = move(onReadable)](Reactor &reactor) {
+    try {
+      onReadable(*owned);
+    } catch (HangupFlag const &) {
+      // peer is gone - stop watching it
+      reactor.remove(*owned);
+    }
+  };
+  add(socketFD, move(entry));
+}
+
+void Reactor::remove(RawServer const &server) { remove(server.fd); }
+
+void Reactor::remove(RawSocket const &socket) { remove(socket.fd); }
+
+size_t Reactor::size() const noexcept { return entries.size(); }
+
+void Reactor::run() {
+  while (true) {
+    poll();
+  }
+}
+
+void Reactor::poll() {
+  // cancel on this if need be
+  if (stopFlag.stop_requested()) {
+    throw stopFlag;
+  }
+
+  array<struct epoll_event, MAX_EVENTS> events;
+  int count = epoll_wait(fd, events.data(), events.size(), -1);
+  if (count == -1) {
+    int error = errno;
+    if (error == EINTR) {
+      // interrupted by signal; caller will poll again
+      return;
+    }
+    throw runtime_error("could not wait for events: "s + strerror(error));
+  }
+
+  dispatching = true;
+  for (int idx = 0; idx < count; ++idx) {
+    if (stopFlag.stop_requested()) {
+      break;
+    }
+
+    // entry might have been removed by an earlier callback in this batch
+    auto found = entries.find(events[idx].data.fd);
+    if (found != entries.end()) {
+      try {
+        found->second->dispatch(*this);
+      } catch (...) {
+        dispatching = false;
+        removed.clear();
+        throw;
+      }
+    }
+  }
+  dispatching = false;
+
+  // now safe to close anything removed during dispatch
+  removed.clear();
+
+  if (stopFlag.stop_requested()) {
+    throw stopFlag;
+  }
+}
+
+void Reactor::add(int entryFD, unique_ptr<Entry> entry) {
+  struct epoll_event event = {};
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.fd = entryFD;
+  if (epoll_ctl(fd, EPOLL_CTL_ADD, entryFD, &event) != 0) {
+    throw runtime_error("could not watch fd: "s + strerror(errno));
+  }
+  entries.emplace(entryFD, move(entry));
+}
+
+void Reactor::remove(int entryFD) {
+  auto found = entries.find(entryFD);
+  if (found == entries.end()) {
+    throw runtime_error("fd not owned by reactor: "s + to_string(entryFD));
+  }
+
+  epoll_ctl(fd, EPOLL_CTL_DEL, entryFD, nullptr);
+  if (dispatching) {
+    // callback might still be running - close later
+    removed.emplace_back(move(found->second));
+  }
+  entries.erase(found);
+}
+}  // namespace nplanetary::networking
+
+#endif
@@ -0,0 +1,71 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "networking/recvBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+using namespace std;
+
+namespace nplanetary::networking {
+RecvBuffer::RecvBuffer(size_t capacity)
+    : buffer(make_unique<uint8_t[]>(capacity)),
+      capacity(capacity),
+      head(0),
+      tail(0) {}
+
+size_t RecvBuffer::size() const noexcept { return tail - head; }
+
+bool RecvBuffer::empty() const noexcept { return head == tail; }
+
+span<uint8_t const> RecvBuffer::peek() const noexcept {
+  return span<uint8_t const>(buffer.get() + head, tail - head);
+}
+
+void RecvBuffer::consume(size_t n) noexcept {
+  head += n;
+  if (head == tail) {
+    // empty - start over at the front for free
+    head = tail = 0;
+  }
+}
+
+span<uint8_t> RecvBuffer::prepare(size_t n) {
+  if (capacity - tail < n) {
+    if (size() + n <= capacity) {
+      // shift unread data back to the start
+      memmove(buffer.get(), buffer.get() + head, size());
+    } else {
+      // too small even when compacted - grow
+      size_t newCapacity = max(capacity * 2, size() + n);
+      unique_ptr<uint8_t[]> newBuffer = make_unique<uint8_t[]>(newCapacity);
+      copy(buffer.get() + head, buffer.get() + tail, newBuffer.get());
+      buffer = move(newBuffer);
+      capacity = newCapacity;
+    }
+    tail -= head;
+    head = 0;
+  }
+  return span<uint8_t>(buffer.get() + tail, n);
+}
+
+void RecvBuffer::commit(size_t n) noexcept { tail += n; }
+}  // namespace nplanetary::networking
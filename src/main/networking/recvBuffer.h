@@ -0,0 +1,84 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_NETWORKING_RECVBUFFER_H_
+#define NPLANETARY_NETWORKING_RECVBUFFER_H_
+
+#include <cstdint>
+#include <memory>
+#include <span>
+
+namespace nplanetary::networking {
+/**
+ * A contiguous queue of received bytes
+ *
+ * Bytes are appended at the tail and consumed from the head without moving
+ * anything; the unread bytes are only shifted back to the start when the tail
+ * runs out of room, so the readable bytes are always one contiguous span
+ */
+class RecvBuffer {
+ public:
+  static constexpr size_t DEFAULT_CAPACITY = 131072;
+
+  explicit RecvBuffer(size_t capacity = DEFAULT_CAPACITY);
+  RecvBuffer(RecvBuffer const &) noexcept = delete;
+  RecvBuffer(RecvBuffer &&) noexcept = default;
+
+  ~RecvBuffer() noexcept = default;
+
+  RecvBuffer &operator=(RecvBuffer const &) noexcept = delete;
+  RecvBuffer &operator=(RecvBuffer &&) noexcept = default;
+
+  /**
+   * Number of unread bytes
+   */
+  size_t size() const noexcept;
+  bool empty() const noexcept;
+
+  /**
+   * All unread bytes; valid until the next call to prepare
+   */
+  std::span<uint8_t const> peek() const noexcept;
+  /**
+   * Marks the first n unread bytes as read
+   */
+  void consume(size_t n) noexcept;
+
+  /**
+   * Get n contiguous bytes of space at the tail to write into
+   *
+   * Invalidates previously peeked spans
+   */
+  std::span<uint8_t> prepare(size_t n);
+  /**
+   * Marks the first n bytes of the prepared space as unread data
+   */
+  void commit(size_t n) noexcept;
+
+ private:
+  std::unique_ptr<uint8_t[]> buffer;
+  size_t capacity;
+  /** index of first unread byte */
+  size_t head;
+  /** index one past the last unread byte */
+  size_t tail;
+};
+}  // namespace nplanetary::networking
+
+#endif  // NPLANETARY_NETWORKING_RECVBUFFER_H_
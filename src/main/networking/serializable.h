@@ -0,0 +1,238 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_NETWORKING_SERIALIZABLE_H_
+#define NPLANETARY_NETWORKING_SERIALIZABLE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+/**
+ * Declares the fields of a struct to send over a Socket
+ *
+ * Use inside the struct's definition, naming the struct and then each field
+ * to send, in order. Fields may be integers, bools, chars, enums, other
+ * serializable structs, or std::arrays of those
+ */
+#define NPLANETARY_SERIALIZABLE(Type, ...)                                   \
+  friend constexpr auto schemaFields(Type const *) {                         \
+    return std::make_tuple(                                                  \
+        NPLANETARY_SCHEMA_FOR_EACH(Type, __VA_ARGS__));                      \
+  }                                                                          \
+  friend constexpr std::string_view schemaName(Type const *) {               \
+    return #Type "{" #__VA_ARGS__ "}";                                       \
+  }
+
+// comma-separated member pointers to each named field
+#define NPLANETARY_SCHEMA_FOR_EACH(Type, ...) \
+  __VA_OPT__(NPLANETARY_SCHEMA_EXPAND(        \
+      NPLANETARY_SCHEMA_FOR_EACH_HELPER(Type, __VA_ARGS__)))
+#define NPLANETARY_SCHEMA_FOR_EACH_HELPER(Type, field, ...)  \
+  &Type::field __VA_OPT__(, NPLANETARY_SCHEMA_FOR_EACH_AGAIN \
+                              NPLANETARY_SCHEMA_PARENS(Type, __VA_ARGS__))
+#define NPLANETARY_SCHEMA_FOR_EACH_AGAIN() NPLANETARY_SCHEMA_FOR_EACH_HELPER
+#define NPLANETARY_SCHEMA_PARENS ()
+#define NPLANETARY_SCHEMA_EXPAND(...)                  \
+  NPLANETARY_SCHEMA_EXPAND3(NPLANETARY_SCHEMA_EXPAND3( \
+      NPLANETARY_SCHEMA_EXPAND3(NPLANETARY_SCHEMA_EXPAND3(__VA_ARGS__))))
+#define NPLANETARY_SCHEMA_EXPAND3(...)                 \
+  NPLANETARY_SCHEMA_EXPAND2(NPLANETARY_SCHEMA_EXPAND2( \
+      NPLANETARY_SCHEMA_EXPAND2(NPLANETARY_SCHEMA_EXPAND2(__VA_ARGS__))))
+#define NPLANETARY_SCHEMA_EXPAND2(...)                 \
+  NPLANETARY_SCHEMA_EXPAND1(NPLANETARY_SCHEMA_EXPAND1( \
+      NPLANETARY_SCHEMA_EXPAND1(NPLANETARY_SCHEMA_EXPAND1(__VA_ARGS__))))
+#define NPLANETARY_SCHEMA_EXPAND1(...) __VA_ARGS__
+
+namespace nplanetary::networking {
+/**
+ * A struct declared with NPLANETARY_SERIALIZABLE
+ */
+template <typename T>
+concept Serializable = requires(T const *x) {
+  schemaFields(x);
+  schemaName(x);
+};
+
+namespace schema {
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325;
+constexpr uint64_t FNV_PRIME = 0x100000001b3;
+
+/**
+ * FNV-1a hash of some text, continuing from hash
+ */
+constexpr uint64_t fnv1a(std::string_view text,
+                         uint64_t hash = FNV_OFFSET_BASIS) noexcept {
+  for (char c : text) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+/**
+ * Mixes a number into an FNV-1a hash, one byte at a time
+ */
+constexpr uint64_t fnv1a(uint64_t x, uint64_t hash) noexcept {
+  for (size_t idx = 0; idx < sizeof(uint64_t); ++idx) {
+    hash ^= (x >> (idx * 8)) & 0xff;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+template <typename T>
+struct IsArray : std::false_type {};
+template <typename T, size_t N>
+struct IsArray<std::array<T, N>> : std::true_type {};
+
+template <typename T>
+constexpr size_t wireSize() noexcept;
+template <typename T>
+constexpr uint64_t hash() noexcept;
+
+/**
+ * Calls f with each field's member pointer
+ */
+template <Serializable T, typename F>
+constexpr void forEachField(F &&f) {
+  std::apply([&f](auto... fields) { (f(fields), ...); },
+             schemaFields(static_cast<T const *>(nullptr)));
+}
+
+template <typename T>
+using FieldType = std::remove_cvref_t<T>;
+
+/**
+ * Bytes taken up by a value of type T on the wire
+ */
+template <typename T>
+constexpr size_t wireSize() noexcept {
+  if constexpr (std::is_same_v<T, bool>) {
+    return sizeof(uint8_t);
+  } else if constexpr (std::is_enum_v<T>) {
+    return sizeof(std::underlying_type_t<T>);
+  } else if constexpr (std::is_integral_v<T>) {
+    return sizeof(T);
+  } else if constexpr (IsArray<T>::value) {
+    return std::tuple_size_v<T> * wireSize<typename T::value_type>();
+  } else {
+    static_assert(Serializable<T>, "type can't be sent over a socket");
+    size_t size = 0;
+    forEachField<T>([&size](auto field) {
+      size += wireSize<FieldType<decltype(std::declval<T>().*field)>>();
+    });
+    return size;
+  }
+}
+
+/**
+ * Hash of T's layout on the wire
+ */
+template <typename T>
+constexpr uint64_t hash() noexcept {
+  if constexpr (std::is_same_v<T, bool>) {
+    return fnv1a("bool");
+  } else if constexpr (std::is_enum_v<T>) {
+    return fnv1a("enum", hash<std::underlying_type_t<T>>());
+  } else if constexpr (std::is_same_v<T, char>) {
+    return fnv1a("char");
+  } else if constexpr (std::is_integral_v<T>) {
+    return fnv1a(sizeof(T),
+                 fnv1a(std::is_signed_v<T> ? "signed" : "unsigned"));
+  } else if constexpr (IsArray<T>::value) {
+    return fnv1a(std::tuple_size_v<T>, hash<typename T::value_type>());
+  } else {
+    uint64_t result = fnv1a(schemaName(static_cast<T const *>(nullptr)));
+    forEachField<T>([&result](auto field) {
+      result =
+          fnv1a(hash<FieldType<decltype(std::declval<T>().*field)>>(), result);
+    });
+    return result;
+  }
+}
+
+/**
+ * Writes x to out in its wire format
+ *
+ * @returns one past the last byte written
+ */
+template <typename T>
+uint8_t *encode(T const &x, uint8_t *out) noexcept {
+  if constexpr (std::is_same_v<T, bool>) {
+    *out = x ? 1 : 0;
+    return out + 1;
+  } else if constexpr (std::is_enum_v<T>) {
+    return encode(static_cast<std::underlying_type_t<T>>(x), out);
+  } else if constexpr (std::is_integral_v<T>) {
+    auto u = static_cast<std::make_unsigned_t<T>>(x);
+    for (size_t idx = 0; idx < sizeof(T); ++idx) {
+      out[idx] = static_cast<uint8_t>(u >> (idx * 8));
+    }
+    return out + sizeof(T);
+  } else if constexpr (IsArray<T>::value) {
+    for (auto const &element : x) {
+      out = encode(element, out);
+    }
+    return out;
+  } else {
+    forEachField<T>([&x, &out](auto field) { out = encode(x.*field, out); });
+    return out;
+  }
+}
+
+/**
+ * Reads x from its wire format in in
+ *
+ * @returns one past the last byte read
+ */
+template <typename T>
+uint8_t const *decode(T &x, uint8_t const *in) noexcept {
+  if constexpr (std::is_same_v<T, bool>) {
+    x = *in != 0;
+    return in + 1;
+  } else if constexpr (std::is_enum_v<T>) {
+    std::underlying_type_t<T> underlying;
+    in = decode(underlying, in);
+    x = static_cast<T>(underlying);
+    return in;
+  } else if constexpr (std::is_integral_v<T>) {
+    std::make_unsigned_t<T> u = 0;
+    for (size_t idx = 0; idx < sizeof(T); ++idx) {
+      u |= static_cast<std::make_unsigned_t<T>>(
+          static_cast<std::make_unsigned_t<T>>(in[idx]) << (idx * 8));
+    }
+    x = static_cast<T>(u);
+    return in + sizeof(T);
+  } else if constexpr (IsArray<T>::value) {
+    for (auto &element : x) {
+      in = decode(element, in);
+    }
+    return in;
+  } else {
+    forEachField<T>([&x, &in](auto field) { in = decode(x.*field, in); });
+    return in;
+  }
+}
+}  // namespace schema
+}  // namespace nplanetary::networking
+
+#endif  // NPLANETARY_NETWORKING_SERIALIZABLE_H_
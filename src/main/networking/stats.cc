@@ -0,0 +1,177 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "networking/stats.h"
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+using namespace std;
+
+namespace nplanetary::networking {
+namespace {
+/**
+ * Formats nanoseconds as seconds without losing precision
+ */
+string seconds(uint64_t nanos) {
+  string fraction = to_string(nanos % 1000000000);
+  return to_string(nanos / 1000000000) + "." +
+         string(9 - fraction.size(), '0') + fraction;
+}
+
+void metric(string &out, string const &name, char const *type,
+            char const *help, string const &value) {
+  out += "# HELP " + name + " " + help + "\n";
+  out += "# TYPE " + name + " " + type + "\n";
+  out += name + " " + value + "\n";
+}
+}  // namespace
+
+Stats &Stats::operator+=(Stats const &other) noexcept {
+  bytesIn += other.bytesIn;
+  bytesOut += other.bytesOut;
+  framesIn += other.framesIn;
+  framesOut += other.framesOut;
+  syscalls += other.syscalls;
+  emptyWakeups += other.emptyWakeups;
+  encryptNanos += other.encryptNanos;
+  decryptNanos += other.decryptNanos;
+  handshakes += other.handshakes;
+  handshakeNanos += other.handshakeNanos;
+  recvBufferHighWater = max(recvBufferHighWater, other.recvBufferHighWater);
+  return *this;
+}
+
+string toPrometheus(Stats const &stats, uint64_t connections) {
+  string out;
+  metric(out, "nplanetary_stats_enabled", "gauge",
+         "Whether counters were compiled in.", STATS_ENABLED ? "1" : "0");
+  metric(out, "nplanetary_connections", "gauge", "Connections open.",
+         to_string(connections));
+  metric(out, "nplanetary_received_bytes_total", "counter",
+         "Bytes received from peers.", to_string(stats.bytesIn));
+  metric(out, "nplanetary_sent_bytes_total", "counter", "Bytes sent to peers.",
+         to_string(stats.bytesOut));
+  metric(out, "nplanetary_received_frames_total", "counter",
+         "Encrypted frames received.", to_string(stats.framesIn));
+  metric(out, "nplanetary_sent_frames_total", "counter",
+         "Encrypted frames sent.", to_string(stats.framesOut));
+  metric(out, "nplanetary_syscalls_total", "counter",
+         "Socket reads, writes, and polls issued.", to_string(stats.syscalls));
+  metric(out, "nplanetary_empty_wakeups_total", "counter",
+         "Wakeups that found nothing to read or write.",
+         to_string(stats.emptyWakeups));
+  metric(out, "nplanetary_encrypt_seconds_total", "counter",
+         "Time spent encrypting frames.", seconds(stats.encryptNanos));
+  metric(out, "nplanetary_decrypt_seconds_total", "counter",
+         "Time spent decrypting frames.", seconds(stats.decryptNanos));
+  metric(out, "nplanetary_handshakes_total", "counter",
+         "Handshakes completed.", to_string(stats.handshakes));
+  metric(out, "nplanetary_handshake_seconds_total", "counter",
+         "Time spent in handshakes.", seconds(stats.handshakeNanos));
+  metric(out, "nplanetary_recv_buffer_high_water_bytes", "gauge",
+         "Most decrypted bytes ever waiting to be read on one connection.",
+         to_string(stats.recvBufferHighWater));
+  return out;
+}
+
+#if defined(NPLANETARY_STATS)
+struct Counters::Registry {
+  mutex lock;
+  unordered_set<Block const *> live;
+  Stats retired;
+};
+
+Counters::Registry &Counters::registry() {
+  static Registry registry;
+  return registry;
+}
+
+Counters::Counters() : block(make_unique<Block>()) {
+  Registry &registry = Counters::registry();
+  scoped_lock guard(registry.lock);
+  registry.live.insert(block.get());
+}
+
+Counters::~Counters() noexcept {
+  if (block == nullptr) {
+    return;
+  }
+  Registry &registry = Counters::registry();
+  scoped_lock guard(registry.lock);
+  registry.retired += block->snapshot();
+  registry.live.erase(block.get());
+}
+
+Counters &Counters::operator=(Counters &&other) noexcept {
+  swap(block, other.block);
+  return *this;
+}
+
+Stats Counters::snapshot() const noexcept {
+  return block != nullptr ? block->snapshot() : Stats();
+}
+
+Stats Counters::total() {
+  Registry &registry = Counters::registry();
+  scoped_lock guard(registry.lock);
+  Stats total = registry.retired;
+  for (Block const *block : registry.live) {
+    total += block->snapshot();
+  }
+  return total;
+}
+
+uint64_t Counters::connections() {
+  Registry &registry = Counters::registry();
+  scoped_lock guard(registry.lock);
+  return registry.live.size();
+}
+
+Stats Counters::Block::snapshot() const noexcept {
+  Stats stats;
+  stats.bytesIn = bytesIn.load(memory_order_relaxed);
+  stats.bytesOut = bytesOut.load(memory_order_relaxed);
+  stats.framesIn = framesIn.load(memory_order_relaxed);
+  stats.framesOut = framesOut.load(memory_order_relaxed);
+  stats.syscalls = syscalls.load(memory_order_relaxed);
+  stats.emptyWakeups = emptyWakeups.load(memory_order_relaxed);
+  stats.encryptNanos = encryptNanos.load(memory_order_relaxed);
+  stats.decryptNanos = decryptNanos.load(memory_order_relaxed);
+  stats.handshakes = handshakes.load(memory_order_relaxed);
+  stats.handshakeNanos = handshakeNanos.load(memory_order_relaxed);
+  stats.recvBufferHighWater = recvBufferHighWater.load(memory_order_relaxed);
+  return stats;
+}
+#else
+Counters::Counters() {}
+
+Counters::~Counters() noexcept {}
+
+Counters &Counters::operator=(Counters &&) noexcept { return *this; }
+
+Stats Counters::snapshot() const noexcept { return Stats(); }
+
+Stats Counters::total() { return Stats(); }
+
+uint64_t Counters::connections() { return 0; }
+#endif
+}  // namespace nplanetary::networking
@@ -0,0 +1,245 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_NETWORKING_STATS_H_
+#define NPLANETARY_NETWORKING_STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace nplanetary::networking {
+/** whether counters were compiled in; if not, every snapshot is zero */
+#if defined(NPLANETARY_STATS)
+constexpr bool STATS_ENABLED = true;
+#else
+constexpr bool STATS_ENABLED = false;
+#endif
+
+/**
+ * A snapshot of what one connection, or every connection, has done
+ */
+struct Stats {
+  uint64_t bytesIn = 0;
+  uint64_t bytesOut = 0;
+  /** encrypted frames received and sent */
+  uint64_t framesIn = 0;
+  uint64_t framesOut = 0;
+  /** reads, writes, and polls; io_uring operations count as one each */
+  uint64_t syscalls = 0;
+  /** times a socket was woken up but had nothing to read or write */
+  uint64_t emptyWakeups = 0;
+  /** time spent encrypting and decrypting frames */
+  uint64_t encryptNanos = 0;
+  uint64_t decryptNanos = 0;
+  /** handshakes finished, and the time spent in them */
+  uint64_t handshakes = 0;
+  uint64_t handshakeNanos = 0;
+  /** most decrypted bytes ever waiting to be read */
+  uint64_t recvBufferHighWater = 0;
+
+  /**
+   * Adds other's counts to these, keeping the larger high-water mark
+   */
+  Stats &operator+=(Stats const &other) noexcept;
+};
+
+/**
+ * Formats stats in the Prometheus text exposition format
+ */
+std::string toPrometheus(Stats const &stats, uint64_t connections);
+
+/**
+ * One connection's counters
+ *
+ * Updated with relaxed atomics, so they may be snapshotted from any thread.
+ * Unless NPLANETARY_STATS is defined, this is empty and every update compiles
+ * to nothing
+ */
+class Counters {
+ private:
+  struct Block;
+
+ public:
+  /**
+   * Adds the time from its creation to its destruction to a counter
+   */
+  class Timer {
+    friend class Counters;
+
+   public:
+    Timer(Timer const &) noexcept = delete;
+    Timer(Timer &&) noexcept = delete;
+
+    ~Timer() noexcept;
+
+    Timer &operator=(Timer const &) noexcept = delete;
+    Timer &operator=(Timer &&) noexcept = delete;
+
+   private:
+#if defined(NPLANETARY_STATS)
+    explicit Timer(std::atomic<uint64_t> *counter) noexcept;
+
+    std::atomic<uint64_t> *counter;
+    std::chrono::steady_clock::time_point start;
+#else
+    Timer() noexcept = default;
+#endif
+  };
+
+  Counters();
+  Counters(Counters const &) noexcept = delete;
+  Counters(Counters &&) noexcept = default;
+
+  /**
+   * Adds the counts to the process-wide totals
+   */
+  ~Counters() noexcept;
+
+  Counters &operator=(Counters const &) noexcept = delete;
+  Counters &operator=(Counters &&) noexcept;
+
+  void addBytesIn(uint64_t n) noexcept;
+  void addBytesOut(uint64_t n) noexcept;
+  void addFrameIn() noexcept;
+  void addFrameOut() noexcept;
+  void addSyscall() noexcept;
+  void addEmptyWakeup() noexcept;
+  /**
+   * Raises the high-water mark to size if it's lower
+   */
+  void noteBuffered(uint64_t size) noexcept;
+
+  Timer timeEncrypt() noexcept;
+  Timer timeDecrypt() noexcept;
+  /**
+   * Counts a finished handshake that began at start
+   */
+  void addHandshake(std::chrono::steady_clock::time_point start) noexcept;
+
+  Stats snapshot() const noexcept;
+  /**
+   * Sums the counters of every connection, open or closed
+   */
+  static Stats total();
+  /**
+   * Number of connections open
+   */
+  static uint64_t connections();
+
+ private:
+#if defined(NPLANETARY_STATS)
+  struct Block {
+    std::atomic<uint64_t> bytesIn;
+    std::atomic<uint64_t> bytesOut;
+    std::atomic<uint64_t> framesIn;
+    std::atomic<uint64_t> framesOut;
+    std::atomic<uint64_t> syscalls;
+    std::atomic<uint64_t> emptyWakeups;
+    std::atomic<uint64_t> encryptNanos;
+    std::atomic<uint64_t> decryptNanos;
+    std::atomic<uint64_t> handshakes;
+    std::atomic<uint64_t> handshakeNanos;
+    std::atomic<uint64_t> recvBufferHighWater;
+
+    Stats snapshot() const noexcept;
+  };
+  /**
+   * Every open connection's counters, and the sum of every closed one's
+   */
+  struct Registry;
+
+  static Registry &registry();
+
+  /** null once moved from */
+  std::unique_ptr<Block> block;
+#endif
+};
+
+#if defined(NPLANETARY_STATS)
+inline Counters::Timer::Timer(std::atomic<uint64_t> *counter) noexcept
+    : counter(counter), start(std::chrono::steady_clock::now()) {}
+inline Counters::Timer::~Timer() noexcept {
+  counter->fetch_add(static_cast<uint64_t>(
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count()),
+                     std::memory_order_relaxed);
+}
+
+inline void Counters::addBytesIn(uint64_t n) noexcept {
+  block->bytesIn.fetch_add(n, std::memory_order_relaxed);
+}
+inline void Counters::addBytesOut(uint64_t n) noexcept {
+  block->bytesOut.fetch_add(n, std::memory_order_relaxed);
+}
+inline void Counters::addFrameIn() noexcept {
+  block->framesIn.fetch_add(1, std::memory_order_relaxed);
+}
+inline void Counters::addFrameOut() noexcept {
+  block->framesOut.fetch_add(1, std::memory_order_relaxed);
+}
+inline void Counters::addSyscall() noexcept {
+  block->syscalls.fetch_add(1, std::memory_order_relaxed);
+}
+inline void Counters::addEmptyWakeup() noexcept {
+  block->emptyWakeups.fetch_add(1, std::memory_order_relaxed);
+}
+inline void Counters::noteBuffered(uint64_t size) noexcept {
+  // only this connection's thread writes, so no compare-exchange is needed
+  if (size > block->recvBufferHighWater.load(std::memory_order_relaxed)) {
+    block->recvBufferHighWater.store(size, std::memory_order_relaxed);
+  }
+}
+inline Counters::Timer Counters::timeEncrypt() noexcept {
+  return Timer(&block->encryptNanos);
+}
+inline Counters::Timer Counters::timeDecrypt() noexcept {
+  return Timer(&block->decryptNanos);
+}
+inline void Counters::addHandshake(
+    std::chrono::steady_clock::time_point start) noexcept {
+  block->handshakes.fetch_add(1, std::memory_order_relaxed);
+  block->handshakeNanos.fetch_add(
+      static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count()),
+      std::memory_order_relaxed);
+}
+#else
+inline Counters::Timer::~Timer() noexcept {}
+
+inline void Counters::addBytesIn(uint64_t) noexcept {}
+inline void Counters::addBytesOut(uint64_t) noexcept {}
+inline void Counters::addFrameIn() noexcept {}
+inline void Counters::addFrameOut() noexcept {}
+inline void Counters::addSyscall() noexcept {}
+inline void Counters::addEmptyWakeup() noexcept {}
+inline void Counters::noteBuffered(uint64_t) noexcept {}
+inline Counters::Timer Counters::timeEncrypt() noexcept { return Timer(); }
+inline Counters::Timer Counters::timeDecrypt() noexcept { return Timer(); }
+inline void Counters::addHandshake(
+    std::chrono::steady_clock::time_point) noexcept {}
+#endif
+}  // namespace nplanetary::networking
+
+#endif  // NPLANETARY_NETWORKING_STATS_H_
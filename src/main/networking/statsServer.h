@@ -0,0 +1,84 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_NETWORKING_STATSSERVER_H_
+#define NPLANETARY_NETWORKING_STATSSERVER_H_
+
+#if defined(__linux__)
+#else
+#error "OS not recognized/supported"
+#endif
+
+#include <sys/types.h>
+
+#include <stop_token>
+#include <string>
+#include <thread>
+
+#include "networking/rawSocket.h"
+#include "networking/stats.h"
+
+namespace nplanetary::networking {
+/**
+ * Serves the process-wide stats in the Prometheus text format over a local
+ * Unix socket
+ *
+ * Each connection gets one dump, then is closed, so the stats can be scraped
+ * with e.g. `socat - UNIX-CONNECT:path`
+ */
+class StatsServer {
+ public:
+  /**
+   * Listens at path, replacing any socket file already there
+   */
+  StatsServer(std::string const &path, std::stop_token const &stopFlag);
+  StatsServer(StatsServer const &) noexcept = delete;
+  StatsServer(StatsServer &&) noexcept = delete;
+
+  /**
+   * Stops serving and removes the socket file, if it's still the one this
+   * server created
+   */
+  ~StatsServer() noexcept;
+
+  StatsServer &operator=(StatsServer const &) noexcept = delete;
+  StatsServer &operator=(StatsServer &&) noexcept = delete;
+
+ private:
+  /** stops serving when the caller's stop token does */
+  struct Forward {
+    std::stop_source *stop;
+    void operator()() const noexcept;
+  };
+
+  void serve();
+
+  std::string path;
+  std::stop_source stop;
+  std::stop_callback<Forward> forward;
+  StopEvent stopEvent;
+  int fd;
+  /** identifies the socket file this server created */
+  dev_t device;
+  ino_t inode;
+  std::thread worker;
+};
+}  // namespace nplanetary::networking
+
+#endif  // NPLANETARY_NETWORKING_STATSSERVER_H_
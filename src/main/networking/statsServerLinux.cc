@@ -0,0 +1,129 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#if defined(__linux__)
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "networking/statsServer.h"
+
+using namespace std;
+
+namespace nplanetary::networking {
+StatsServer::StatsServer(string const &path, stop_token const &stopFlag)
+    : path(path),
+      stop(),
+      forward(stopFlag, Forward{&stop}),
+      stopEvent(stop.get_token()),
+      fd(0),
+      device(0),
+      inode(0),
+      worker() {
+  struct sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw runtime_error("stats socket path too long: "s + path);
+  }
+  copy(path.begin(), path.end(), address.sun_path);
+
+  if (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0); fd == -1) {
+    fd = 0;
+    throw runtime_error("could not create stats socket: "s + strerror(errno));
+  }
+
+  // replace any socket left over from an earlier run, but nothing else
+  struct stat status;
+  if (lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+    unlink(path.c_str());
+  }
+  if (bind(fd, reinterpret_cast<struct sockaddr const *>(&address),
+           sizeof(address)) == -1 ||
+      lstat(path.c_str(), &status) == -1 || listen(fd, SOMAXCONN) == -1) {
+    int error = errno;
+    close(fd);
+    throw runtime_error("could not listen on "s + path + ": " +
+                        strerror(error));
+  }
+  device = status.st_dev;
+  inode = status.st_ino;
+
+  worker = thread(&StatsServer::serve, this);
+}
+
+StatsServer::~StatsServer() noexcept {
+  stop.request_stop();
+  worker.join();
+  close(fd);
+
+  // someone else may have replaced our socket file since
+  struct stat status;
+  if (lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode) &&
+      status.st_dev == device && status.st_ino == inode) {
+    unlink(path.c_str());
+  }
+}
+
+void StatsServer::Forward::operator()() const noexcept { stop->request_stop(); }
+
+void StatsServer::serve() {
+  array<struct pollfd, 2> polled = {{
+      {.fd = fd, .events = POLLIN, .revents = 0},
+      {.fd = stopEvent.getFD(), .events = POLLIN, .revents = 0},
+  }};
+  while (!stop.stop_requested()) {
+    if (poll(polled.data(), polled.size(), -1) <= 0 ||
+        (polled[0].revents & POLLIN) == 0) {
+      // interrupted or stopped - check again
+      continue;
+    }
+
+    int connFD = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (connFD == -1) {
+      // the scraper gave up; nothing to do
+      continue;
+    }
+
+    // the dump is small enough to fit in a fresh socket's send buffer
+    string dump = toPrometheus(Counters::total(), Counters::connections());
+    for (size_t sent = 0; sent != dump.size();) {
+      ssize_t retval =
+          send(connFD, dump.data() + sent, dump.size() - sent, MSG_NOSIGNAL);
+      if (retval == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      sent += static_cast<size_t>(retval);
+    }
+    close(connFD);
+  }
+}
+}  // namespace nplanetary::networking
+
+#endif
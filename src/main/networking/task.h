@@ -0,0 +1,144 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_NETWORKING_TASK_H_
+#define NPLANETARY_NETWORKING_TASK_H_
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <variant>
+
+namespace nplanetary::networking {
+class Executor;
+
+/**
+ * A lazily started coroutine producing a T
+ *
+ * Starts running when awaited, and resumes whoever awaited it once it
+ * finishes; exceptions thrown inside are rethrown to the awaiter. Spawn or run
+ * a task on an Executor to start one from outside a coroutine
+ */
+template <typename T = void>
+class [[nodiscard]] Task {
+  friend class Executor;
+
+ public:
+  struct promise_type;
+
+  Task(Task const &) noexcept = delete;
+  Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+
+  ~Task() noexcept {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  Task &operator=(Task const &) noexcept = delete;
+  Task &operator=(Task &&other) noexcept {
+    std::swap(handle, other.handle);
+    return *this;
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<> awaiter) noexcept {
+    handle.promise().continuation = awaiter;
+    return handle;
+  }
+  T await_resume() { return handle.promise().result(); }
+
+ private:
+  explicit Task(std::coroutine_handle<promise_type> handle) noexcept
+      : handle(handle) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+namespace task {
+/**
+ * Resumes the awaiting coroutine once a task finishes
+ */
+struct FinalAwaiter {
+  bool await_ready() const noexcept { return false; }
+  template <typename Promise>
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<Promise> handle) noexcept {
+    std::coroutine_handle<> continuation = handle.promise().continuation;
+    return continuation ? continuation : std::noop_coroutine();
+  }
+  void await_resume() const noexcept {}
+};
+
+/**
+ * Where a task's result or exception is kept until it is awaited
+ */
+template <typename T>
+struct Result {
+  Result() noexcept : value() {}
+
+  template <typename U>
+  void return_value(U &&x) {
+    value.template emplace<1>(std::forward<U>(x));
+  }
+  void unhandled_exception() noexcept {
+    value.template emplace<2>(std::current_exception());
+  }
+  T result() {
+    if (value.index() == 2) {
+      std::rethrow_exception(std::get<2>(value));
+    }
+    return std::move(std::get<1>(value));
+  }
+
+  std::variant<std::monostate, T, std::exception_ptr> value;
+};
+template <>
+struct Result<void> {
+  Result() noexcept : error() {}
+
+  void return_void() noexcept {}
+  void unhandled_exception() noexcept { error = std::current_exception(); }
+  void result() {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  std::exception_ptr error;
+};
+}  // namespace task
+
+template <typename T>
+struct Task<T>::promise_type : task::Result<T> {
+  promise_type() noexcept : task::Result<T>(), continuation() {}
+
+  Task get_return_object() noexcept {
+    return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+  }
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  task::FinalAwaiter final_suspend() const noexcept { return {}; }
+
+  /** coroutine awaiting this task, if any */
+  std::coroutine_handle<> continuation;
+};
+}  // namespace nplanetary::networking
+
+#endif  // NPLANETARY_NETWORKING_TASK_H_
@@ -0,0 +1,250 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/combat.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+using namespace nplanetary::map;
+
+namespace nplanetary::rules {
+namespace {
+constexpr size_t FACES = Dice::FACES;
+
+/**
+ * Attacking strength, as a multiple of the defender's, needed to reach each
+ * band of the combat table past the first
+ */
+constexpr array<double, 6> RATIOS = {0.25, 0.5, 1.0, 2.0, 3.0, 4.0};
+
+/** rolls on the damage table for each band and each face of 1d6 */
+constexpr array<array<uint8_t, FACES>, RATIOS.size() + 1> ROLLS = {{
+    {0, 0, 0, 0, 0, 0},
+    {0, 0, 0, 0, 0, 1},
+    {0, 0, 0, 0, 1, 1},
+    {0, 0, 0, 1, 1, 2},
+    {0, 0, 1, 1, 2, 2},
+    {0, 1, 1, 2, 2, 3},
+    {1, 1, 2, 2, 3, 3},
+}};
+
+/**
+ * Points of damage dealt by one entry of a damage table
+ */
+struct Damage {
+  uint8_t weapons;
+  uint8_t drives;
+  uint8_t structure;
+};
+
+/** damage tables for each role that has one, one after another */
+constexpr array<Damage, 3 * FACES> DAMAGE = {{
+    // military
+    {1, 0, 0},
+    {0, 1, 0},
+    {0, 0, 1},
+    {1, 0, 1},
+    {1, 1, 0},
+    {0, 1, 1},
+    // civilian
+    {0, 1, 0},
+    {0, 0, 1},
+    {0, 0, 1},
+    {0, 1, 1},
+    {0, 1, 1},
+    {0, 1, 1},
+    // base
+    {0, 0, 0},
+    {1, 0, 0},
+    {1, 0, 0},
+    {0, 0, 1},
+    {0, 0, 1},
+    {1, 0, 1},
+}};
+static_assert(static_cast<size_t>(Role::BASE) * FACES + FACES ==
+              DAMAGE.size());
+}  // namespace
+
+size_t Combatants::size() const noexcept { return q.size(); }
+
+size_t Combatants::add(Hex position, Hex velocity, uint8_t strength,
+                       Role role) {
+  q.push_back(position.q);
+  r.push_back(position.r);
+  vq.push_back(velocity.q);
+  vr.push_back(velocity.r);
+  strengths.push_back(strength);
+  roles.push_back(role);
+  weapons.push_back(0);
+  drives.push_back(0);
+  structure.push_back(0);
+  destroyed.push_back(0);
+  return q.size() - 1;
+}
+
+void Combatants::clear() noexcept {
+  q.clear();
+  r.clear();
+  vq.clear();
+  vr.clear();
+  strengths.clear();
+  roles.clear();
+  weapons.clear();
+  drives.clear();
+  structure.clear();
+  destroyed.clear();
+}
+
+size_t Attacks::size() const noexcept { return attackers.size(); }
+
+void Attacks::add(uint32_t attacker, span<uint32_t const> targeted,
+                  double strength) {
+  double portion = strength / static_cast<double>(targeted.size());
+  for (uint32_t target : targeted) {
+    attackers.push_back(attacker);
+    targets.push_back(target);
+    strengths.push_back(portion);
+  }
+}
+
+void Attacks::clear() noexcept {
+  attackers.clear();
+  targets.clear();
+  strengths.clear();
+}
+
+Combat::Combat() noexcept
+    : applied(),
+      totals(),
+      rolling(),
+      bands(),
+      faces(),
+      hitTargets(),
+      hitEntries() {}
+
+span<double const> Combat::resolve(Combatants &combatants,
+                                   Attacks const &attacks, Dice const &dice,
+                                   uint32_t turn) {
+  size_t count = combatants.size();
+  for (size_t idx = 0; idx < attacks.size(); ++idx) {
+    if (attacks.attackers[idx] >= count || attacks.targets[idx] >= count) {
+      throw runtime_error("attack by or on a combatant that doesn't exist");
+    }
+  }
+
+  modify(combatants, attacks);
+  totals.assign(count, 0.0);
+  tally(attacks);
+  roll(combatants, dice, turn);
+  apply(combatants);
+  return totals;
+}
+
+void Combat::modify(Combatants const &combatants, Attacks const &attacks) {
+  size_t count = attacks.size();
+  applied.resize(count);
+  for (size_t idx = 0; idx < count; ++idx) {
+    uint32_t attacker = attacks.attackers[idx];
+    uint32_t target = attacks.targets[idx];
+    Hex offset = Hex{combatants.q[target] - combatants.q[attacker],
+                     combatants.r[target] - combatants.r[attacker]};
+    Hex closing = Hex{combatants.vq[attacker] - combatants.vq[target],
+                      combatants.vr[attacker] - combatants.vr[target]};
+
+    // neighbouring hexes are a unit apart, so the dot product of two axial
+    // vectors is qq' + (qr' + rq') / 2 + rr', and the length of one is the
+    // square root of its dot product with itself
+    double dot = closing.q * offset.q +
+                 0.5 * (closing.q * offset.r + closing.r * offset.q) +
+                 closing.r * offset.r;
+    double squared = offset.q * offset.q + offset.q * offset.r +
+                     offset.r * offset.r;
+    double along = squared > 0 ? dot / sqrt(squared) : 0.0;
+    applied[idx] = max(attacks.strengths[idx] - length(offset) + along, 0.0);
+  }
+}
+
+void Combat::tally(Attacks const &attacks) {
+  for (size_t idx = 0; idx < attacks.size(); ++idx) {
+    totals[attacks.targets[idx]] += applied[idx];
+  }
+}
+
+void Combat::roll(Combatants &combatants, Dice const &dice, uint32_t turn) {
+  rolling.clear();
+  bands.clear();
+  for (size_t target = 0; target < totals.size(); ++target) {
+    double total = totals[target];
+    if (!(total > 0)) {
+      continue;
+    }
+
+    if (combatants.roles[target] == Role::ORDNANCE) {
+      if (total >= 1) {
+        combatants.destroyed[target] = 1;
+      }
+      continue;
+    }
+
+    double strength = combatants.strengths[target];
+    size_t band = 0;
+    for (double ratio : RATIOS) {
+      band += total >= ratio * strength;
+    }
+    if (band != 0) {
+      rolling.push_back(static_cast<uint32_t>(target));
+      bands.push_back(static_cast<uint8_t>(band));
+    }
+  }
+
+  // each target's roll on the combat table comes first, then its rolls on
+  // the damage table
+  faces.resize(rolling.size());
+  dice.roll(turn, Phase::COMBAT, rolling, 0, faces);
+  hitTargets.clear();
+  hitEntries.clear();
+  for (size_t idx = 0; idx < rolling.size(); ++idx) {
+    uint32_t target = rolling[idx];
+    size_t table = static_cast<size_t>(combatants.roles[target]) * FACES;
+    uint8_t rolls = ROLLS[bands[idx]][faces[idx] - 1];
+    for (uint32_t count = 1; count <= rolls; ++count) {
+      uint8_t face = dice.roll(Counter{turn, Phase::COMBAT, target, count});
+      hitTargets.push_back(target);
+      hitEntries.push_back(static_cast<uint8_t>(table + face - 1));
+    }
+  }
+}
+
+void Combat::apply(Combatants &combatants) const noexcept {
+  for (size_t idx = 0; idx < hitTargets.size(); ++idx) {
+    uint32_t target = hitTargets[idx];
+    Damage damage = DAMAGE[hitEntries[idx]];
+    combatants.weapons[target] =
+        static_cast<uint8_t>(combatants.weapons[target] + damage.weapons);
+    combatants.drives[target] =
+        static_cast<uint8_t>(combatants.drives[target] + damage.drives);
+    combatants.structure[target] =
+        static_cast<uint8_t>(combatants.structure[target] + damage.structure);
+  }
+}
+}  // namespace nplanetary::rules
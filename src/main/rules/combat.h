@@ -0,0 +1,167 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_RULES_COMBAT_H_
+#define NPLANETARY_RULES_COMBAT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "map/hex.h"
+#include "rules/dice.h"
+
+namespace nplanetary::rules {
+/**
+ * Which damage table something rolls on when attacked
+ */
+enum class Role : uint8_t {
+  MILITARY,
+  CIVILIAN,
+  BASE,
+  /** destroyed by any attack of strength one or more, without rolling */
+  ORDNANCE,
+};
+
+/**
+ * Everything that may attack or be attacked in a combat phase, stored as one
+ * array per property
+ *
+ * Positions and velocities are axial coordinates, as in map::Hex
+ */
+struct Combatants {
+  std::vector<int32_t> q = {};
+  std::vector<int32_t> r = {};
+  std::vector<int32_t> vq = {};
+  std::vector<int32_t> vr = {};
+  /** base combat strength, which attacks against it are compared to */
+  std::vector<uint8_t> strengths = {};
+  std::vector<Role> roles = {};
+  /** points of damage taken so far by each system */
+  std::vector<uint8_t> weapons = {};
+  std::vector<uint8_t> drives = {};
+  std::vector<uint8_t> structure = {};
+  /** set once a piece of ordnance is shot down */
+  std::vector<uint8_t> destroyed = {};
+
+  size_t size() const noexcept;
+  /**
+   * Adds something undamaged
+   *
+   * @returns its index
+   */
+  size_t add(map::Hex position, map::Hex velocity, uint8_t strength,
+             Role role);
+  void clear() noexcept;
+};
+
+/**
+ * Attacks ordered for a combat phase, one per attacker and target, stored as
+ * one array per property
+ */
+struct Attacks {
+  std::vector<uint32_t> attackers = {};
+  std::vector<uint32_t> targets = {};
+  /** share of the attacker's strength used, before modifiers */
+  std::vector<double> strengths = {};
+
+  size_t size() const noexcept;
+  /**
+   * Splits strength into equal portions, one against each target
+   *
+   * Checking that the attacker has that much strength, working weapons and
+   * a clear line of sight is up to whoever gave the order
+   */
+  void add(uint32_t attacker, std::span<uint32_t const> targets,
+           double strength);
+  void clear() noexcept;
+};
+
+/**
+ * Resolves a combat phase
+ *
+ * Each attack is reduced by one for each hex of range, and changed by the
+ * attacker's velocity relative to the target along the line between them,
+ * down to a minimum of zero. What's left is added up for each target and
+ * compared to its strength, which picks a band of the combat table; a 1d6
+ * roll in that band says how many times to roll on the target's damage
+ * table. Both tables are lookups, and damage is applied once every roll is
+ * made.
+ *
+ * Each target's rolls are named by the turn and the target's index, so the
+ * same combatants, attacks and dice always give the same result. Reuses its
+ * own buffers between phases, so each thread needs its own
+ */
+class Combat {
+ public:
+  Combat() noexcept;
+  Combat(Combat const &) = default;
+  Combat(Combat &&) noexcept = default;
+
+  ~Combat() noexcept = default;
+
+  Combat &operator=(Combat const &) = default;
+  Combat &operator=(Combat &&) noexcept = default;
+
+  /**
+   * Resolves every attack, adding the damage dealt to the combatants
+   *
+   * @returns total strength applied to each combatant, after modifiers;
+   * valid until the next call
+   */
+  std::span<double const> resolve(Combatants &combatants,
+                                  Attacks const &attacks, Dice const &dice,
+                                  uint32_t turn);
+
+ private:
+  /**
+   * Finds what each attack's strength comes to after modifiers
+   */
+  void modify(Combatants const &combatants, Attacks const &attacks);
+  /**
+   * Adds up the strength applied to each combatant
+   */
+  void tally(Attacks const &attacks);
+  /**
+   * Rolls on the combat and damage tables for each combatant attacked
+   */
+  void roll(Combatants &combatants, Dice const &dice, uint32_t turn);
+  /**
+   * Adds each hit's damage to the combatant it was dealt to
+   */
+  void apply(Combatants &combatants) const noexcept;
+
+  /** strength of each attack after modifiers */
+  std::vector<double> applied;
+  std::vector<double> totals;
+
+  /** ships and bases attacked hard enough to roll, and the band each is in */
+  std::vector<uint32_t> rolling;
+  std::vector<uint8_t> bands;
+  /** each one's roll on the combat table */
+  std::vector<uint8_t> faces;
+
+  /** combatants hit and the damage table entry rolled, one per roll */
+  std::vector<uint32_t> hitTargets;
+  std::vector<uint8_t> hitEntries;
+};
+}  // namespace nplanetary::rules
+
+#endif  // NPLANETARY_RULES_COMBAT_H_
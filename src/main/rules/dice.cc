@@ -0,0 +1,104 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/dice.h"
+
+#include <array>
+#include <stdexcept>
+
+using namespace std;
+
+namespace nplanetary::rules {
+namespace {
+/** Philox4x32 multipliers and key increments, from Salmon et al. 2011 */
+constexpr uint64_t MULTIPLIER_0 = 0xd2511f53;
+constexpr uint64_t MULTIPLIER_1 = 0xcd9e8d57;
+constexpr uint32_t WEYL_0 = 0x9e3779b9;
+constexpr uint32_t WEYL_1 = 0xbb67ae85;
+constexpr int ROUNDS = 10;
+/** 32 bit outputs per block */
+constexpr uint32_t WORDS = 4;
+
+/**
+ * The index'th block of random bits for some entity in some phase of a turn
+ */
+array<uint32_t, WORDS> philox(uint32_t key0, uint32_t key1, uint32_t block,
+                              uint32_t entity, uint32_t turn,
+                              uint32_t phase) noexcept {
+  uint32_t x0 = block;
+  uint32_t x1 = entity;
+  uint32_t x2 = turn;
+  uint32_t x3 = phase;
+  for (int round = 0; round < ROUNDS; ++round) {
+    uint64_t product0 = MULTIPLIER_0 * x0;
+    uint64_t product1 = MULTIPLIER_1 * x2;
+    x0 = static_cast<uint32_t>(product1 >> 32) ^ x1 ^ key0;
+    x1 = static_cast<uint32_t>(product1);
+    x2 = static_cast<uint32_t>(product0 >> 32) ^ x3 ^ key1;
+    x3 = static_cast<uint32_t>(product0);
+    key0 += WEYL_0;
+    key1 += WEYL_1;
+  }
+  return {x0, x1, x2, x3};
+}
+
+/**
+ * Scales 32 random bits to a number below bound; off from uniform by at
+ * most bound in 2^32
+ */
+uint32_t scale(uint32_t bits, uint32_t bound) noexcept {
+  return static_cast<uint32_t>(uint64_t{bits} * bound >> 32);
+}
+}  // namespace
+
+Dice::Dice(uint64_t seed) noexcept
+    : key0(static_cast<uint32_t>(seed)),
+      key1(static_cast<uint32_t>(seed >> 32)) {}
+
+uint32_t Dice::bits(Counter const &counter) const noexcept {
+  return philox(key0, key1, counter.index / WORDS, counter.entity,
+                counter.turn,
+                static_cast<uint32_t>(counter.phase))[counter.index % WORDS];
+}
+
+uint32_t Dice::below(Counter const &counter, uint32_t bound) const noexcept {
+  return scale(bits(counter), bound);
+}
+
+uint8_t Dice::roll(Counter const &counter) const noexcept {
+  return static_cast<uint8_t>(scale(bits(counter), FACES) + 1);
+}
+
+void Dice::roll(uint32_t turn, Phase phase, span<uint32_t const> entities,
+                uint32_t index, span<uint8_t> faces) const {
+  if (faces.size() != entities.size()) {
+    throw runtime_error("every entity needs a face to roll");
+  }
+
+  uint32_t block = index / WORDS;
+  uint32_t word = index % WORDS;
+  for (size_t idx = 0; idx < entities.size(); ++idx) {
+    auto [x0, x1, x2, x3] = philox(key0, key1, block, entities[idx], turn,
+                                   static_cast<uint32_t>(phase));
+    // picking the word by value, not by indexing, keeps the loop vectorized
+    uint32_t chosen = word == 0 ? x0 : word == 1 ? x1 : word == 2 ? x2 : x3;
+    faces[idx] = static_cast<uint8_t>(scale(chosen, FACES) + 1);
+  }
+}
+}  // namespace nplanetary::rules
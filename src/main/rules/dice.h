@@ -0,0 +1,97 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_RULES_DICE_H_
+#define NPLANETARY_RULES_DICE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace nplanetary::rules {
+/**
+ * Part of a turn that rolls dice; each has its own rolls
+ */
+enum class Phase : uint32_t {
+  ORDNANCE,
+  COMBAT,
+};
+
+/**
+ * Names one roll: the index'th roll made for some entity in some phase of
+ * some turn
+ */
+struct Counter {
+  uint32_t turn;
+  Phase phase;
+  uint32_t entity;
+  uint32_t index;
+};
+
+/**
+ * Every random roll in a game, found from the game's seed and which roll it
+ * is rather than from the rolls before it
+ *
+ * Each roll comes from Philox4x32-10, a counter-based generator, keyed by the
+ * seed and counting by turn, phase, entity and index, so rolls can be made
+ * in any order or on any thread, and anyone with the seed can check a turn
+ * by making the same rolls. Only as unpredictable as the seed, which should
+ * come from a secure source like randombytes_buf and be kept from players
+ * until the game's over
+ */
+class Dice {
+ public:
+  static constexpr uint32_t FACES = 6;
+
+  explicit Dice(uint64_t seed) noexcept;
+  Dice(Dice const &) noexcept = default;
+  Dice(Dice &&) noexcept = default;
+
+  ~Dice() noexcept = default;
+
+  Dice &operator=(Dice const &) noexcept = default;
+  Dice &operator=(Dice &&) noexcept = default;
+
+  /**
+   * 32 random bits
+   */
+  uint32_t bits(Counter const &counter) const noexcept;
+  /**
+   * A number from zero up to but not including bound, which must be positive
+   */
+  uint32_t below(Counter const &counter, uint32_t bound) const noexcept;
+  /**
+   * 1d6
+   */
+  uint8_t roll(Counter const &counter) const noexcept;
+  /**
+   * Rolls 1d6 once for each of many entities, all with the same index
+   *
+   * @param faces set to each entity's roll
+   */
+  void roll(uint32_t turn, Phase phase, std::span<uint32_t const> entities,
+            uint32_t index, std::span<uint8_t> faces) const;
+
+ private:
+  uint32_t key0;
+  uint32_t key1;
+};
+}  // namespace nplanetary::rules
+
+#endif  // NPLANETARY_RULES_DICE_H_
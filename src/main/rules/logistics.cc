@@ -0,0 +1,249 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/logistics.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <limits>
+
+using namespace std;
+
+namespace nplanetary::rules {
+namespace {
+constexpr uint32_t EMPTY = numeric_limits<uint32_t>::max();
+constexpr size_t MIN_SLOTS = 64;
+/** which sides of a pair ordered a transfer, or give in a flow */
+constexpr uint8_t LOWER = 1;
+constexpr uint8_t HIGHER = 2;
+
+/** what each resource becomes when given to a base */
+constexpr array<Resource, RESOURCE_COUNT> AT_BASE = {
+    Resource::FUEL,  Resource::SUPPLIES,  Resource::SUPPLIES, Resource::FUEL,
+    Resource::MINES, Resource::TORPEDOES, Resource::NUKES,
+};
+
+size_t stock(size_t holder, Resource resource) noexcept {
+  return holder * RESOURCE_COUNT + static_cast<size_t>(resource);
+}
+
+uint64_t hash(uint64_t pair, uint64_t detail) noexcept {
+  uint64_t mixed = (pair ^ detail * 0x9e3779b97f4a7c15) * 0xbf58476d1ce4e5b9;
+  return mixed ^ mixed >> 31;
+}
+}  // namespace
+
+size_t Holders::size() const noexcept { return owners.size(); }
+
+size_t Holders::add(uint32_t owner, bool base) {
+  owners.push_back(owner);
+  bases.push_back(base);
+  disabled.push_back(0);
+  stocks.insert(stocks.end(), RESOURCE_COUNT, 0);
+  return owners.size() - 1;
+}
+
+void Holders::clear() noexcept {
+  owners.clear();
+  bases.clear();
+  disabled.clear();
+  stocks.clear();
+}
+
+int32_t Holders::getStock(size_t idx, Resource resource) const noexcept {
+  return stocks[stock(idx, resource)];
+}
+
+void Holders::setStock(size_t idx, Resource resource,
+                       int32_t amount) noexcept {
+  stocks[stock(idx, resource)] = amount;
+}
+
+size_t Orders::size() const noexcept { return issuers.size(); }
+
+void Orders::add(uint32_t issuer, uint32_t partner, Resource resource,
+                 int32_t amount) {
+  issuers.push_back(issuer);
+  partners.push_back(partner);
+  resources.push_back(resource);
+  amounts.push_back(amount);
+}
+
+void Orders::clear() noexcept {
+  issuers.clear();
+  partners.clear();
+  resources.clear();
+  amounts.clear();
+}
+
+Logistics::Logistics() noexcept
+    : pairs(),
+      details(),
+      sides(),
+      entries(),
+      flows(),
+      flowGivers(),
+      transferPairs(),
+      transferDetails(),
+      transferSides(),
+      transferFlows(),
+      transferOutcomes(),
+      orderTransfers(),
+      outcomes() {}
+
+span<Outcome const> Logistics::resolve(Holders &holders,
+                                       Orders const &orders) {
+  canonicalize(holders, orders);
+  match(orders.size());
+  apply(holders);
+  for (size_t idx = 0; idx < orders.size(); ++idx) {
+    if (outcomes[idx] != Outcome::INVALID) {
+      outcomes[idx] = transferOutcomes[orderTransfers[idx]];
+    }
+  }
+  return outcomes;
+}
+
+void Logistics::canonicalize(Holders const &holders, Orders const &orders) {
+  size_t count = orders.size();
+  size_t holderCount = holders.size();
+  pairs.resize(count);
+  details.resize(count);
+  sides.resize(count);
+  outcomes.assign(count, Outcome::DONE);
+  for (size_t idx = 0; idx < count; ++idx) {
+    uint32_t issuer = orders.issuers[idx];
+    uint32_t partner = orders.partners[idx];
+    Resource resource = orders.resources[idx];
+    int32_t amount = orders.amounts[idx];
+    // the lowest amount can't be given the other way round
+    if (issuer >= holderCount || partner >= holderCount ||
+        issuer == partner || static_cast<size_t>(resource) >= RESOURCE_COUNT ||
+        amount == 0 || amount == numeric_limits<int32_t>::min()) {
+      outcomes[idx] = Outcome::INVALID;
+      continue;
+    }
+
+    bool lower = issuer < partner;
+    uint64_t low = min(issuer, partner);
+    uint64_t high = max(issuer, partner);
+    int32_t given = lower ? amount : -amount;
+    pairs[idx] = low << 32 | high;
+    details[idx] = static_cast<uint64_t>(resource) << 32 |
+                   static_cast<uint32_t>(given);
+    sides[idx] = lower ? LOWER : HIGHER;
+  }
+}
+
+void Logistics::match(size_t count) {
+  size_t slots = bit_ceil(max(2 * count, MIN_SLOTS));
+  size_t mask = slots - 1;
+  entries.assign(slots, Entry{0, 0, EMPTY});
+  flows.assign(slots, Entry{0, 0, EMPTY});
+  flowGivers.clear();
+  transferPairs.clear();
+  transferDetails.clear();
+  transferSides.clear();
+  transferFlows.clear();
+  orderTransfers.assign(count, EMPTY);
+
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (outcomes[idx] == Outcome::INVALID) {
+      continue;
+    }
+
+    uint64_t pair = pairs[idx];
+    uint64_t detail = details[idx];
+    size_t slot = hash(pair, detail) & mask;
+    while (entries[slot].transfer != EMPTY &&
+           (entries[slot].pair != pair || entries[slot].detail != detail)) {
+      slot = (slot + 1) & mask;
+    }
+
+    Entry &entry = entries[slot];
+    if (entry.transfer == EMPTY) {
+      uint32_t transfer = static_cast<uint32_t>(transferPairs.size());
+      entry = Entry{pair, detail, transfer};
+      transferPairs.push_back(pair);
+      transferDetails.push_back(detail);
+      transferSides.push_back(0);
+
+      // and the flow of this resource between them it's part of
+      uint64_t resource = detail & ~uint64_t{0xffffffff};
+      size_t flowSlot = hash(pair, resource) & mask;
+      while (flows[flowSlot].transfer != EMPTY &&
+             (flows[flowSlot].pair != pair ||
+              flows[flowSlot].detail != resource)) {
+        flowSlot = (flowSlot + 1) & mask;
+      }
+      Entry &flow = flows[flowSlot];
+      if (flow.transfer == EMPTY) {
+        flow = Entry{pair, resource, static_cast<uint32_t>(flowGivers.size())};
+        flowGivers.push_back(0);
+      }
+      int32_t given = static_cast<int32_t>(static_cast<uint32_t>(detail));
+      flowGivers[flow.transfer] |= given > 0 ? LOWER : HIGHER;
+      transferFlows.push_back(flow.transfer);
+    }
+    transferSides[entry.transfer] |= sides[idx];
+    orderTransfers[idx] = entry.transfer;
+  }
+}
+
+void Logistics::apply(Holders &holders) {
+  size_t count = transferPairs.size();
+  transferOutcomes.resize(count);
+  for (size_t transfer = 0; transfer < count; ++transfer) {
+    uint32_t low = static_cast<uint32_t>(transferPairs[transfer] >> 32);
+    uint32_t high = static_cast<uint32_t>(transferPairs[transfer]);
+    Resource resource = static_cast<Resource>(transferDetails[transfer] >> 32);
+    int32_t given = static_cast<int32_t>(
+        static_cast<uint32_t>(transferDetails[transfer]));
+
+    // one side's order is enough if the other side is its own or can't
+    // refuse, unless the resource was also ordered to go the other way
+    uint8_t ordered = transferSides[transfer];
+    uint32_t other = ordered == LOWER ? high : low;
+    if (ordered != (LOWER | HIGHER) &&
+        ((holders.owners[low] != holders.owners[high] &&
+          holders.disabled[other] == 0) ||
+         flowGivers[transferFlows[transfer]] == (LOWER | HIGHER))) {
+      transferOutcomes[transfer] = Outcome::UNMATCHED;
+      continue;
+    }
+
+    uint32_t giver = given > 0 ? low : high;
+    uint32_t receiver = given > 0 ? high : low;
+    int32_t amount = given > 0 ? given : -given;
+    int32_t &held = holders.stocks[stock(giver, resource)];
+    if (held < amount) {
+      transferOutcomes[transfer] = Outcome::SHORT;
+      continue;
+    }
+
+    held -= amount;
+    Resource received = holders.bases[receiver] != 0
+                            ? AT_BASE[static_cast<size_t>(resource)]
+                            : resource;
+    holders.stocks[stock(receiver, received)] += amount;
+    transferOutcomes[transfer] = Outcome::DONE;
+  }
+}
+}  // namespace nplanetary::rules
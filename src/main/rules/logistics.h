@@ -0,0 +1,203 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_RULES_LOGISTICS_H_
+#define NPLANETARY_RULES_LOGISTICS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace nplanetary::rules {
+/**
+ * Something that can be carried and transferred
+ */
+enum class Resource : uint8_t {
+  FUEL,
+  SUPPLIES,
+  /** becomes supplies when given to a base */
+  ORE,
+  /** becomes fuel when given to a base */
+  WATER,
+  MINES,
+  TORPEDOES,
+  NUKES,
+};
+
+constexpr size_t RESOURCE_COUNT = 7;
+
+/**
+ * Ships and bases that may transfer resources, stored as one array per
+ * property
+ */
+struct Holders {
+  /** player each belongs to */
+  std::vector<uint32_t> owners = {};
+  std::vector<uint8_t> bases = {};
+  /**
+   * Set if both its drives and weapons are disabled, if it has them, so
+   * anyone may transfer to or from it without its agreement
+   */
+  std::vector<uint8_t> disabled = {};
+  /** amount of each resource held, RESOURCE_COUNT per holder */
+  std::vector<int32_t> stocks = {};
+
+  size_t size() const noexcept;
+  /**
+   * Adds something holding nothing
+   *
+   * @returns its index
+   */
+  size_t add(uint32_t owner, bool base);
+  void clear() noexcept;
+
+  int32_t getStock(size_t idx, Resource resource) const noexcept;
+  void setStock(size_t idx, Resource resource, int32_t amount) noexcept;
+};
+
+/**
+ * Transfers ordered in a logistics phase, each given by one side of the
+ * transfer, stored as one array per property
+ */
+struct Orders {
+  /** holder the order was given to */
+  std::vector<uint32_t> issuers = {};
+  /** holder on the other side */
+  std::vector<uint32_t> partners = {};
+  std::vector<Resource> resources = {};
+  /** amount given to the partner, or taken from it if negative */
+  std::vector<int32_t> amounts = {};
+
+  size_t size() const noexcept;
+  void add(uint32_t issuer, uint32_t partner, Resource resource,
+           int32_t amount);
+  void clear() noexcept;
+};
+
+/**
+ * What became of an order
+ */
+enum class Outcome : uint8_t {
+  DONE,
+  /**
+   * The partner wasn't ordered to make the same transfer, and either belongs
+   * to another player and isn't disabled, or the same resource was also
+   * ordered to go the other way between them
+   */
+  UNMATCHED,
+  /** whoever was giving didn't have enough */
+  SHORT,
+  /** not a transfer between two holders that exist */
+  INVALID,
+};
+
+/**
+ * Resolves a logistics phase
+ *
+ * Orders for the same transfer, from either side, are one transfer; one
+ * with another player's holder only goes through if that side ordered it
+ * too, unless the holder is disabled. One that only one side ordered never
+ * goes through if the same resource was also ordered to go the other way
+ * between them, since it's unclear which should happen. Each order is
+ * reduced to a key of
+ * both holders in order, the resource, and the amount going from the first
+ * to the second, and matched with the others through a hash table, so a
+ * phase takes time in proportion to the number of orders.
+ *
+ * Transfers are made in the order they were first ordered, and fail if the
+ * giver doesn't have enough by then. Checking that holders are close enough
+ * to transfer, and have room for what they're given, is up to whoever gave
+ * the orders. Reuses its own buffers between phases, so each thread needs
+ * its own
+ */
+class Logistics {
+ public:
+  Logistics() noexcept;
+  Logistics(Logistics const &) = default;
+  Logistics(Logistics &&) noexcept = default;
+
+  ~Logistics() noexcept = default;
+
+  Logistics &operator=(Logistics const &) = default;
+  Logistics &operator=(Logistics &&) noexcept = default;
+
+  /**
+   * Makes every transfer that goes through, changing the holders' stocks
+   *
+   * @returns what became of each order; valid until the next call
+   */
+  std::span<Outcome const> resolve(Holders &holders, Orders const &orders);
+
+ private:
+  /**
+   * A transfer in a hash table
+   */
+  struct Entry {
+    /** lower holder in the high half, the higher in the low half */
+    uint64_t pair;
+    /**
+     * resource in the high half, and signed amount in the low half, except in
+     * flows, where it's zero
+     */
+    uint64_t detail;
+    /** index of the transfer or flow, or EMPTY */
+    uint32_t transfer;
+  };
+
+  /**
+   * Finds each order's key, marking orders that can't be transfers
+   */
+  void canonicalize(Holders const &holders, Orders const &orders);
+  /**
+   * Finds the transfer each order is part of, adding new ones as found
+   */
+  void match(size_t count);
+  /**
+   * Makes every transfer that was agreed to, in the order they were found
+   */
+  void apply(Holders &holders);
+
+  /** each order's key, valid unless it's INVALID */
+  std::vector<uint64_t> pairs;
+  std::vector<uint64_t> details;
+  /** which side of the pair gave each order; one for the lower holder */
+  std::vector<uint8_t> sides;
+
+  std::vector<Entry> entries;
+  /** each resource moved between each pair, keyed without the amount */
+  std::vector<Entry> flows;
+  /** which holders of each flow's pair give in it, as a bitmask */
+  std::vector<uint8_t> flowGivers;
+
+  /** each transfer's key, and which sides ordered it, as a bitmask */
+  std::vector<uint64_t> transferPairs;
+  std::vector<uint64_t> transferDetails;
+  std::vector<uint8_t> transferSides;
+  /** flow each transfer is part of */
+  std::vector<uint32_t> transferFlows;
+  std::vector<Outcome> transferOutcomes;
+  /** transfer each order is part of */
+  std::vector<uint32_t> orderTransfers;
+
+  std::vector<Outcome> outcomes;
+};
+}  // namespace nplanetary::rules
+
+#endif  // NPLANETARY_RULES_LOGISTICS_H_
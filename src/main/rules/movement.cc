@@ -0,0 +1,345 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/movement.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+using namespace std;
+using namespace nplanetary::map;
+
+namespace nplanetary::rules {
+namespace {
+/** offset stored pulls are biased by so they're never negative */
+constexpr int32_t PULL_BIAS = 4;
+constexpr uint8_t PULL_MASK = 0x7;
+constexpr int PULL_R_SHIFT = 3;
+constexpr uint8_t SURFACE = 0x40;
+
+constexpr uint8_t pack(Hex pull, bool surface) noexcept {
+  return static_cast<uint8_t>(
+      (pull.q + PULL_BIAS) | (pull.r + PULL_BIAS) << PULL_R_SHIFT |
+      (surface ? SURFACE : 0));
+}
+constexpr int32_t pullQ(uint8_t packed) noexcept {
+  return (packed & PULL_MASK) - PULL_BIAS;
+}
+constexpr int32_t pullR(uint8_t packed) noexcept {
+  return (packed >> PULL_R_SHIFT & PULL_MASK) - PULL_BIAS;
+}
+
+/** an ordinary hex, which neither pulls nor crashes anything */
+constexpr uint8_t EMPTY = pack(Hex{0, 0}, false);
+/** clearance of hexes too far from any body to bother counting */
+constexpr uint8_t FAR = 0xff;
+
+/**
+ * Keeps path points off the edges between hexes, so they always round the
+ * same way; s is nudged by minus their sum
+ */
+constexpr double NUDGE_Q = 1e-6;
+constexpr double NUDGE_R = 2e-6;
+
+/**
+ * Makes every coordinate on a path positive, so truncating rounds down
+ */
+constexpr int32_t ROUNDING_BIAS = 4 * Movers::MAX_COORDINATE;
+
+/**
+ * Nearest integer to x, rounding halves up
+ *
+ * Written as a truncating conversion so the loops using it vectorize without
+ * needing a rounding instruction
+ */
+inline int32_t nearest(double x) noexcept {
+  return static_cast<int32_t>(x + (ROUNDING_BIAS + 0.5)) - ROUNDING_BIAS;
+}
+
+/**
+ * Whether a position or velocity is within MAX_COORDINATE of zero
+ */
+constexpr bool inRange(int64_t q, int64_t r) noexcept {
+  return -Movers::MAX_COORDINATE <= q && q <= Movers::MAX_COORDINATE &&
+         -Movers::MAX_COORDINATE <= r && r <= Movers::MAX_COORDINATE;
+}
+}  // namespace
+
+size_t Movers::size() const noexcept { return q.size(); }
+
+size_t Movers::add(Hex position, Hex velocity) {
+  if (!inRange(position.q, position.r) || !inRange(velocity.q, velocity.r)) {
+    throw runtime_error("mover out of range");
+  }
+
+  q.push_back(position.q);
+  r.push_back(position.r);
+  vq.push_back(velocity.q);
+  vr.push_back(velocity.r);
+  burnQ.push_back(0);
+  burnR.push_back(0);
+  fates.push_back(Fate::FLYING);
+  return q.size() - 1;
+}
+
+void Movers::clear() noexcept {
+  q.clear();
+  r.clear();
+  vq.clear();
+  vr.clear();
+  burnQ.clear();
+  burnR.clear();
+  fates.clear();
+}
+
+Hex Movers::getPosition(size_t idx) const noexcept {
+  return Hex{q[idx], r[idx]};
+}
+
+Hex Movers::getVelocity(size_t idx) const noexcept {
+  return Hex{vq[idx], vr[idx]};
+}
+
+void Movers::setBurn(size_t idx, Hex burn) noexcept {
+  burnQ[idx] = burn.q;
+  burnR[idx] = burn.r;
+}
+
+Movement::Movement(Map const &map)
+    : radius(map.getRadius()),
+      stride(2 * map.getRadius() + 3),
+      field(map.size(), EMPTY),
+      clearance(map.size(), FAR),
+      destQ(),
+      destR(),
+      traces() {
+  vector<size_t> frontier;
+  for (size_t idx = 0; idx < field.size(); ++idx) {
+    Hex pull = Hex{0, 0};
+    uint8_t gravity = map.getGravity(idx);
+    for (size_t direction = 0; direction < DIRECTION_COUNT; ++direction) {
+      if ((gravity >> direction & 1) != 0) {
+        pull += DIRECTIONS[direction];
+      }
+    }
+    bool surface = map.getTerrain(idx) == Terrain::BODY;
+    field[idx] = pack(pull, surface);
+
+    if (gravity != 0 || surface) {
+      clearance[idx] = 0;
+      frontier.push_back(idx);
+    }
+  }
+
+  // spread out from everything that matters to a path, a ring at a time
+  vector<size_t> next;
+  for (uint8_t distance = 1; distance < FAR && !frontier.empty();
+       ++distance) {
+    next.clear();
+    for (size_t idx : frontier) {
+      for (size_t direction = 0; direction < DIRECTION_COUNT; ++direction) {
+        size_t adjacent =
+            map.neighbour(idx, static_cast<Direction>(direction));
+        if (map.getTerrain(adjacent) != Terrain::OFF_MAP &&
+            clearance[adjacent] == FAR) {
+          clearance[adjacent] = distance;
+          next.push_back(adjacent);
+        }
+      }
+    }
+    swap(frontier, next);
+  }
+
+  // paths ending off the map are rare enough to always trace
+  for (size_t idx = 0; idx < clearance.size(); ++idx) {
+    if (map.getTerrain(idx) == Terrain::OFF_MAP) {
+      clearance[idx] = 0;
+    }
+  }
+}
+
+void Movement::advance(Movers &movers) {
+  size_t count = movers.size();
+  destQ.resize(count);
+  destR.resize(count);
+
+  // check every burn before anything moves, so a bad one changes nothing
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (movers.fates[idx] == Fate::FLYING &&
+        !inRange(int64_t{movers.vq[idx]} + movers.burnQ[idx],
+                 int64_t{movers.vr[idx]} + movers.burnR[idx])) {
+      throw runtime_error("burn out of range: "s + to_string(idx));
+    }
+  }
+
+  // the loops that only touch each mover's own entries are branchless so they
+  // vectorize; none of the arrays overlap, which ivdep tells the compiler
+  // instead of it checking
+  int32_t *q = movers.q.data();
+  int32_t *r = movers.r.data();
+  int32_t *vq = movers.vq.data();
+  int32_t *vr = movers.vr.data();
+  int32_t *burnQ = movers.burnQ.data();
+  int32_t *burnR = movers.burnR.data();
+  Fate *fates = movers.fates.data();
+  int32_t *toQ = destQ.data();
+  int32_t *toR = destR.data();
+
+  // burn and find where everything would end up, which is where it is for
+  // anything no longer flying
+#pragma GCC ivdep
+  for (size_t idx = 0; idx < count; ++idx) {
+    int32_t flying = fates[idx] == Fate::FLYING;
+    int32_t velocityQ = vq[idx] + burnQ[idx] * flying;
+    int32_t velocityR = vr[idx] + burnR[idx] * flying;
+    vq[idx] = velocityQ;
+    vr[idx] = velocityR;
+    burnQ[idx] = 0;
+    burnR[idx] = 0;
+    toQ[idx] = q[idx] + velocityQ * flying;
+    toR[idx] = r[idx] + velocityR * flying;
+  }
+
+  // every hex along a path is at most its length from the start, so a path
+  // can only touch something that pulls or crashes it if it starts that close
+  uint8_t const *clear = clearance.data();
+  traces.clear();
+  for (size_t idx = 0; idx < count; ++idx) {
+    int32_t hexes = length(Hex{toQ[idx] - q[idx], toR[idx] - r[idx]});
+    if (hexes != 0 && clear[cell(q[idx], r[idx])] <= hexes) {
+      traces.add(static_cast<uint32_t>(idx), movers.getPosition(idx),
+                 movers.getVelocity(idx));
+    }
+  }
+
+  // trace every path near a body a hex at a time, all paths in lockstep; the
+  // start hex is step zero, so it never pulls. Looking up the field is a
+  // gather, so this stays scalar, but it's only run for the few paths that
+  // need it
+  size_t traced = traces.movers.size();
+  int32_t longest = 0;
+  for (int32_t steps : traces.steps) {
+    longest = max(longest, steps);
+  }
+  double const *startQ = traces.startQ.data();
+  double const *startR = traces.startR.data();
+  double const *stepQ = traces.stepQ.data();
+  double const *stepR = traces.stepR.data();
+  int32_t const *steps = traces.steps.data();
+  int32_t *pullQs = traces.pullQ.data();
+  int32_t *pullRs = traces.pullR.data();
+  uint8_t *crashed = traces.crashed.data();
+  int32_t *crashQ = traces.crashQ.data();
+  int32_t *crashR = traces.crashR.data();
+  uint8_t const *cells = field.data();
+  for (int32_t step = 1; step <= longest; ++step) {
+    for (size_t idx = 0; idx < traced; ++idx) {
+      // round the point on the path to the hex it's in, in cube coordinates
+      double pointQ = startQ[idx] + stepQ[idx] * step;
+      double pointR = startR[idx] + stepR[idx] * step;
+      double pointS = -pointQ - pointR;
+      int32_t hexQ = nearest(pointQ);
+      int32_t hexR = nearest(pointR);
+      int32_t hexS = nearest(pointS);
+      double errorQ = fabs(hexQ - pointQ);
+      double errorR = fabs(hexR - pointR);
+      double errorS = fabs(hexS - pointS);
+      bool fixQ = (errorQ > errorR) & (errorQ > errorS);
+      bool fixR = !fixQ & (errorR > errorS);
+      hexQ = fixQ ? -hexR - hexS : hexQ;
+      hexR = fixR ? -hexQ - hexS : hexR;
+
+      uint8_t packed = cells[cell(hexQ, hexR)];
+      bool moving = (step <= steps[idx]) & (crashed[idx] == 0);
+      bool crashing = moving & ((packed & SURFACE) != 0);
+      pullQs[idx] += moving ? pullQ(packed) : 0;
+      pullRs[idx] += moving ? pullR(packed) : 0;
+      crashQ[idx] = crashing ? hexQ : crashQ[idx];
+      crashR[idx] = crashing ? hexR : crashR[idx];
+      crashed[idx] |= static_cast<uint8_t>(crashing);
+    }
+  }
+
+#pragma GCC ivdep
+  for (size_t idx = 0; idx < count; ++idx) {
+    int32_t hexes = abs(toQ[idx]) + abs(toR[idx]) + abs(toQ[idx] + toR[idx]);
+    Fate fate = fates[idx];
+    bool lost = (fate == Fate::FLYING) & (hexes > 2 * radius);
+    q[idx] = toQ[idx];
+    r[idx] = toR[idx];
+    fates[idx] = lost ? Fate::LOST : fate;
+  }
+  for (size_t idx = 0; idx < traced; ++idx) {
+    uint32_t mover = traces.movers[idx];
+    if (crashed[idx] != 0) {
+      q[mover] = crashQ[idx];
+      r[mover] = crashR[idx];
+      fates[mover] = Fate::CRASHED;
+    } else {
+      vq[mover] += pullQs[idx];
+      vr[mover] += pullRs[idx];
+    }
+  }
+}
+
+Hex Movement::getPull(Hex hex) const noexcept {
+  uint8_t packed = field[cell(hex.q, hex.r)];
+  return Hex{pullQ(packed), pullR(packed)};
+}
+
+size_t Movement::cell(int32_t q, int32_t r) const noexcept {
+  bool onMap = abs(q) + abs(r) + abs(q + r) <= 2 * radius;
+  return onMap ? static_cast<size_t>((r + radius + 1) * stride +
+                                     (q + radius + 1))
+               : 0;
+}
+
+void Movement::Traces::clear() noexcept {
+  movers.clear();
+  startQ.clear();
+  startR.clear();
+  stepQ.clear();
+  stepR.clear();
+  steps.clear();
+  pullQ.clear();
+  pullR.clear();
+  crashed.clear();
+  crashQ.clear();
+  crashR.clear();
+}
+
+void Movement::Traces::add(uint32_t mover, Hex start, Hex velocity) {
+  int32_t hexes = length(velocity);
+  movers.push_back(mover);
+  startQ.push_back(start.q + NUDGE_Q);
+  startR.push_back(start.r + NUDGE_R);
+  stepQ.push_back(static_cast<double>(velocity.q) / hexes);
+  stepR.push_back(static_cast<double>(velocity.r) / hexes);
+  steps.push_back(hexes);
+  pullQ.push_back(0);
+  pullR.push_back(0);
+  crashed.push_back(0);
+  crashQ.push_back(0);
+  crashR.push_back(0);
+}
+}  // namespace nplanetary::rules
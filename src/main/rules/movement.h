@@ -0,0 +1,166 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_RULES_MOVEMENT_H_
+#define NPLANETARY_RULES_MOVEMENT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "map/hex.h"
+#include "map/map.h"
+
+namespace nplanetary::rules {
+/**
+ * What became of something after it moved
+ */
+enum class Fate : uint8_t {
+  FLYING,
+  /** its path touched the surface of a body */
+  CRASHED,
+  /** it ended its move off the map */
+  LOST,
+};
+
+/**
+ * Ships and ordnance that move, stored as one array per property so a turn
+ * can be resolved for all of them at once
+ *
+ * Positions and velocities are axial coordinates, as in map::Hex, and must
+ * stay within MAX_COORDINATE of the centre
+ */
+struct Movers {
+  /** furthest a position or velocity may be from zero in any coordinate */
+  static constexpr int32_t MAX_COORDINATE = 1 << 19;
+
+  std::vector<int32_t> q = {};
+  std::vector<int32_t> r = {};
+  std::vector<int32_t> vq = {};
+  std::vector<int32_t> vr = {};
+  /**
+   * Change in velocity ordered for this turn, cleared once applied; checking
+   * that it's allowed is up to whoever gave the order
+   */
+  std::vector<int32_t> burnQ = {};
+  std::vector<int32_t> burnR = {};
+  /** anything no longer FLYING stays where it is */
+  std::vector<Fate> fates = {};
+
+  size_t size() const noexcept;
+  /**
+   * Adds something flying, without a burn; throws if its position or
+   * velocity is out of range
+   *
+   * @returns its index
+   */
+  size_t add(map::Hex position, map::Hex velocity);
+  void clear() noexcept;
+
+  map::Hex getPosition(size_t idx) const noexcept;
+  map::Hex getVelocity(size_t idx) const noexcept;
+  void setBurn(size_t idx, map::Hex burn) noexcept;
+};
+
+/**
+ * Resolves the movement phase on one map
+ *
+ * Everything flying applies its burn, then moves along its velocity. Each
+ * gravity hex entered, not counting the one it started in, pulls the
+ * velocity one hex towards its body for the next turn, and touching the
+ * surface of a body is a crash. Gravity is looked up in a table built once
+ * per map, and only paths that start near a body are traced hex by hex.
+ *
+ * Reuses its own buffers between turns, so each thread needs its own copy
+ */
+class Movement {
+ public:
+  explicit Movement(map::Map const &map);
+  Movement(Movement const &) = default;
+  Movement(Movement &&) noexcept = default;
+
+  ~Movement() noexcept = default;
+
+  Movement &operator=(Movement const &) = default;
+  Movement &operator=(Movement &&) noexcept = default;
+
+  /**
+   * Moves everything flying by one turn
+   *
+   * Throws without moving anything if a burn would take a velocity out of
+   * range
+   */
+  void advance(Movers &movers);
+
+  /**
+   * Change in velocity a hex imposes on anything entering it
+   */
+  map::Hex getPull(map::Hex hex) const noexcept;
+
+ private:
+  /**
+   * Where a hex's entry in the field is; the corner of the border, which
+   * never pulls, for hexes off the map
+   */
+  size_t cell(int32_t q, int32_t r) const noexcept;
+
+  /**
+   * Paths being traced this turn, one array per property
+   */
+  struct Traces {
+    /** which mover each trace is for */
+    std::vector<uint32_t> movers = {};
+    /** start of the path, nudged off the edges between hexes */
+    std::vector<double> startQ = {};
+    std::vector<double> startR = {};
+    /** one hex's worth of the path */
+    std::vector<double> stepQ = {};
+    std::vector<double> stepR = {};
+    std::vector<int32_t> steps = {};
+    std::vector<int32_t> pullQ = {};
+    std::vector<int32_t> pullR = {};
+    std::vector<uint8_t> crashed = {};
+    std::vector<int32_t> crashQ = {};
+    std::vector<int32_t> crashR = {};
+
+    void clear() noexcept;
+    void add(uint32_t mover, map::Hex start, map::Hex velocity);
+  };
+
+  int32_t radius;
+  int32_t stride;
+  /**
+   * Each stored hex's pull and whether it's a surface, packed into a byte so
+   * the whole field stays in cache
+   */
+  std::vector<uint8_t> field;
+
+  /**
+   * Hexes from each stored hex to the nearest one that pulls or is a
+   * surface, as far as it's worth counting; zero off the map
+   */
+  std::vector<uint8_t> clearance;
+
+  std::vector<int32_t> destQ;
+  std::vector<int32_t> destR;
+  Traces traces;
+};
+}  // namespace nplanetary::rules
+
+#endif  // NPLANETARY_RULES_MOVEMENT_H_
@@ -0,0 +1,304 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/ordnance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+using namespace nplanetary::map;
+
+namespace nplanetary::rules {
+namespace {
+/**
+ * Hexes a target's track is widened by when binned; a point within half a
+ * hex of another is less than one hex from it along each axis
+ */
+constexpr int32_t MARGIN = 1;
+/** log2 of the hexes along each side of a bucket, unless that's too many */
+constexpr int32_t BUCKET_SHIFT = 2;
+constexpr int64_t MAX_BUCKETS = 1 << 16;
+/** time of a candidate that's never hit; after the end of the turn */
+constexpr double MISS = 2.0;
+
+/**
+ * Range of buckets along one axis
+ */
+struct Span {
+  int32_t low;
+  int32_t high;
+};
+
+/**
+ * Buckets covering the coordinates between from and to, widened by margin
+ * and clamped to the grid
+ */
+Span buckets(int32_t from, int32_t to, int32_t margin, int32_t origin,
+             int32_t shift, int32_t count) noexcept {
+  int32_t low = (min(from, to) - margin - origin) >> shift;
+  int32_t high = (max(from, to) + margin - origin) >> shift;
+  return Span{max(low, 0), min(high, count - 1)};
+}
+}  // namespace
+
+size_t Tracks::size() const noexcept { return fromQ.size(); }
+
+size_t Tracks::add(Hex from, Hex to) {
+  fromQ.push_back(from.q);
+  fromR.push_back(from.r);
+  toQ.push_back(to.q);
+  toR.push_back(to.r);
+  return fromQ.size() - 1;
+}
+
+void Tracks::clear() noexcept {
+  fromQ.clear();
+  fromR.clear();
+  toQ.clear();
+  toR.clear();
+}
+
+Detonations::Detonations() noexcept
+    : originQ(0),
+      originR(0),
+      shift(BUCKET_SHIFT),
+      columns(0),
+      rows(0),
+      starts(),
+      entries(),
+      seen(),
+      pieces(),
+      candidates(),
+      a(),
+      b(),
+      c(),
+      times(),
+      tied(),
+      results() {}
+
+span<uint32_t const> Detonations::resolve(Tracks const &targets,
+                                          span<uint8_t const> sizes,
+                                          Tracks const &ordnance,
+                                          span<uint32_t const> exempt,
+                                          Dice const &dice, uint32_t turn) {
+  if (sizes.size() != targets.size()) {
+    throw runtime_error("every target needs a size");
+  } else if (exempt.size() != ordnance.size()) {
+    throw runtime_error("every piece of ordnance needs an exemption");
+  }
+
+  bin(targets);
+  gather(targets, ordnance, exempt);
+  approach(targets, ordnance);
+  results.assign(ordnance.size(), NO_TARGET);
+  choose(sizes, dice, turn);
+  return results;
+}
+
+void Detonations::bin(Tracks const &targets) {
+  size_t count = targets.size();
+  if (count == 0) {
+    columns = 0;
+    rows = 0;
+    starts.assign(1, 0);
+    entries.clear();
+    return;
+  }
+
+  int32_t lowQ = numeric_limits<int32_t>::max();
+  int32_t highQ = numeric_limits<int32_t>::min();
+  int32_t lowR = numeric_limits<int32_t>::max();
+  int32_t highR = numeric_limits<int32_t>::min();
+  for (size_t idx = 0; idx < count; ++idx) {
+    lowQ = min({lowQ, targets.fromQ[idx], targets.toQ[idx]});
+    highQ = max({highQ, targets.fromQ[idx], targets.toQ[idx]});
+    lowR = min({lowR, targets.fromR[idx], targets.toR[idx]});
+    highR = max({highR, targets.fromR[idx], targets.toR[idx]});
+  }
+  originQ = lowQ - MARGIN;
+  originR = lowR - MARGIN;
+  int64_t spanQ = highQ + MARGIN - originQ;
+  int64_t spanR = highR + MARGIN - originR;
+
+  // targets spread far apart get bigger buckets, so the grid stays small
+  shift = BUCKET_SHIFT;
+  while (((spanQ >> shift) + 1) * ((spanR >> shift) + 1) > MAX_BUCKETS) {
+    ++shift;
+  }
+  columns = static_cast<int32_t>((spanQ >> shift) + 1);
+  rows = static_cast<int32_t>((spanR >> shift) + 1);
+
+  // count each bucket's targets, then lay them out one bucket after another
+  starts.assign(static_cast<size_t>(columns * rows) + 1, 0);
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t idx = 0; idx < count; ++idx) {
+      Span qs = buckets(targets.fromQ[idx], targets.toQ[idx], MARGIN, originQ,
+                        shift, columns);
+      Span rs = buckets(targets.fromR[idx], targets.toR[idx], MARGIN, originR,
+                        shift, rows);
+      for (int32_t row = rs.low; row <= rs.high; ++row) {
+        for (int32_t column = qs.low; column <= qs.high; ++column) {
+          size_t bucket = static_cast<size_t>(row * columns + column);
+          if (pass == 0) {
+            ++starts[bucket + 1];
+          } else {
+            entries[starts[bucket]++] = static_cast<uint32_t>(idx);
+          }
+        }
+      }
+    }
+
+    if (pass == 0) {
+      for (size_t bucket = 1; bucket < starts.size(); ++bucket) {
+        starts[bucket] += starts[bucket - 1];
+      }
+      entries.resize(starts.back());
+    } else {
+      // filling moved each start to where the next bucket starts
+      copy_backward(starts.begin(), starts.end() - 1, starts.end());
+      starts[0] = 0;
+    }
+  }
+}
+
+void Detonations::gather(Tracks const &targets, Tracks const &ordnance,
+                         span<uint32_t const> exempt) {
+  seen.assign(targets.size(), 0);
+  pieces.clear();
+  candidates.clear();
+  for (size_t piece = 0; piece < ordnance.size(); ++piece) {
+    uint32_t stamp = static_cast<uint32_t>(piece) + 1;
+    Span qs = buckets(ordnance.fromQ[piece], ordnance.toQ[piece], 0, originQ,
+                      shift, columns);
+    Span rs = buckets(ordnance.fromR[piece], ordnance.toR[piece], 0, originR,
+                      shift, rows);
+    for (int32_t row = rs.low; row <= rs.high; ++row) {
+      for (int32_t column = qs.low; column <= qs.high; ++column) {
+        size_t bucket = static_cast<size_t>(row * columns + column);
+        for (uint32_t entry = starts[bucket]; entry < starts[bucket + 1];
+             ++entry) {
+          uint32_t target = entries[entry];
+          if (seen[target] != stamp && target != exempt[piece]) {
+            seen[target] = stamp;
+            pieces.push_back(static_cast<uint32_t>(piece));
+            candidates.push_back(target);
+          }
+        }
+      }
+    }
+  }
+}
+
+void Detonations::approach(Tracks const &targets, Tracks const &ordnance) {
+  size_t count = candidates.size();
+  a.resize(count);
+  b.resize(count);
+  c.resize(count);
+  times.resize(count);
+
+  // where the piece is relative to the target, and how fast that changes;
+  // squared distances between hex centres are q^2 + qr + r^2, and quadrupling
+  // everything makes half a hex squared a whole number
+  for (size_t idx = 0; idx < count; ++idx) {
+    uint32_t piece = pieces[idx];
+    uint32_t target = candidates[idx];
+    int64_t fromQ = ordnance.fromQ[piece] - targets.fromQ[target];
+    int64_t fromR = ordnance.fromR[piece] - targets.fromR[target];
+    int64_t toQ = ordnance.toQ[piece] - targets.toQ[target];
+    int64_t toR = ordnance.toR[piece] - targets.toR[target];
+    int64_t velocityQ = toQ - fromQ;
+    int64_t velocityR = toR - fromR;
+    a[idx] = static_cast<double>(
+        4 * (velocityQ * velocityQ + velocityQ * velocityR +
+             velocityR * velocityR));
+    b[idx] = static_cast<double>(
+        4 * (2 * fromQ * velocityQ + fromQ * velocityR + fromR * velocityQ +
+             2 * fromR * velocityR));
+    c[idx] = static_cast<double>(
+        4 * (fromQ * fromQ + fromQ * fromR + fromR * fromR) - 1);
+  }
+
+  // whether the distance ever gets down to half a hex; the coefficients are
+  // whole numbers, so this is decided exactly
+  double const *as = a.data();
+  double const *bs = b.data();
+  double const *cs = c.data();
+  double *ts = times.data();
+#pragma GCC ivdep
+  for (size_t idx = 0; idx < count; ++idx) {
+    double discriminant = bs[idx] * bs[idx] - 4 * as[idx] * cs[idx];
+    bool inside = cs[idx] <= 0;
+    bool closing = (bs[idx] < 0) & (discriminant >= 0);
+    bool inTime =
+        (as[idx] + bs[idx] + cs[idx] <= 0) | (-bs[idx] <= 2 * as[idx]);
+    ts[idx] = (inside | (closing & inTime)) ? 0.0 : MISS;
+  }
+
+  // when it first does, for the few that hit and didn't start that close
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (ts[idx] < MISS && cs[idx] > 0) {
+      double discriminant = bs[idx] * bs[idx] - 4 * as[idx] * cs[idx];
+      ts[idx] = (-bs[idx] - sqrt(discriminant)) / (2 * as[idx]);
+    }
+  }
+}
+
+void Detonations::choose(span<uint8_t const> sizes, Dice const &dice,
+                         uint32_t turn) {
+  size_t count = candidates.size();
+  size_t begin = 0;
+  while (begin < count) {
+    uint32_t piece = pieces[begin];
+    size_t end = begin;
+    double first = MISS;
+    for (; end < count && pieces[end] == piece; ++end) {
+      first = min(first, times[end]);
+    }
+    if (first >= MISS) {
+      begin = end;
+      continue;
+    }
+
+    uint8_t largest = 0;
+    for (size_t idx = begin; idx < end; ++idx) {
+      if (times[idx] <= first) {
+        largest = max(largest, sizes[candidates[idx]]);
+      }
+    }
+    tied.clear();
+    for (size_t idx = begin; idx < end; ++idx) {
+      if (times[idx] <= first && sizes[candidates[idx]] == largest) {
+        tied.push_back(candidates[idx]);
+      }
+    }
+
+    if (tied.size() == 1) {
+      results[piece] = tied[0];
+    } else {
+      // bucket order depends on the grid, so put ties in a fixed order first
+      sort(tied.begin(), tied.end());
+      results[piece] = tied[dice.below(Counter{turn, Phase::ORDNANCE, piece, 0},
+                                       static_cast<uint32_t>(tied.size()))];
+    }
+    begin = end;
+  }
+}
+}  // namespace nplanetary::rules
@@ -0,0 +1,148 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef NPLANETARY_RULES_ORDNANCE_H_
+#define NPLANETARY_RULES_ORDNANCE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "map/hex.h"
+#include "rules/dice.h"
+
+namespace nplanetary::rules {
+/**
+ * Things moving in a straight line from one hex to another over a turn,
+ * stored as one array per property
+ */
+struct Tracks {
+  std::vector<int32_t> fromQ = {};
+  std::vector<int32_t> fromR = {};
+  std::vector<int32_t> toQ = {};
+  std::vector<int32_t> toR = {};
+
+  size_t size() const noexcept;
+  /**
+   * @returns the track's index
+   */
+  size_t add(map::Hex from, map::Hex to);
+  void clear() noexcept;
+};
+
+/**
+ * Finds what each piece of ordnance detonates against during a turn's
+ * movement
+ *
+ * A piece detonates against the first ship or base that comes within half a
+ * hex of it, with both moving steadily along their tracks. Targets reached
+ * at the same moment are broken by size, largest first, then at random.
+ *
+ * Targets are binned into a grid of buckets by the hexes their tracks cover,
+ * so each piece is only checked against targets that pass nearby, and those
+ * checks are done in one batch. Reuses its own buffers between turns, so
+ * each thread needs its own
+ */
+class Detonations {
+ public:
+  static constexpr uint32_t NO_TARGET = std::numeric_limits<uint32_t>::max();
+
+  Detonations() noexcept;
+  Detonations(Detonations const &) = default;
+  Detonations(Detonations &&) noexcept = default;
+
+  ~Detonations() noexcept = default;
+
+  Detonations &operator=(Detonations const &) = default;
+  Detonations &operator=(Detonations &&) noexcept = default;
+
+  /**
+   * Finds each piece of ordnance's target
+   *
+   * @param targets ships and bases, which may be hit
+   * @param sizes how large each target is; larger ones are hit first
+   * @param ordnance pieces of ordnance, which never hit each other
+   * @param exempt for each piece, a target it can't hit, like the ship that
+   * launched it this turn, or NO_TARGET
+   * @param dice breaks ties between targets of the same size, with each
+   * piece's roll named by the turn and the piece's index
+   * @returns the target each piece hits, or NO_TARGET; valid until the next
+   * call
+   */
+  std::span<uint32_t const> resolve(Tracks const &targets,
+                                    std::span<uint8_t const> sizes,
+                                    Tracks const &ordnance,
+                                    std::span<uint32_t const> exempt,
+                                    Dice const &dice, uint32_t turn);
+
+ private:
+  /**
+   * Bins every target into the buckets its track passes through
+   */
+  void bin(Tracks const &targets);
+  /**
+   * Finds the targets passing near each piece, once each
+   */
+  void gather(Tracks const &targets, Tracks const &ordnance,
+              std::span<uint32_t const> exempt);
+  /**
+   * Finds when each nearby target first comes within half a hex, if it does
+   */
+  void approach(Tracks const &targets, Tracks const &ordnance);
+  /**
+   * Picks each piece's target out of those it comes close enough to
+   */
+  void choose(std::span<uint8_t const> sizes, Dice const &dice,
+              uint32_t turn);
+
+  /** lowest axial coordinates covered by the grid */
+  int32_t originQ;
+  int32_t originR;
+  /** log2 of the hexes along each side of a bucket */
+  int32_t shift;
+  int32_t columns;
+  int32_t rows;
+  /** where each bucket's targets start in entries; one past the end too */
+  std::vector<uint32_t> starts;
+  std::vector<uint32_t> entries;
+  /** the last piece each target was gathered for, plus one */
+  std::vector<uint32_t> seen;
+
+  /** targets passing near each piece, grouped by piece */
+  std::vector<uint32_t> pieces;
+  std::vector<uint32_t> candidates;
+  /**
+   * Each candidate's squared distance from its piece over the turn, as
+   * a t^2 + b t + c, scaled so the coefficients are integers
+   */
+  std::vector<double> a;
+  std::vector<double> b;
+  std::vector<double> c;
+  /** when in the turn each candidate is hit, or more than one if it isn't */
+  std::vector<double> times;
+  /** targets hit at the same moment with the same size */
+  std::vector<uint32_t> tied;
+
+  std::vector<uint32_t> results;
+};
+}  // namespace nplanetary::rules
+
+#endif  // NPLANETARY_RULES_ORDNANCE_H_
@@ -0,0 +1,174 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/combat.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace nplanetary::map;
+using namespace nplanetary::rules;
+
+namespace {
+bool near(double actual, double expected) {
+  return fabs(actual - expected) < 1e-9;
+}
+}  // namespace
+
+TEST_CASE("Attacks are modified by range and velocity", "[rules]") {
+  Combat combat;
+  Dice dice = Dice(23);
+  Combatants combatants;
+  uint32_t target = static_cast<uint32_t>(
+      combatants.add(Hex{2, 0}, Hex{0, 0}, 16, Role::MILITARY));
+  auto strength = [&](Hex velocity, double attacking) {
+    combatants.add(Hex{0, 0}, velocity, 4, Role::MILITARY);
+    Attacks attacks;
+    attacks.add(static_cast<uint32_t>(combatants.size() - 1),
+                span<uint32_t const>(&target, 1), attacking);
+    return combat.resolve(combatants, attacks, dice, 0)[target];
+  };
+
+  // two hexes away
+  REQUIRE(near(strength(Hex{0, 0}, 4), 2));
+  // straight towards or away from the target
+  REQUIRE(near(strength(Hex{1, 0}, 4), 3));
+  REQUIRE(near(strength(Hex{-2, 0}, 4), 0));
+  // sixty degrees off
+  REQUIRE(near(strength(Hex{0, 1}, 4), 2.5));
+  // ninety degrees off
+  REQUIRE(near(strength(Hex{1, -2}, 4), 2));
+  // and never below zero
+  REQUIRE(near(strength(Hex{-3, 0}, 4), 0));
+  // attacks far below the target's strength never hurt it
+  REQUIRE(combatants.weapons[target] == 0);
+  REQUIRE(combatants.drives[target] == 0);
+  REQUIRE(combatants.structure[target] == 0);
+}
+
+TEST_CASE("Attacks are split and added up per target", "[rules]") {
+  Combat combat;
+  Dice dice = Dice(23);
+  Combatants combatants;
+  combatants.add(Hex{0, 0}, Hex{0, 0}, 6, Role::MILITARY);
+  combatants.add(Hex{0, 0}, Hex{0, 0}, 2, Role::CIVILIAN);
+  combatants.add(Hex{1, 0}, Hex{0, 0}, 1, Role::ORDNANCE);
+  combatants.add(Hex{-2, 0}, Hex{0, 0}, 1, Role::ORDNANCE);
+  combatants.add(Hex{0, 0}, Hex{0, 0}, 0, Role::MILITARY);
+
+  vector<uint32_t> targets = {1, 2, 3};
+  Attacks attacks;
+  attacks.add(0, targets, 6);
+  attacks.add(4, targets, 1.5);
+  REQUIRE(attacks.size() == 6);
+
+  span<double const> totals = combat.resolve(combatants, attacks, dice, 0);
+  REQUIRE(totals.size() == combatants.size());
+  REQUIRE(near(totals[0], 0));
+  REQUIRE(near(totals[1], 2.5));
+  REQUIRE(near(totals[2], 1));
+  REQUIRE(near(totals[3], 0));
+  // ordnance is shot down by any attack of strength one or more
+  REQUIRE(combatants.destroyed[2] == 1);
+  REQUIRE(combatants.destroyed[3] == 0);
+  REQUIRE(combatants.destroyed[0] == 0);
+
+  attacks.clear();
+  attacks.add(0, targets, 6);
+  attacks.add(5, targets, 1);
+  REQUIRE_THROWS_AS(combat.resolve(combatants, attacks, dice, 0),
+                    runtime_error);
+}
+
+TEST_CASE("Damage follows the combat and damage tables", "[rules]") {
+  Combat combat;
+  Dice dice = Dice(23);
+  uint32_t target = 0;
+
+  for (Role role : {Role::MILITARY, Role::CIVILIAN, Role::BASE}) {
+    size_t points = 0;
+    uint32_t rounds = 3000;
+    for (uint32_t round = 0; round < rounds; ++round) {
+      Combatants combatants;
+      combatants.add(Hex{0, 0}, Hex{0, 0}, 2, role);
+      combatants.add(Hex{0, 0}, Hex{0, 0}, 8, Role::MILITARY);
+      Attacks attacks;
+      attacks.add(1, span<uint32_t const>(&target, 1), 8);
+      combat.resolve(combatants, attacks, dice, round);
+
+      // four times the target's strength rolls between once and thrice
+      size_t dealt = static_cast<size_t>(combatants.weapons[0]) +
+                     combatants.drives[0] + combatants.structure[0];
+      REQUIRE(dealt <= 6);
+      if (role == Role::MILITARY) {
+        REQUIRE(dealt >= 1);
+      } else if (role == Role::CIVILIAN) {
+        REQUIRE(dealt >= 1);
+        REQUIRE(combatants.weapons[0] == 0);
+      } else {
+        REQUIRE(combatants.drives[0] == 0);
+      }
+      points += dealt;
+    }
+
+    // two rolls on average, each dealing one and a half, one and a half,
+    // or one point on average
+    double expected = role == Role::BASE ? 2.0 : 3.0;
+    double average = static_cast<double>(points) / static_cast<double>(rounds);
+    REQUIRE(fabs(average - expected) < 0.15);
+  }
+}
+
+TEST_CASE("Combat is repeatable with the same seed", "[rules]") {
+  auto fight = [](uint64_t seed) {
+    mt19937_64 placement = mt19937_64(7);
+    uniform_int_distribution<int32_t> position =
+        uniform_int_distribution<int32_t>(-5, 5);
+    Combatants combatants;
+    for (size_t idx = 0; idx < 50; ++idx) {
+      combatants.add(Hex{position(placement), position(placement)},
+                     Hex{position(placement), position(placement)}, 4,
+                     idx % 3 == 0 ? Role::CIVILIAN : Role::MILITARY);
+    }
+    Attacks attacks;
+    for (uint32_t attacker = 0; attacker < 50; ++attacker) {
+      vector<uint32_t> targets = {(attacker + 1) % 50, (attacker + 7) % 50};
+      attacks.add(attacker, targets, 8);
+    }
+
+    Combat combat;
+    Dice dice = Dice(seed);
+    combat.resolve(combatants, attacks, dice, 1);
+    combat.resolve(combatants, attacks, dice, 2);
+    return combatants;
+  };
+
+  Combatants first = fight(1);
+  Combatants second = fight(1);
+  REQUIRE(first.weapons == second.weapons);
+  REQUIRE(first.drives == second.drives);
+  REQUIRE(first.structure == second.structure);
+  REQUIRE(first.structure != fight(2).structure);
+}
@@ -21,12 +21,43 @@
 
 #include <sodium.h>
 
+#include <algorithm>
+#include <array>
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <limits>
 #include <thread>
+#include <vector>
+
+#include "networking/executor.h"
 
 using namespace std;
+using namespace std::chrono_literals;
 using namespace nplanetary::networking;
 
+namespace {
+/**
+ * Accepts one connection and decodes a length-prefixed message from it,
+ * counting how many times decoding was tried
+ */
+Task<void> decodeMessage(CryptoServer &server, vector<uint8_t> &message,
+                         size_t &attempts) {
+  CryptoSocket connection = co_await server.asyncAccept();
+  co_await connection.asyncDecode([&]() {
+    ++attempts;
+    array<uint8_t, sizeof(uint32_t)> header;
+    connection.read(header.data(), header.size());
+    uint32_t size = (static_cast<uint32_t>(header[0]) << 0) |
+                    (static_cast<uint32_t>(header[1]) << 8) |
+                    (static_cast<uint32_t>(header[2]) << 16) |
+                    (static_cast<uint32_t>(header[3]) << 24);
+    message.resize(size);
+    connection.read(message.data(), message.size());
+  });
+}
+}  // namespace
+
 TEST_CASE("Sodium is automatically initialized", "[libraries]") {
   REQUIRE(sodium_init() == 1);
 }
@@ -111,3 +142,335 @@ TEST_CASE("Invalid password raises exception in crypto networking",
   }
   client.join();
 }
+
+TEST_CASE("Can send data larger than one crypto frame", "[networking]") {
+  stop_source source;
+  CryptoServer server = CryptoServer("password", source.get_token());
+
+  vector<uint8_t> message = vector<uint8_t>(200000);
+  for (size_t idx = 0; idx < message.size(); ++idx) {
+    message[idx] = static_cast<uint8_t>(idx * 7);
+  }
+  thread sender = thread(
+      [&message](stop_token stopFlag) {
+        CryptoSocket socket = CryptoSocket("127.0.0.1", "password", stopFlag);
+        socket.write(message.data(), message.size());
+        socket.flush();
+      },
+      source.get_token());
+  CryptoSocket connection = server.accept();
+  vector<uint8_t> recvd = vector<uint8_t>(message.size());
+  connection.read(recvd.data(), recvd.size());
+  REQUIRE(message == recvd);
+  sender.join();
+}
+
+TEST_CASE("Async decode waits for the bytes it needs", "[networking]") {
+  stop_source source;
+  Executor executor = Executor(source.get_token());
+  CryptoServer server = CryptoServer("password", source.get_token());
+
+  // many narrow frames long, and sent in two parts so decoding starts early
+  vector<uint8_t> message = vector<uint8_t>(200000);
+  for (size_t idx = 0; idx < message.size(); ++idx) {
+    message[idx] = static_cast<uint8_t>(idx * 7);
+  }
+  thread sender = thread(
+      [&message](stop_token stopFlag) {
+        CryptoSocket socket =
+            CryptoSocket("127.0.0.1", "password", stopFlag,
+                         CryptoSocket::COMPACT_INTEGERS);
+        array<uint8_t, sizeof(uint32_t)> header = {
+            static_cast<uint8_t>(message.size() >> 0),
+            static_cast<uint8_t>(message.size() >> 8),
+            static_cast<uint8_t>(message.size() >> 16),
+            static_cast<uint8_t>(message.size() >> 24),
+        };
+        size_t half = message.size() / 2;
+        socket.write(header.data(), header.size());
+        socket.write(message.data(), half);
+        socket.flush();
+        this_thread::sleep_for(50ms);
+        socket.write(message.data() + half, message.size() - half);
+        socket.flush();
+      },
+      source.get_token());
+
+  vector<uint8_t> recvd;
+  size_t attempts = 0;
+  executor.run(decodeMessage(server, recvd, attempts));
+  REQUIRE(recvd == message);
+  // once to find the length, once more to find the rest, and once to finish
+  REQUIRE(attempts <= 3);
+  sender.join();
+}
+
+TEST_CASE("Can send bulk data with and without wide frames",
+          "[networking]") {
+  stop_source source;
+  CryptoServer server = CryptoServer("password", source.get_token());
+
+  vector<uint8_t> message = vector<uint8_t>(3 << 20);
+  for (size_t idx = 0; idx < message.size(); ++idx) {
+    message[idx] = static_cast<uint8_t>(idx * 7);
+  }
+  for (uint8_t features :
+       {CryptoSocket::ALL_FEATURES, CryptoSocket::COMPACT_INTEGERS}) {
+    thread sender = thread(
+        [&message, features](stop_token stopFlag) {
+          CryptoSocket socket =
+              CryptoSocket("127.0.0.1", "password", stopFlag, features);
+          socket.setFraming(Framing::BULK);
+          for (size_t sent = 0; sent < message.size(); sent += 1000) {
+            socket.write(message.data() + sent,
+                         min<size_t>(1000, message.size() - sent));
+          }
+          socket.flush();
+        },
+        source.get_token());
+    CryptoSocket connection = server.accept();
+    vector<uint8_t> recvd = vector<uint8_t>(message.size());
+    connection.read(recvd.data(), recvd.size());
+    REQUIRE(message == recvd);
+    sender.join();
+
+    // bulk data goes in the largest frames the features allow
+    if (STATS_ENABLED) {
+      size_t frameSize = (features & CryptoSocket::WIDE_FRAMES) != 0
+                             ? 1 << 20
+                             : numeric_limits<uint16_t>::max();
+      REQUIRE(connection.getStats().framesIn <=
+              2 * message.size() / frameSize + 2);
+    }
+  }
+}
+
+TEST_CASE("Can broadcast to many crypto sockets", "[networking]") {
+  constexpr size_t CLIENTS = 4;
+  stop_source source;
+  CryptoServer server = CryptoServer("password", source.get_token());
+  Broadcaster broadcaster = Broadcaster(2);
+
+  vector<uint8_t> message = vector<uint8_t>(200000);
+  for (size_t idx = 0; idx < message.size(); ++idx) {
+    message[idx] = static_cast<uint8_t>(idx * 7);
+  }
+  vector<thread> clients;
+  for (size_t idx = 0; idx < CLIENTS; ++idx) {
+    clients.emplace_back(
+        [&message](stop_token stopFlag) {
+          CryptoSocket socket =
+              CryptoSocket("127.0.0.1", "password", stopFlag);
+          uint8_t id;
+          socket.read(&id, sizeof(id));
+          vector<uint8_t> recvd = vector<uint8_t>(message.size());
+          socket.read(recvd.data(), recvd.size());
+          REQUIRE(recvd == message);
+        },
+        source.get_token());
+  }
+
+  vector<CryptoSocket> connections;
+  vector<CryptoSocket *> recipients;
+  for (size_t idx = 0; idx < CLIENTS; ++idx) {
+    connections.push_back(server.accept());
+  }
+  for (size_t idx = 0; idx < CLIENTS; ++idx) {
+    // what's already queued goes first
+    uint8_t id = static_cast<uint8_t>(idx);
+    connections[idx].write(&id, sizeof(id));
+    recipients.push_back(&connections[idx]);
+  }
+  connections[0].setFraming(Framing::BULK);
+  broadcaster.send(recipients, message);
+
+  for (thread &client : clients) {
+    client.join();
+  }
+}
+
+TEST_CASE("Crypto sockets use only features both sides offer",
+          "[networking]") {
+  stop_source source;
+  CryptoServer server = CryptoServer("password", source.get_token());
+
+  thread client = thread(
+      [](stop_token stopFlag) {
+        CryptoSocket socket =
+            CryptoSocket("127.0.0.1", "password", stopFlag, 0);
+        REQUIRE(socket.getFeatures() == 0);
+      },
+      source.get_token());
+  CryptoSocket connection = server.accept();
+  REQUIRE(connection.getFeatures() == 0);
+  client.join();
+
+  client = thread(
+      [](stop_token stopFlag) {
+        CryptoSocket socket = CryptoSocket("127.0.0.1", "password", stopFlag);
+        REQUIRE(socket.getFeatures() == CryptoSocket::ALL_FEATURES);
+      },
+      source.get_token());
+  connection = server.accept();
+  REQUIRE(connection.getFeatures() == CryptoSocket::ALL_FEATURES);
+  client.join();
+}
+
+TEST_CASE("Can resume crypto session with ticket", "[networking]") {
+  stop_source source;
+  CryptoServer server = CryptoServer("password", source.get_token());
+
+  CryptoSocket::Ticket ticket;
+  thread client = thread(
+      [&ticket](stop_token stopFlag) {
+        CryptoSocket socket = CryptoSocket("127.0.0.1", "password", stopFlag);
+        ticket = socket.getTicket();
+      },
+      source.get_token());
+  server.accept();
+  client.join();
+
+  // resuming doesn't need the password
+  uint8_t message = 0xdb;
+  client = thread(
+      [&ticket, &message](stop_token stopFlag) {
+        CryptoSocket socket =
+            CryptoSocket("127.0.0.1", ticket, "bad", stopFlag);
+        REQUIRE(socket.getFeatures() == CryptoSocket::ALL_FEATURES);
+        REQUIRE(socket.getTicket().sealed != ticket.sealed);
+        socket.write(&message, 1);
+        socket.flush();
+      },
+      source.get_token());
+  CryptoSocket connection = server.accept();
+  uint8_t recvd;
+  connection.read(&recvd, 1);
+  REQUIRE(message == recvd);
+  client.join();
+}
+
+TEST_CASE("Rejected crypto ticket falls back to full handshake",
+          "[networking]") {
+  stop_source source;
+  CryptoServer server = CryptoServer("password", source.get_token());
+
+  CryptoSocket::Ticket ticket = {};
+  uint8_t message = 0xdb;
+  thread client = thread(
+      [&ticket, &message](stop_token stopFlag) {
+        CryptoSocket socket =
+            CryptoSocket("127.0.0.1", ticket, "password", stopFlag);
+        socket.write(&message, 1);
+        socket.flush();
+      },
+      source.get_token());
+  CryptoSocket connection = server.accept();
+  uint8_t recvd;
+  connection.read(&recvd, 1);
+  REQUIRE(message == recvd);
+  client.join();
+
+  // and the password is still checked
+  client = thread(
+      [&ticket](stop_token stopFlag) {
+        try {
+          CryptoSocket socket =
+              CryptoSocket("127.0.0.1", ticket, "bad", stopFlag);
+          FAIL("Expected password mismatch flag to be thrown");
+        } catch (PasswordMismatchFlag const &) {
+        }
+      },
+      source.get_token());
+  try {
+    server.accept();
+    FAIL("Expected password mismatch flag to be thrown");
+  } catch (PasswordMismatchFlag const &) {
+  }
+  client.join();
+}
+
+TEST_CASE("Stalled crypto client does not hold up other handshakes",
+          "[networking]") {
+  stop_source source;
+  CryptoServer server =
+      CryptoServer("password", source.get_token(), CryptoSocket::ALL_FEATURES,
+                   ServerOptions{.handshakeWorkers = 2});
+
+  // connects but never says anything
+  RawSocket stalled = RawSocket("127.0.0.1", source.get_token());
+  thread client = thread(
+      [](stop_token stopFlag) {
+        CryptoSocket socket = CryptoSocket("127.0.0.1", "password", stopFlag);
+        uint8_t byte = 42;
+        socket.write(&byte, 1);
+        socket.flush();
+      },
+      source.get_token());
+  CryptoSocket connection = server.accept();
+  uint8_t byte;
+  connection.read(&byte, 1);
+  REQUIRE(byte == 42);
+  client.join();
+}
+
+TEST_CASE("Crypto handshake times out", "[networking]") {
+  stop_source source;
+  CryptoServer server = CryptoServer(
+      "password", source.get_token(), CryptoSocket::ALL_FEATURES,
+      ServerOptions{.handshakeTimeout = chrono::milliseconds(50)});
+
+  RawSocket stalled = RawSocket("127.0.0.1", source.get_token());
+  try {
+    server.accept();
+    FAIL("Expected timeout flag to be thrown");
+  } catch (TimeoutFlag const &) {
+  }
+}
+
+TEST_CASE("Crypto handshake benchmark", "[.][benchmark]") {
+  stop_source source;
+  CryptoServer server = CryptoServer("password", source.get_token());
+
+  BENCHMARK("one handshake") {
+    thread client = thread(
+        [](stop_token stopFlag) {
+          CryptoSocket("127.0.0.1", "password", stopFlag);
+        },
+        source.get_token());
+    CryptoSocket connection = server.accept();
+    client.join();
+  };
+  CryptoSocket::Ticket ticket;
+  thread first = thread(
+      [&ticket](stop_token stopFlag) {
+        ticket = CryptoSocket("127.0.0.1", "password", stopFlag).getTicket();
+      },
+      source.get_token());
+  server.accept();
+  first.join();
+  BENCHMARK("one resumption") {
+    thread client = thread(
+        [&ticket](stop_token stopFlag) {
+          CryptoSocket("127.0.0.1", ticket, "password", stopFlag);
+        },
+        source.get_token());
+    CryptoSocket connection = server.accept();
+    client.join();
+  };
+  BENCHMARK("six clients reconnecting") {
+    vector<thread> clients;
+    for (size_t idx = 0; idx < 6; ++idx) {
+      clients.emplace_back(
+          [](stop_token stopFlag) {
+            CryptoSocket("127.0.0.1", "password", stopFlag);
+          },
+          source.get_token());
+    }
+    for (size_t idx = 0; idx < clients.size(); ++idx) {
+      CryptoSocket connection = server.accept();
+    }
+    for (thread &client : clients) {
+      client.join();
+    }
+  };
+}
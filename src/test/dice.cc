@@ -0,0 +1,97 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/dice.h"
+
+#include <array>
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace nplanetary::rules;
+
+TEST_CASE("Dice match Philox4x32-10", "[rules]") {
+  // known answers from the Random123 reference implementation
+  Dice zero = Dice(0);
+  array<uint32_t, 4> expected = {0x6627e8d5, 0xe169c58d, 0xbc57ac4c,
+                                 0x9b00dbd8};
+  for (uint32_t word = 0; word < 4; ++word) {
+    REQUIRE(zero.bits(Counter{0, Phase::ORDNANCE, 0, word}) ==
+            expected[word]);
+  }
+
+  Dice pi = Dice(0x299f31d0a4093822);
+  expected = {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1};
+  for (uint32_t word = 0; word < 4; ++word) {
+    REQUIRE(pi.bits(Counter{0x13198a2e, static_cast<Phase>(0x03707344),
+                            0x85a308d3, 0x243f6a88u * 4 + word}) ==
+            expected[word]);
+  }
+}
+
+TEST_CASE("Dice roll fairly and independently", "[rules]") {
+  Dice dice = Dice(24);
+  array<size_t, Dice::FACES + 1> counts = {};
+  for (uint32_t turn = 0; turn < 1000; ++turn) {
+    for (uint32_t entity = 0; entity < 6; ++entity) {
+      uint8_t face = dice.roll(Counter{turn, Phase::COMBAT, entity, 0});
+      REQUIRE(face >= 1);
+      REQUIRE(face <= Dice::FACES);
+      ++counts[face];
+    }
+  }
+  for (uint32_t face = 1; face <= Dice::FACES; ++face) {
+    REQUIRE(counts[face] > 900);
+    REQUIRE(counts[face] < 1100);
+  }
+
+  // changing any part of the counter gives another roll
+  Counter counter = Counter{7, Phase::COMBAT, 5, 2};
+  uint32_t bits = dice.bits(counter);
+  REQUIRE(dice.bits(Counter{8, Phase::COMBAT, 5, 2}) != bits);
+  REQUIRE(dice.bits(Counter{7, Phase::ORDNANCE, 5, 2}) != bits);
+  REQUIRE(dice.bits(Counter{7, Phase::COMBAT, 6, 2}) != bits);
+  REQUIRE(dice.bits(Counter{7, Phase::COMBAT, 5, 3}) != bits);
+  REQUIRE(Dice(25).bits(counter) != bits);
+  REQUIRE(dice.bits(counter) == bits);
+  REQUIRE(dice.below(counter, 1) == 0);
+}
+
+TEST_CASE("Dice roll in batches like one at a time", "[rules]") {
+  Dice dice = Dice(24);
+  vector<uint32_t> entities;
+  for (uint32_t entity = 0; entity < 100; ++entity) {
+    entities.push_back(entity * 3 + 1);
+  }
+  vector<uint8_t> faces = vector<uint8_t>(entities.size());
+
+  for (uint32_t index = 0; index < 9; ++index) {
+    dice.roll(2, Phase::COMBAT, entities, index, faces);
+    for (size_t idx = 0; idx < entities.size(); ++idx) {
+      REQUIRE(faces[idx] ==
+              dice.roll(Counter{2, Phase::COMBAT, entities[idx], index}));
+    }
+  }
+
+  faces.pop_back();
+  REQUIRE_THROWS_AS(dice.roll(2, Phase::COMBAT, entities, 0, faces),
+                    runtime_error);
+}
@@ -0,0 +1,133 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "networking/executor.h"
+
+#include <array>
+#include <catch2/catch_test_macros.hpp>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+using namespace nplanetary::networking;
+
+namespace {
+Task<int> answer() { co_return 42; }
+
+Task<int> addOne(Task<int> task) { co_return co_await task + 1; }
+
+Task<void> fail() {
+  throw runtime_error("failed");
+  co_return;
+}
+
+/**
+ * Accepts one connection and reads a 16 byte message from it
+ */
+Task<void> receiveMessage(RawServer &server, array<uint8_t, 16> &recvd) {
+  RawSocket connection = co_await server.asyncAccept();
+  co_await connection.asyncRead(recvd.data(), recvd.size());
+}
+}  // namespace
+
+TEST_CASE("Can construct executor", "[networking]") {
+  stop_source source;
+  Executor(source.get_token());
+}
+
+TEST_CASE("Executor runs tasks to completion", "[networking]") {
+  stop_source source;
+  Executor executor = Executor(source.get_token());
+  REQUIRE(executor.run(addOne(answer())) == 43);
+}
+
+TEST_CASE("Tasks rethrow exceptions to their awaiter", "[networking]") {
+  stop_source source;
+  Executor executor = Executor(source.get_token());
+  REQUIRE_THROWS_AS(executor.run(fail()), runtime_error);
+}
+
+TEST_CASE("Executor rethrows exceptions from spawned tasks", "[networking]") {
+  stop_source source;
+  Executor executor = Executor(source.get_token());
+  executor.spawn(fail());
+  REQUIRE_THROWS_AS(executor.poll(), runtime_error);
+}
+
+TEST_CASE("Executor serves many raw sockets on one thread", "[networking]") {
+  stop_source source;
+  Executor executor = Executor(source.get_token());
+  RawServer server = RawServer(source.get_token());
+
+  array<uint8_t, 16> message = {
+      0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7,
+  };
+  array<uint8_t, 16> first;
+  array<uint8_t, 16> second;
+  RawSocket firstClient = RawSocket("127.0.0.1", source.get_token());
+  RawSocket secondClient = RawSocket("127.0.0.1", source.get_token());
+  executor.spawn(receiveMessage(server, first));
+  executor.spawn(receiveMessage(server, second));
+
+  // start both tasks, then answer in the opposite order
+  executor.poll();
+  secondClient.write(message.data(), message.size());
+  firstClient.write(message.data(), message.size());
+  while (first != message || second != message) {
+    executor.poll();
+  }
+}
+
+TEST_CASE("Executor serves in-process sockets", "[networking]") {
+  stop_source source;
+  Executor executor = Executor(source.get_token());
+  RawServer server =
+      RawServer(source.get_token(), ListenOptions{.address = "local:executor"});
+
+  array<uint8_t, 16> message = {
+      0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7,
+  };
+  array<uint8_t, 16> recvd;
+  executor.spawn(receiveMessage(server, recvd));
+  executor.poll();
+
+  // connect and write only once the task is waiting
+  RawSocket client = RawSocket("local:executor", source.get_token());
+  executor.poll();
+  client.write(message.data(), message.size());
+  while (recvd != message) {
+    executor.poll();
+  }
+}
+
+TEST_CASE("Stop cancels tasks waiting on raw sockets", "[networking]") {
+  stop_source source;
+  Executor executor = Executor(source.get_token());
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  array<uint8_t, 16> recvd;
+  thread stopper = thread([&source]() { source.request_stop(); });
+  try {
+    executor.run(receiveMessage(server, recvd));
+    FAIL("Expected stop token to be thrown");
+  } catch (stop_token const &) {
+  }
+  stopper.join();
+}
@@ -0,0 +1,160 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "map/lineOfSight.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "map/map.h"
+
+using namespace std;
+using namespace nplanetary::map;
+
+namespace {
+/**
+ * Hex a point is in, rounding cube coordinates
+ */
+Hex nearest(double q, double r) {
+  double s = -q - r;
+  double roundQ = round(q);
+  double roundR = round(r);
+  double roundS = round(s);
+  if (fabs(roundQ - q) > fabs(roundR - r) &&
+      fabs(roundQ - q) > fabs(roundS - s)) {
+    roundQ = -roundR - roundS;
+  } else if (fabs(roundR - r) > fabs(roundS - s)) {
+    roundR = -roundQ - roundS;
+  }
+  return Hex{static_cast<int32_t>(roundQ), static_cast<int32_t>(roundR)};
+}
+
+/**
+ * Whether a line passes through a body, other than a surface it starts or
+ * ends on, checked at many points along it
+ *
+ * A point is in a body if every point near it is in some surface, which
+ * covers points inside a surface and on the edge between two surfaces
+ */
+bool blockedBySampling(Map const &map, Hex from, Hex to) {
+  constexpr int SAMPLES = 20000;
+  constexpr double NEAR = 1e-4;
+  for (int sample = 1; sample < SAMPLES; ++sample) {
+    double t = static_cast<double>(sample) / SAMPLES;
+    double q = from.q + (to.q - from.q) * t;
+    double r = from.r + (to.r - from.r) * t;
+    bool blocked = true;
+    for (Hex direction : DIRECTIONS) {
+      Hex hex = nearest(q + NEAR * direction.q, r + NEAR * direction.r);
+      blocked = blocked && hex != from && hex != to && map.contains(hex) &&
+                map.getTerrain(map.index(hex)) == Terrain::BODY;
+    }
+    if (blocked) {
+      return true;
+    }
+  }
+  return false;
+}
+}  // namespace
+
+TEST_CASE("Bodies block lines through them", "[map]") {
+  Map map = Map(8);
+  map.addBody(Body{.name = "Sol", .centre = {0, 0}, .radius = 1,
+                   .major = true});
+  map.setTerrain(Hex{0, 3}, Terrain::ORE_ASTEROID);
+  LineOfSight sight = LineOfSight(map);
+
+  REQUIRE(!sight.visible(Hex{-3, 0}, Hex{3, 0}));
+  REQUIRE(!sight.visible(Hex{3, 0}, Hex{-3, 0}));
+  REQUIRE(sight.visible(Hex{-3, 2}, Hex{3, 2}));
+  // asteroids don't block anything
+  REQUIRE(sight.visible(Hex{-3, 3}, Hex{3, 3}));
+  // nor does the surface something's on
+  REQUIRE(sight.visible(Hex{1, 0}, Hex{4, 0}));
+  REQUIRE(!sight.visible(Hex{-1, 0}, Hex{4, 0}));
+  REQUIRE(sight.visible(Hex{5, 1}, Hex{5, 1}));
+  REQUIRE_THROWS_AS(sight.visible(Hex{9, 0}, Hex{0, 0}), runtime_error);
+}
+
+TEST_CASE("Lines grazing a body aren't blocked", "[map]") {
+  Map map = Map(8);
+  map.addBody(Body{.name = "Sol", .centre = {0, 0}, .radius = 0,
+                   .major = true});
+  LineOfSight sight = LineOfSight(map);
+  // runs along the edge between the sun and the hex east of it
+  REQUIRE(sight.visible(Hex{2, -3}, Hex{-1, 3}));
+
+  map.addBody(Body{.name = "Companion", .centre = {1, 0}, .radius = 0,
+                   .major = true});
+  sight = LineOfSight(map);
+  // but not along the edge between two surfaces
+  REQUIRE(!sight.visible(Hex{2, -3}, Hex{-1, 3}));
+  REQUIRE(sight.visible(Hex{3, -3}, Hex{0, 3}));
+}
+
+TEST_CASE("Lines of sight are remembered for a turn", "[map]") {
+  Map map = Map(8);
+  map.addBody(Body{.name = "Sol", .centre = {0, 0}, .radius = 1,
+                   .major = true});
+  LineOfSight sight = LineOfSight(map);
+
+  vector<Hex> from = {Hex{-3, 0}, Hex{-3, 2}, Hex{3, 0}, Hex{-3, 2}};
+  vector<Hex> to = {Hex{3, 0}, Hex{3, 2}, Hex{-3, 0}, Hex{3, 2}};
+  vector<uint8_t> results = vector<uint8_t>(from.size());
+  sight.visible(from, to, results);
+  REQUIRE(results == vector<uint8_t>{0, 1, 0, 1});
+  // each pair is remembered once, whichever way round it was asked
+  REQUIRE(sight.getCached() == 2);
+
+  sight.newTurn();
+  REQUIRE(sight.getCached() == 0);
+  REQUIRE(sight.visible(Hex{3, 2}, Hex{-3, 2}));
+  REQUIRE(sight.getCached() == 1);
+}
+
+TEST_CASE("Lines of sight match sampling the line", "[map]") {
+  Map map = Map(20);
+  map.addBody(Body{.name = "Sol", .centre = {0, 0}, .radius = 2,
+                   .major = true});
+  map.addBody(Body{.name = "Terra", .centre = {9, -4}, .radius = 1,
+                   .major = true});
+  map.addBody(Body{.name = "Luna", .centre = {-8, 12}, .radius = 0,
+                   .major = false});
+  LineOfSight sight = LineOfSight(map);
+
+  mt19937 rng = mt19937(22);
+  uniform_int_distribution<int32_t> coordinate =
+      uniform_int_distribution<int32_t>(-20, 20);
+  size_t blocked = 0;
+  for (int query = 0; query < 2000; ++query) {
+    Hex from = Hex{coordinate(rng), coordinate(rng)};
+    Hex to = Hex{coordinate(rng), coordinate(rng)};
+    if (!map.contains(from) || !map.contains(to)) {
+      continue;
+    }
+    bool expected = !blockedBySampling(map, from, to);
+    REQUIRE(sight.visible(from, to) == expected);
+    blocked += !expected;
+  }
+  REQUIRE(blocked > 0);
+}
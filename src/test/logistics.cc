@@ -0,0 +1,237 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/logistics.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+using namespace nplanetary::rules;
+
+TEST_CASE("Transfers with other players need both sides", "[rules]") {
+  Logistics logistics;
+  Holders holders;
+  holders.add(0, false);
+  holders.add(1, false);
+  holders.setStock(0, Resource::FUEL, 10);
+  holders.setStock(1, Resource::SUPPLIES, 10);
+
+  Orders orders;
+  // one side gives fuel and takes supplies; the other does the opposite
+  orders.add(0, 1, Resource::FUEL, 5);
+  orders.add(0, 1, Resource::SUPPLIES, -1);
+  orders.add(1, 0, Resource::FUEL, -5);
+  orders.add(1, 0, Resource::SUPPLIES, 1);
+  // one side only
+  orders.add(0, 1, Resource::FUEL, 2);
+  // different amounts
+  orders.add(0, 1, Resource::FUEL, 3);
+  orders.add(1, 0, Resource::FUEL, -4);
+
+  span<Outcome const> outcomes = logistics.resolve(holders, orders);
+  REQUIRE(vector<Outcome>(outcomes.begin(), outcomes.end()) ==
+          vector<Outcome>{Outcome::DONE, Outcome::DONE, Outcome::DONE,
+                          Outcome::DONE, Outcome::UNMATCHED,
+                          Outcome::UNMATCHED, Outcome::UNMATCHED});
+  REQUIRE(holders.getStock(0, Resource::FUEL) == 5);
+  REQUIRE(holders.getStock(1, Resource::FUEL) == 5);
+  REQUIRE(holders.getStock(0, Resource::SUPPLIES) == 1);
+  REQUIRE(holders.getStock(1, Resource::SUPPLIES) == 9);
+
+  // unless the other side is disabled
+  holders.disabled[1] = 1;
+  orders.clear();
+  orders.add(0, 1, Resource::FUEL, -5);
+  logistics.resolve(holders, orders);
+  REQUIRE(holders.getStock(0, Resource::FUEL) == 10);
+  REQUIRE(holders.getStock(1, Resource::FUEL) == 0);
+}
+
+TEST_CASE("Identical transfers happen once", "[rules]") {
+  Logistics logistics;
+  Holders holders;
+  holders.add(0, true);
+  holders.add(0, false);
+  holders.setStock(0, Resource::FUEL, 20);
+
+  // the ship takes fuel from its own base, and the base gives it
+  Orders orders;
+  orders.add(1, 0, Resource::FUEL, -5);
+  orders.add(0, 1, Resource::FUEL, 5);
+  orders.add(1, 0, Resource::FUEL, -5);
+  // and the base gives fuel it doesn't have left
+  orders.add(0, 1, Resource::FUEL, 16);
+
+  span<Outcome const> outcomes = logistics.resolve(holders, orders);
+  REQUIRE(vector<Outcome>(outcomes.begin(), outcomes.end()) ==
+          vector<Outcome>{Outcome::DONE, Outcome::DONE, Outcome::DONE,
+                          Outcome::SHORT});
+  REQUIRE(holders.getStock(0, Resource::FUEL) == 15);
+  REQUIRE(holders.getStock(1, Resource::FUEL) == 5);
+}
+
+TEST_CASE("One-sided transfers both ways round don't happen", "[rules]") {
+  Logistics logistics;
+  Holders holders;
+  holders.add(0, false);
+  holders.add(0, false);
+  holders.add(1, false);
+  holders.disabled[2] = 1;
+  holders.setStock(0, Resource::FUEL, 10);
+  holders.setStock(1, Resource::FUEL, 10);
+  holders.setStock(2, Resource::FUEL, 10);
+
+  Orders orders;
+  // the player's own ships each give the other fuel
+  orders.add(0, 1, Resource::FUEL, 5);
+  orders.add(1, 0, Resource::FUEL, 3);
+  // and one gives and takes fuel from a disabled ship
+  orders.add(0, 2, Resource::FUEL, 2);
+  orders.add(0, 2, Resource::FUEL, -4);
+  // but different resources, or gifts the same way round, are fine
+  orders.add(0, 1, Resource::SUPPLIES, 0);
+  orders.add(1, 2, Resource::FUEL, 1);
+  orders.add(1, 2, Resource::FUEL, 2);
+
+  span<Outcome const> outcomes = logistics.resolve(holders, orders);
+  REQUIRE(vector<Outcome>(outcomes.begin(), outcomes.end()) ==
+          vector<Outcome>{Outcome::UNMATCHED, Outcome::UNMATCHED,
+                          Outcome::UNMATCHED, Outcome::UNMATCHED,
+                          Outcome::INVALID, Outcome::DONE, Outcome::DONE});
+  REQUIRE(holders.getStock(0, Resource::FUEL) == 10);
+  REQUIRE(holders.getStock(1, Resource::FUEL) == 7);
+  REQUIRE(holders.getStock(2, Resource::FUEL) == 13);
+}
+
+TEST_CASE("Bases turn ore and water into supplies and fuel", "[rules]") {
+  Logistics logistics;
+  Holders holders;
+  holders.add(0, false);
+  holders.add(1, true);
+  holders.add(0, false);
+  holders.setStock(0, Resource::ORE, 4);
+  holders.setStock(0, Resource::WATER, 3);
+
+  Orders orders;
+  orders.add(0, 1, Resource::ORE, 4);
+  orders.add(1, 0, Resource::ORE, -4);
+  orders.add(0, 1, Resource::WATER, 2);
+  orders.add(1, 0, Resource::WATER, -2);
+  // but ships don't
+  orders.add(0, 2, Resource::WATER, 1);
+  // and orders naming nobody, or nothing, do nothing
+  orders.add(0, 0, Resource::WATER, 1);
+  orders.add(0, 3, Resource::WATER, 1);
+  orders.add(0, 2, Resource::WATER, 0);
+  orders.add(0, 2, static_cast<Resource>(RESOURCE_COUNT), 1);
+
+  span<Outcome const> outcomes = logistics.resolve(holders, orders);
+  for (size_t idx = 0; idx < 5; ++idx) {
+    REQUIRE(outcomes[idx] == Outcome::DONE);
+  }
+  for (size_t idx = 5; idx < orders.size(); ++idx) {
+    REQUIRE(outcomes[idx] == Outcome::INVALID);
+  }
+  REQUIRE(holders.getStock(1, Resource::ORE) == 0);
+  REQUIRE(holders.getStock(1, Resource::SUPPLIES) == 4);
+  REQUIRE(holders.getStock(1, Resource::WATER) == 0);
+  REQUIRE(holders.getStock(1, Resource::FUEL) == 2);
+  REQUIRE(holders.getStock(2, Resource::WATER) == 1);
+  REQUIRE(holders.getStock(0, Resource::ORE) == 0);
+  REQUIRE(holders.getStock(0, Resource::WATER) == 0);
+}
+
+TEST_CASE("Transfers match a pairwise check", "[rules]") {
+  mt19937 rng = mt19937(25);
+  uniform_int_distribution<uint32_t> holder =
+      uniform_int_distribution<uint32_t>(0, 19);
+  uniform_int_distribution<int32_t> amount =
+      uniform_int_distribution<int32_t>(-3, 3);
+  uniform_int_distribution<uint32_t> resource =
+      uniform_int_distribution<uint32_t>(0, 1);
+
+  Holders holders;
+  for (uint32_t idx = 0; idx < 20; ++idx) {
+    holders.add(idx % 4, false);
+    holders.disabled[idx] = idx % 7 == 0;
+    holders.setStock(idx, Resource::FUEL, 1000);
+    holders.setStock(idx, Resource::SUPPLIES, 1000);
+  }
+  Holders expected = holders;
+
+  Orders orders;
+  while (orders.size() < 2000) {
+    uint32_t issuer = holder(rng);
+    uint32_t partner = holder(rng);
+    int32_t given = amount(rng);
+    if (issuer != partner && given != 0) {
+      orders.add(issuer, partner, static_cast<Resource>(resource(rng)),
+                 given);
+    }
+  }
+  Logistics logistics;
+  span<Outcome const> outcomes = logistics.resolve(holders, orders);
+
+  // compare each order with every other; nobody runs short
+  using Key = tuple<uint32_t, uint32_t, Resource, int32_t>;
+  map<Key, bool> done;
+  for (size_t idx = 0; idx < orders.size(); ++idx) {
+    uint32_t issuer = orders.issuers[idx];
+    uint32_t partner = orders.partners[idx];
+    Resource ordered = orders.resources[idx];
+    int32_t given = orders.amounts[idx];
+    bool agreed = holders.owners[issuer] == holders.owners[partner] ||
+                  holders.disabled[partner] != 0;
+    bool matched = false;
+    for (size_t other = 0; other < orders.size(); ++other) {
+      uint32_t otherIssuer = orders.issuers[other];
+      uint32_t otherPartner = orders.partners[other];
+      int32_t otherGiven = orders.amounts[other];
+      matched = matched || (otherIssuer == partner &&
+                            otherPartner == issuer &&
+                            orders.resources[other] == ordered &&
+                            otherGiven == -given);
+      // the same resource going the other way round
+      bool opposed =
+          orders.resources[other] == ordered &&
+          ((otherIssuer == issuer && otherPartner == partner &&
+            (otherGiven > 0) != (given > 0)) ||
+           (otherIssuer == partner && otherPartner == issuer &&
+            (otherGiven > 0) == (given > 0)));
+      agreed = agreed && !opposed;
+    }
+    agreed = agreed || matched;
+    REQUIRE(outcomes[idx] == (agreed ? Outcome::DONE : Outcome::UNMATCHED));
+
+    Key key = issuer < partner ? Key{issuer, partner, ordered, given}
+                               : Key{partner, issuer, ordered, -given};
+    if (agreed && !done[key]) {
+      done[key] = true;
+      size_t resourceIdx = static_cast<size_t>(ordered);
+      expected.stocks[issuer * RESOURCE_COUNT + resourceIdx] -= given;
+      expected.stocks[partner * RESOURCE_COUNT + resourceIdx] += given;
+    }
+  }
+  REQUIRE(holders.stocks == expected.stocks);
+}
@@ -0,0 +1,169 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "map/map.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+
+#include "networking/networking.h"
+
+using namespace std;
+using namespace nplanetary::map;
+using namespace nplanetary::networking;
+
+static_assert(distance(Hex{0, 0}, Hex{2, -1}) == 2);
+static_assert(neighbour(Hex{3, 4}, opposite(Direction::EAST)) == Hex{2, 4});
+static_assert(Hex{1, 2}.s() == -3);
+
+namespace {
+/**
+ * A small map with a one hex planet and a larger moon
+ */
+Map smallSystem() {
+  Map map = Map(6);
+  map.addBody(Body{.name = "Venus", .centre = {0, 0}, .radius = 0,
+                   .major = true});
+  map.addBody(Body{.name = "Big Moon", .centre = {4, -2}, .radius = 1,
+                   .major = false});
+  map.setTerrain(Hex{-4, 4}, Terrain::ORE_ASTEROID);
+  map.setTerrain(Hex{-5, 1}, Terrain::ICE_ASTEROID);
+  map.setBase(Hex{0, 0}, 2, true);
+  return map;
+}
+}  // namespace
+
+TEST_CASE("Hex distances count steps", "[map]") {
+  REQUIRE(distance(Hex{0, 0}, Hex{0, 0}) == 0);
+  REQUIRE(distance(Hex{-3, 1}, Hex{2, -4}) == 5);
+  for (Hex step : DIRECTIONS) {
+    REQUIRE(length(step) == 1);
+    REQUIRE(length(step * 3) == 3);
+  }
+}
+
+TEST_CASE("Map stores every hex with constant neighbour offsets", "[map]") {
+  Map map = Map(5);
+  size_t onMap = 0;
+  for (size_t idx = 0; idx < map.size(); ++idx) {
+    Hex hex = map.hexAt(idx);
+    REQUIRE(map.index(hex) == idx);
+    REQUIRE((map.getTerrain(idx) != Terrain::OFF_MAP) == map.contains(hex));
+    if (!map.contains(hex)) {
+      continue;
+    }
+
+    ++onMap;
+    for (size_t direction = 0; direction < DIRECTION_COUNT; ++direction) {
+      Direction d = static_cast<Direction>(direction);
+      REQUIRE(map.neighbour(idx, d) == map.index(neighbour(hex, d)));
+    }
+  }
+  REQUIRE(onMap == 3 * 5 * 6 + 1);
+  REQUIRE_THROWS_AS(Map(-1), runtime_error);
+}
+
+TEST_CASE("Bodies pull the hexes around them towards them", "[map]") {
+  Map map = smallSystem();
+  REQUIRE(map.getBodies().size() == 2);
+  REQUIRE(map.getTerrain(map.index(Hex{0, 0})) == Terrain::BODY);
+  REQUIRE(map.getBody(map.index(Hex{0, 0})) == 0);
+  REQUIRE(map.getBases(map.index(Hex{0, 0})) == 1 << 2);
+
+  // every neighbour of a one hex planet points at it
+  for (size_t direction = 0; direction < DIRECTION_COUNT; ++direction) {
+    Direction d = static_cast<Direction>(direction);
+    size_t idx = map.index(neighbour(Hex{0, 0}, d));
+    REQUIRE(map.getGravity(idx) == 1 << static_cast<size_t>(opposite(d)));
+    REQUIRE(map.getBody(idx) == 0);
+  }
+
+  // a larger body has a surface, and a ring of gravity one hex out
+  REQUIRE(map.getTerrain(map.index(Hex{5, -2})) == Terrain::BODY);
+  REQUIRE(map.getBody(map.index(Hex{5, -2})) == 1);
+  REQUIRE(map.getGravity(map.index(Hex{6, -2})) ==
+          1 << static_cast<size_t>(Direction::WEST));
+  REQUIRE(map.getGravity(map.index(Hex{0, 3})) == 0);
+  REQUIRE(map.getBody(map.index(Hex{0, 3})) == Map::NO_BODY);
+
+  REQUIRE_THROWS_AS(map.addBody(Body{.name = "Overlap", .centre = {4, -1},
+                                     .radius = 0, .major = false}),
+                    runtime_error);
+  REQUIRE_THROWS_AS(map.setTerrain(Hex{0, 0}, Terrain::SPACE), runtime_error);
+  REQUIRE_THROWS_AS(map.setTerrain(Hex{7, 0}, Terrain::SPACE), runtime_error);
+}
+
+TEST_CASE("Gravity looks the same from every side of a body", "[map]") {
+  Map map = Map(6);
+  map.addBody(Body{.name = "Mars", .centre = {0, 0}, .radius = 1,
+                   .major = true});
+
+  // turning a sixth of the way round, anticlockwise, turns the pull too
+  for (size_t idx = 0; idx < map.size(); ++idx) {
+    Hex hex = map.hexAt(idx);
+    if (!map.contains(hex)) {
+      continue;
+    }
+
+    Hex turned = Hex{-hex.s(), -hex.q};
+    uint8_t gravity = map.getGravity(idx);
+    uint8_t rotated = static_cast<uint8_t>(
+        (gravity << 1 | gravity >> (DIRECTION_COUNT - 1)) & 0x3f);
+    REQUIRE(map.getGravity(map.index(turned)) == rotated);
+  }
+
+  // a hex as close to two neighbours on the surface is pulled towards the
+  // clockwise one, wherever it is
+  REQUIRE(map.getGravity(map.index(Hex{2, -1})) ==
+          1 << static_cast<size_t>(Direction::WEST));
+  REQUIRE(map.getGravity(map.index(Hex{-1, -1})) ==
+          1 << static_cast<size_t>(Direction::SOUTHEAST));
+}
+
+TEST_CASE("Can send maps", "[map]") {
+  stop_source source;
+  Server server = Server(
+      "password", source.get_token(), CryptoSocket::ALL_FEATURES,
+      ServerOptions{.listen = {.address = "local:map", .trustLocal = true}});
+
+  Map sent = smallSystem();
+  thread sender = thread(
+      [&sent](stop_token stopFlag) {
+        Socket socket = Socket("local:map", "password", stopFlag);
+        socket << sent;
+        socket.flush();
+      },
+      source.get_token());
+  Socket connection = server.accept();
+  Map recvd;
+  connection >> recvd;
+  sender.join();
+
+  REQUIRE(recvd.getRadius() == sent.getRadius());
+  REQUIRE(recvd.getBodies().size() == sent.getBodies().size());
+  REQUIRE(recvd.getBodies()[1].name == "Big Moon");
+  for (size_t idx = 0; idx < sent.size(); ++idx) {
+    REQUIRE(recvd.getTerrain(idx) == sent.getTerrain(idx));
+    REQUIRE(recvd.getGravity(idx) == sent.getGravity(idx));
+    REQUIRE(recvd.getBody(idx) == sent.getBody(idx));
+    REQUIRE(recvd.getBases(idx) == sent.getBases(idx));
+  }
+}
@@ -0,0 +1,167 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/movement.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <random>
+#include <stdexcept>
+
+#include "map/map.h"
+
+using namespace std;
+using namespace nplanetary::map;
+using namespace nplanetary::rules;
+
+namespace {
+/**
+ * A map with a one hex sun in the middle and a larger planet off to one side
+ */
+Map solarSystem() {
+  Map map = Map(10);
+  map.addBody(Body{.name = "Sol", .centre = {0, 0}, .radius = 0,
+                   .major = true});
+  map.addBody(Body{.name = "Mars", .centre = {-6, 2}, .radius = 1,
+                   .major = true});
+  return map;
+}
+}  // namespace
+
+TEST_CASE("Movers burn then drift", "[rules]") {
+  Movement movement = Movement(Map(10));
+  Movers movers;
+  size_t ship = movers.add(Hex{0, 0}, Hex{1, 0});
+  movers.setBurn(ship, Hex{0, 1});
+
+  movement.advance(movers);
+  REQUIRE(movers.getPosition(ship) == Hex{1, 1});
+  REQUIRE(movers.getVelocity(ship) == Hex{1, 1});
+  REQUIRE(movers.burnQ[ship] == 0);
+  REQUIRE(movers.burnR[ship] == 0);
+
+  movement.advance(movers);
+  REQUIRE(movers.getPosition(ship) == Hex{2, 2});
+  REQUIRE(movers.getVelocity(ship) == Hex{1, 1});
+  REQUIRE(movers.fates[ship] == Fate::FLYING);
+}
+
+TEST_CASE("Movers out of range are rejected", "[rules]") {
+  Movement movement = Movement(Map(10));
+  Movers movers;
+  REQUIRE_THROWS_AS(movers.add(Hex{Movers::MAX_COORDINATE + 1, 0}, Hex{0, 0}),
+                    runtime_error);
+  REQUIRE_THROWS_AS(movers.add(Hex{0, 0}, Hex{0, -Movers::MAX_COORDINATE - 1}),
+                    runtime_error);
+  REQUIRE(movers.size() == 0);
+
+  size_t ship = movers.add(Hex{0, 0}, Hex{Movers::MAX_COORDINATE, 0});
+  size_t other = movers.add(Hex{0, 0}, Hex{1, 0});
+  movers.setBurn(ship, Hex{1, 0});
+  REQUIRE_THROWS_AS(movement.advance(movers), runtime_error);
+  REQUIRE(movers.getPosition(other) == Hex{0, 0});
+  REQUIRE(movers.burnQ[ship] == 1);
+}
+
+TEST_CASE("Gravity hexes entered pull movers", "[rules]") {
+  Movement movement = Movement(solarSystem());
+  REQUIRE(movement.getPull(Hex{1, -1}) == Hex{-1, 1});
+  REQUIRE(movement.getPull(Hex{0, -1}) == Hex{0, 1});
+  REQUIRE(movement.getPull(Hex{3, 3}) == Hex{0, 0});
+
+  Movers movers;
+  size_t falling = movers.add(Hex{2, -1}, Hex{-1, 0});
+  size_t passing = movers.add(Hex{-2, -1}, Hex{4, 0});
+  size_t leaving = movers.add(Hex{1, 0}, Hex{1, 0});
+  size_t orbiting = movers.add(Hex{0, 1}, Hex{0, 0});
+
+  movement.advance(movers);
+  // pulled by the last hex of its path
+  REQUIRE(movers.getPosition(falling) == Hex{1, -1});
+  REQUIRE(movers.getVelocity(falling) == Hex{-2, 1});
+  // pulled by each gravity hex along its path
+  REQUIRE(movers.getPosition(passing) == Hex{2, -1});
+  REQUIRE(movers.getVelocity(passing) == Hex{3, 2});
+  // the hex something starts in never pulls
+  REQUIRE(movers.getVelocity(leaving) == Hex{1, 0});
+  REQUIRE(movers.getPosition(orbiting) == Hex{0, 1});
+  REQUIRE(movers.getVelocity(orbiting) == Hex{0, 0});
+
+  movement.advance(movers);
+  REQUIRE(movers.fates[falling] == Fate::CRASHED);
+  REQUIRE(movers.getPosition(falling) == Hex{0, 0});
+  REQUIRE(movers.fates[passing] == Fate::FLYING);
+}
+
+TEST_CASE("Movers crash into larger bodies and leave the map", "[rules]") {
+  Movement movement = Movement(solarSystem());
+  Movers movers;
+  size_t crashing = movers.add(Hex{-9, 2}, Hex{6, 0});
+  size_t lost = movers.add(Hex{9, 0}, Hex{2, 0});
+
+  movement.advance(movers);
+  REQUIRE(movers.fates[crashing] == Fate::CRASHED);
+  REQUIRE(movers.getPosition(crashing) == Hex{-7, 2});
+  REQUIRE(movers.fates[lost] == Fate::LOST);
+  REQUIRE(movers.getPosition(lost) == Hex{11, 0});
+
+  // nothing moves once it's gone
+  movers.setBurn(lost, Hex{-1, 0});
+  movement.advance(movers);
+  REQUIRE(movers.getPosition(crashing) == Hex{-7, 2});
+  REQUIRE(movers.getPosition(lost) == Hex{11, 0});
+  REQUIRE(movers.getVelocity(lost) == Hex{2, 0});
+}
+
+TEST_CASE("Moving together matches moving alone", "[rules]") {
+  Map map = solarSystem();
+  Movement movement = Movement(map);
+  mt19937 rng = mt19937(20);
+  uniform_int_distribution<int32_t> position =
+      uniform_int_distribution<int32_t>(-10, 10);
+  uniform_int_distribution<int32_t> speed =
+      uniform_int_distribution<int32_t>(-4, 4);
+  uniform_int_distribution<int32_t> burn =
+      uniform_int_distribution<int32_t>(-1, 1);
+
+  Movers together;
+  while (together.size() < 2000) {
+    Hex start = Hex{position(rng), position(rng)};
+    if (map.contains(start) &&
+        map.getTerrain(map.index(start)) != Terrain::BODY) {
+      size_t idx = together.add(start, Hex{speed(rng), speed(rng)});
+      together.setBurn(idx, Hex{burn(rng), burn(rng)});
+    }
+  }
+  Movers alone = together;
+
+  for (int turn = 0; turn < 3; ++turn) {
+    movement.advance(together);
+  }
+  for (size_t idx = 0; idx < alone.size(); ++idx) {
+    Movers one;
+    one.add(alone.getPosition(idx), alone.getVelocity(idx));
+    one.setBurn(0, Hex{alone.burnQ[idx], alone.burnR[idx]});
+    for (int turn = 0; turn < 3; ++turn) {
+      movement.advance(one);
+    }
+    REQUIRE(one.getPosition(0) == together.getPosition(idx));
+    REQUIRE(one.getVelocity(0) == together.getVelocity(idx));
+    REQUIRE(one.fates[0] == together.fates[idx]);
+  }
+}
@@ -19,12 +19,135 @@
 
 #include "networking/networking.h"
 
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
+#include <limits>
+#include <string>
 #include <thread>
+#include <vector>
+
+#include "networking/executor.h"
 
 using namespace std;
 using namespace nplanetary::networking;
 
+namespace {
+struct Order {
+  uint32_t ship;
+  int16_t q;
+  int16_t r;
+  uint8_t burn;
+  bool overload;
+
+  NPLANETARY_SERIALIZABLE(Order, ship, q, r, burn, overload)
+};
+
+struct OtherOrder {
+  uint32_t ship;
+  int16_t q;
+  int16_t r;
+  uint8_t fuel;
+  bool overload;
+
+  NPLANETARY_SERIALIZABLE(OtherOrder, ship, q, r, fuel, overload)
+};
+
+/**
+ * Sends extreme values of every scalar type, offering the given features
+ */
+void sendEveryScalar(uint8_t features) {
+  stop_source source;
+  Server server = Server("password", source.get_token(), features);
+
+  thread sender = thread(
+      [features](stop_token stopFlag) {
+        Socket socket = Socket("127.0.0.1", "password", stopFlag, features);
+        socket << numeric_limits<uint8_t>::max()
+               << numeric_limits<uint16_t>::max()
+               << numeric_limits<uint32_t>::max()
+               << numeric_limits<uint64_t>::max()
+               << numeric_limits<int8_t>::min()
+               << numeric_limits<int16_t>::min()
+               << numeric_limits<int32_t>::min()
+               << numeric_limits<int64_t>::min() << 'x' << "string"s << true;
+        socket.flush();
+      },
+      source.get_token());
+  Socket connection = server.accept();
+
+  uint8_t u8;
+  uint16_t u16;
+  uint32_t u32;
+  uint64_t u64;
+  int8_t s8;
+  int16_t s16;
+  int32_t s32;
+  int64_t s64;
+  char c;
+  string str;
+  bool b;
+  connection >> u8 >> u16 >> u32 >> u64 >> s8 >> s16 >> s32 >> s64 >> c >>
+      str >> b;
+  REQUIRE(u8 == numeric_limits<uint8_t>::max());
+  REQUIRE(u16 == numeric_limits<uint16_t>::max());
+  REQUIRE(u32 == numeric_limits<uint32_t>::max());
+  REQUIRE(u64 == numeric_limits<uint64_t>::max());
+  REQUIRE(s8 == numeric_limits<int8_t>::min());
+  REQUIRE(s16 == numeric_limits<int16_t>::min());
+  REQUIRE(s32 == numeric_limits<int32_t>::min());
+  REQUIRE(s64 == numeric_limits<int64_t>::min());
+  REQUIRE(c == 'x');
+  REQUIRE(str == "string");
+  REQUIRE(b);
+  sender.join();
+}
+
+/**
+ * Sends a few fields, offering the given features
+ */
+void sendFields(uint8_t features) {
+  stop_source source;
+  Server server = Server("password", source.get_token(), features);
+
+  thread sender = thread(
+      [features](stop_token stopFlag) {
+        Socket socket = Socket("127.0.0.1", "password", stopFlag, features);
+        socket.sendField(0, 5);
+        socket.sendField(1, -5);
+        socket.sendField(0, 6);
+        socket.sendField(0, numeric_limits<int64_t>::min());
+        socket.sendField(0, numeric_limits<int64_t>::max());
+        socket.sendField(1, -5);
+        socket.flush();
+      },
+      source.get_token());
+  Socket connection = server.accept();
+
+  REQUIRE(connection.receiveField(0) == 5);
+  REQUIRE(connection.receiveField(1) == -5);
+  REQUIRE(connection.receiveField(0) == 6);
+  REQUIRE(connection.receiveField(0) == numeric_limits<int64_t>::min());
+  REQUIRE(connection.receiveField(0) == numeric_limits<int64_t>::max());
+  REQUIRE(connection.receiveField(1) == -5);
+  sender.join();
+}
+
+/**
+ * Accepts one connection, reads a value of each kind, and echoes some back
+ */
+Task<void> echo(Server &server, Order &order, vector<uint16_t> &bulk) {
+  Socket connection = co_await server.asyncAccept();
+  uint32_t x = co_await connection.read<uint32_t>();
+  string text = co_await connection.read<string>();
+  bulk = co_await connection.read<vector<uint16_t>>();
+  order = co_await connection.read<Order>();
+
+  co_await connection.write(x + 1);
+  co_await connection.write(text);
+  co_await connection.asyncFlush();
+}
+}  // namespace
+
 TEST_CASE("Can construct server socket", "[networking]") {
   stop_source source;
   Server("password", source.get_token());
@@ -97,3 +220,435 @@ TEST_CASE("Invalid password raises exception in networking", "[networking]") {
   }
   client.join();
 }
+
+TEST_CASE("Trusted in-process sockets skip the handshake", "[networking]") {
+  stop_source source;
+  Server server =
+      Server("password", source.get_token(), CryptoSocket::ALL_FEATURES,
+             ServerOptions{.listen = {.address = "local:trusted",
+                                      .trustLocal = true}});
+
+  // larger than a frame, so it's split over several
+  vector<uint16_t> bulk = vector<uint16_t>(100000);
+  for (size_t idx = 0; idx < bulk.size(); ++idx) {
+    bulk[idx] = static_cast<uint16_t>(idx * 7);
+  }
+  thread client = thread(
+      [&bulk](stop_token stopFlag) {
+        // the password isn't checked
+        Socket socket = Socket("local:trusted", "bad", stopFlag);
+        socket << static_cast<uint32_t>(41) << bulk;
+        socket.flush();
+
+        uint32_t x;
+        socket >> x;
+        REQUIRE(x == 42);
+      },
+      source.get_token());
+
+  Socket connection = server.accept();
+  uint32_t x;
+  vector<uint16_t> recvd;
+  connection >> x >> recvd;
+  REQUIRE(recvd == bulk);
+  connection << x + 1;
+  connection.flush();
+  client.join();
+}
+
+TEST_CASE("Untrusted in-process sockets still check the password",
+          "[networking]") {
+  stop_source source;
+  Server server =
+      Server("password", source.get_token(), CryptoSocket::ALL_FEATURES,
+             ServerOptions{.listen = {.address = "local:untrusted"}});
+  thread client = thread(
+      [](stop_token stopFlag) {
+        REQUIRE_THROWS_AS(Socket("local:untrusted", "bad", stopFlag),
+                          PasswordMismatchFlag);
+        Socket socket = Socket("local:untrusted", "password", stopFlag);
+        socket << true;
+        socket.flush();
+      },
+      source.get_token());
+  REQUIRE_THROWS_AS(server.accept(), PasswordMismatchFlag);
+
+  Socket connection = server.accept();
+  bool recvd;
+  connection >> recvd;
+  REQUIRE(recvd);
+  client.join();
+}
+
+TEST_CASE("Can send every scalar type", "[networking]") {
+  sendEveryScalar(CryptoSocket::ALL_FEATURES);
+}
+
+TEST_CASE("Can send every scalar type without compact integers",
+          "[networking]") {
+  sendEveryScalar(0);
+}
+
+TEST_CASE("Can send fields", "[networking]") {
+  sendFields(CryptoSocket::ALL_FEATURES);
+}
+
+TEST_CASE("Can send fields without compact integers", "[networking]") {
+  sendFields(0);
+}
+
+TEST_CASE("Field mismatch raises exception", "[networking]") {
+  stop_source source;
+  Server server = Server("password", source.get_token());
+
+  thread sender = thread(
+      [](stop_token stopFlag) {
+        Socket socket = Socket("127.0.0.1", "password", stopFlag);
+        socket.sendField(1, 1);
+        socket.flush();
+      },
+      source.get_token());
+  Socket connection = server.accept();
+  REQUIRE_THROWS_AS(connection.receiveField(2), runtime_error);
+  sender.join();
+}
+
+TEST_CASE("Can send arrays", "[networking]") {
+  stop_source source;
+  Server server = Server("password", source.get_token());
+
+  vector<uint8_t> u8s = {0, 1, 0xff};
+  vector<uint16_t> u16s = {0, 1, 0x1234, 0xffff};
+  vector<uint32_t> u32s = {0x12345678, 0};
+  vector<uint64_t> u64s = {0x123456789abcdef0};
+  vector<int8_t> s8s = {-1, 1};
+  vector<int16_t> s16s = {-2, 2};
+  vector<int32_t> s32s = {-3, 3};
+  vector<int64_t> s64s = {-4, 4};
+  vector<string> strings = {"alpha", "", "gamma"};
+  vector<uint16_t> empty = {};
+  thread sender = thread(
+      [&](stop_token stopFlag) {
+        Socket socket = Socket("127.0.0.1", "password", stopFlag);
+        socket << span<uint8_t const>(u8s) << span<uint16_t const>(u16s)
+               << span<uint32_t const>(u32s) << span<uint64_t const>(u64s)
+               << span<int8_t const>(s8s) << span<int16_t const>(s16s)
+               << span<int32_t const>(s32s) << span<int64_t const>(s64s)
+               << span<string const>(strings) << span<uint16_t const>(empty);
+        socket.flush();
+      },
+      source.get_token());
+  Socket connection = server.accept();
+
+  vector<uint8_t> recvdU8s;
+  vector<uint16_t> recvdU16s;
+  vector<uint32_t> recvdU32s;
+  vector<uint64_t> recvdU64s;
+  vector<int8_t> recvdS8s;
+  vector<int16_t> recvdS16s;
+  vector<int32_t> recvdS32s;
+  vector<int64_t> recvdS64s;
+  vector<string> recvdStrings;
+  vector<uint16_t> recvdEmpty = {1};
+  connection >> recvdU8s >> recvdU16s >> recvdU32s >> recvdU64s >> recvdS8s >>
+      recvdS16s >> recvdS32s >> recvdS64s >> recvdStrings >> recvdEmpty;
+  REQUIRE(recvdU8s == u8s);
+  REQUIRE(recvdU16s == u16s);
+  REQUIRE(recvdU32s == u32s);
+  REQUIRE(recvdU64s == u64s);
+  REQUIRE(recvdS8s == s8s);
+  REQUIRE(recvdS16s == s16s);
+  REQUIRE(recvdS32s == s32s);
+  REQUIRE(recvdS64s == s64s);
+  REQUIRE(recvdStrings == strings);
+  REQUIRE(recvdEmpty.empty());
+  sender.join();
+}
+
+TEST_CASE("Can send arrays longer than a receive chunk", "[networking]") {
+  stop_source source;
+  Server server = Server("password", source.get_token());
+
+  vector<uint64_t> u64s = vector<uint64_t>(20000);
+  for (size_t idx = 0; idx < u64s.size(); ++idx) {
+    u64s[idx] = idx * 0x9e3779b97f4a7c15;
+  }
+  vector<string> strings = vector<string>(5000);
+  for (size_t idx = 0; idx < strings.size(); ++idx) {
+    strings[idx] = to_string(idx);
+  }
+  thread sender = thread(
+      [&](stop_token stopFlag) {
+        Socket socket = Socket("127.0.0.1", "password", stopFlag);
+        socket << span<uint64_t const>(u64s) << span<string const>(strings);
+        socket.flush();
+      },
+      source.get_token());
+  Socket connection = server.accept();
+
+  vector<uint64_t> recvdU64s = {1, 2, 3};
+  vector<string> recvdStrings = {"stale"};
+  connection >> recvdU64s >> recvdStrings;
+  REQUIRE(recvdU64s == u64s);
+  REQUIRE(recvdStrings == strings);
+  sender.join();
+}
+
+TEST_CASE("Array element type mismatch raises exception", "[networking]") {
+  stop_source source;
+  Server server = Server("password", source.get_token());
+
+  vector<uint16_t> message = {1, 2, 3};
+  thread sender = thread(
+      [&message](stop_token stopFlag) {
+        Socket socket = Socket("127.0.0.1", "password", stopFlag);
+        socket << span<uint16_t const>(message);
+        socket.flush();
+      },
+      source.get_token());
+  Socket connection = server.accept();
+  vector<uint32_t> recvd;
+  REQUIRE_THROWS_AS(connection >> recvd, runtime_error);
+  sender.join();
+}
+
+TEST_CASE("Can send serializable structs", "[networking]") {
+  stop_source source;
+  Server server = Server("password", source.get_token());
+
+  Order message = {.ship = 7, .q = -1, .r = 2, .burn = 3, .overload = true};
+  thread sender = thread(
+      [&message](stop_token stopFlag) {
+        Socket socket = Socket("127.0.0.1", "password", stopFlag);
+        socket << message << message;
+        socket.flush();
+      },
+      source.get_token());
+  Socket connection = server.accept();
+
+  Order recvd;
+  connection >> recvd;
+  REQUIRE(recvd.ship == message.ship);
+  REQUIRE(recvd.q == message.q);
+  REQUIRE(recvd.r == message.r);
+  REQUIRE(recvd.burn == message.burn);
+  REQUIRE(recvd.overload == message.overload);
+
+  OtherOrder other;
+  REQUIRE_THROWS_AS(connection >> other, runtime_error);
+  sender.join();
+}
+
+TEST_CASE("Can send messages with every framing", "[networking]") {
+  stop_source source;
+  Server server = Server("password", source.get_token());
+
+  vector<uint16_t> bulk = vector<uint16_t>(100000);
+  for (size_t idx = 0; idx < bulk.size(); ++idx) {
+    bulk[idx] = static_cast<uint16_t>(idx * 7);
+  }
+  Order order = {.ship = 7, .q = -1, .r = 2, .burn = 3, .overload = true};
+  thread client = thread(
+      [&bulk, &order](stop_token stopFlag) {
+        Socket socket = Socket("127.0.0.1", "password", stopFlag);
+        socket.message(Framing::BULK, [&]() { socket << bulk; });
+        socket.message(Framing::IMMEDIATE, [&]() { socket << order; });
+
+        // acknowledgements go out as soon as they're flushed
+        socket.setFraming(Framing::IMMEDIATE);
+        uint32_t ack;
+        socket >> ack;
+        socket << ack + 1;
+        socket.flush();
+      },
+      source.get_token());
+  Socket connection = server.accept();
+
+  vector<uint16_t> recvdBulk;
+  Order recvdOrder;
+  connection >> recvdBulk >> recvdOrder;
+  REQUIRE(recvdBulk == bulk);
+  REQUIRE(recvdOrder.ship == order.ship);
+
+  connection.message(Framing::IMMEDIATE,
+                     [&]() { connection << static_cast<uint32_t>(41); });
+  uint32_t reply;
+  connection >> reply;
+  REQUIRE(reply == 42);
+  client.join();
+}
+
+TEST_CASE("Can broadcast to sockets with and without compact integers",
+          "[networking]") {
+  stop_source source;
+  Server server = Server("password", source.get_token());
+  Broadcaster broadcaster = Broadcaster(1);
+
+  vector<uint16_t> bulk = vector<uint16_t>(10000);
+  for (size_t idx = 0; idx < bulk.size(); ++idx) {
+    bulk[idx] = static_cast<uint16_t>(idx * 7);
+  }
+  vector<thread> clients;
+  for (uint8_t features : {CryptoSocket::ALL_FEATURES, uint8_t{0}}) {
+    clients.emplace_back(
+        [&bulk, features](stop_token stopFlag) {
+          Socket socket = Socket("127.0.0.1", "password", stopFlag, features);
+          uint32_t x;
+          string text;
+          vector<uint16_t> recvdBulk;
+          socket >> x >> text >> recvdBulk;
+          REQUIRE(x == 300);
+          REQUIRE(text == "state");
+          REQUIRE(recvdBulk == bulk);
+        },
+        source.get_token());
+  }
+
+  vector<Socket> connections;
+  connections.push_back(server.accept());
+  connections.push_back(server.accept());
+  vector<Socket *> recipients = {&connections[0], &connections[1]};
+  Socket::broadcast(broadcaster, recipients, [&bulk](Socket &socket) {
+    socket << static_cast<uint32_t>(300) << "state"s
+           << span<uint16_t const>(bulk);
+  });
+
+  for (thread &client : clients) {
+    client.join();
+  }
+}
+
+TEST_CASE("Can exchange data with tasks", "[networking]") {
+  stop_source source;
+  Executor executor = Executor(source.get_token());
+  Server server = Server("password", source.get_token());
+
+  // larger than a frame, so it can't be read until several arrive
+  vector<uint16_t> bulk = vector<uint16_t>(100000);
+  for (size_t idx = 0; idx < bulk.size(); ++idx) {
+    bulk[idx] = static_cast<uint16_t>(idx * 7);
+  }
+  Order message = {.ship = 7, .q = -1, .r = 2, .burn = 3, .overload = true};
+  thread client = thread(
+      [&bulk, &message](stop_token stopFlag) {
+        Socket socket = Socket("127.0.0.1", "password", stopFlag);
+        socket << static_cast<uint32_t>(41) << "hello"s << bulk << message;
+        socket.flush();
+
+        uint32_t x;
+        string text;
+        socket >> x >> text;
+        REQUIRE(x == 42);
+        REQUIRE(text == "hello");
+      },
+      source.get_token());
+
+  Order recvdOrder;
+  vector<uint16_t> recvdBulk;
+  executor.run(echo(server, recvdOrder, recvdBulk));
+  REQUIRE(recvdBulk == bulk);
+  REQUIRE(recvdOrder.ship == message.ship);
+  REQUIRE(recvdOrder.overload == message.overload);
+  client.join();
+}
+
+TEST_CASE("Bulk array send benchmark", "[.][benchmark]") {
+  constexpr size_t COUNT = 8192;
+
+  stop_source source;
+  Server server = Server("password", source.get_token());
+
+  thread receiver = thread(
+      [](stop_token stopFlag) {
+        Socket socket = Socket("127.0.0.1", "password", stopFlag);
+        try {
+          while (true) {
+            bool bulk;
+            socket >> bulk;
+            if (bulk) {
+              vector<uint16_t> xs;
+              socket >> xs;
+            } else {
+              uint16_t x;
+              for (size_t idx = 0; idx < COUNT; ++idx) {
+                socket >> x;
+              }
+            }
+          }
+        } catch (HangupFlag const &) {
+        }
+      },
+      source.get_token());
+  Socket connection = server.accept();
+
+  vector<uint16_t> hexes = vector<uint16_t>(COUNT);
+  for (size_t idx = 0; idx < hexes.size(); ++idx) {
+    hexes[idx] = static_cast<uint16_t>(idx);
+  }
+  // 3 bytes per element
+  BENCHMARK("8192 hexes one at a time") {
+    connection << false;
+    for (uint16_t hex : hexes) {
+      connection << hex;
+    }
+    connection.flush();
+  };
+  // 2 bytes per element, plus 6 bytes of header
+  BENCHMARK("8192 hexes as an array") {
+    connection << true << span<uint16_t const>(hexes);
+    connection.flush();
+  };
+
+  { Socket closed = move(connection); }
+  receiver.join();
+}
+
+TEST_CASE("Serializable struct send benchmark", "[.][benchmark]") {
+  constexpr size_t COUNT = 4096;
+
+  stop_source source;
+  Server server = Server("password", source.get_token());
+
+  thread receiver = thread(
+      [](stop_token stopFlag) {
+        Socket socket = Socket("127.0.0.1", "password", stopFlag);
+        try {
+          while (true) {
+            bool fused;
+            socket >> fused;
+            Order order;
+            for (size_t idx = 0; idx < COUNT; ++idx) {
+              if (fused) {
+                socket >> order;
+              } else {
+                socket >> order.ship >> order.q >> order.r >> order.burn >>
+                    order.overload;
+              }
+            }
+          }
+        } catch (HangupFlag const &) {
+        }
+      },
+      source.get_token());
+  Socket connection = server.accept();
+
+  Order order = {.ship = 7, .q = -1, .r = 2, .burn = 3, .overload = true};
+  BENCHMARK("4096 orders field by field") {
+    connection << false;
+    for (size_t idx = 0; idx < COUNT; ++idx) {
+      connection << order.ship << order.q << order.r << order.burn
+                 << order.overload;
+    }
+    connection.flush();
+  };
+  BENCHMARK("4096 orders as structs") {
+    connection << true;
+    for (size_t idx = 0; idx < COUNT; ++idx) {
+      connection << order;
+    }
+    connection.flush();
+  };
+
+  { Socket closed = move(connection); }
+  receiver.join();
+}
@@ -0,0 +1,179 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "rules/ordnance.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <cstdint>
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace std;
+using namespace nplanetary::map;
+using namespace nplanetary::rules;
+
+namespace {
+/**
+ * Whether two tracks come within half a hex, by finding their closest
+ * approach
+ */
+bool passClose(Tracks const &first, size_t firstIdx, Tracks const &second,
+               size_t secondIdx) {
+  auto distance = [](double q, double r) { return q * q + q * r + r * r; };
+  double fromQ = first.fromQ[firstIdx] - second.fromQ[secondIdx];
+  double fromR = first.fromR[firstIdx] - second.fromR[secondIdx];
+  double velocityQ = first.toQ[firstIdx] - second.toQ[secondIdx] - fromQ;
+  double velocityR = first.toR[firstIdx] - second.toR[secondIdx] - fromR;
+
+  double speed = distance(velocityQ, velocityR);
+  double t = 0;
+  if (speed > 0) {
+    t = -(2 * fromQ * velocityQ + fromQ * velocityR + fromR * velocityQ +
+          2 * fromR * velocityR) /
+        (2 * speed);
+    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+  }
+  return distance(fromQ + velocityQ * t, fromR + velocityR * t) <=
+         0.25 + 1e-9;
+}
+}  // namespace
+
+TEST_CASE("Ordnance detonates within half a hex", "[rules]") {
+  Detonations detonations;
+  Dice dice = Dice(21);
+  Tracks ships;
+  vector<uint8_t> sizes = {1, 1, 1};
+  size_t through = ships.add(Hex{-2, 0}, Hex{2, 0});
+  ships.add(Hex{-2, 1}, Hex{2, 1});
+  size_t launcher = ships.add(Hex{5, 5}, Hex{7, 5});
+
+  Tracks ordnance;
+  size_t mine = ordnance.add(Hex{0, 1}, Hex{0, 1});
+  size_t crossing = ordnance.add(Hex{0, -3}, Hex{0, 3});
+  size_t parallel = ordnance.add(Hex{-2, -1}, Hex{2, -1});
+  size_t launched = ordnance.add(Hex{5, 5}, Hex{5, 5});
+  vector<uint32_t> exempt = vector<uint32_t>(ordnance.size(),
+                                             Detonations::NO_TARGET);
+  exempt[launched] = static_cast<uint32_t>(launcher);
+
+  span<uint32_t const> targets =
+      detonations.resolve(ships, sizes, ordnance, exempt, dice, 0);
+  // sits on the second ship's path
+  REQUIRE(targets[mine] == 1);
+  // crosses the first ship's path as it passes
+  REQUIRE(targets[crossing] == through);
+  // never closer than one hex
+  REQUIRE(targets[parallel] == Detonations::NO_TARGET);
+  // the ship that launched it is left alone
+  REQUIRE(targets[launched] == Detonations::NO_TARGET);
+
+  exempt[launched] = Detonations::NO_TARGET;
+  targets = detonations.resolve(ships, sizes, ordnance, exempt, dice, 0);
+  REQUIRE(targets[launched] == launcher);
+}
+
+TEST_CASE("Ordnance hits the first target, then the largest", "[rules]") {
+  Detonations detonations;
+  Dice dice = Dice(21);
+  Tracks ships;
+  // larger, but further along the torpedo's path
+  ships.add(Hex{3, 0}, Hex{3, 0});
+  size_t sooner = ships.add(Hex{1, 0}, Hex{1, 0});
+  // stacked in the same hex
+  ships.add(Hex{0, 5}, Hex{0, 5});
+  size_t large = ships.add(Hex{0, 5}, Hex{0, 5});
+  vector<uint8_t> sizes = {9, 1, 1, 4};
+
+  Tracks ordnance;
+  size_t torpedo = ordnance.add(Hex{0, 0}, Hex{4, 0});
+  size_t mine = ordnance.add(Hex{0, 6}, Hex{0, 4});
+  vector<uint32_t> exempt = vector<uint32_t>(ordnance.size(),
+                                             Detonations::NO_TARGET);
+
+  span<uint32_t const> targets =
+      detonations.resolve(ships, sizes, ordnance, exempt, dice, 0);
+  REQUIRE(targets[torpedo] == sooner);
+  REQUIRE(targets[mine] == large);
+}
+
+TEST_CASE("Ordnance breaks ties at random, repeatably", "[rules]") {
+  Detonations detonations;
+  Tracks ships;
+  for (int idx = 0; idx < 4; ++idx) {
+    ships.add(Hex{2, 0}, Hex{2, 0});
+  }
+  vector<uint8_t> sizes = vector<uint8_t>(ships.size(), 3);
+  Tracks ordnance;
+  for (int idx = 0; idx < 64; ++idx) {
+    ordnance.add(Hex{0, 0}, Hex{4, 0});
+  }
+  vector<uint32_t> exempt = vector<uint32_t>(ordnance.size(),
+                                             Detonations::NO_TARGET);
+
+  span<uint32_t const> results =
+      detonations.resolve(ships, sizes, ordnance, exempt, Dice(21), 3);
+  vector<uint32_t> first = vector<uint32_t>(results.begin(), results.end());
+  REQUIRE(set<uint32_t>(first.begin(), first.end()).size() == ships.size());
+
+  results = detonations.resolve(ships, sizes, ordnance, exempt, Dice(21), 3);
+  REQUIRE(vector<uint32_t>(results.begin(), results.end()) == first);
+  results = detonations.resolve(ships, sizes, ordnance, exempt, Dice(21), 4);
+  REQUIRE(vector<uint32_t>(results.begin(), results.end()) != first);
+}
+
+TEST_CASE("Ordnance finds every target a pairwise check does", "[rules]") {
+  Detonations detonations;
+  mt19937_64 rng = mt19937_64(21);
+  Dice dice = Dice(21);
+  uniform_int_distribution<int32_t> position =
+      uniform_int_distribution<int32_t>(-30, 30);
+  uniform_int_distribution<int32_t> speed =
+      uniform_int_distribution<int32_t>(-4, 4);
+
+  Tracks ships;
+  while (ships.size() < 100) {
+    Hex from = Hex{position(rng), position(rng)};
+    ships.add(from, from + Hex{speed(rng), speed(rng)});
+  }
+  vector<uint8_t> sizes = vector<uint8_t>(ships.size(), 1);
+  Tracks ordnance;
+  while (ordnance.size() < 1000) {
+    Hex from = Hex{position(rng), position(rng)};
+    ordnance.add(from, from + Hex{speed(rng), speed(rng)} * (rng() % 2 == 0));
+  }
+  vector<uint32_t> exempt = vector<uint32_t>(ordnance.size(),
+                                             Detonations::NO_TARGET);
+
+  span<uint32_t const> targets =
+      detonations.resolve(ships, sizes, ordnance, exempt, dice, 0);
+  size_t hit = 0;
+  for (size_t piece = 0; piece < ordnance.size(); ++piece) {
+    bool close = false;
+    for (size_t ship = 0; ship < ships.size(); ++ship) {
+      close = close || passClose(ordnance, piece, ships, ship);
+    }
+    REQUIRE(close == (targets[piece] != Detonations::NO_TARGET));
+    if (close) {
+      REQUIRE(passClose(ordnance, piece, ships, targets[piece]));
+      ++hit;
+    }
+  }
+  REQUIRE(hit > 0);
+}
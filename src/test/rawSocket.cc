@@ -19,13 +19,83 @@
 
 #include "networking/rawSocket.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <array>
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <vector>
+
+#include "networking/executor.h"
 
 using namespace std;
+using namespace std::chrono_literals;
+using namespace std::string_literals;
 using namespace nplanetary::networking;
 
+namespace {
+constexpr size_t BULK_SIZE = 8 * 1024 * 1024;
+
+/**
+ * Reads count bytes in small pieces, pausing between each, like a slow client
+ */
+void slowRead(RawSocket &socket, size_t count) {
+  array<uint8_t, 4096> buf;
+  while (count != 0) {
+    size_t n = min(count, buf.size());
+    socket.read(buf.data(), n);
+    count -= n;
+    this_thread::sleep_for(20us);
+  }
+}
+
+/**
+ * Runs f on a thread with only stackSize bytes of stack, rethrowing whatever
+ * it throws
+ */
+void runWithStack(size_t stackSize, function<void()> f) {
+  struct Job {
+    function<void()> f;
+    exception_ptr error;
+  } job = {move(f), nullptr};
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, stackSize);
+  pthread_t thread;
+  int retval = pthread_create(
+      &thread, &attr,
+      [](void *arg) -> void * {
+        Job *job = static_cast<Job *>(arg);
+        try {
+          job->f();
+        } catch (...) {
+          job->error = current_exception();
+        }
+        return nullptr;
+      },
+      &job);
+  pthread_attr_destroy(&attr);
+  REQUIRE(retval == 0);
+  pthread_join(thread, nullptr);
+
+  if (job.error != nullptr) {
+    rethrow_exception(job.error);
+  }
+}
+}  // namespace
+
 TEST_CASE("Can construct raw server socket", "[networking]") {
   stop_source source;
   RawServer(source.get_token());
@@ -77,3 +147,469 @@ TEST_CASE("Can connect to raw server and receive data", "[networking]") {
   connection.write(message.data(), message.size());
   sender.join();
 }
+
+TEST_CASE("Raw server accepts several connections", "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket first = RawSocket("127.0.0.1", source.get_token());
+  RawSocket second = RawSocket("127.0.0.1", source.get_token());
+  RawSocket third = RawSocket("127.0.0.1", source.get_token());
+  REQUIRE(server.accept());
+  REQUIRE(server.accept());
+  REQUIRE(server.accept());
+}
+
+TEST_CASE("Blocked raw socket read is cancelled by stop", "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  RawSocket connection = server.accept();
+  thread stopper = thread([&source]() { source.request_stop(); });
+  try {
+    uint8_t byte;
+    connection.read(&byte, 1);
+    FAIL("Expected stop token to be thrown");
+  } catch (stop_token const &) {
+  }
+  stopper.join();
+}
+
+TEST_CASE("Raw socket read times out at deadline", "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  RawSocket connection = server.accept();
+  connection.setDeadline(chrono::steady_clock::now() + 50ms);
+  try {
+    uint8_t byte;
+    connection.read(&byte, 1);
+    FAIL("Expected timeout flag to be thrown");
+  } catch (TimeoutFlag const &) {
+  }
+
+  // no deadline once cleared
+  connection.clearDeadline();
+  uint8_t byte = 42;
+  client.write(&byte, 1);
+  connection.read(&byte, 1);
+  REQUIRE(byte == 42);
+}
+
+// sockets with a deadline always poll, even if io_uring is available
+
+TEST_CASE("Polled raw socket read is cancelled by stop", "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  RawSocket connection = server.accept();
+  connection.setDeadline(chrono::steady_clock::now() + 1h);
+  thread stopper = thread([&source]() {
+    this_thread::sleep_for(50ms);
+    source.request_stop();
+  });
+  try {
+    uint8_t byte;
+    connection.read(&byte, 1);
+    FAIL("Expected stop token to be thrown");
+  } catch (stop_token const &) {
+  }
+  stopper.join();
+}
+
+TEST_CASE("Polled raw socket write is cancelled by stop", "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  RawSocket connection = server.accept();
+  // far more than the socket buffers hold, and the client never reads it
+  vector<uint8_t> message = vector<uint8_t>(64 * 1024 * 1024);
+  connection.setDeadline(chrono::steady_clock::now() + 1h);
+  // later writes start with the buffers already full
+  for (int attempt = 0; attempt < 5; ++attempt) {
+    stop_source stopping;
+    connection.setStopFlag(stopping.get_token());
+    thread stopper = thread([&stopping]() {
+      this_thread::sleep_for(50ms);
+      stopping.request_stop();
+    });
+    try {
+      connection.write(message.data(), message.size());
+      FAIL("Expected stop token to be thrown");
+    } catch (stop_token const &) {
+    }
+    stopper.join();
+  }
+}
+
+TEST_CASE("Raw socket write times out at deadline", "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  RawSocket connection = server.accept();
+  vector<uint8_t> message = vector<uint8_t>(64 * 1024 * 1024);
+  connection.setDeadline(chrono::steady_clock::now() + 50ms);
+  try {
+    connection.write(message.data(), message.size());
+    FAIL("Expected timeout flag to be thrown");
+  } catch (TimeoutFlag const &) {
+  }
+
+  // what was sent before the deadline still arrives
+  client.setDeadline(chrono::steady_clock::now() + 1h);
+  uint8_t byte;
+  client.read(&byte, 1);
+  REQUIRE(byte == 0);
+}
+
+TEST_CASE("Can write to many raw sockets at once", "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  array<uint8_t, 16> message = {
+      0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7,
+  };
+  RawSocket first = RawSocket("127.0.0.1", source.get_token());
+  RawSocket firstConnection = server.accept();
+  RawSocket second = RawSocket("127.0.0.1", source.get_token());
+  RawSocket secondConnection = server.accept();
+
+  array<RawSocket::Write, 2> writes = {{
+      {.socket = &firstConnection,
+       .buf = message.data(),
+       .count = message.size()},
+      {.socket = &secondConnection,
+       .buf = message.data(),
+       .count = message.size()},
+  }};
+  RawSocket::writeAll(writes);
+
+  array<uint8_t, 16> recvd;
+  first.read(recvd.data(), recvd.size());
+  REQUIRE(message == recvd);
+  second.read(recvd.data(), recvd.size());
+  REQUIRE(message == recvd);
+}
+
+TEST_CASE("Blocked write to many raw sockets is cancelled by stop",
+          "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  RawSocket connection = server.accept();
+  // far more than the socket buffers hold, and the client never reads it
+  vector<uint8_t> message = vector<uint8_t>(64 * 1024 * 1024);
+  // fill the buffers first, which grow as they fill, so the batched send
+  // hasn't sent anything when it's cancelled
+  for (int attempt = 0; attempt < 5; ++attempt) {
+    stop_source filling;
+    connection.setStopFlag(filling.get_token());
+    thread filler = thread([&filling]() {
+      this_thread::sleep_for(50ms);
+      filling.request_stop();
+    });
+    try {
+      connection.write(message.data(), message.size());
+      FAIL("Expected stop token to be thrown");
+    } catch (stop_token const &) {
+    }
+    filler.join();
+  }
+  connection.setStopFlag(source.get_token());
+
+  array<RawSocket::Write, 1> writes = {{
+      {.socket = &connection, .buf = message.data(), .count = message.size()},
+  }};
+  thread stopper = thread([&source]() {
+    this_thread::sleep_for(50ms);
+    source.request_stop();
+  });
+  try {
+    RawSocket::writeAll(writes);
+    FAIL("Expected stop token to be thrown");
+  } catch (stop_token const &) {
+  }
+  stopper.join();
+}
+
+TEST_CASE("Can gather writes to raw socket", "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  array<uint8_t, 16> message = {
+      0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7,
+  };
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  RawSocket connection = server.accept();
+
+  array<span<uint8_t const>, 3> buffers = {
+      span<uint8_t const>(message.data(), 3),
+      span<uint8_t const>(),
+      span<uint8_t const>(message.data() + 3, message.size() - 3),
+  };
+  connection.write(buffers);
+
+  array<uint8_t, 16> recvd;
+  client.read(recvd.data(), recvd.size());
+  REQUIRE(message == recvd);
+}
+
+TEST_CASE("Gathered write to slow reader sends every buffer",
+          "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  RawSocket connection = server.accept();
+  vector<uint8_t> first = vector<uint8_t>(BULK_SIZE / 2);
+  vector<uint8_t> second = vector<uint8_t>(BULK_SIZE / 2);
+  for (size_t idx = 0; idx < first.size(); ++idx) {
+    first[idx] = static_cast<uint8_t>(idx);
+    second[idx] = static_cast<uint8_t>(idx * 7);
+  }
+  vector<uint8_t> recvd = vector<uint8_t>(BULK_SIZE);
+  thread reader = thread([&client, &recvd]() {
+    for (size_t done = 0; done != recvd.size(); done += 4096) {
+      client.read(recvd.data() + done, 4096);
+      this_thread::sleep_for(20us);
+    }
+  });
+
+  // a deadline sends through poll, which only gets part of it out at a time
+  connection.setDeadline(chrono::steady_clock::now() + 1h);
+  array<span<uint8_t const>, 2> buffers = {
+      span<uint8_t const>(first),
+      span<uint8_t const>(second),
+  };
+  connection.write(buffers);
+  reader.join();
+  REQUIRE(equal(first.begin(), first.end(), recvd.begin()));
+  REQUIRE(equal(second.begin(), second.end(), recvd.begin() + BULK_SIZE / 2));
+}
+
+TEST_CASE("Blocked gathered write times out at deadline", "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  RawSocket connection = server.accept();
+  // far more than the socket buffers hold, and the client never reads it
+  vector<uint8_t> message = vector<uint8_t>(64 * 1024 * 1024);
+  array<span<uint8_t const>, 2> buffers = {
+      span<uint8_t const>(message.data(), message.size() / 2),
+      span<uint8_t const>(message.data() + message.size() / 2,
+                          message.size() / 2),
+  };
+  connection.setDeadline(chrono::steady_clock::now() + 50ms);
+  try {
+    connection.write(buffers);
+    FAIL("Expected timeout flag to be thrown");
+  } catch (TimeoutFlag const &) {
+  }
+}
+
+TEST_CASE("Raw socket transfers to slow reader in bounded stack",
+          "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  RawSocket connection = server.accept();
+  thread reader = thread([&client]() { slowRead(client, BULK_SIZE); });
+
+  // every partial write used to add a stack frame
+  runWithStack(64 * 1024, [&connection]() {
+    vector<uint8_t> payload = vector<uint8_t>(BULK_SIZE);
+    connection.write(payload.data(), payload.size());
+  });
+  reader.join();
+}
+
+TEST_CASE("Raw server listens on a chosen address and port", "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(
+      source.get_token(), ListenOptions{.address = "127.0.0.1", .port = 0});
+  uint16_t port = server.getPort();
+  REQUIRE(port != 0);
+  REQUIRE(port != PORT);
+
+  array<uint8_t, 16> message = {
+      0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7,
+  };
+  RawSocket client =
+      RawSocket("127.0.0.1:"s + to_string(port), source.get_token());
+  RawSocket connection = server.accept();
+  client.write(message.data(), message.size());
+  array<uint8_t, 16> recvd;
+  connection.read(recvd.data(), recvd.size());
+  REQUIRE(message == recvd);
+}
+
+TEST_CASE("Raw servers share a port with SO_REUSEPORT", "[networking]") {
+  stop_source source;
+  RawServer first = RawServer(source.get_token(),
+                              ListenOptions{.port = 0, .reusePort = true});
+  uint16_t port = first.getPort();
+  RawServer second = RawServer(source.get_token(),
+                               ListenOptions{.port = port, .reusePort = true});
+  REQUIRE_THROWS_AS(RawServer(source.get_token(), ListenOptions{.port = port}),
+                    runtime_error);
+
+  // the kernel picks which server gets each connection
+  Executor executor = Executor(source.get_token());
+  size_t accepted = 0;
+  vector<RawSocket> connections;
+  auto acceptAll = [](RawServer &server, vector<RawSocket> &connections,
+                      size_t &accepted) -> Task<void> {
+    while (true) {
+      connections.push_back(co_await server.asyncAccept());
+      ++accepted;
+    }
+  };
+  executor.spawn(acceptAll(first, connections, accepted));
+  executor.spawn(acceptAll(second, connections, accepted));
+
+  vector<RawSocket> clients;
+  for (size_t idx = 0; idx < 8; ++idx) {
+    clients.push_back(
+        RawSocket("127.0.0.1:"s + to_string(port), source.get_token()));
+  }
+  while (accepted != clients.size()) {
+    executor.poll();
+  }
+}
+
+TEST_CASE("Can send data over a Unix domain socket", "[networking]") {
+  stop_source source;
+  string path = "/tmp/nplanetary-test-"s + to_string(getpid()) + ".sock";
+  {
+    RawServer server =
+        RawServer(source.get_token(), ListenOptions{.address = "unix:" + path});
+
+    array<uint8_t, 16> message = {
+        0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7,
+    };
+    RawSocket client = RawSocket("unix:" + path, source.get_token());
+    RawSocket connection = server.accept();
+    client.setNoDelay(true);
+    client.write(message.data(), message.size());
+    array<uint8_t, 16> recvd;
+    connection.read(recvd.data(), recvd.size());
+    REQUIRE(message == recvd);
+  }
+
+  // the socket file is removed along with the server
+  REQUIRE(access(path.c_str(), F_OK) == -1);
+}
+
+TEST_CASE("Unix domain servers leave files that aren't sockets alone",
+          "[networking]") {
+  stop_source source;
+  string path = "/tmp/nplanetary-test-"s + to_string(getpid()) + ".sock";
+  int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+  REQUIRE(fd != -1);
+  close(fd);
+
+  REQUIRE_THROWS_AS(
+      RawServer(source.get_token(), ListenOptions{.address = "unix:" + path}),
+      runtime_error);
+  REQUIRE(access(path.c_str(), F_OK) == 0);
+  unlink(path.c_str());
+}
+
+TEST_CASE("Unix domain servers leave a socket that replaced theirs alone",
+          "[networking]") {
+  stop_source source;
+  string path = "/tmp/nplanetary-test-"s + to_string(getpid()) + ".sock";
+  {
+    optional<RawServer> first;
+    first.emplace(source.get_token(), ListenOptions{.address = "unix:" + path});
+    // takes over the path from the first server
+    RawServer second =
+        RawServer(source.get_token(), ListenOptions{.address = "unix:" + path});
+    first.reset();
+    REQUIRE(access(path.c_str(), F_OK) == 0);
+  }
+  REQUIRE(access(path.c_str(), F_OK) == -1);
+}
+
+TEST_CASE("Can send data through an in-process pipe", "[networking]") {
+  stop_source source;
+  RawServer server =
+      RawServer(source.get_token(), ListenOptions{.address = "local:raw"});
+
+  // larger than the pipe, so the writer has to wait for the reader
+  vector<uint8_t> payload = vector<uint8_t>(BULK_SIZE);
+  for (size_t idx = 0; idx < payload.size(); ++idx) {
+    payload[idx] = static_cast<uint8_t>(idx * 7);
+  }
+  thread sender = thread(
+      [&payload](stop_token stopFlag) {
+        RawSocket socket = RawSocket("local:raw", stopFlag);
+        REQUIRE(!socket.isTrusted());
+        socket.write(payload.data(), payload.size());
+      },
+      source.get_token());
+  RawSocket connection = server.accept();
+  vector<uint8_t> recvd = vector<uint8_t>(BULK_SIZE);
+  connection.read(recvd.data(), recvd.size());
+  REQUIRE(recvd == payload);
+  sender.join();
+
+  // the sender is gone
+  uint8_t byte;
+  REQUIRE_THROWS_AS(connection.read(&byte, 1), HangupFlag);
+  REQUIRE_THROWS_AS(RawSocket("local:missing", source.get_token()),
+                    runtime_error);
+}
+
+TEST_CASE("In-process pipe read times out or is cancelled", "[networking]") {
+  stop_source source;
+  RawServer server =
+      RawServer(source.get_token(), ListenOptions{.address = "local:waiting"});
+
+  RawSocket client = RawSocket("local:waiting", source.get_token());
+  RawSocket connection = server.accept();
+  connection.setDeadline(chrono::steady_clock::now() + 50ms);
+  uint8_t byte;
+  REQUIRE_THROWS_AS(connection.read(&byte, 1), TimeoutFlag);
+
+  connection.clearDeadline();
+  thread stopper = thread([&source]() { source.request_stop(); });
+  try {
+    connection.read(&byte, 1);
+    FAIL("Expected stop token to be thrown");
+  } catch (stop_token const &) {
+  }
+  stopper.join();
+}
+
+TEST_CASE("Raw socket bulk transfer benchmark", "[.][benchmark]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+
+  RawSocket client = RawSocket("127.0.0.1", source.get_token());
+  RawSocket connection = server.accept();
+  thread reader = thread([&client]() {
+    try {
+      while (true) {
+        slowRead(client, BULK_SIZE);
+      }
+    } catch (HangupFlag const &) {
+    }
+  });
+
+  vector<uint8_t> payload = vector<uint8_t>(BULK_SIZE);
+  BENCHMARK("8 MiB to slow reader") {
+    connection.write(payload.data(), payload.size());
+  };
+
+  { RawSocket closed = move(connection); }
+  reader.join();
+}
@@ -0,0 +1,111 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "networking/reactor.h"
+
+#include <array>
+#include <catch2/catch_test_macros.hpp>
+#include <optional>
+#include <thread>
+#include <utility>
+
+using namespace std;
+using namespace nplanetary::networking;
+
+TEST_CASE("Can construct reactor", "[networking]") {
+  stop_source source;
+  Reactor(source.get_token());
+}
+
+TEST_CASE("Reactor stops when requested", "[networking]") {
+  stop_source source;
+  Reactor reactor = Reactor(source.get_token());
+  reactor.add(RawServer(source.get_token()), [](RawServer &) {});
+  thread stopper = thread([&source]() { source.request_stop(); });
+  try {
+    reactor.run();
+  } catch (stop_token const &) {
+  }
+  stopper.join();
+}
+
+TEST_CASE("Reactor dispatches accepts and reads", "[networking]") {
+  stop_source source;
+  Reactor reactor = Reactor(source.get_token());
+
+  array<uint8_t, 16> message = {
+      0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7,
+  };
+  array<uint8_t, 16> recvd;
+  reactor.add(RawServer(source.get_token()), [&](RawServer &server) {
+    reactor.add(server.accept(), [&](RawSocket &connection) {
+      connection.read(recvd.data(), recvd.size());
+      source.request_stop();
+    });
+  });
+
+  thread sender = thread(
+      [&message](stop_token stopFlag) {
+        RawSocket socket = RawSocket("127.0.0.1", stopFlag);
+        socket.write(message.data(), message.size());
+      },
+      source.get_token());
+  try {
+    reactor.run();
+  } catch (stop_token const &) {
+  }
+  REQUIRE(message == recvd);
+  REQUIRE(reactor.size() == 2);
+  sender.join();
+}
+
+TEST_CASE("Reactor removes sockets that hang up", "[networking]") {
+  stop_source source;
+  Reactor reactor = Reactor(source.get_token());
+
+  reactor.add(RawServer(source.get_token()), [&](RawServer &server) {
+    reactor.add(server.accept(), [](RawSocket &connection) {
+      uint8_t byte;
+      connection.read(&byte, 1);
+    });
+  });
+
+  { RawSocket socket = RawSocket("127.0.0.1", source.get_token()); }
+  reactor.poll();
+  REQUIRE(reactor.size() == 2);
+  reactor.poll();
+  REQUIRE(reactor.size() == 1);
+}
+
+TEST_CASE("Moved reactor removes sockets that hang up", "[networking]") {
+  stop_source source;
+  RawServer server = RawServer(source.get_token());
+  Reactor first = Reactor(source.get_token());
+
+  optional<RawSocket> socket = RawSocket("127.0.0.1", source.get_token());
+  first.add(server.accept(), [](RawSocket &connection) {
+    uint8_t byte;
+    connection.read(&byte, 1);
+  });
+
+  Reactor second = move(first);
+  socket.reset();
+  second.poll();
+  REQUIRE(second.size() == 0);
+}
@@ -0,0 +1,96 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "networking/recvBuffer.h"
+
+#include <algorithm>
+#include <catch2/catch_test_macros.hpp>
+
+using namespace std;
+using namespace nplanetary::networking;
+
+namespace {
+void append(RecvBuffer &buffer, uint8_t first, size_t count) {
+  span<uint8_t> space = buffer.prepare(count);
+  for (size_t idx = 0; idx < count; ++idx) {
+    space[idx] = static_cast<uint8_t>(first + idx);
+  }
+  buffer.commit(count);
+}
+}  // namespace
+
+TEST_CASE("Receive buffer starts empty", "[networking]") {
+  RecvBuffer buffer = RecvBuffer(16);
+  REQUIRE(buffer.empty());
+  REQUIRE(buffer.size() == 0);
+  REQUIRE(buffer.peek().empty());
+}
+
+TEST_CASE("Receive buffer returns committed bytes in order", "[networking]") {
+  RecvBuffer buffer = RecvBuffer(16);
+  append(buffer, 0, 4);
+  append(buffer, 4, 4);
+  REQUIRE(buffer.size() == 8);
+
+  span<uint8_t const> bytes = buffer.peek();
+  for (size_t idx = 0; idx < bytes.size(); ++idx) {
+    REQUIRE(bytes[idx] == idx);
+  }
+
+  buffer.consume(3);
+  REQUIRE(buffer.size() == 5);
+  REQUIRE(buffer.peek()[0] == 3);
+
+  buffer.consume(5);
+  REQUIRE(buffer.empty());
+}
+
+TEST_CASE("Receive buffer only keeps committed bytes", "[networking]") {
+  RecvBuffer buffer = RecvBuffer(16);
+  span<uint8_t> space = buffer.prepare(8);
+  REQUIRE(space.size() == 8);
+  fill(space.begin(), space.end(), 7);
+  buffer.commit(2);
+  REQUIRE(buffer.size() == 2);
+}
+
+TEST_CASE("Receive buffer compacts unread bytes", "[networking]") {
+  RecvBuffer buffer = RecvBuffer(16);
+  append(buffer, 0, 12);
+  buffer.consume(10);
+  append(buffer, 12, 12);
+
+  span<uint8_t const> bytes = buffer.peek();
+  REQUIRE(bytes.size() == 14);
+  for (size_t idx = 0; idx < bytes.size(); ++idx) {
+    REQUIRE(bytes[idx] == idx + 10);
+  }
+}
+
+TEST_CASE("Receive buffer grows when full", "[networking]") {
+  RecvBuffer buffer = RecvBuffer(16);
+  append(buffer, 0, 10);
+  append(buffer, 10, 100);
+
+  span<uint8_t const> bytes = buffer.peek();
+  REQUIRE(bytes.size() == 110);
+  for (size_t idx = 0; idx < bytes.size(); ++idx) {
+    REQUIRE(bytes[idx] == idx);
+  }
+}
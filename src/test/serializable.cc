@@ -0,0 +1,126 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "networking/serializable.h"
+
+#include <array>
+#include <catch2/catch_test_macros.hpp>
+
+using namespace std;
+using namespace nplanetary::networking;
+
+namespace {
+enum class Facing : uint8_t { NORTH, SOUTH };
+
+struct Position {
+  int16_t q;
+  int16_t r;
+
+  NPLANETARY_SERIALIZABLE(Position, q, r)
+};
+
+struct Ship {
+  uint32_t id;
+  Position position;
+  Facing facing;
+  bool landed;
+  array<uint8_t, 3> cargo;
+
+  NPLANETARY_SERIALIZABLE(Ship, id, position, facing, landed, cargo)
+};
+
+struct RenamedShip {
+  uint32_t id;
+  Position location;
+  Facing facing;
+  bool landed;
+  array<uint8_t, 3> cargo;
+
+  NPLANETARY_SERIALIZABLE(RenamedShip, id, location, facing, landed, cargo)
+};
+
+struct WidenedPosition {
+  int32_t q;
+  int16_t r;
+
+  NPLANETARY_SERIALIZABLE(WidenedPosition, q, r)
+};
+
+class Private {
+ public:
+  Private() noexcept = default;
+  explicit Private(uint64_t secret) noexcept : secret(secret) {}
+
+  uint64_t getSecret() const noexcept { return secret; }
+
+ private:
+  uint64_t secret = 0;
+
+  NPLANETARY_SERIALIZABLE(Private, secret)
+};
+}  // namespace
+
+TEST_CASE("Schema wire size is the sum of its fields", "[networking]") {
+  STATIC_REQUIRE(schema::wireSize<Position>() == 4);
+  STATIC_REQUIRE(schema::wireSize<Ship>() == 4 + 4 + 1 + 1 + 3);
+}
+
+TEST_CASE("Schema hash depends on names and types", "[networking]") {
+  STATIC_REQUIRE(schema::hash<Ship>() == schema::hash<Ship>());
+  STATIC_REQUIRE(schema::hash<Ship>() != schema::hash<RenamedShip>());
+  STATIC_REQUIRE(schema::hash<Position>() !=
+                 schema::hash<WidenedPosition>());
+}
+
+TEST_CASE("Serializable structs round trip", "[networking]") {
+  Ship ship = {
+      .id = 0xdeadbeef,
+      .position = {.q = -3, .r = 4},
+      .facing = Facing::SOUTH,
+      .landed = true,
+      .cargo = {1, 2, 3},
+  };
+  array<uint8_t, schema::wireSize<Ship>()> bytes;
+  REQUIRE(schema::encode(ship, bytes.data()) == bytes.data() + bytes.size());
+
+  Ship decoded = {};
+  REQUIRE(schema::decode(decoded, bytes.data()) ==
+          bytes.data() + bytes.size());
+  REQUIRE(decoded.id == ship.id);
+  REQUIRE(decoded.position.q == ship.position.q);
+  REQUIRE(decoded.position.r == ship.position.r);
+  REQUIRE(decoded.facing == ship.facing);
+  REQUIRE(decoded.landed == ship.landed);
+  REQUIRE(decoded.cargo == ship.cargo);
+}
+
+TEST_CASE("Serializable structs are little endian", "[networking]") {
+  Position position = {.q = 0x0102, .r = -2};
+  array<uint8_t, schema::wireSize<Position>()> bytes;
+  schema::encode(position, bytes.data());
+  REQUIRE(bytes == array<uint8_t, 4>{0x02, 0x01, 0xfe, 0xff});
+}
+
+TEST_CASE("Serializable structs may have private fields", "[networking]") {
+  array<uint8_t, schema::wireSize<Private>()> bytes;
+  schema::encode(Private(42), bytes.data());
+  Private decoded;
+  schema::decode(decoded, bytes.data());
+  REQUIRE(decoded.getSecret() == 42);
+}
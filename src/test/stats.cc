@@ -0,0 +1,153 @@
+// Copyright 2023 Justin Hu
+//
+// This file is part of NPlanetary.
+//
+// NPlanetary is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// NPlanetary is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with NPlanetary. If not, see <https://www.gnu.org/licenses/>.
+//
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "networking/stats.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <array>
+#include <catch2/catch_test_macros.hpp>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "networking/cryptoSocket.h"
+#include "networking/statsServer.h"
+
+using namespace std;
+using namespace nplanetary::networking;
+
+TEST_CASE("Adding stats sums counts and keeps the highest high-water mark",
+          "[networking]") {
+  Stats stats;
+  stats.bytesIn = 3;
+  stats.handshakes = 1;
+  stats.recvBufferHighWater = 100;
+  Stats other;
+  other.bytesIn = 4;
+  other.handshakes = 2;
+  other.recvBufferHighWater = 50;
+
+  stats += other;
+  REQUIRE(stats.bytesIn == 7);
+  REQUIRE(stats.handshakes == 3);
+  REQUIRE(stats.recvBufferHighWater == 100);
+}
+
+TEST_CASE("Prometheus dump has every metric", "[networking]") {
+  Stats stats;
+  stats.bytesOut = 12345;
+  stats.encryptNanos = 1500000000;
+
+  string dump = toPrometheus(stats, 2);
+  REQUIRE(dump.find("# TYPE nplanetary_sent_bytes_total counter\n") !=
+          string::npos);
+  REQUIRE(dump.find("\nnplanetary_sent_bytes_total 12345\n") != string::npos);
+  REQUIRE(dump.find("\nnplanetary_encrypt_seconds_total 1.500000000\n") !=
+          string::npos);
+  REQUIRE(dump.find("\nnplanetary_connections 2\n") != string::npos);
+}
+
+TEST_CASE("Crypto sockets count what they do", "[networking]") {
+  stop_source source;
+  CryptoServer server = CryptoServer("password", source.get_token());
+
+  array<uint8_t, 16> message = {};
+  thread sender = thread(
+      [&message](stop_token stopFlag) {
+        CryptoSocket socket = CryptoSocket("127.0.0.1", "password", stopFlag);
+        socket.write(message.data(), message.size());
+        socket.flush();
+      },
+      source.get_token());
+  CryptoSocket connection = server.accept();
+  array<uint8_t, 16> recvd;
+  connection.read(recvd.data(), recvd.size());
+  sender.join();
+
+  Stats stats = connection.getStats();
+  if (STATS_ENABLED) {
+    REQUIRE(stats.handshakes == 1);
+    REQUIRE(stats.framesIn == 1);
+    REQUIRE(stats.bytesIn > message.size());
+    REQUIRE(stats.bytesOut > 0);
+    REQUIRE(stats.syscalls > 0);
+    REQUIRE(stats.recvBufferHighWater == message.size());
+    REQUIRE(Counters::total().handshakes >= 2);
+  } else {
+    REQUIRE(stats.handshakes == 0);
+    REQUIRE(stats.bytesIn == 0);
+  }
+}
+
+TEST_CASE("Stats server serves a dump over a Unix socket", "[networking]") {
+  string path = "/tmp/nplanetary-test-stats-" + to_string(getpid());
+  stop_source source;
+  StatsServer server = StatsServer(path, source.get_token());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  REQUIRE(fd != -1);
+  struct sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  copy(path.begin(), path.end(), address.sun_path);
+  REQUIRE(connect(fd, reinterpret_cast<struct sockaddr const *>(&address),
+                  sizeof(address)) == 0);
+
+  string dump;
+  array<char, 4096> buf;
+  for (ssize_t retval; (retval = read(fd, buf.data(), buf.size())) > 0;) {
+    dump.append(buf.data(), static_cast<size_t>(retval));
+  }
+  close(fd);
+
+  REQUIRE(dump.find("\nnplanetary_connections ") != string::npos);
+  REQUIRE(dump.ends_with("\n"));
+}
+
+TEST_CASE("Stats server leaves files that aren't sockets alone",
+          "[networking]") {
+  string path = "/tmp/nplanetary-test-stats-" + to_string(getpid());
+  stop_source source;
+  int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+  REQUIRE(fd != -1);
+  close(fd);
+
+  REQUIRE_THROWS_AS(StatsServer(path, source.get_token()), runtime_error);
+  REQUIRE(access(path.c_str(), F_OK) == 0);
+  unlink(path.c_str());
+}
+
+TEST_CASE("Stats server leaves a file that replaced its socket alone",
+          "[networking]") {
+  string path = "/tmp/nplanetary-test-stats-" + to_string(getpid());
+  stop_source source;
+  {
+    StatsServer server = StatsServer(path, source.get_token());
+    REQUIRE(unlink(path.c_str()) == 0);
+    int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+    REQUIRE(fd != -1);
+    close(fd);
+  }
+
+  REQUIRE(access(path.c_str(), F_OK) == 0);
+  unlink(path.c_str());
+}